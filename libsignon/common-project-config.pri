@@ -16,6 +16,13 @@ QMAKE_CXXFLAGS -= -Werror -Wno-write-strings
 # Disable RTTI
 QMAKE_CXXFLAGS += -fno-exceptions -fno-rtti
 
+# ThreadSanitizer build, used to check the multithreaded parts of the
+# daemon (such as the CredentialsDBReader) for data races
+CONFIG(tsan) {
+    QMAKE_CXXFLAGS += -fsanitize=thread -fno-omit-frame-pointer -g
+    QMAKE_LFLAGS += -fsanitize=thread
+}
+
 greaterThan(QT_MAJOR_VERSION, 4) {
     # Qt5: use C++0x. This is used to avoid the source incompatibility
     # with the QSKIP macro, as described in:
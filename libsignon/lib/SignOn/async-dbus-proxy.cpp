@@ -25,16 +25,19 @@
 #include "async-dbus-proxy.h"
 
 #include <QDBusConnection>
+#include <QDBusMessage>
 #include <QDBusObjectPath>
 #include <QDBusPendingCallWatcher>
 #include <QDebug>
 #include <QMetaMethod>
 #include <QMetaType>
 #include <QPointer>
+#include <QTimer>
 
 #include "connection-manager.h"
 #include "dbusinterface.h"
 #include "libsignoncommon.h"
+#include "signond/chrometrace.h"
 #include "signond/signoncommon.h"
 
 using namespace SignOn;
@@ -59,14 +62,24 @@ public:
 
 } // namespace
 
+static QDBusError timedOutError()
+{
+    return QDBusError(QDBusMessage::createError(SIGNOND_TIMED_OUT_ERR_NAME,
+                                                SIGNOND_TIMED_OUT_ERR_STR));
+}
+
 PendingCall::PendingCall(const QString &method,
                          const QList<QVariant> &args,
                          QObject *parent):
     QObject(parent),
+    m_interfaceName(0),
     m_method(method),
     m_args(args),
     m_watcher(0),
-    m_interfaceWasDestroyed(false)
+    m_interfaceWasDestroyed(false),
+    m_traceTime(0),
+    m_timeout(-1),
+    m_deadlineTimer(0)
 {
 }
 
@@ -80,14 +93,72 @@ bool PendingCall::cancel()
         // Too late, can't cancel
         return false;
     }
+    if (m_deadlineTimer) m_deadlineTimer->stop();
     Q_EMIT finished(0);
     return true;
 }
 
+void PendingCall::setTraceId(const QString &traceId)
+{
+    m_traceId = traceId;
+    m_traceTime = ChromeTrace::now();
+}
+
+void PendingCall::setTimeout(int msecs)
+{
+    if (msecs <= 0) return;
+
+    m_timeout = msecs;
+    m_clock.start();
+    if (m_deadlineTimer == 0) {
+        m_deadlineTimer = new QTimer(this);
+        m_deadlineTimer->setSingleShot(true);
+        QObject::connect(m_deadlineTimer, SIGNAL(timeout()),
+                         this, SLOT(onDeadline()));
+    }
+    m_deadlineTimer->start(msecs);
+}
+
+int PendingCall::remainingTime() const
+{
+    if (m_timeout < 0) return -1;
+    return int(qMax(qint64(0), m_timeout - m_clock.elapsed()));
+}
+
+void PendingCall::onDeadline()
+{
+    /* Calls sent to the daemon are timed out by D-Bus */
+    if (m_watcher != 0 && !m_watcher->isFinished()) return;
+
+    TRACE() << "Deadline expired for" << m_method;
+    fail(timedOutError());
+}
+
 void PendingCall::doCall(QDBusAbstractInterface *interface)
 {
-    QDBusPendingCall call =
-        interface->asyncCallWithArgumentList(m_method, m_args);
+    int timeout = remainingTime();
+    if (timeout == 0) {
+        fail(timedOutError());
+        return;
+    }
+
+    /* Let signond drop the request if it cannot be served in time */
+    if (timeout > 0) {
+        for (int i = 0; i < m_args.count(); i++) {
+            if (m_args.at(i).type() != QVariant::Map) continue;
+            QVariantMap map = m_args.at(i).toMap();
+            if (!map.contains(SIGNOND_SESSION_TIMEOUT)) continue;
+            map.insert(SIGNOND_SESSION_TIMEOUT, timeout);
+            m_args[i] = map;
+        }
+    }
+
+    if (!m_traceId.isEmpty()) {
+        ChromeTrace::span(m_traceId, "AsyncDBusProxy::queued", m_traceTime);
+        m_traceTime = ChromeTrace::now();
+    }
+
+    QDBusPendingCall call = asyncCall(interface);
     m_watcher = new QDBusPendingCallWatcher(call, this);
     QObject::connect(m_watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
                      this, SLOT(onFinished(QDBusPendingCallWatcher*)));
@@ -97,14 +168,39 @@ void PendingCall::doCall(QDBusAbstractInterface *interface)
                      this, SLOT(onInterfaceDestroyed()));
 }
 
+QDBusPendingCall PendingCall::asyncCall(QDBusAbstractInterface *interface)
+{
+    int timeout = remainingTime();
+    if (m_path.isEmpty() && timeout < 0)
+        return interface->asyncCallWithArgumentList(m_method, m_args);
+
+    QDBusMessage msg = m_path.isEmpty() ?
+        QDBusMessage::createMethodCall(interface->service(),
+                                       interface->path(),
+                                       interface->interface(),
+                                       m_method) :
+        QDBusMessage::createMethodCall(interface->service(), m_path,
+                                       QLatin1String(m_interfaceName),
+                                       m_method);
+    msg.setArguments(m_args);
+    return interface->connection().asyncCall(msg, timeout < 0 ?
+                                             interface->timeout() : timeout);
+}
+
 void PendingCall::fail(const QDBusError &err)
 {
+    if (m_deadlineTimer) m_deadlineTimer->stop();
     Q_EMIT error(err);
     Q_EMIT finished(0);
 }
 
 void PendingCall::onFinished(QDBusPendingCallWatcher *watcher)
 {
+    if (!m_traceId.isEmpty()) {
+        ChromeTrace::span(m_traceId, "D-Bus call", m_traceTime);
+        m_traceTime = ChromeTrace::now();
+    }
+
     /* Check if the call failed because the interface became invalid; if
      * so, emit a signal to instruct the AsyncDBusProxy to re-queue this
      * operation. */
@@ -118,10 +214,15 @@ void PendingCall::onFinished(QDBusPendingCallWatcher *watcher)
         }
     }
 
+    if (m_deadlineTimer) m_deadlineTimer->stop();
+
     QPointer<PendingCall> thisguard(this);
     QPointer<QDBusPendingCallWatcher> watcherguard(watcher);
     if (watcher->isError()) {
-        Q_EMIT error(watcher->error());
+        QDBusError err = watcher->error();
+        if (m_timeout >= 0 && err.type() == QDBusError::NoReply)
+            err = timedOutError();
+        Q_EMIT error(err);
     } else {
         Q_EMIT success(watcher);
     }
@@ -149,7 +250,8 @@ AsyncDBusProxy::AsyncDBusProxy(const QString &service,
     m_connection(NULL),
     m_clientObject(clientObject),
     m_interface(NULL),
-    m_status(Incomplete)
+    m_status(Incomplete),
+    m_timeout(-1)
 {
 }
 
@@ -254,13 +356,38 @@ PendingCall *AsyncDBusProxy::queueCall(const QString &method,
                                        const QList<QVariant> &args,
                                        QObject *receiver,
                                        const char *replySlot,
+                                       const char *errorSlot,
+                                       int timeout)
+{
+    PendingCall *call = new PendingCall(method, args, this);
+    call->setTimeout(timeout);
+    return queueCall(call, receiver, replySlot, errorSlot);
+}
+
+PendingCall *AsyncDBusProxy::queueCall(const QDBusObjectPath &objectPath,
+                                       const char *interface,
+                                       const QString &method,
+                                       const QList<QVariant> &args,
+                                       const char *replySlot,
                                        const char *errorSlot)
 {
     PendingCall *call = new PendingCall(method, args, this);
+    call->m_path = objectPath.path();
+    call->m_interfaceName = interface;
+    return queueCall(call, m_clientObject, replySlot, errorSlot);
+}
+
+PendingCall *AsyncDBusProxy::queueCall(PendingCall *call,
+                                       QObject *receiver,
+                                       const char *replySlot,
+                                       const char *errorSlot)
+{
     QObject::connect(call, SIGNAL(finished(QDBusPendingCallWatcher*)),
                      this, SLOT(onCallFinished(QDBusPendingCallWatcher*)));
     QObject::connect(call, SIGNAL(requeueRequested()),
                      this, SLOT(onRequeueRequested()));
+    if (call->m_timeout < 0)
+        call->setTimeout(m_timeout);
 
     if (errorSlot) {
         QObject::connect(call, SIGNAL(error(const QDBusError&)),
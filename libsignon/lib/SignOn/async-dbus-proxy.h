@@ -26,6 +26,7 @@
 #define SIGNON_ASYNC_DBUS_PROXY_H
 
 #include <QDBusError>
+#include <QElapsedTimer>
 #include <QObject>
 #include <QQueue>
 #include <QVariant>
@@ -33,7 +34,9 @@
 class QDBusAbstractInterface;
 class QDBusConnection;
 class QDBusObjectPath;
+class QDBusPendingCall;
 class QDBusPendingCallWatcher;
+class QTimer;
 
 /*
  * @cond IMPL
@@ -53,6 +56,18 @@ public:
 
     bool cancel();
 
+    /* Records the call's queueing and D-Bus round trip as spans of the
+     * traced request @traceId */
+    void setTraceId(const QString &traceId);
+
+    /* Fails the call with a SIGNOND_TIMED_OUT_ERR_NAME error if no reply
+     * arrived within @msecs from now; 0 or less means no deadline. The time
+     * left is also sent to signond in the SIGNOND_SESSION_TIMEOUT field of
+     * the session data, if the arguments have one. */
+    void setTimeout(int msecs);
+    /* -1 if the call has no deadline */
+    int remainingTime() const;
+
 Q_SIGNALS:
     void finished(QDBusPendingCallWatcher *watcher);
     void success(QDBusPendingCallWatcher *watcher);
@@ -62,6 +77,7 @@ Q_SIGNALS:
 private Q_SLOTS:
     void onFinished(QDBusPendingCallWatcher *watcher);
     void onInterfaceDestroyed();
+    void onDeadline();
     void fail(const QDBusError &error);
 
 private:
@@ -70,12 +86,22 @@ private:
                 const QList<QVariant> &args,
                 QObject *parent = 0);
     void doCall(QDBusAbstractInterface *interface);
+    QDBusPendingCall asyncCall(QDBusAbstractInterface *interface);
 
 private:
+    /* Object path and interface of the called method, if it does not belong
+     * to the proxy's object */
+    QString m_path;
+    const char *m_interfaceName;
     QString m_method;
     QList<QVariant> m_args;
     QDBusPendingCallWatcher *m_watcher;
     bool m_interfaceWasDestroyed;
+    QString m_traceId;
+    qint64 m_traceTime;
+    int m_timeout;
+    QElapsedTimer m_clock;
+    QTimer *m_deadlineTimer;
 };
 
 class AsyncDBusProxy: public QObject
@@ -89,7 +115,10 @@ public:
     ~AsyncDBusProxy();
 
     void setObjectPath(const QDBusObjectPath &objectPath);
+    bool hasObjectPath() const { return !m_path.isEmpty(); }
     void setError(const QDBusError &error);
+    /* Default deadline of the calls queued from now on */
+    void setTimeout(int msecs) { m_timeout = msecs; }
 
     PendingCall *queueCall(const QString &method,
                            const QList<QVariant> &args,
@@ -99,6 +128,16 @@ public:
                            const QList<QVariant> &args,
                            QObject *receiver,
                            const char *replySlot,
+                           const char *errorSlot,
+                           int timeout = -1);
+    /* Queues a call to a method of another object of the same service; the
+     * call is made once the proxy is ready, in order with the calls to the
+     * proxy's object. */
+    PendingCall *queueCall(const QDBusObjectPath &objectPath,
+                           const char *interface,
+                           const QString &method,
+                           const QList<QVariant> &args,
+                           const char *replySlot,
                            const char *errorSlot);
     bool connect(const char *name, QObject *receiver, const char *slot);
 
@@ -119,6 +158,10 @@ private:
     void setStatus(Status status);
     void update();
     void enqueue(PendingCall *call);
+    PendingCall *queueCall(PendingCall *call,
+                           QObject *receiver,
+                           const char *replySlot,
+                           const char *errorSlot);
 
 private Q_SLOTS:
     void onCallFinished(QDBusPendingCallWatcher *watcher);
@@ -135,6 +178,7 @@ private:
     DBusInterface *m_interface;
     Status m_status;
     QDBusError m_lastError;
+    int m_timeout;
 };
 
 class SignondAsyncDBusProxy: public AsyncDBusProxy
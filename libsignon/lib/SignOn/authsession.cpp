@@ -75,4 +75,9 @@ void AuthSession::cancel()
     impl->cancel();
 }
 
+void AuthSession::setTimeout(int msecs)
+{
+    impl->setTimeout(msecs);
+}
+
 } //namespace SignOn
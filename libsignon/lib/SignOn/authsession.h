@@ -213,6 +213,18 @@ public:
      */
     void cancel();
 
+    /*!
+     * Sets a deadline for the operations started from now on: if an
+     * operation does not complete within @a msecs milliseconds, the error()
+     * signal is emitted with Error::type() Error::TimedOut, and the
+     * authentication service drops the request if it has not started
+     * processing it yet, or cancels it otherwise.
+     * By default there is no deadline.
+     * @param msecs Time allowed for each operation; 0 or a negative value
+     * removes the deadline.
+     */
+    void setTimeout(int msecs);
+
     /*!
      * Signs message by using secret stored into identity.
      * This convenience interface is to do special challenge to signature service.
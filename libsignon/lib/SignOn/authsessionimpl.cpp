@@ -21,16 +21,23 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
  * 02110-1301 USA
  */
+#include "signond/chrometrace.h"
 #include "signond/signoncommon.h"
 
 #include "authsessionimpl.h"
 #include "libsignoncommon.h"
 
+#include <QAtomicInt>
 #include <QDBusPendingCallWatcher>
 #include <QDBusPendingReply>
+#include <QUuid>
 
 using namespace SignOn;
 
+/* Cleared if signond does not implement processWithIdentity; sessions of
+ * all the threads share it */
+static QAtomicInt processWithIdentityAvailable(1);
+
 static QVariantMap sessionData2VariantMap(const SessionData &data)
 {
     QVariantMap result;
@@ -51,7 +58,10 @@ AuthSessionImpl::AuthSessionImpl(AuthSession *parent,
     m_dbusProxy(SIGNOND_AUTH_SESSION_INTERFACE_C,
                 this),
     m_methodName(methodName),
-    m_processCall(0)
+    m_processCall(0),
+    m_processCreatesSession(false),
+    m_traceStart(0),
+    m_timeout(0)
 {
     m_dbusProxy.connect("stateChanged", this,
                         SLOT(stateSlot(int, const QString&)));
@@ -63,7 +73,9 @@ AuthSessionImpl::AuthSessionImpl(AuthSession *parent,
     m_id = id;
     m_isAuthInProcessing = false;
 
-    initInterface();
+    /* The session object is registered by initInterface() when the first
+     * operation is queued, unless that is process(): see
+     * processWithIdentity(). */
 }
 
 AuthSessionImpl::~AuthSessionImpl()
@@ -149,22 +161,86 @@ void AuthSessionImpl::process(const SessionData &sessionData,
     QVariantMap sessionDataVa = sessionData2VariantMap(sessionData);
     QString remoteFunctionName;
 
+    m_traceId.clear();
+    if (ChromeTrace::isEnabled()) {
+        m_traceId = ChromeTrace::newTraceId();
+        m_traceStart = ChromeTrace::now();
+        sessionDataVa.insert(SIGNOND_SESSION_TRACE_ID, m_traceId);
+    }
+
+    /* The actual value is set when the call is sent */
+    if (m_timeout > 0)
+        sessionDataVa.insert(SIGNOND_SESSION_TIMEOUT, m_timeout);
+
     QVariantList arguments;
     arguments += sessionDataVa;
     arguments += mechanism;
 
     remoteFunctionName = QLatin1String("process");
 
-    m_processCall = send2interface(remoteFunctionName,
-                   SLOT(responseSlot(QDBusPendingCallWatcher*)), arguments);
+    if (!m_isAuthInProcessing && !m_dbusProxy.hasObjectPath() &&
+        processWithIdentityAvailable.fetchAndAddRelaxed(0) != 0) {
+        m_processCall = processWithIdentity(arguments);
+    } else {
+        m_processCall = send2interface(remoteFunctionName,
+                       SLOT(responseSlot(QDBusPendingCallWatcher*)), arguments);
+    }
+    if (!m_traceId.isEmpty())
+        m_processCall->setTraceId(m_traceId);
     Q_EMIT m_parent->stateChanged(AuthSession::ProcessPending,
                                   QLatin1String("The request is added "
                                                 "to queue."));
 }
 
+void AuthSessionImpl::setTimeout(int msecs)
+{
+    m_timeout = msecs;
+    m_dbusProxy.setTimeout(msecs);
+}
+
+PendingCall *
+AuthSessionImpl::processWithIdentity(const QVariantList &processArguments)
+{
+    /* No session object is registered yet: have signond create it while
+     * starting the processing, which saves the getAuthSessionObjectPath
+     * round trip. We choose the object path, so that the signals of the
+     * session are connected before the call is made; while signond waits
+     * for the access control decision, it holds the path and records a
+     * cancellation of the request. */
+    QDBusObjectPath objectPath(SIGNOND_CLIENT_AUTH_SESSION_OBJECTPATH_PREFIX +
+        QString::fromLatin1(QUuid::createUuid().toRfc4122().toHex()));
+    m_dbusProxy.setObjectPath(objectPath);
+    m_processCreatesSession = true;
+    m_processArguments = processArguments;
+
+    QVariantList arguments;
+    arguments += m_id;
+    arguments += m_methodName;
+    arguments += QVariant::fromValue(objectPath);
+    arguments += processArguments;
+
+    return m_dbusProxy.queueCall(
+        QDBusObjectPath(SIGNOND_DAEMON_OBJECTPATH),
+        SIGNOND_DAEMON_INTERFACE_C,
+        QLatin1String("processWithIdentity"),
+        arguments,
+        SLOT(responseSlot(QDBusPendingCallWatcher*)),
+        SLOT(processWithIdentityErrorSlot(const QDBusError&)));
+}
+
+void AuthSessionImpl::forgetCreatedSession()
+{
+    /* The session object might not have been created: the next operation
+     * will register a new one. */
+    if (!m_processCreatesSession) return;
+    m_processCreatesSession = false;
+    m_dbusProxy.setObjectPath(QDBusObjectPath());
+}
+
 void AuthSessionImpl::cancel()
 {
     if (m_processCall && m_processCall->cancel()) {
+        forgetCreatedSession();
         emit m_parent->error(Error(Error::SessionCanceled,
                                    QLatin1String("Process is canceled.")));
     } else {
@@ -172,6 +248,15 @@ void AuthSessionImpl::cancel()
     }
 
     m_processCall = 0;
+    traceProcessDone();
+}
+
+void AuthSessionImpl::traceProcessDone()
+{
+    if (m_traceId.isEmpty()) return;
+
+    ChromeTrace::span(m_traceId, "AuthSession::process", m_traceStart);
+    m_traceId.clear();
 }
 
 void AuthSessionImpl::ignoreError(const QDBusError &err)
@@ -184,6 +269,7 @@ void AuthSessionImpl::errorSlot(const QDBusError &err)
     TRACE() << err;
 
     m_processCall = 0;
+    traceProcessDone();
     int errCode = Error::Unknown;
     QString errMessage;
 
@@ -265,6 +351,27 @@ void AuthSessionImpl::authenticationSlot(QDBusPendingCallWatcher *call)
     m_isAuthInProcessing = false;
 }
 
+void AuthSessionImpl::processWithIdentityErrorSlot(const QDBusError &err)
+{
+    forgetCreatedSession();
+
+    if (err.type() == QDBusError::UnknownMethod) {
+        /* signond is older than this library: fall back to registering the
+         * session object first */
+        TRACE() << "processWithIdentity not available";
+        processWithIdentityAvailable.fetchAndStoreRelaxed(0);
+        m_processCall = send2interface(QLatin1String("process"),
+                            SLOT(responseSlot(QDBusPendingCallWatcher*)),
+                            m_processArguments);
+        if (!m_traceId.isEmpty())
+            m_processCall->setTraceId(m_traceId);
+        return;
+    }
+
+    m_processArguments.clear();
+    errorSlot(err);
+}
+
 void AuthSessionImpl::deleteServiceProxy()
 {
     PendingCall *call = qobject_cast<PendingCall*>(sender());
@@ -283,6 +390,9 @@ void AuthSessionImpl::mechanismsAvailableSlot(QDBusPendingCallWatcher *call)
 void AuthSessionImpl::responseSlot(QDBusPendingCallWatcher *call)
 {
     m_processCall = 0;
+    m_processCreatesSession = false;
+    m_processArguments.clear();
+    traceProcessDone();
 
     QDBusPendingReply<QVariantMap> reply = *call;
     QVariantMap sessionDataVa = reply.argumentAt<0>();
@@ -296,5 +406,6 @@ void AuthSessionImpl::stateSlot(int state, const QString &message)
 
 void AuthSessionImpl::unregisteredSlot()
 {
+    m_processCreatesSession = false;
     m_dbusProxy.setObjectPath(QDBusObjectPath());
 }
@@ -64,12 +64,14 @@ public Q_SLOTS:
     void queryAvailableMechanisms(const QStringList &wantedMechanisms);
     void process(const SessionData &sessionData, const QString &mechanism);
     void cancel();
+    void setTimeout(int msecs);
 
 private Q_SLOTS:
     bool initInterface();
     void ignoreError(const QDBusError &err);
     void errorSlot(const QDBusError &err);
     void authenticationSlot(QDBusPendingCallWatcher *call);
+    void processWithIdentityErrorSlot(const QDBusError &err);
     void deleteServiceProxy();
     void mechanismsAvailableSlot(QDBusPendingCallWatcher *call);
     void responseSlot(QDBusPendingCallWatcher *call);
@@ -80,7 +82,10 @@ private:
     PendingCall *send2interface(const QString &operation,
                                 const char *slot,
                                 const QVariantList &arguments);
+    PendingCall *processWithIdentity(const QVariantList &processArguments);
+    void forgetCreatedSession();
     void setId(quint32 id);
+    void traceProcessDone();
 
 private:
     AuthSession *m_parent;
@@ -97,6 +102,24 @@ private:
      * Handle to process operation
      */
     QPointer<PendingCall> m_processCall;
+
+    /*
+     * Whether m_processCall is a processWithIdentity call, which creates the
+     * session object, and the arguments of the process operation
+     */
+    bool m_processCreatesSession;
+    QVariantList m_processArguments;
+
+    /*
+     * Correlation id and start time of the traced process operation
+     */
+    QString m_traceId;
+    qint64 m_traceStart;
+
+    /*
+     * Deadline of the operations, in milliseconds (0 for none)
+     */
+    int m_timeout;
 };
 
 } //namespace SignOn
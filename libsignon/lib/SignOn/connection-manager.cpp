@@ -24,27 +24,109 @@
 #include "libsignoncommon.h"
 #include "signond/signoncommon.h"
 
+#include <QAtomicInt>
+#include <QCoreApplication>
 #include <QDBusConnectionInterface>
 #include <QDBusError>
 #include <QDBusPendingCallWatcher>
-#include <QPointer>
+#include <QHash>
+#include <QMutex>
 #include <QProcessEnvironment>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <QThreadStorage>
 #if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
 #include <QStandardPaths>
 #endif
 
 using namespace SignOn;
 
-static QPointer<ConnectionManager> connectionInstance = 0;
+/* Each thread has its own connection manager, and therefore its own peer
+ * connection to signond: the proxies living in a thread are served by its
+ * event loop only, and no state is shared among threads. The managers of
+ * the other threads are destroyed when their thread exits, while the one of
+ * the main thread lives as long as the process. */
+static ConnectionManager *mainThreadInstance = 0;
+static QThreadStorage<ConnectionManager *> threadInstances;
+static QAtomicInt peerConnectionCount(0);
+
+/* The peer connections being opened by a PeerConnector, mapped to whether
+ * the connector has finished. The manager which requested the connection
+ * removes it once it gets the result, or when it's destroyed before that:
+ * then, whoever comes last closes the connection. */
+static QMutex pendingPeersMutex;
+static QHash<QString, bool> pendingPeers;
+
+namespace SignOn {
+
+/* Opens a peer connection from a thread of the global pool */
+class PeerConnector: public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+    PeerConnector(const QString &address, const QString &name):
+        QObject(0),
+        m_address(address),
+        m_name(name)
+    {
+    }
+
+    void run()
+    {
+        QString errorName = connectToPeer(m_address, m_name);
+
+        QMutexLocker locker(&pendingPeersMutex);
+        if (!pendingPeers.contains(m_name)) {
+            TRACE() << "Connection manager gone, closing" << m_name;
+            QDBusConnection::disconnectFromPeer(m_name);
+            return;
+        }
+        pendingPeers[m_name] = true;
+        Q_EMIT finished(m_name, errorName);
+    }
+
+    /* Returns the name of the error, if the connection failed */
+    static QString connectToPeer(const QString &address, const QString &name)
+    {
+        QDBusConnection connection =
+            QDBusConnection::connectToPeer(address, name);
+        if (connection.isConnected()) return QString();
+
+        QDBusError error = connection.lastError();
+        TRACE() << "p2p error:" << error << error.type();
+        QDBusConnection::disconnectFromPeer(name);
+        return error.name();
+    }
+
+Q_SIGNALS:
+    void finished(const QString &name, const QString &errorName);
+
+private:
+    QString m_address;
+    QString m_name;
+};
+
+} // namespace
+
+static ConnectionManager *&currentInstance()
+{
+    QCoreApplication *app = QCoreApplication::instance();
+    if (app == 0 || QThread::currentThread() == app->thread())
+        return mainThreadInstance;
+    return threadInstances.localData();
+}
 
 ConnectionManager::ConnectionManager(QObject *parent):
     QObject(parent),
     m_connection(QLatin1String("libsignon-qt-invalid")),
-    m_serviceStatus(ServiceStatusUnknown)
+    m_serviceStatus(ServiceStatusUnknown),
+    m_isConnecting(false)
 {
-    if (connectionInstance == 0) {
+    if (currentInstance() == 0) {
         init();
-        connectionInstance = this;
+        currentInstance() = this;
     } else {
         BLAME() << "SignOn::ConnectionManager instantiated more than once!";
     }
@@ -52,14 +134,29 @@ ConnectionManager::ConnectionManager(QObject *parent):
 
 ConnectionManager::~ConnectionManager()
 {
+    /* The result of a pending connection would never be delivered */
+    if (m_isConnecting) {
+        QMutexLocker locker(&pendingPeersMutex);
+        if (pendingPeers.take(m_connectingName)) {
+            TRACE() << "Closing" << m_connectingName;
+            QDBusConnection::disconnectFromPeer(m_connectingName);
+        }
+    }
+
+    /* Let signond release the objects it registered for this connection */
+    if (!m_peerName.isEmpty()) {
+        TRACE() << "Closing" << m_peerName;
+        QDBusConnection::disconnectFromPeer(m_peerName);
+    }
 }
 
 ConnectionManager *ConnectionManager::instance()
 {
-    if (connectionInstance == 0) {
-        connectionInstance = new ConnectionManager;
+    ConnectionManager *&instance = currentInstance();
+    if (instance == 0) {
+        new ConnectionManager;
     }
-    return connectionInstance;
+    return instance;
 }
 
 void ConnectionManager::connect()
@@ -76,13 +173,12 @@ bool ConnectionManager::hasConnection() const
     return m_connection.isConnected();
 }
 
-ConnectionManager::SocketConnectionStatus
-ConnectionManager::setupSocketConnection()
+QString ConnectionManager::peerAddress() const
 {
     QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
     QLatin1String one("1");
     if (environment.value(QLatin1String("SSO_USE_PEER_BUS"), one) != one) {
-        return SocketConnectionUnavailable;
+        return QString();
     }
 
 #if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
@@ -91,65 +187,106 @@ ConnectionManager::setupSocketConnection()
 #else
     QString runtimeDir = environment.value(QLatin1String("XDG_RUNTIME_DIR"));
 #endif
-    if (runtimeDir.isEmpty()) return SocketConnectionUnavailable;
+    if (runtimeDir.isEmpty()) return QString();
 
-    QString socketFileName =
-        QString::fromLatin1("unix:path=%1/" SIGNOND_SOCKET_FILENAME).arg(runtimeDir);
-    static int count = 0;
+    return QString::fromLatin1("unix:path=%1/" SIGNOND_SOCKET_FILENAME).arg(runtimeDir);
+}
 
-    QDBusConnection connection =
-        QDBusConnection::connectToPeer(socketFileName,
-                                       QString(QLatin1String("libsignon-qt%1")).arg(count++));
-    if (!connection.isConnected()) {
-        QDBusError error = connection.lastError();
-        QString name = error.name();
-        TRACE() << "p2p error:" << error << error.type();
-        if (name == QLatin1String("org.freedesktop.DBus.Error.FileNotFound") &&
+void ConnectionManager::init()
+{
+    if (m_serviceStatus == ServiceActivating || m_isConnecting) return;
+
+    QString address = peerAddress();
+    if (address.isEmpty()) {
+        useBusConnection();
+        return;
+    }
+
+    QString connectionName = QString(QLatin1String("libsignon-qt%1"))
+        .arg(peerConnectionCount.fetchAndAddRelaxed(1));
+    m_isConnecting = true;
+    m_connectingName = connectionName;
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 6, 0)
+    /* Connecting blocks until the socket is connected (or the connection
+     * fails): do it out of this thread, while the proxies queue their
+     * calls. */
+    PeerConnector *connector = new PeerConnector(address, connectionName);
+    QObject::connect(connector,
+                     SIGNAL(finished(const QString&, const QString&)),
+                     this,
+                     SLOT(onPeerConnectFinished(const QString&,
+                                                const QString&)),
+                     Qt::QueuedConnection);
+    pendingPeersMutex.lock();
+    pendingPeers.insert(connectionName, false);
+    pendingPeersMutex.unlock();
+    QThreadPool::globalInstance()->start(connector);
+#else
+    /* Older QtDBus versions don't support using a connection out of the
+     * thread which opened it */
+    onPeerConnectFinished(connectionName,
+                          PeerConnector::connectToPeer(address,
+                                                       connectionName));
+#endif
+}
+
+void ConnectionManager::useBusConnection()
+{
+    m_connection = SIGNOND_BUS;
+
+    if (m_connection.isConnected()) {
+        TRACE() << "Connected to" << m_connection.name();
+        Q_EMIT connected(m_connection);
+    }
+}
+
+void ConnectionManager::onPeerConnectFinished(const QString &name,
+                                              const QString &errorName)
+{
+    m_isConnecting = false;
+    pendingPeersMutex.lock();
+    pendingPeers.remove(name);
+    pendingPeersMutex.unlock();
+
+    if (!errorName.isEmpty()) {
+        if (errorName ==
+            QLatin1String("org.freedesktop.DBus.Error.FileNotFound") &&
             m_serviceStatus != ServiceActivated) {
-            return SocketConnectionNoService;
+            activateService();
         } else {
-            return SocketConnectionUnavailable;
+            useBusConnection();
         }
+        return;
     }
 
-    m_connection = connection;
+    m_connection = QDBusConnection(name);
+    m_peerName = name;
     m_connection.connect(QString(),
                          QLatin1String("/org/freedesktop/DBus/Local"),
                          QLatin1String("org.freedesktop.DBus.Local"),
                          QLatin1String("Disconnected"),
                          this, SLOT(onDisconnected()));
 
-    return SocketConnectionOk;
+    TRACE() << "Connected to" << m_connection.name();
+    Q_EMIT connected(m_connection);
 }
 
-void ConnectionManager::init()
+void ConnectionManager::activateService()
 {
-    if (m_serviceStatus == ServiceActivating) return;
-
-    SocketConnectionStatus status = setupSocketConnection();
-
-    if (status == SocketConnectionNoService) {
-        TRACE() << "Peer connection unavailable, activating service";
-        QDBusConnectionInterface *interface =
-            QDBusConnection::sessionBus().interface();
-        QDBusPendingCall call =
-            interface->asyncCall(QLatin1String("StartServiceByName"),
-                                 SIGNOND_SERVICE, uint(0));
-        m_serviceStatus = ServiceActivating;
-        QDBusPendingCallWatcher *watcher =
-            new QDBusPendingCallWatcher(call, this);
-        QObject::connect(watcher,
-                         SIGNAL(finished(QDBusPendingCallWatcher*)),
-                         this,
-                         SLOT(onActivationDone(QDBusPendingCallWatcher*)));
-    } else if (status == SocketConnectionUnavailable) {
-        m_connection = SIGNOND_BUS;
-    }
-
-    if (m_connection.isConnected()) {
-        TRACE() << "Connected to" << m_connection.name();
-        Q_EMIT connected(m_connection);
-    }
+    TRACE() << "Peer connection unavailable, activating service";
+    QDBusConnectionInterface *interface =
+        QDBusConnection::sessionBus().interface();
+    QDBusPendingCall call =
+        interface->asyncCall(QLatin1String("StartServiceByName"),
+                             SIGNOND_SERVICE, uint(0));
+    m_serviceStatus = ServiceActivating;
+    QDBusPendingCallWatcher *watcher =
+        new QDBusPendingCallWatcher(call, this);
+    QObject::connect(watcher,
+                     SIGNAL(finished(QDBusPendingCallWatcher*)),
+                     this,
+                     SLOT(onActivationDone(QDBusPendingCallWatcher*)));
 }
 
 void ConnectionManager::onActivationDone(QDBusPendingCallWatcher *watcher)
@@ -172,3 +309,5 @@ void ConnectionManager::onDisconnected()
     m_serviceStatus = ServiceStatusUnknown;
     Q_EMIT disconnected();
 }
+
+#include "connection-manager.moc"
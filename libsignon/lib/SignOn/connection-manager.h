@@ -34,12 +34,6 @@ class ConnectionManager: public QObject
 {
     Q_OBJECT
 
-    enum SocketConnectionStatus {
-        SocketConnectionOk = 0,
-        SocketConnectionUnavailable,
-        SocketConnectionNoService
-    };
-
     enum ServiceStatus {
         ServiceStatusUnknown = 0,
         ServiceActivating,
@@ -64,16 +58,22 @@ Q_SIGNALS:
     void disconnected();
 
 private:
-    SocketConnectionStatus setupSocketConnection();
+    QString peerAddress() const;
     void init();
+    void useBusConnection();
+    void activateService();
 
 private Q_SLOTS:
+    void onPeerConnectFinished(const QString &name, const QString &errorName);
     void onActivationDone(QDBusPendingCallWatcher *watcher);
     void onDisconnected();
 
 private:
     QDBusConnection m_connection;
+    QString m_peerName;
+    QString m_connectingName;
     ServiceStatus m_serviceStatus;
+    bool m_isConnecting;
 };
 
 }
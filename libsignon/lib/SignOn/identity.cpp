@@ -133,4 +133,9 @@ void Identity::signOut()
     impl->signOut();
 }
 
+void Identity::setTimeout(int msecs)
+{
+    impl->setTimeout(msecs);
+}
+
 } //namespace SignOn
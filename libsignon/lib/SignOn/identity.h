@@ -248,6 +248,8 @@ public:
      * Query stored credential parameters for this authentication identity.
      * On success, a signal info() is emitted with parameters
      * in the service.
+     * The parameters are cached, so repeated queries are answered without
+     * any IPC until the service notifies a change of the identity.
      * If the operation fails, a signal error() is emitted.
      * If query fails, Error::type() is
      * Error::CredentialsNotAvailable,
@@ -316,6 +318,20 @@ public:
      */
     void signOut();
 
+    /*!
+     * Sets a deadline for the operations started from now on on this
+     * Identity: if an operation does not complete within @a msecs
+     * milliseconds, the error() signal is emitted with Error::type()
+     * Error::TimedOut.
+     * By default there is no deadline.
+     * The Identity instances referring to the same identity share the
+     * queries of its information: while one is in progress, the deadline of
+     * the instance which started it applies to all of them.
+     * @param msecs Time allowed for each operation; 0 or a negative value
+     * removes the deadline.
+     */
+    void setTimeout(int msecs);
+
 Q_SIGNALS:
 
     /*!
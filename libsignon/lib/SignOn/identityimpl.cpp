@@ -24,7 +24,6 @@
 #include <stdarg.h>
 
 #include <QByteArray>
-#include <QDBusArgument>
 #include <QDBusPendingReply>
 #include <QTimer>
 
@@ -35,53 +34,28 @@
 #include "identityinfo.h"
 #include "identityinfoimpl.h"
 #include "authsessionimpl.h"
+#include "remote-identity.h"
 #include "signonerror.h"
 
 #define SIGNOND_AUTH_SESSION_CANCEL_TIMEOUT 5000 //ms
 
 using namespace SignOn;
 
-/* Keep these aligned with the State enum */
-static const char *stateNames[] = {
-    "PendingRegistration",
-    "NeedsRegistration",
-    "NeedsUpdate",
-    "PendingUpdate",
-    "Removed",
-    "Ready",
-};
-
-static QString stateName(IdentityImpl::State state)
-{
-    return QLatin1String((state < IdentityImpl::LastState) ?
-                         stateNames[state] : "Unknown");
-}
-
 IdentityImpl::IdentityImpl(Identity *parent, const quint32 id):
     QObject(parent),
     m_parent(parent),
-    m_identityInfo(new IdentityInfo),
-    m_dbusProxy(SIGNOND_IDENTITY_INTERFACE_C,
-                this),
+    m_remote(RemoteIdentity::acquire(this, id)),
     m_tmpIdentityInfo(NULL),
-    m_state(NeedsRegistration),
-    m_infoQueried(true),
+    m_infoQueried(false),
     m_methodsQueried(false),
-    m_signOutRequestedByThisIdentity(false)
+    m_signOutRequestedByThisIdentity(false),
+    m_timeout(0)
 {
-    m_dbusProxy.connect("infoUpdated", this, SLOT(infoUpdated(int)));
-    m_dbusProxy.connect("unregistered", this, SLOT(remoteObjectDestroyed()));
-    QObject::connect(&m_dbusProxy, SIGNAL(objectPathNeeded()),
-                     this, SLOT(sendRegisterRequest()));
-
-    m_identityInfo->setId(id);
-    sendRegisterRequest();
 }
 
 IdentityImpl::~IdentityImpl()
 {
-    if (m_identityInfo)
-        delete m_identityInfo;
+    m_remote->release(this);
 
     if (m_tmpIdentityInfo)
         delete m_tmpIdentityInfo;
@@ -91,29 +65,24 @@ IdentityImpl::~IdentityImpl()
             destroySession(session);
 }
 
-void IdentityImpl::updateState(State state)
+void IdentityImpl::copyInfo(const IdentityInfo &info)
 {
-    TRACE() << "Updating state: " << stateName(state) << this;
-
-    m_state = state;
-    switch (state)
-    {
-    case NeedsUpdate:
-        updateContents();
-        break;
-    default:
-        break;
-    }
+    *m_remote->info()->impl = *info.impl;
 }
 
-void IdentityImpl::copyInfo(const IdentityInfo &info)
+quint32 IdentityImpl::id() const
 {
-    *m_identityInfo->impl = *info.impl;
+   return m_remote->id();
 }
 
-quint32 IdentityImpl::id() const
+void IdentityImpl::queueCall(const QString &method, const QVariantList &args,
+                             const char *replySlot)
 {
-   return m_identityInfo->id();
+    /* The proxy is shared: set the deadline on each call */
+    m_remote->proxy()->queueCall(method, args, this, replySlot,
+                                 SLOT(errorReply(const QDBusError&)),
+                                 m_timeout);
+    m_remote->addRegistrationWaiter(this);
 }
 
 AuthSession *IdentityImpl::createSession(const QString &methodName,
@@ -145,13 +114,13 @@ void IdentityImpl::queryAvailableMethods()
     TRACE() << "Querying available identity authentication methods.";
     if (!checkRemoved()) return;
 
-    if (m_state == Ready) {
-        emit m_parent->methodsAvailable(m_identityInfo->methods());
+    if (m_remote->state() == RemoteIdentity::Ready) {
+        emit m_parent->methodsAvailable(m_remote->info()->methods());
         return;
     }
 
     m_methodsQueried = true;
-    updateContents();
+    m_remote->updateContents(m_timeout);
 }
 
 void IdentityImpl::requestCredentialsUpdate(const QString &message)
@@ -161,21 +130,20 @@ void IdentityImpl::requestCredentialsUpdate(const QString &message)
 
     QVariantList args;
     args << message;
-    m_dbusProxy.queueCall(QLatin1String("requestCredentialsUpdate"),
-                          args,
-                          SLOT(storeCredentialsReply(QDBusPendingCallWatcher*)),
-                          SLOT(errorReply(const QDBusError&)));
+    queueCall(QLatin1String("requestCredentialsUpdate"), args,
+              SLOT(storeCredentialsReply(QDBusPendingCallWatcher*)));
 }
 
 void IdentityImpl::storeCredentials(const IdentityInfo &info)
 {
     TRACE() << "Storing credentials";
 
-    if (m_state == Removed) {
-        updateState(NeedsRegistration);
+    if (m_remote->state() == RemoteIdentity::Removed) {
+        m_remote->updateState(RemoteIdentity::NeedsRegistration);
     }
 
-    const IdentityInfo *localInfo = info.impl->isEmpty() ? m_identityInfo : &info;
+    const IdentityInfo *localInfo =
+        info.impl->isEmpty() ? m_remote->info() : &info;
 
     if (localInfo->impl->isEmpty()) {
         emit m_parent->error(
@@ -186,12 +154,11 @@ void IdentityImpl::storeCredentials(const IdentityInfo &info)
 
     QVariantList args;
     QVariantMap map = localInfo->impl->toMap();
-    map.insert(SIGNOND_IDENTITY_INFO_ID, m_identityInfo->id());
+    map.insert(SIGNOND_IDENTITY_INFO_ID, id());
     args << map;
 
-    m_dbusProxy.queueCall(QLatin1String("store"), args,
-                          SLOT(storeCredentialsReply(QDBusPendingCallWatcher*)),
-                          SLOT(errorReply(const QDBusError&)));
+    queueCall(QLatin1String("store"), args,
+              SLOT(storeCredentialsReply(QDBusPendingCallWatcher*)));
 }
 
 void IdentityImpl::remove()
@@ -204,10 +171,8 @@ void IdentityImpl::remove()
      */
 
     if (id() != SIGNOND_NEW_IDENTITY) {
-        m_dbusProxy.queueCall(QLatin1String("remove"),
-                              QVariantList(),
-                              SLOT(removeReply()),
-                              SLOT(errorReply(const QDBusError&)));
+        queueCall(QLatin1String("remove"), QVariantList(),
+                  SLOT(removeReply()));
     } else {
         emit m_parent->error(Error(Error::IdentityNotFound,
                                    QLatin1String("Remove request failed. The "
@@ -220,10 +185,9 @@ void IdentityImpl::addReference(const QString &reference)
     TRACE() << "Adding reference to identity";
     if (!checkRemoved()) return;
 
-    m_dbusProxy.queueCall(QLatin1String("addReference"),
-                          QVariantList() << QVariant(reference),
-                          SLOT(addReferenceReply()),
-                          SLOT(errorReply(const QDBusError&)));
+    queueCall(QLatin1String("addReference"),
+              QVariantList() << QVariant(reference),
+              SLOT(addReferenceReply()));
 }
 
 void IdentityImpl::removeReference(const QString &reference)
@@ -231,10 +195,9 @@ void IdentityImpl::removeReference(const QString &reference)
     TRACE() << "Removing reference from identity";
     if (!checkRemoved()) return;
 
-    m_dbusProxy.queueCall(QLatin1String("removeReference"),
-                          QVariantList() << QVariant(reference),
-                          SLOT(removeReferenceReply()),
-                          SLOT(errorReply(const QDBusError&)));
+    queueCall(QLatin1String("removeReference"),
+              QVariantList() << QVariant(reference),
+              SLOT(removeReferenceReply()));
 }
 
 void IdentityImpl::queryInfo()
@@ -242,13 +205,13 @@ void IdentityImpl::queryInfo()
     TRACE() << "Querying info.";
     if (!checkRemoved()) return;
 
-    if (m_state == Ready) {
-        emit m_parent->info(IdentityInfo(*m_identityInfo));
+    if (m_remote->state() == RemoteIdentity::Ready) {
+        emit m_parent->info(IdentityInfo(*m_remote->info()));
         return;
     }
 
     m_infoQueried = true;
-    updateContents();
+    m_remote->updateContents(m_timeout);
 }
 
 void IdentityImpl::verifyUser(const QString &message)
@@ -263,10 +226,8 @@ void IdentityImpl::verifyUser(const QVariantMap &params)
     TRACE() << "Verifying user.";
     if (!checkRemoved()) return;
 
-    m_dbusProxy.queueCall(QLatin1String("verifyUser"),
-                          QVariantList() << params,
-                          SLOT(verifyUserReply(QDBusPendingCallWatcher*)),
-                          SLOT(errorReply(const QDBusError&)));
+    queueCall(QLatin1String("verifyUser"), QVariantList() << params,
+              SLOT(verifyUserReply(QDBusPendingCallWatcher*)));
 }
 
 void IdentityImpl::verifySecret(const QString &secret)
@@ -274,10 +235,9 @@ void IdentityImpl::verifySecret(const QString &secret)
     TRACE();
     if (!checkRemoved()) return;
 
-    m_dbusProxy.queueCall(QLatin1String("verifySecret"),
-                          QVariantList() << QVariant(secret),
-                          SLOT(verifySecretReply(QDBusPendingCallWatcher*)),
-                          SLOT(errorReply(const QDBusError&)));
+    queueCall(QLatin1String("verifySecret"),
+              QVariantList() << QVariant(secret),
+              SLOT(verifySecretReply(QDBusPendingCallWatcher*)));
 }
 
 void IdentityImpl::signOut()
@@ -290,10 +250,8 @@ void IdentityImpl::signOut()
        be able to perform the operation.
     */
     if (id() != SIGNOND_NEW_IDENTITY) {
-        m_dbusProxy.queueCall(QLatin1String("signOut"),
-                              QVariantList(),
-                              SLOT(signOutReply()),
-                              SLOT(errorReply(const QDBusError&)));
+        queueCall(QLatin1String("signOut"), QVariantList(),
+                  SLOT(signOutReply()));
         m_signOutRequestedByThisIdentity = true;
     }
 
@@ -344,13 +302,13 @@ void IdentityImpl::storeCredentialsReply(QDBusPendingCallWatcher *call)
     quint32 id = reply.argumentAt<0>();
     TRACE() << "stored id:" << id << "old id:" << this->id();
     if (m_tmpIdentityInfo) {
-        *m_identityInfo = *m_tmpIdentityInfo;
+        *m_remote->info() = *m_tmpIdentityInfo;
         delete m_tmpIdentityInfo;
         m_tmpIdentityInfo = NULL;
     }
 
     if (id != this->id()) {
-        m_identityInfo->setId(id);
+        m_remote->setId(id);
         foreach (AuthSession *session, m_authSessions)
             session->impl->setId(id);
     }
@@ -359,8 +317,8 @@ void IdentityImpl::storeCredentialsReply(QDBusPendingCallWatcher *call)
 
 void IdentityImpl::removeReply()
 {
-    m_identityInfo->impl->clear();
-    updateState(Removed);
+    m_remote->info()->impl->clear();
+    m_remote->updateState(RemoteIdentity::Removed);
     emit m_parent->removed();
 }
 
@@ -374,25 +332,27 @@ void IdentityImpl::removeReferenceReply()
     emit m_parent->referenceRemoved();
 }
 
-void IdentityImpl::getInfoReply(QDBusPendingCallWatcher *call)
+void IdentityImpl::infoReady()
 {
-    QDBusPendingReply<QVariantMap> reply = *call;
-    QVariantMap infoData = reply.argumentAt<0>();
-    TRACE() << infoData;
-    updateCachedData(infoData);
-    updateState(Ready);
-
     if (m_infoQueried) {
-        Q_EMIT m_parent->info(IdentityInfo(*m_identityInfo));
+        Q_EMIT m_parent->info(IdentityInfo(*m_remote->info()));
         m_infoQueried = false;
     }
 
     if (m_methodsQueried) {
-        Q_EMIT m_parent->methodsAvailable(m_identityInfo->methods());
+        Q_EMIT m_parent->methodsAvailable(m_remote->info()->methods());
         m_methodsQueried = false;
     }
 }
 
+void IdentityImpl::remoteError(const QDBusError &err)
+{
+    /* The pending queries failed; the next ones will fetch the info again */
+    m_infoQueried = false;
+    m_methodsQueried = false;
+    errorReply(err);
+}
+
 void IdentityImpl::verifyUserReply(QDBusPendingCallWatcher *call)
 {
     QDBusPendingReply<bool> reply = *call;
@@ -414,16 +374,13 @@ void IdentityImpl::signOutReply()
 
 void IdentityImpl::infoUpdated(int state)
 {
+    /* The shared RemoteIdentity has already updated its state */
     const char *stateStr;
     switch ((IdentityState)state) {
-    /* Data updated on the server side. */
     case IdentityDataUpdated:
-        updateState(NeedsUpdate);
         stateStr = "NeedsUpdate";
         break;
-    /* Data removed on the server side. */
     case IdentityRemoved:
-        updateState(Removed);
         stateStr = "Removed";
         break;
     /* A remote client identity signed out,
@@ -493,10 +450,10 @@ void IdentityImpl::errorReply(const QDBusError& err)
     } else if (err.name() == SIGNOND_FORGOT_PASSWORD_ERR_NAME) {
        emit m_parent->error(Error(Error::ForgotPassword, err.message()));
        return;
+    } else if (err.name() == SIGNOND_TIMED_OUT_ERR_NAME) {
+       emit m_parent->error(Error(Error::TimedOut, err.message()));
+       return;
     } else {
-        if (m_state == this->PendingRegistration)
-            updateState(NeedsRegistration);
-
         TRACE() << "Non internal SSO error reply.";
     }
 
@@ -510,77 +467,9 @@ void IdentityImpl::errorReply(const QDBusError& err)
     emit m_parent->error(Error(Error::Unknown, err.message()));
 }
 
-void IdentityImpl::updateContents()
-{
-    m_dbusProxy.queueCall(QLatin1String("getInfo"),
-                          QVariantList(),
-                          SLOT(getInfoReply(QDBusPendingCallWatcher*)),
-                          SLOT(errorReply(const QDBusError&)));
-    updateState(PendingUpdate);
-}
-
-bool IdentityImpl::sendRegisterRequest()
-{
-    if (m_state == PendingRegistration) return true;
-
-    QVariantList args;
-    QString registerMethodName = QLatin1String("registerNewIdentity");
-
-    if (id() != SIGNOND_NEW_IDENTITY) {
-        registerMethodName = QLatin1String("getIdentity");
-        args << m_identityInfo->id();
-    }
-
-    SignondAsyncDBusProxy *authService =
-        new SignondAsyncDBusProxy(SIGNOND_DAEMON_INTERFACE_C, this);
-    authService->setObjectPath(QDBusObjectPath(SIGNOND_DAEMON_OBJECTPATH));
-
-    PendingCall *call =
-        authService->queueCall(registerMethodName,
-                               args,
-                               SLOT(registerReply(QDBusPendingCallWatcher*)),
-                               SLOT(errorReply(const QDBusError&)));
-    QObject::connect(call, SIGNAL(finished(QDBusPendingCallWatcher*)),
-                     this, SLOT(deleteServiceProxy()));
-    updateState(PendingRegistration);
-    return true;
-}
-
-void IdentityImpl::updateCachedData(const QVariantMap &infoData)
-{
-    m_identityInfo->impl->updateFromMap(infoData);
-}
-
-void IdentityImpl::registerReply(QDBusPendingCallWatcher *call)
-{
-    QVariantList arguments = call->reply().arguments();
-    if (arguments.count() > 1) {
-        QDBusArgument info = arguments.at(1).value<QDBusArgument>();
-        updateCachedData(qdbus_cast<QVariantMap>(info));
-    }
-
-    m_dbusProxy.setObjectPath(arguments.at(0).value<QDBusObjectPath>());
-    updateState(Ready);
-}
-
-void IdentityImpl::deleteServiceProxy()
-{
-    PendingCall *call = qobject_cast<PendingCall*>(sender());
-    /* This destroys the AsyncDBusProxy which we created just for registering
-     * the identity. */
-    call->parent()->deleteLater();
-}
-
-void IdentityImpl::remoteObjectDestroyed()
-{
-    TRACE();
-    m_dbusProxy.setObjectPath(QDBusObjectPath());
-    updateState(NeedsRegistration);
-}
-
 bool IdentityImpl::checkRemoved()
 {
-    if (m_state == Removed) {
+    if (m_remote->state() == RemoteIdentity::Removed) {
         Q_EMIT m_parent->error(Error(Error::IdentityNotFound,
                                      QLatin1String("Removed from database.")));
         return false;
@@ -42,6 +42,7 @@
 namespace SignOn {
 
 class IdentityInfo;
+class RemoteIdentity;
 
 /*!
  * @class IdentityImpl
@@ -54,24 +55,15 @@ class IdentityImpl: public QObject
     Q_DISABLE_COPY(IdentityImpl)
 
     friend class Identity;
+    friend class RemoteIdentity;
 
 public:
-    enum State {
-        PendingRegistration = 0, /* Ongoing registration */
-        NeedsRegistration,       /* Remote object not created or destroyed */
-        NeedsUpdate,             /* Remote data changed */
-        PendingUpdate,           /* Update in progress */
-        Removed,                 /* Removed from database */
-        Ready,                   /* Ready for querying locally cached data, or
-                                    any remote operation */
-        LastState
-    };
-
     IdentityImpl(Identity *parent,
                  const quint32 id = 0);
     ~IdentityImpl();
 
     quint32 id() const;
+    void setTimeout(int msecs) { m_timeout = msecs; }
     AuthSession *createSession(const QString &methodName, QObject *parent = 0);
     void destroySession(AuthSession *session);
 
@@ -81,15 +73,12 @@ public Q_SLOTS:
     void removeReply();
     void addReferenceReply();
     void removeReferenceReply();
-    void getInfoReply(QDBusPendingCallWatcher *call);
     void verifyUserReply(QDBusPendingCallWatcher *call);
     void verifySecretReply(QDBusPendingCallWatcher *call);
     void signOutReply();
     void infoUpdated(int);
-    void remoteObjectDestroyed();
 
 private Q_SLOTS:
-    bool sendRegisterRequest();
     void queryAvailableMethods();
     void requestCredentialsUpdate(const QString &message = QString());
     void storeCredentials(const IdentityInfo &info);
@@ -102,28 +91,26 @@ private Q_SLOTS:
     void verifySecret(const QString &secret);
     void signOut();
     void authSessionCancelReply(const SignOn::Error &err);
-    void registerReply(QDBusPendingCallWatcher *call);
-    void deleteServiceProxy();
 
 private:
     void copyInfo(const IdentityInfo &info);
-    void updateState(State state);
     bool checkRemoved();
-
-    void updateContents();
-    void updateCachedData(const QVariantMap &infoData);
+    void queueCall(const QString &method, const QVariantList &args,
+                   const char *replySlot);
+    void infoReady();
+    bool isWaitingForInfo() const { return m_infoQueried || m_methodsQueried; }
+    void remoteError(const QDBusError &err);
     void clearAuthSessionsCache();
 
 private:
     Identity *m_parent;
-    IdentityInfo *m_identityInfo;
-    SignondAsyncDBusProxy m_dbusProxy;
+    /* Shared with the other instances of this thread having the same id */
+    RemoteIdentity *m_remote;
 
     /* Cache info in the storing case, so that if the storing succeeds, server
      * side does not have to send succesfully stored data over IPC channel.
      */
     IdentityInfo *m_tmpIdentityInfo;
-    State m_state;
     QList<AuthSession *> m_authSessions;
 
     /* This flag tells the queryInfo() reply slot to emit the info() signal */
@@ -135,6 +122,9 @@ private:
 
     /* Marks this Identity as the one which requested the sign out */
     bool m_signOutRequestedByThisIdentity;
+
+    /* Deadline of the operations, in milliseconds (0 for none) */
+    int m_timeout;
 };
 
 }  // namespace SignOn
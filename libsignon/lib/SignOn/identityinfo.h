@@ -58,6 +58,7 @@ class SIGNON_EXPORT IdentityInfo
 {
     friend class AuthServiceImpl;
     friend class IdentityImpl;
+    friend class RemoteIdentity;
 
 public:
     /*!
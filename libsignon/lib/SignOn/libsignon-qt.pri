@@ -21,6 +21,7 @@ public_headers += \
 
 private_headers = authserviceimpl.h \
     identityimpl.h \
+    remote-identity.h \
     async-dbus-proxy.h \
     authsessionimpl.h \
     connection-manager.h \
@@ -36,6 +37,7 @@ INCLUDEPATH += . \
 SOURCES += identityinfo.cpp \
     identity.cpp \
     identityimpl.cpp \
+    remote-identity.cpp \
     async-dbus-proxy.cpp \
     authservice.cpp \
     authserviceimpl.cpp \
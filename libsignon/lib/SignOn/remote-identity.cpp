@@ -0,0 +1,327 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+#include "remote-identity.h"
+
+#include <QDBusArgument>
+#include <QDBusObjectPath>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QHash>
+#include <QThreadStorage>
+
+#include "identityimpl.h"
+#include "identityinfo.h"
+#include "identityinfoimpl.h"
+#include "libsignoncommon.h"
+#include "signond/signoncommon.h"
+
+using namespace SignOn;
+
+/* The D-Bus proxies cannot be used out of the thread which created them, so
+ * each thread has its own registry */
+typedef QHash<quint32, RemoteIdentity *> RemoteIdentities;
+static QThreadStorage<RemoteIdentities *> threadRegistry;
+
+static RemoteIdentities *registry()
+{
+    if (!threadRegistry.hasLocalData())
+        threadRegistry.setLocalData(new RemoteIdentities);
+    return threadRegistry.localData();
+}
+
+/* Keep these aligned with the State enum */
+static const char *stateNames[] = {
+    "PendingRegistration",
+    "NeedsRegistration",
+    "NeedsUpdate",
+    "PendingUpdate",
+    "Removed",
+    "Ready",
+};
+
+static QString stateName(RemoteIdentity::State state)
+{
+    return QLatin1String((state < RemoteIdentity::LastState) ?
+                         stateNames[state] : "Unknown");
+}
+
+RemoteIdentity::RemoteIdentity(quint32 id):
+    QObject(0),
+    m_info(new IdentityInfo),
+    m_dbusProxy(SIGNOND_IDENTITY_INTERFACE_C, this),
+    m_state(NeedsRegistration),
+    m_registering(false)
+{
+    m_dbusProxy.connect("infoUpdated", this, SLOT(infoUpdated(int)));
+    m_dbusProxy.connect("unregistered", this, SLOT(remoteObjectDestroyed()));
+    QObject::connect(&m_dbusProxy, SIGNAL(objectPathNeeded()),
+                     this, SLOT(sendRegisterRequest()));
+
+    m_info->setId(id);
+    sendRegisterRequest();
+}
+
+RemoteIdentity::~RemoteIdentity()
+{
+    delete m_info;
+}
+
+RemoteIdentity *RemoteIdentity::acquire(IdentityImpl *user, quint32 id)
+{
+    RemoteIdentity *remote = 0;
+    if (id != SIGNOND_NEW_IDENTITY)
+        remote = registry()->value(id, 0);
+
+    if (remote == 0) {
+        remote = new RemoteIdentity(id);
+        if (id != SIGNOND_NEW_IDENTITY)
+            registry()->insert(id, remote);
+    }
+
+    TRACE() << "Identity" << id << "users:" << remote->m_users.count() + 1;
+    remote->m_users.append(user);
+    return remote;
+}
+
+void RemoteIdentity::release(IdentityImpl *user)
+{
+    m_users.removeOne(user);
+    m_registrationWaiters.removeOne(user);
+    if (!m_users.isEmpty()) return;
+
+    RemoteIdentities *identities = registry();
+    if (identities->value(id(), 0) == this)
+        identities->remove(id());
+
+    /* We might be called from one of our own slots */
+    deleteLater();
+}
+
+quint32 RemoteIdentity::id() const
+{
+    return m_info->id();
+}
+
+void RemoteIdentity::setId(quint32 id)
+{
+    quint32 oldId = this->id();
+    if (id == oldId) return;
+
+    m_info->setId(id);
+
+    RemoteIdentities *identities = registry();
+    if (identities->value(oldId, 0) == this)
+        identities->remove(oldId);
+    if (id != SIGNOND_NEW_IDENTITY && !identities->contains(id))
+        identities->insert(id, this);
+}
+
+void RemoteIdentity::updateState(State state)
+{
+    TRACE() << "Updating state: " << stateName(state) << this;
+
+    m_state = state;
+    switch (state)
+    {
+    case NeedsUpdate:
+        updateContents();
+        break;
+    default:
+        break;
+    }
+}
+
+void RemoteIdentity::updateContents(int timeout)
+{
+    if (m_state == PendingUpdate) return;
+
+    m_dbusProxy.queueCall(QLatin1String("getInfo"),
+                          QVariantList(),
+                          this,
+                          SLOT(getInfoReply(QDBusPendingCallWatcher*)),
+                          SLOT(errorReply(const QDBusError&)),
+                          timeout);
+    updateState(PendingUpdate);
+}
+
+void RemoteIdentity::addRegistrationWaiter(IdentityImpl *user)
+{
+    if (!m_registering) return;
+    if (!m_registrationWaiters.contains(user))
+        m_registrationWaiters.append(user);
+}
+
+bool RemoteIdentity::sendRegisterRequest()
+{
+    if (m_registering) return true;
+
+    QVariantList args;
+    QString registerMethodName = QLatin1String("registerNewIdentity");
+
+    if (id() != SIGNOND_NEW_IDENTITY) {
+        registerMethodName = QLatin1String("getIdentity");
+        args << id();
+    }
+
+    SignondAsyncDBusProxy *authService =
+        new SignondAsyncDBusProxy(SIGNOND_DAEMON_INTERFACE_C, this);
+    authService->setObjectPath(QDBusObjectPath(SIGNOND_DAEMON_OBJECTPATH));
+
+    PendingCall *call =
+        authService->queueCall(registerMethodName,
+                               args,
+                               SLOT(registerReply(QDBusPendingCallWatcher*)),
+                               SLOT(registerErrorReply(const QDBusError&)));
+    QObject::connect(call, SIGNAL(finished(QDBusPendingCallWatcher*)),
+                     this, SLOT(deleteServiceProxy()));
+    m_registering = true;
+    updateState(PendingRegistration);
+    return true;
+}
+
+void RemoteIdentity::updateCachedData(const QVariantMap &infoData)
+{
+    m_info->impl->updateFromMap(infoData);
+}
+
+void RemoteIdentity::registerReply(QDBusPendingCallWatcher *call)
+{
+    QVariantList arguments = call->reply().arguments();
+    if (arguments.count() > 1) {
+        QDBusArgument info = arguments.at(1).value<QDBusArgument>();
+        updateCachedData(qdbus_cast<QVariantMap>(info));
+    }
+
+    m_dbusProxy.setObjectPath(arguments.at(0).value<QDBusObjectPath>());
+    m_registering = false;
+    m_registrationWaiters.clear();
+    updateState(Ready);
+}
+
+void RemoteIdentity::getInfoReply(QDBusPendingCallWatcher *call)
+{
+    QDBusPendingReply<QVariantMap> reply = *call;
+    QVariantMap infoData = reply.argumentAt<0>();
+    TRACE() << infoData;
+    updateCachedData(infoData);
+    updateState(Ready);
+    notifyInfoReady();
+}
+
+bool RemoteIdentity::hasInfoWaiters() const
+{
+    foreach (IdentityImpl *user, m_users) {
+        if (user->isWaitingForInfo()) return true;
+    }
+    return false;
+}
+
+void RemoteIdentity::notifyInfoReady()
+{
+    QList<IdentityImpl *> users = m_users;
+    foreach (IdentityImpl *user, users)
+        user->infoReady();
+}
+
+void RemoteIdentity::registerErrorReply(const QDBusError &err)
+{
+    TRACE() << err.name();
+
+    QList<IdentityImpl *> users = m_registrationWaiters;
+    m_registering = false;
+    m_registrationWaiters.clear();
+    updateState(NeedsRegistration);
+
+    notifyError(users, err);
+}
+
+void RemoteIdentity::errorReply(const QDBusError &err)
+{
+    TRACE() << err.name();
+
+    /* Not through updateState(), which would call getInfo again at once:
+     * the next query will */
+    if (m_state == PendingUpdate)
+        m_state = NeedsUpdate;
+
+    notifyError(QList<IdentityImpl *>(), err);
+}
+
+void RemoteIdentity::notifyError(QList<IdentityImpl *> users,
+                                 const QDBusError &err)
+{
+    /* Only the users which are waiting for a reply get the error */
+    foreach (IdentityImpl *user, m_users) {
+        if (user->isWaitingForInfo() && !users.contains(user))
+            users.append(user);
+    }
+
+    foreach (IdentityImpl *user, users) {
+        /* A previous user might have released us */
+        if (m_users.contains(user))
+            user->remoteError(err);
+    }
+}
+
+void RemoteIdentity::deleteServiceProxy()
+{
+    PendingCall *call = qobject_cast<PendingCall*>(sender());
+    /* This destroys the AsyncDBusProxy which we created just for registering
+     * the identity. */
+    call->parent()->deleteLater();
+}
+
+void RemoteIdentity::infoUpdated(int state)
+{
+    switch ((IdentityState)state) {
+    /* Data updated on the server side. */
+    case IdentityDataUpdated:
+        /* Fetch the new data only if some user is waiting for it; otherwise
+         * the next query will */
+        if (hasInfoWaiters()) {
+            updateState(NeedsUpdate);
+        } else if (m_state != PendingUpdate) {
+            m_state = NeedsUpdate;
+        }
+        break;
+    /* Data removed on the server side. */
+    case IdentityRemoved:
+        updateState(Removed);
+        break;
+    default:
+        break;
+    }
+
+    QList<IdentityImpl *> users = m_users;
+    foreach (IdentityImpl *user, users)
+        user->infoUpdated(state);
+}
+
+void RemoteIdentity::remoteObjectDestroyed()
+{
+    TRACE();
+    m_dbusProxy.setObjectPath(QDBusObjectPath());
+    updateState(NeedsRegistration);
+}
@@ -0,0 +1,142 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+#ifndef SIGNON_REMOTE_IDENTITY_H
+#define SIGNON_REMOTE_IDENTITY_H
+
+#include <QList>
+#include <QObject>
+#include <QVariantMap>
+
+#include "async-dbus-proxy.h"
+
+class QDBusPendingCallWatcher;
+
+/*
+ * @cond IMPL
+ */
+namespace SignOn {
+
+class IdentityImpl;
+class IdentityInfo;
+
+/*!
+ * @class RemoteIdentity
+ * The signond Identity object, shared by all the IdentityImpl instances of
+ * a thread which refer to the same stored identity: it holds the D-Bus
+ * proxy with its registration and signal subscriptions, and the cached
+ * IdentityInfo. The users are told about the changes of the remote object.
+ *
+ * Identities which have not been stored yet get an unshared instance,
+ * which joins the registry of its thread when the identity is stored.
+ */
+class RemoteIdentity: public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(RemoteIdentity)
+
+public:
+    enum State {
+        PendingRegistration = 0, /* Ongoing registration */
+        NeedsRegistration,       /* Remote object not created or destroyed */
+        NeedsUpdate,             /* Remote data changed */
+        PendingUpdate,           /* Update in progress */
+        Removed,                 /* Removed from database */
+        Ready,                   /* Ready for querying locally cached data, or
+                                    any remote operation */
+        LastState
+    };
+
+    /*!
+     * Returns the instance for the identity @a id, creating it if needed,
+     * and adds @a user to its users.
+     */
+    static RemoteIdentity *acquire(IdentityImpl *user, quint32 id);
+
+    /*!
+     * Removes @a user from the users; the instance is destroyed with its
+     * last user.
+     */
+    void release(IdentityImpl *user);
+
+    quint32 id() const;
+    void setId(quint32 id);
+
+    IdentityInfo *info() const { return m_info; }
+    AsyncDBusProxy *proxy() { return &m_dbusProxy; }
+
+    State state() const { return m_state; }
+    void updateState(State state);
+
+    /*!
+     * Refreshes the cached IdentityInfo, unless an update is in progress.
+     * The refresh fails if it doesn't complete within @a timeout
+     * milliseconds (if positive).
+     */
+    void updateContents(int timeout = -1);
+
+    /*!
+     * Records that @a user has a call waiting for the registration, so that
+     * it is told if the registration fails.
+     */
+    void addRegistrationWaiter(IdentityImpl *user);
+
+private Q_SLOTS:
+    bool sendRegisterRequest();
+    void registerReply(QDBusPendingCallWatcher *call);
+    void getInfoReply(QDBusPendingCallWatcher *call);
+    void registerErrorReply(const QDBusError &err);
+    void errorReply(const QDBusError &err);
+    void deleteServiceProxy();
+    void infoUpdated(int state);
+    void remoteObjectDestroyed();
+
+private:
+    RemoteIdentity(quint32 id);
+    ~RemoteIdentity();
+
+    void updateCachedData(const QVariantMap &infoData);
+    bool hasInfoWaiters() const;
+    void notifyInfoReady();
+    void notifyError(QList<IdentityImpl *> users, const QDBusError &err);
+
+private:
+    IdentityInfo *m_info;
+    SignondAsyncDBusProxy m_dbusProxy;
+    State m_state;
+    /* Set while the registration call is pending; the state can move on
+     * meanwhile, if a getInfo call is queued */
+    bool m_registering;
+    QList<IdentityImpl *> m_users;
+    /* The users having calls queued while the registration is pending */
+    QList<IdentityImpl *> m_registrationWaiters;
+};
+
+} //SignOn
+
+/*
+ * @endcond IMPL
+ */
+
+#endif // SIGNON_REMOTE_IDENTITY_H
@@ -60,6 +60,14 @@ namespace SignOn {
  */
 #define SSO_ACCESS_CONTROL_TOKENS QLatin1String("AccessControlTokens")
 
+/*!
+ * Property which a plugin can set in its result to tell for how many seconds
+ * the result can be given again, without invoking the plugin, to identical
+ * requests which do not allow user interaction.
+ * @note to be used by the plugins developers only.
+ */
+#define SSO_RESULT_CACHE_TTL QLatin1String("ResultCacheTtl")
+
 /*!
  * @enum SignonUiPolicy
  * Policy to define how the plugin interacts with the user.
@@ -29,9 +29,28 @@
 #include <QDebug>
 
 #include "SignOn/signonplugincommon.h"
+#include "SignOn/ipc.h"
+
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+}
 
 #define SIGNON_IPC_BUFFER_PAGE_SIZE 16384
 
+/* memfd_create() and file sealing are only available on recent Linux/glibc;
+ * elsewhere BLOBs are always paged through the write channel. */
+#if defined(__linux__) && defined(MFD_ALLOW_SEALING) && defined(F_ADD_SEALS)
+#define SIGNON_HAS_SEALED_MEMFD
+#define SIGNON_MEMFD_SEALS \
+    (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+#endif
+
 using namespace SignOn;
 
 BlobIOHandler::BlobIOHandler(QIODevice *readChannel,
@@ -41,7 +60,8 @@ BlobIOHandler::BlobIOHandler(QIODevice *readChannel,
     m_readChannel(readChannel),
     m_writeChannel(writeChannel),
     m_readNotifier(0),
-    m_blobSize(-1)
+    m_blobSize(-1),
+    m_sharedMemoryChannel(-1)
 {
 }
 
@@ -53,6 +73,15 @@ void BlobIOHandler::setReadChannelSocketNotifier(QSocketNotifier *notifier)
     m_readNotifier = notifier;
 }
 
+void BlobIOHandler::setSharedMemoryChannel(int socketFd)
+{
+#ifdef SIGNON_HAS_SEALED_MEMFD
+    m_sharedMemoryChannel = socketFd;
+#else
+    Q_UNUSED(socketFd);
+#endif
+}
+
 bool BlobIOHandler::sendData(const QVariantMap &map)
 {
     if (m_writeChannel == 0) {
@@ -62,6 +91,14 @@ bool BlobIOHandler::sendData(const QVariantMap &map)
 
     QDataStream stream(m_writeChannel);
     QByteArray ba = variantMapToByteArray(map);
+
+    if (ba.size() > SIGNON_IPC_BUFFER_PAGE_SIZE &&
+        m_sharedMemoryChannel >= 0 &&
+        sendSharedMemory(ba)) {
+        stream << (int)PLUGIN_BLOB_SHARED_MEMORY;
+        return true;
+    }
+
     stream << ba.size();
 
     QVector<QByteArray> pages = pageByteArray(ba);
@@ -94,8 +131,158 @@ void BlobIOHandler::setReadNotificationEnabled(bool enabled)
     }
 }
 
+bool BlobIOHandler::sendSharedMemory(const QByteArray &array)
+{
+#ifdef SIGNON_HAS_SEALED_MEMFD
+    int fd = memfd_create("signon-blob", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        BLAME() << "memfd_create failed:" << strerror(errno);
+        return false;
+    }
+
+    const char *data = array.constData();
+    qint64 left = array.size();
+    while (left > 0) {
+        ssize_t written = ::write(fd, data, left);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            BLAME() << "Writing BLOB to memfd failed:" << strerror(errno);
+            ::close(fd);
+            return false;
+        }
+        data += written;
+        left -= written;
+    }
+
+    /* Once sealed, the receiver can map the file without fearing that we
+     * change or truncate it under its feet. */
+    if (fcntl(fd, F_ADD_SEALS, SIGNON_MEMFD_SEALS) != 0) {
+        BLAME() << "Sealing memfd failed:" << strerror(errno);
+        ::close(fd);
+        return false;
+    }
+
+    char dummy = 0;
+    struct iovec iov;
+    iov.iov_base = &dummy;
+    iov.iov_len = sizeof(dummy);
+
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    ssize_t sent;
+    do {
+        sent = ::sendmsg(m_sharedMemoryChannel, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+
+    /* The receiver got its own copy of the descriptor */
+    ::close(fd);
+
+    if (sent != sizeof(dummy)) {
+        BLAME() << "Sending memfd failed:" << strerror(errno);
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(array);
+    return false;
+#endif
+}
+
+void BlobIOHandler::readSharedMemory()
+{
+    int fd = -1;
+
+#ifdef SIGNON_HAS_SEALED_MEMFD
+    char dummy;
+    struct iovec iov;
+    iov.iov_base = &dummy;
+    iov.iov_len = sizeof(dummy);
+
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    /* The descriptor is sent before the marker is written to the data
+     * channel, so it must already be queued: never block here. */
+    ssize_t received;
+    do {
+        received = ::recvmsg(m_sharedMemoryChannel, &msg,
+                             MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+
+    struct cmsghdr *cmsg = received > 0 ? CMSG_FIRSTHDR(&msg) : 0;
+    if (cmsg != 0 &&
+        cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+#endif
+
+    if (fd < 0) {
+        BLAME() << "No memfd received on the shared memory channel.";
+        emit error();
+        return;
+    }
+
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    void *addr = MAP_FAILED;
+#ifdef SIGNON_HAS_SEALED_MEMFD
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (seals & SIGNON_MEMFD_SEALS) != SIGNON_MEMFD_SEALS) {
+        BLAME() << "Received memfd is not sealed; refusing it.";
+    } else if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        BLAME() << "Cannot get size of received memfd.";
+    } else {
+        addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+#endif
+    ::close(fd);
+
+    if (addr == MAP_FAILED) {
+        emit error();
+        return;
+    }
+
+    /* Deserialize straight from the mapping; the QVariantMap makes its own
+     * copies of the data, so the mapping can be released right after. */
+    QByteArray mapped =
+        QByteArray::fromRawData(static_cast<const char *>(addr), st.st_size);
+    QVariantMap sessionDataMap = byteArrayToVariantMap(mapped);
+    mapped.clear();
+    munmap(addr, st.st_size);
+
+    emit dataReceived(sessionDataMap);
+}
+
 void BlobIOHandler::receiveData(int expectedDataSize)
 {
+    if (expectedDataSize == PLUGIN_BLOB_SHARED_MEMORY) {
+        readSharedMemory();
+        return;
+    }
+
     m_blobBuffer.clear();
     m_blobSize = expectedDataSize;
 
@@ -111,26 +298,32 @@ void BlobIOHandler::readBlob()
 {
     QDataStream in(m_readChannel);
 
-    QByteArray fractionBa;
-    in >> fractionBa;
-    m_blobBuffer.append(fractionBa);
+    do {
+        QByteArray fractionBa;
+        in >> fractionBa;
+        m_blobBuffer.append(fractionBa);
 
-    //Avoid infinite loops if the other party behaves badly
-    if ((fractionBa.size() == 0) && (m_blobBuffer.size() < m_blobSize)) {
-        setReadNotificationEnabled(false);
-        emit error();
-        return;
-    }
+        //Avoid infinite loops if the other party behaves badly
+        if ((fractionBa.size() == 0) && (m_blobBuffer.size() < m_blobSize)) {
+            setReadNotificationEnabled(false);
+            emit error();
+            return;
+        }
 
-    if (m_blobBuffer.size() == m_blobSize) {
-        QVariantMap sessionDataMap;
-        sessionDataMap = byteArrayToVariantMap(m_blobBuffer);
+        if (m_blobBuffer.size() == m_blobSize) {
+            QVariantMap sessionDataMap;
+            sessionDataMap = byteArrayToVariantMap(m_blobBuffer);
 
-        if (m_blobSize > SIGNON_IPC_BUFFER_PAGE_SIZE)
-            setReadNotificationEnabled(false);
+            if (m_blobSize > SIGNON_IPC_BUFFER_PAGE_SIZE)
+                setReadNotificationEnabled(false);
 
-        emit dataReceived(sessionDataMap);
-    }
+            emit dataReceived(sessionDataMap);
+            return;
+        }
+
+        /* Channels notifying through readyRead() may have buffered more than
+         * one page at once, and won't notify again for those. */
+    } while (m_readNotifier == 0 && m_readChannel->bytesAvailable() > 0);
 }
 
 QVariantMap expandDBusArgumentValue(const QVariant &value, bool *success)
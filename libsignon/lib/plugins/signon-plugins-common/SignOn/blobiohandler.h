@@ -29,12 +29,16 @@
 #include <QVariantMap>
 #include <QSocketNotifier>
 
+class TestBlobIOHandlerBench;
+
 namespace SignOn {
 
 class BlobIOHandler: public QObject
 {
     Q_OBJECT
 
+    friend class ::TestBlobIOHandlerBench;
+
 public:
     BlobIOHandler(QIODevice *inputChannel,
                   QIODevice *outputChannel,
@@ -46,6 +50,15 @@ public:
 
     void setReadChannelSocketNotifier(QSocketNotifier *notifier);
 
+    /*!
+     * Sets the Unix domain socket used to pass file descriptors to/from the
+     * other party. When set, BLOBs bigger than one IPC page are written once
+     * into a sealed memory file whose descriptor is sent over this socket,
+     * instead of being paged through the write channel.
+     * @param socketFd connected AF_UNIX socket, or -1 to disable.
+     */
+    void setSharedMemoryChannel(int socketFd);
+
 public Q_SLOTS:
     void readBlob();
 
@@ -55,6 +68,8 @@ Q_SIGNALS:
 
 private:
     void setReadNotificationEnabled(bool enable);
+    bool sendSharedMemory(const QByteArray &array);
+    void readSharedMemory();
 
     QByteArray variantMapToByteArray(const QVariantMap &map);
     QVariantMap byteArrayToVariantMap(const QByteArray &array);
@@ -66,6 +81,7 @@ public:
     QByteArray m_blobBuffer;
     QSocketNotifier *m_readNotifier;
     int m_blobSize;
+    int m_sharedMemoryChannel;
 };
 
 }
@@ -48,4 +48,22 @@ enum PluginResponse {
     PLUGIN_RESPONSE_LAST
 };
 
+/* Sent in place of the BLOB size when the BLOB is transferred as a sealed
+ * memory file over the shared memory channel. */
+#define PLUGIN_BLOB_SHARED_MEMORY (-2)
+
+/* Environment variable telling the plugin process which inherited file
+ * descriptor is its end of the IPC socket; without it, the standard input
+ * and output are used. */
+#define PLUGIN_IPC_FD_ENV "SSO_PLUGIN_IPC_FD"
+
+/* Environment variable telling the plugin process which inherited file
+ * descriptor is its end of the shared memory channel. */
+#define PLUGIN_SHARED_MEMORY_FD_ENV "SSO_PLUGIN_SHM_FD"
+
+/* Environment variable telling the plugin process which inherited file
+ * descriptor is its end of the cancel channel; only PLUGIN_OP_CANCEL is sent
+ * there, so that it reaches the plugin while the main channel is busy. */
+#define PLUGIN_CANCEL_FD_ENV "SSO_PLUGIN_CANCEL_FD"
+
 #endif // SIGNON_PLUGINS_COMMON_IPC_H
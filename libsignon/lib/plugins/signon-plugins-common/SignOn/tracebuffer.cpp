@@ -0,0 +1,201 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+#include "tracebuffer.h"
+
+#include <QAtomicInt>
+#include <QFile>
+#include <QHash>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace SignOn;
+
+namespace {
+
+TraceEvent traceEvents[TraceBuffer::Capacity];
+QAtomicInt traceHead;
+
+/* Stored as a plain C string, to be usable from a signal handler */
+char traceDumpFile[256];
+
+const char *traceEventNames[TraceEventCount] = {
+    "invalid",
+    "session-queued",
+    "session-cache-hit",
+    "session-coalesced",
+    "session-started",
+    "session-result",
+    "session-error",
+    "plugin-spawned",
+    "plugin-sent",
+    "plugin-received",
+    "remote-operation",
+    "remote-response",
+};
+
+bool writeAll(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+void fillHeader(TraceDumpHeader &header)
+{
+    memcpy(header.magic, "SSOTRACE", sizeof(header.magic));
+    header.version = TraceBuffer::DumpVersion;
+    header.pid = getpid();
+    header.capacity = TraceBuffer::Capacity;
+    header.eventSize = sizeof(TraceEvent);
+}
+
+void dumpSignalHandler(int signal)
+{
+    Q_UNUSED(signal);
+    int savedErrno = errno;
+    TraceBuffer::dump();
+    errno = savedErrno;
+}
+
+} // namespace
+
+void TraceBuffer::record(TraceEventId id, quint32 requestId,
+                         quint64 arg0, quint64 arg1)
+{
+    quint32 sequence = quint32(traceHead.fetchAndAddRelaxed(1)) + 1;
+    TraceEvent &event = traceEvents[(sequence - 1) & (Capacity - 1)];
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    /* A reader seeing a sequence number which is 0, or which doesn't match
+     * the position, discards the event */
+    event.sequence = 0;
+    __sync_synchronize();
+    event.eventId = id;
+    event.timestamp = quint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    event.requestId = requestId;
+    event.reserved = 0;
+    event.args[0] = arg0;
+    event.args[1] = arg1;
+    __sync_synchronize();
+    event.sequence = sequence;
+}
+
+quint32 TraceBuffer::requestId(const QString &key)
+{
+    return qHash(key);
+}
+
+void TraceBuffer::setDumpFile(const QString &path)
+{
+    QByteArray encoded = QFile::encodeName(path);
+    qstrncpy(traceDumpFile, encoded.constData(), sizeof(traceDumpFile));
+}
+
+QString TraceBuffer::dumpFile()
+{
+    return QFile::decodeName(traceDumpFile);
+}
+
+void TraceBuffer::initialize(const QString &name)
+{
+    if (traceDumpFile[0] != '\0') return;
+
+    /* The temporary directory is shared with other users, who could
+     * pre-create the file or a link with the same name: without a private
+     * runtime directory, dumps are disabled unless setDumpFile() is
+     * called. */
+    QString dir = QFile::decodeName(qgetenv("XDG_RUNTIME_DIR"));
+    if (dir.isEmpty())
+        return;
+    setDumpFile(QString::fromLatin1("%1/signon-trace-%2-%3")
+                .arg(dir).arg(name).arg(getpid()));
+}
+
+bool TraceBuffer::dump()
+{
+    if (traceDumpFile[0] == '\0') return false;
+
+    int fd = ::open(traceDumpFile,
+                    O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+                    0600);
+    if (fd < 0) return false;
+
+    bool ok = writeTo(fd);
+    ::close(fd);
+    return ok;
+}
+
+bool TraceBuffer::writeTo(int fd)
+{
+    TraceDumpHeader header;
+    fillHeader(header);
+
+    return writeAll(fd, reinterpret_cast<const char *>(&header),
+                    sizeof(header)) &&
+        writeAll(fd, reinterpret_cast<const char *>(traceEvents),
+                 sizeof(traceEvents));
+}
+
+QByteArray TraceBuffer::toByteArray()
+{
+    TraceDumpHeader header;
+    fillHeader(header);
+
+    QByteArray data(reinterpret_cast<const char *>(&header), sizeof(header));
+    data.append(reinterpret_cast<const char *>(traceEvents),
+                sizeof(traceEvents));
+    return data;
+}
+
+void TraceBuffer::installSignalHandler()
+{
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = dumpSignalHandler;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_RESTART;
+
+    sigaction(SIGUSR1, &act, 0);
+}
+
+const char *TraceBuffer::eventName(quint32 id)
+{
+    if (id >= TraceEventCount) return "unknown";
+    return traceEventNames[id];
+}
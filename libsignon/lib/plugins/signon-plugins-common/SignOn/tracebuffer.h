@@ -0,0 +1,136 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+#ifndef SIGNON_TRACEBUFFER_H
+#define SIGNON_TRACEBUFFER_H
+
+#include <QByteArray>
+#include <QString>
+
+namespace SignOn {
+
+/*!
+ * Identifiers of the events recorded in the TraceBuffer; the meaning of the
+ * two arguments is documented next to each of them. Append new ones at the
+ * end, as dumps store the numeric values.
+ */
+enum TraceEventId {
+    TraceInvalid = 0,
+    /* signond */
+    TraceSessionQueued,         /* identity ID, queue length */
+    TraceSessionCacheHit,       /* identity ID */
+    TraceSessionCoalesced,      /* identity ID */
+    TraceSessionStarted,        /* identity ID, queue length */
+    TraceSessionResult,         /* identity ID */
+    TraceSessionError,          /* identity ID, error code */
+    TracePluginSpawned,         /* spawn time in microseconds */
+    TracePluginSent,            /* operation code */
+    TracePluginReceived,        /* response code, round-trip microseconds */
+    /* signonpluginprocess */
+    TraceRemoteOperation,       /* operation code */
+    TraceRemoteResponse,        /* response code */
+    TraceEventCount
+};
+
+/*!
+ * A fixed-size binary trace event. @a sequence is 1 for the first event
+ * recorded in the process and grows by one with each event; it's 0 while
+ * the event is being written.
+ */
+struct TraceEvent {
+    quint32 sequence;
+    quint32 eventId;
+    quint64 timestamp;          /* CLOCK_MONOTONIC, in nanoseconds */
+    quint32 requestId;
+    quint32 reserved;
+    quint64 args[2];
+};
+
+/*!
+ * Header of a trace dump; it is followed by TraceBuffer::Capacity events,
+ * in native byte order.
+ */
+struct TraceDumpHeader {
+    char magic[8];              /* "SSOTRACE" */
+    quint32 version;
+    quint32 pid;
+    quint32 capacity;
+    quint32 eventSize;
+};
+
+/*!
+ * @class TraceBuffer
+ * Per-process ring buffer of the most recent TraceEvent records.
+ *
+ * Recording an event takes an atomic increment and a few stores, with no
+ * locking and no formatting, so it can be left on in production. The
+ * buffer is dumped on demand with dump(), which only uses
+ * async-signal-safe calls and can therefore run from a signal handler;
+ * signon-trace-decode turns dumps into text.
+ */
+class TraceBuffer
+{
+public:
+    enum {
+        Capacity = 4096,        /* must be a power of two */
+        DumpVersion = 1
+    };
+
+    static void record(TraceEventId id, quint32 requestId,
+                       quint64 arg0 = 0, quint64 arg1 = 0);
+
+    /*!
+     * Derives a request ID from a key identifying the request.
+     */
+    static quint32 requestId(const QString &key);
+
+    /*!
+     * Sets the file where dump() writes; the default is
+     * "signon-trace-<name>-<pid>" in $XDG_RUNTIME_DIR. If that is not set,
+     * there is no default and dump() fails.
+     */
+    static void setDumpFile(const QString &path);
+    static QString dumpFile();
+    static void initialize(const QString &name);
+
+    /*!
+     * Writes the buffer to the dump file, replacing it; symbolic links
+     * are not followed.
+     */
+    static bool dump();
+    static bool writeTo(int fd);
+    static QByteArray toByteArray();
+
+    /*!
+     * Makes SIGUSR1 dump the buffer. Only for processes which don't handle
+     * UNIX signals in their event loop.
+     */
+    static void installSignalHandler();
+
+    static const char *eventName(quint32 id);
+};
+
+} //namespace SignOn
+
+#endif // SIGNON_TRACEBUFFER_H
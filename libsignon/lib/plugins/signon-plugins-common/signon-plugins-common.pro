@@ -13,10 +13,12 @@ INCLUDEPATH += ../
 DEFINES += SIGNON_PLUGIN_TRACE
 
 SOURCES += \
-    SignOn/blobiohandler.cpp
+    SignOn/blobiohandler.cpp \
+    SignOn/tracebuffer.cpp
 HEADERS += \
     SignOn/blobiohandler.h \
-    SignOn/ipc.h
+    SignOn/ipc.h \
+    SignOn/tracebuffer.h
 
 headers.files = \
     SignOn/blobiohandler.h
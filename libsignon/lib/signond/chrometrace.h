@@ -0,0 +1,172 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef SIGNON_CHROMETRACE_H
+#define SIGNON_CHROMETRACE_H
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QString>
+
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace SignOn {
+
+/*!
+ * @class ChromeTrace
+ * Writes the spans of traced authentication requests in the Chrome
+ * trace-event format; this is an internal, header-only helper shared by
+ * libsignon-qt, signond and the plugin processes.
+ *
+ * Tracing is enabled by setting the SSO_TRACE_DIR environment variable to
+ * an existing directory: each process then appends its events to
+ * "signon-<pid>.json" in there. The files are JSON arrays without the
+ * closing bracket; "signon-trace-decode --chrome" merges them into a
+ * single file which can be loaded into chrome://tracing or Perfetto.
+ *
+ * Spans are nestable async events whose global id is the request's
+ * correlation id (see SIGNOND_SESSION_TRACE_ID), so that the spans
+ * recorded for a request by all the processes are shown on one track.
+ * Timestamps are taken from CLOCK_MONOTONIC, which is shared by all the
+ * processes of the machine.
+ */
+class ChromeTrace
+{
+public:
+    /*!
+     * @returns whether tracing is enabled in this process.
+     */
+    static bool isEnabled() { return state().file != 0; }
+
+    /*!
+     * @returns the current time in microseconds, suitable for span().
+     */
+    static qint64 now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return qint64(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    /*!
+     * @returns a new correlation id, unique on this machine.
+     */
+    static QString newTraceId()
+    {
+        State &s = state();
+        QMutexLocker locker(&s.mutex);
+        return QString::fromLatin1("%1-%2-%3")
+            .arg(getpid(), 0, 16)
+            .arg(now(), 0, 16)
+            .arg(++s.lastId, 0, 16);
+    }
+
+    /*!
+     * Records a span of the request @a traceId called @a name, started at
+     * @a start (as returned by now()) and ending now. Does nothing if
+     * tracing is disabled or @a traceId is empty.
+     */
+    static void span(const QString &traceId, const char *name, qint64 start)
+    {
+        State &s = state();
+        if (s.file == 0 || traceId.isEmpty()) return;
+
+        qint64 end = now();
+        QByteArray id = escape(traceId.toLatin1());
+        QByteArray tid = QByteArray::number(qint64(syscall(SYS_gettid)));
+        QByteArray common = "\"cat\":\"signon\",\"name\":\"" +
+            escape(QByteArray(name)) + "\",\"id2\":{\"global\":\"" + id +
+            "\"},\"pid\":" + s.pid + ",\"tid\":" + tid + ",\"ts\":";
+
+        QByteArray events =
+            "{\"ph\":\"b\"," + common + QByteArray::number(start) +
+            ",\"args\":{\"traceId\":\"" + id + "\"}},\n"
+            "{\"ph\":\"e\"," + common + QByteArray::number(end) + "},\n";
+
+        QMutexLocker locker(&s.mutex);
+        fwrite(events.constData(), 1, events.size(), s.file);
+        fflush(s.file);
+    }
+
+private:
+    struct State {
+        State(): file(0), lastId(0)
+        {
+            QByteArray dir = qgetenv("SSO_TRACE_DIR");
+            if (dir.isEmpty()) return;
+
+            pid = QByteArray::number(qint64(getpid()));
+            QByteArray path = dir + "/signon-" + pid + ".json";
+            file = fopen(path.constData(), "a");
+            if (file == 0) return;
+
+            QByteArray process;
+            if (QCoreApplication::instance() != 0)
+                process = QFileInfo(QCoreApplication::applicationFilePath())
+                    .fileName().toLatin1();
+            if (process.isEmpty())
+                process = "pid " + pid;
+
+            fseek(file, 0, SEEK_END);
+            QByteArray header = ftell(file) == 0 ? "[\n" : "";
+            header += "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" +
+                pid + ",\"args\":{\"name\":\"" + escape(process) + "\"}},\n";
+            fwrite(header.constData(), 1, header.size(), file);
+            fflush(file);
+        }
+        ~State() { if (file != 0) fclose(file); }
+
+        QMutex mutex;
+        FILE *file;
+        QByteArray pid;
+        quint32 lastId;
+    };
+
+    static State &state()
+    {
+        static State s;
+        return s;
+    }
+
+    static QByteArray escape(const QByteArray &text)
+    {
+        QByteArray result;
+        result.reserve(text.size());
+        for (int i = 0; i < text.size(); i++) {
+            char c = text.at(i);
+            if (c == '"' || c == '\\') result += '\\';
+            if (uchar(c) >= 0x20) result += c;
+        }
+        return result;
+    }
+};
+
+} // namespace SignOn
+
+#endif // SIGNON_CHROMETRACE_H
@@ -58,6 +58,15 @@
 
 #define SIGNOND_DAEMON_OBJECTPATH \
     SIGNOND_STRING("/com/google/code/AccountsSSO/SingleSignOn")
+/* Prefix of the object paths of the authentication sessions */
+#define SIGNOND_AUTH_SESSION_OBJECTPATH_PREFIX \
+    SIGNOND_STRING("/com/google/code/AccountsSSO/SingleSignOn/AuthSession_")
+/* Prefix of the object paths chosen by the clients for the authentication
+ * sessions created by processWithIdentity(); it must be followed by a UUID
+ * in hexadecimal digits */
+#define SIGNOND_CLIENT_AUTH_SESSION_OBJECTPATH_PREFIX \
+    SIGNOND_STRING("/com/google/code/AccountsSSO/SingleSignOn/" \
+                   "ClientAuthSession_")
 #define SIGNOND_DAEMON_INTERFACE_C        SIGNOND_SERVICE_PREFIX ".AuthService"
 #define SIGNOND_IDENTITY_INTERFACE_C      SIGNOND_SERVICE_PREFIX ".Identity"
 #define SIGNOND_AUTH_SESSION_INTERFACE_C  SIGNOND_SERVICE_PREFIX ".AuthSession"
@@ -88,6 +97,26 @@
 #define SIGNOND_IDENTITY_INFO_USERNAME_IS_SECRET \
     SIGNOND_STRING("UserNameSecret")
 
+/*
+ * Session data key carrying the correlation id of a traced request; it is
+ * added by the client when SSO_TRACE_DIR is set and never reaches plugins.
+ * */
+#define SIGNOND_SESSION_TRACE_ID SIGNOND_STRING("_SignonTraceId")
+
+/*
+ * Session data key carrying the TraceBuffer request ID of the request being
+ * processed, so that the plugin process records its events under the same
+ * ID as signond; it is added by signond and never reaches plugins.
+ * */
+#define SIGNOND_SESSION_REQUEST_ID SIGNOND_STRING("_SignonRequestId")
+
+/*
+ * Session data key carrying the time (in milliseconds) left to the client's
+ * deadline when the request was sent; requests which are still waiting when
+ * it expires are dropped by signond. It never reaches plugins.
+ * */
+#define SIGNOND_SESSION_TIMEOUT SIGNOND_STRING("_SignonTimeout")
+
 /*
  * Common server/client sides error names and messages
  * */
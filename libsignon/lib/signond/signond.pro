@@ -9,7 +9,10 @@ SUBDIRS = SignOn
 public_headers += \
     signoncommon.h
 
-HEADERS = $$public_headers
+private_headers += \
+    chrometrace.h
+
+HEADERS = $$public_headers $$private_headers
 
 INCLUDEPATH += . \
     $$TOP_SRC_DIR/include
@@ -19,7 +22,8 @@ DEFINES += QT_NO_CAST_TO_ASCII QT_NO_CAST_FROM_ASCII
 OTHER_FILES = \
     com.google.code.AccountsSSO.SingleSignOn.AuthService.xml \
     com.google.code.AccountsSSO.SingleSignOn.AuthSession.xml \
-    com.google.code.AccountsSSO.SingleSignOn.Identity.xml
+    com.google.code.AccountsSSO.SingleSignOn.Identity.xml \
+    com.google.code.AccountsSSO.SingleSignOn.Metrics.xml
 
 headers.files = $$public_headers
 headers.path = $${INSTALL_PREFIX}/include/signond
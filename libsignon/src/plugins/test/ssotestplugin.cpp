@@ -20,6 +20,7 @@
  * 02110-1301 USA
  */
 
+#include <QDateTime>
 #include <QMutex>
 #include <QMutexLocker>
 #include <unistd.h>
@@ -85,8 +86,15 @@ void SsoTestPlugin::execProcess(const SignOn::SessionData &inData,
 {
     SignOn::SessionData outData(inData);
     outData.setRealm("testRealm_after_test");
-
-    for (int i = 0; i < 10; i++)
+    /* Lets the tests tell whether requests were processed in parallel */
+    outData.setProperty(QLatin1String("ProcessStarted"),
+                        QDateTime::currentMSecsSinceEpoch());
+
+    /* The benchmarks set "NoDelay" to measure the IPC only, without the
+     * status updates and the time spent waiting between them */
+    int steps = inData.getProperty(QLatin1String("NoDelay")).toBool() ?
+        0 : 10;
+    for (int i = 0; i < steps; i++)
         if (!is_canceled) {
             TRACE() << "Signal is sent";
             emit statusChanged(PLUGIN_STATE_WAITING,
@@ -103,6 +111,9 @@ void SsoTestPlugin::execProcess(const SignOn::SessionData &inData,
         return;
     }
 
+    outData.setProperty(QLatin1String("ProcessFinished"),
+                        QDateTime::currentMSecsSinceEpoch());
+
     if (mechanism == QLatin1String("BLOB")) {
         emit result(outData);
         return;
@@ -36,6 +36,8 @@ extern "C" {
 #include "debug.h"
 #include "remotepluginprocess.h"
 
+#include "SignOn/tracebuffer.h"
+
 #include <QDebug>
 
 using namespace RemotePluginProcessNS;
@@ -86,6 +88,9 @@ int main(int argc, char *argv[])
 
     QString type = app.arguments().at(1); TRACE() << type;
 
+    SignOn::TraceBuffer::initialize(QLatin1String("plugin-") + type);
+    SignOn::TraceBuffer::installSignalHandler();
+
     fcntl(fileno(stdin), F_SETFL, fcntl(fileno(stdin), F_GETFL, 0) | O_NONBLOCK);
 
     process = RemotePluginProcess::createRemotePluginProcess(type, &app);
@@ -93,8 +98,7 @@ int main(int argc, char *argv[])
     if (!process)
         return 1;
 
-    fprintf(stdout, "process started");
-    fflush(stdout);
+    process->notifyStarted();
 
     QObject::connect(process, SIGNAL(processStopped()), &app, SLOT(quit()));
     int ret = app.exec();
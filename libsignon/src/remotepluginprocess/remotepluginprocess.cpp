@@ -24,6 +24,7 @@
 #include <QTimer>
 #include <QBuffer>
 #include <QDataStream>
+#include <errno.h>
 #include <unistd.h>
 
 #include "debug.h"
@@ -31,10 +32,13 @@
 #include "my-network-proxy-factory.h"
 #endif
 #include "remotepluginprocess.h"
+#include "signond/chrometrace.h"
+#include "signond/signoncommon.h"
 
 // signon-plugins-common
 #include "SignOn/blobiohandler.h"
 #include "SignOn/ipc.h"
+#include "SignOn/tracebuffer.h"
 
 using namespace SignOn;
 
@@ -50,6 +54,9 @@ RemotePluginProcess::RemotePluginProcess(QObject *parent):
     m_plugin = NULL;
     m_readnotifier = NULL;
     m_errnotifier = NULL;
+    m_traceName = 0;
+    m_traceStart = 0;
+    m_traceRequestId = 0;
 
     qRegisterMetaType<SignOn::SessionData>("SignOn::SessionData");
     qRegisterMetaType<QString>("QString");
@@ -57,15 +64,17 @@ RemotePluginProcess::RemotePluginProcess(QObject *parent):
 
 RemotePluginProcess::~RemotePluginProcess()
 {
-    delete m_plugin;
-    delete m_readnotifier;
-    delete m_errnotifier;
-
+    /* Stop the cancel thread first, as it uses the plugin */
     if (cancelThread) {
         cancelThread->quit();
         cancelThread->wait();
         delete cancelThread;
+        cancelThread = NULL;
     }
+
+    delete m_plugin;
+    delete m_readnotifier;
+    delete m_errnotifier;
 }
 
 RemotePluginProcess *
@@ -148,21 +157,37 @@ bool RemotePluginProcess::setupDataStreams()
 {
     TRACE();
 
-    m_inFile.open(STDIN_FILENO, QIODevice::ReadOnly);
-    m_outFile.open(STDOUT_FILENO, QIODevice::WriteOnly);
+    /* signond hands us one end of a socket pair; older daemons talk to us
+     * through the standard input and output. */
+    int inChannel = STDIN_FILENO;
+    int outChannel = STDOUT_FILENO;
+    bool ok = false;
+    int ipcChannel = qgetenv(PLUGIN_IPC_FD_ENV).toInt(&ok);
+    if (ok && ipcChannel >= 0) {
+        inChannel = ipcChannel;
+        outChannel = ipcChannel;
+    }
+
+    m_inFile.open(inChannel, QIODevice::ReadOnly);
+    m_outFile.open(outChannel, QIODevice::WriteOnly);
 
-    m_readnotifier = new QSocketNotifier(STDIN_FILENO, QSocketNotifier::Read);
-    m_errnotifier = new QSocketNotifier(STDIN_FILENO,
+    m_readnotifier = new QSocketNotifier(inChannel, QSocketNotifier::Read);
+    m_errnotifier = new QSocketNotifier(inChannel,
                                         QSocketNotifier::Exception);
 
     connect(m_readnotifier, SIGNAL(activated(int)), this, SLOT(startTask()));
     connect(m_errnotifier, SIGNAL(activated(int)),
             this, SIGNAL(processStopped()));
 
-    if (!cancelThread)
-        cancelThread = new CancelEventThread(m_plugin);
-
-    TRACE() << "cancel thread created";
+    /* Cancel requests have their own channel, so that they can be read
+     * while the main thread is blocked in the plugin; without it, they are
+     * handled by startTask() like any other operation. */
+    int cancelChannel = qgetenv(PLUGIN_CANCEL_FD_ENV).toInt(&ok);
+    if (ok && cancelChannel >= 0 && !cancelThread) {
+        cancelThread = new CancelEventThread(m_plugin, cancelChannel);
+        cancelThread->start();
+        TRACE() << "cancel thread created";
+    }
 
     m_blobIOHandler = new BlobIOHandler(&m_inFile, &m_outFile, this);
 
@@ -178,9 +203,22 @@ bool RemotePluginProcess::setupDataStreams()
 
     m_blobIOHandler->setReadChannelSocketNotifier(m_readnotifier);
 
+    /* signond hands us a socket for exchanging large BLOBs as sealed memory
+     * files; if it's missing, BLOBs are paged through the IPC channel. */
+    int sharedMemoryChannel =
+        qgetenv(PLUGIN_SHARED_MEMORY_FD_ENV).toInt(&ok);
+    if (ok && sharedMemoryChannel >= 0)
+        m_blobIOHandler->setSharedMemoryChannel(sharedMemoryChannel);
+
     return true;
 }
 
+void RemotePluginProcess::notifyStarted()
+{
+    m_outFile.write("process started");
+    m_outFile.flush();
+}
+
 bool RemotePluginProcess::setupProxySettings()
 {
     TRACE();
@@ -204,9 +242,18 @@ void RemotePluginProcess::blobIOError()
     connect(m_readnotifier, SIGNAL(activated(int)), this, SLOT(startTask()));
 }
 
+void RemotePluginProcess::traceOperationDone()
+{
+    if (m_traceId.isEmpty()) return;
+
+    ChromeTrace::span(m_traceId, m_traceName, m_traceStart);
+    m_traceId.clear();
+}
+
 void RemotePluginProcess::result(const SignOn::SessionData &data)
 {
     disableCancelThread();
+    traceOperationDone();
     QDataStream out(&m_outFile);
     QVariantMap resultDataMap;
 
@@ -214,6 +261,8 @@ void RemotePluginProcess::result(const SignOn::SessionData &data)
         resultDataMap[key] = data.getProperty(key);
 
     out << (quint32)PLUGIN_RESPONSE_RESULT;
+    TraceBuffer::record(TraceRemoteResponse, m_traceRequestId,
+                        PLUGIN_RESPONSE_RESULT);
 
     m_blobIOHandler->sendData(resultDataMap);
 
@@ -229,6 +278,8 @@ void RemotePluginProcess::store(const SignOn::SessionData &data)
         storeDataMap[key] = data.getProperty(key);
 
     out << (quint32)PLUGIN_RESPONSE_STORE;
+    TraceBuffer::record(TraceRemoteResponse, m_traceRequestId,
+                        PLUGIN_RESPONSE_STORE);
 
     m_blobIOHandler->sendData(storeDataMap);
 
@@ -238,6 +289,7 @@ void RemotePluginProcess::store(const SignOn::SessionData &data)
 void RemotePluginProcess::error(const SignOn::Error &err)
 {
     disableCancelThread();
+    traceOperationDone();
 
     QDataStream out(&m_outFile);
 
@@ -246,13 +298,16 @@ void RemotePluginProcess::error(const SignOn::Error &err)
     out << err.message();
     m_outFile.flush();
 
-    TRACE() << "error is sent" << err.type() << " " << err.message();
+    TraceBuffer::record(TraceRemoteResponse, m_traceRequestId,
+                        PLUGIN_RESPONSE_ERROR, err.type());
 }
 
 void RemotePluginProcess::userActionRequired(const SignOn::UiSessionData &data)
 {
-    TRACE();
+    TraceBuffer::record(TraceRemoteResponse, m_traceRequestId,
+                        PLUGIN_RESPONSE_UI);
     disableCancelThread();
+    traceOperationDone();
 
     QDataStream out(&m_outFile);
     QVariantMap resultDataMap;
@@ -267,8 +322,10 @@ void RemotePluginProcess::userActionRequired(const SignOn::UiSessionData &data)
 
 void RemotePluginProcess::refreshed(const SignOn::UiSessionData &data)
 {
-    TRACE();
+    TraceBuffer::record(TraceRemoteResponse, m_traceRequestId,
+                        PLUGIN_RESPONSE_REFRESHED);
     disableCancelThread();
+    traceOperationDone();
 
     QDataStream out(&m_outFile);
     QVariantMap resultDataMap;
@@ -371,17 +428,28 @@ void RemotePluginProcess::sessionDataReceived(const QVariantMap &sessionDataMap)
     enableCancelThread();
     TRACE() << "The cancel thread is started";
 
+    /* The correlation id is for signon only: don't pass it to the plugin */
+    QVariantMap dataMap = sessionDataMap;
+    m_traceId = dataMap.take(SIGNOND_SESSION_TRACE_ID).toString();
+    m_traceStart = ChromeTrace::now();
+    m_traceRequestId = dataMap.take(SIGNOND_SESSION_REQUEST_ID).toUInt();
+    TraceBuffer::record(TraceRemoteOperation, m_traceRequestId,
+                        m_currentOperation);
+
     if (m_currentOperation == PLUGIN_OP_PROCESS) {
-        SessionData inData(sessionDataMap);
+        m_traceName = "AuthPluginInterface::process";
+        SessionData inData(dataMap);
         m_plugin->process(inData, m_currentMechanism);
         m_currentMechanism.clear();
 
     } else if(m_currentOperation == PLUGIN_OP_PROCESS_UI) {
-        UiSessionData inData(sessionDataMap);
+        m_traceName = "AuthPluginInterface::userActionFinished";
+        UiSessionData inData(dataMap);
         m_plugin->userActionFinished(inData);
 
     } else if(m_currentOperation == PLUGIN_OP_REFRESH) {
-        UiSessionData inData(sessionDataMap);
+        m_traceName = "AuthPluginInterface::refresh";
+        UiSessionData inData(dataMap);
         m_plugin->refresh(inData);
 
     } else {
@@ -396,58 +464,14 @@ void RemotePluginProcess::sessionDataReceived(const QVariantMap &sessionDataMap)
 
 void RemotePluginProcess::enableCancelThread()
 {
-    QEventLoop loop;
-    connect(cancelThread,
-            SIGNAL(started()),
-            &loop,
-            SLOT(quit()));
-
-    m_readnotifier->setEnabled(false);
-    QTimer::singleShot(0.5*1000, &loop, SLOT(quit()));
-    cancelThread->start();
-    loop.exec();
-    QThread::yieldCurrentThread();
+    if (cancelThread)
+        cancelThread->setOperationRunning(true);
 }
 
 void RemotePluginProcess::disableCancelThread()
 {
-    if (!cancelThread->isRunning())
-        return;
-
-    /**
-     * Sort of terrible workaround which
-     * I do not know how to fix: the thread
-     * could hang up during wait up without
-     * these loops and sleeps
-     */
-    cancelThread->quit();
-
-    TRACE() << "Before the isFinished loop ";
-
-    int i = 0;
-    while (!cancelThread->isFinished()) {
-        cancelThread->quit();
-        TRACE() << "Internal iteration " << i++;
-        usleep(0.005 * 1000000);
-    }
-
-    if (!cancelThread->wait(500)) {
-        BLAME() << "Cannot disable cancel thread";
-        int i;
-        for (i = 0; i < 5; i++) {
-            usleep(0.01 * 1000000);
-            if (cancelThread->wait(500))
-                break;
-        }
-
-        if (i == 5) {
-            BLAME() << "Cannot do anything with cancel thread";
-            cancelThread->terminate();
-            cancelThread->wait();
-        }
-    }
-
-    m_readnotifier->setEnabled(true);
+    if (cancelThread)
+        cancelThread->setOperationRunning(false);
 }
 
 void RemotePluginProcess::startTask()
@@ -457,6 +481,12 @@ void RemotePluginProcess::startTask()
 
     QDataStream in(&m_inFile);
     in >> opcode;
+    /* The operations carrying session data are recorded once the data,
+     * which holds their request ID, has been received */
+    if (opcode != PLUGIN_OP_PROCESS &&
+        opcode != PLUGIN_OP_PROCESS_UI &&
+        opcode != PLUGIN_OP_REFRESH)
+        TraceBuffer::record(TraceRemoteOperation, m_traceRequestId, opcode);
 
     switch (opcode) {
     case PLUGIN_OP_CANCEL:
@@ -493,8 +523,6 @@ void RemotePluginProcess::startTask()
         break;
     };
 
-    TRACE() << "operation is completed";
-
     if (!is_stopped) {
         if (!m_outFile.flush())
             is_stopped = true;
@@ -507,29 +535,35 @@ void RemotePluginProcess::startTask()
     }
 }
 
-CancelEventThread::CancelEventThread(AuthPluginInterface *plugin)
+CancelEventThread::CancelEventThread(AuthPluginInterface *plugin,
+                                     int channel)
 {
     m_plugin = plugin;
     m_cancelNotifier = 0;
+    m_channel = channel;
 }
 
 CancelEventThread::~CancelEventThread()
 {
-    delete m_cancelNotifier;
+    ::close(m_channel);
 }
 
 void CancelEventThread::run()
 {
-    if (!m_cancelNotifier) {
-        m_cancelNotifier = new QSocketNotifier(STDIN_FILENO,
-                                               QSocketNotifier::Read);
-        connect(m_cancelNotifier, SIGNAL(activated(int)),
-                this, SLOT(cancel()), Qt::DirectConnection);
-    }
+    /* The notifier must live in this thread */
+    m_cancelNotifier = new QSocketNotifier(m_channel, QSocketNotifier::Read);
+    connect(m_cancelNotifier, SIGNAL(activated(int)),
+            this, SLOT(cancel()), Qt::DirectConnection);
 
-    m_cancelNotifier->setEnabled(true);
     exec();
-    m_cancelNotifier->setEnabled(false);
+
+    delete m_cancelNotifier;
+    m_cancelNotifier = 0;
+}
+
+void CancelEventThread::setOperationRunning(bool running)
+{
+    m_operationRunning.fetchAndStoreOrdered(running ? 1 : 0);
 }
 
 void CancelEventThread::cancel()
@@ -537,9 +571,23 @@ void CancelEventThread::cancel()
     char buf[4];
     memset(buf, 0, 4);
     int n = 0;
+    int received = 0;
+
+    /* This thread is the only reader of the channel */
+    while (received < 4) {
+        n = read(m_channel, buf + received, 4 - received);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        received += n;
+    }
 
-    if (!(n = read(STDIN_FILENO, buf, 4))) {
-        qCritical() << "Cannot read from cancel socket";
+    if (received < 4) {
+        if (n == 0) {
+            TRACE() << "Cancel channel closed";
+        } else {
+            qCritical() << "Cannot read from cancel socket";
+        }
+        m_cancelNotifier->setEnabled(false);
         return;
     }
 
@@ -551,9 +599,18 @@ void CancelEventThread::cancel()
     QDataStream ds(ba);
     ds >> opcode;
 
-    if (opcode != PLUGIN_OP_CANCEL)
-        qCritical() << "wrong operation code: breakage of remotepluginprocess "
-            "threads synchronization: " << opcode;
+    if (opcode != PLUGIN_OP_CANCEL) {
+        qCritical() << "wrong operation code on the cancel channel: "
+            << opcode;
+        return;
+    }
+
+    /* A cancel request crossing the reply must not affect the next
+     * operation */
+    if (m_operationRunning.fetchAndAddOrdered(0) == 0) {
+        TRACE() << "No operation running, ignoring cancel request";
+        return;
+    }
 
     m_plugin->cancel();
 }
@@ -23,6 +23,7 @@
 #ifndef REMOTEPLUGINPROCESS_H
 #define REMOTEPLUGINPROCESS_H
 
+#include <QAtomicInt>
 #include <QCoreApplication>
 #include <QString>
 #include <QStringList>
@@ -68,17 +69,19 @@ namespace RemotePluginProcessNS {
 
 /*!
  * @class CancelEventThread
- * Thread to enable cancel functionality.
+ * Thread to enable cancel functionality: it is the only reader of the cancel
+ * channel, and forwards the requests to the plugin while it is busy.
  */
 class CancelEventThread: public QThread
 {
     Q_OBJECT
 
 public:
-    CancelEventThread(AuthPluginInterface *plugin);
+    CancelEventThread(AuthPluginInterface *plugin, int channel);
     ~CancelEventThread();
 
     void run();
+    void setOperationRunning(bool running);
 
 public Q_SLOTS:
     void cancel();
@@ -86,6 +89,8 @@ public Q_SLOTS:
 private:
     AuthPluginInterface *m_plugin;
     QSocketNotifier *m_cancelNotifier;
+    int m_channel;
+    QAtomicInt m_operationRunning;
 };
 
 /*!
@@ -106,6 +111,7 @@ public:
     bool loadPlugin(QString &type);
     bool setupDataStreams();
     bool setupProxySettings();
+    void notifyStarted();
 
 public Q_SLOTS:
     void startTask();
@@ -126,6 +132,13 @@ private:
     quint32 m_currentOperation;
     QString m_currentMechanism;
 
+    //Correlation id and start time of the traced operation
+    QString m_traceId;
+    const char *m_traceName;
+    qint64 m_traceStart;
+    //TraceBuffer request ID of the current operation
+    quint32 m_traceRequestId;
+
 private:
     QString getPluginName(const QString &type);
     void type();
@@ -138,6 +151,7 @@ private:
 
     void enableCancelThread();
     void disableCancelThread();
+    void traceOperationDone();
 
 private Q_SLOTS:
     void result(const SignOn::SessionData &data);
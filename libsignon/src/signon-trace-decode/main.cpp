@@ -0,0 +1,177 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+/*
+ * Prints the events contained in one or more trace dumps (written by
+ * signond and signonpluginprocess on SIGUSR1, or returned by the
+ * traceBuffer() D-Bus method of signond), merged by timestamp.
+ *
+ * With --chrome, merges instead the Chrome trace-event files written in
+ * SSO_TRACE_DIR by the traced processes into a single JSON array.
+ */
+
+#include "SignOn/tracebuffer.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QList>
+#include <QStringList>
+#include <QtAlgorithms>
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace SignOn;
+
+struct DecodedEvent {
+    quint32 pid;
+    TraceEvent event;
+};
+
+static bool eventLessThan(const DecodedEvent &e1, const DecodedEvent &e2)
+{
+    if (e1.event.timestamp != e2.event.timestamp)
+        return e1.event.timestamp < e2.event.timestamp;
+    return e1.event.sequence < e2.event.sequence;
+}
+
+static bool readDump(const QString &fileName, QList<DecodedEvent> &events)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        fprintf(stderr, "%s: cannot open\n", qPrintable(fileName));
+        return false;
+    }
+
+    QByteArray data = file.readAll();
+    TraceDumpHeader header;
+    if (data.size() < int(sizeof(header))) {
+        fprintf(stderr, "%s: truncated header\n", qPrintable(fileName));
+        return false;
+    }
+    memcpy(&header, data.constData(), sizeof(header));
+
+    if (memcmp(header.magic, "SSOTRACE", sizeof(header.magic)) != 0 ||
+        header.version != TraceBuffer::DumpVersion ||
+        header.eventSize != sizeof(TraceEvent)) {
+        fprintf(stderr, "%s: not a trace dump, or unsupported version\n",
+                qPrintable(fileName));
+        return false;
+    }
+
+    if (data.size() < int(sizeof(header) +
+                          header.capacity * sizeof(TraceEvent))) {
+        fprintf(stderr, "%s: truncated dump\n", qPrintable(fileName));
+        return false;
+    }
+
+    const char *eventData = data.constData() + sizeof(header);
+    for (quint32 i = 0; i < header.capacity; i++) {
+        DecodedEvent decoded;
+        decoded.pid = header.pid;
+        memcpy(&decoded.event, eventData + i * sizeof(TraceEvent),
+               sizeof(TraceEvent));
+
+        /* Skip empty slots, and those which were being written */
+        if (decoded.event.sequence == 0 ||
+            ((decoded.event.sequence - 1) & (header.capacity - 1)) != i)
+            continue;
+
+        events.append(decoded);
+    }
+
+    return true;
+}
+
+static int mergeChromeTraces(const QStringList &files)
+{
+    QByteArray merged = "[\n";
+    foreach (const QString &fileName, files) {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly)) {
+            fprintf(stderr, "%s: cannot open\n", qPrintable(fileName));
+            return 1;
+        }
+
+        /* Each file is an unterminated array: drop the opening bracket and
+         * the trailing comma, so that the events can be joined */
+        QByteArray events = file.readAll().trimmed();
+        if (events.startsWith('['))
+            events = events.mid(1).trimmed();
+        if (events.endsWith(','))
+            events.chop(1);
+        if (events.isEmpty())
+            continue;
+
+        if (merged.size() > 2)
+            merged += ",\n";
+        merged += events;
+    }
+    merged += "\n]\n";
+
+    fwrite(merged.constData(), 1, merged.size(), stdout);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QStringList files = app.arguments().mid(1);
+    bool chrome = !files.isEmpty() &&
+        files.first() == QLatin1String("--chrome");
+    if (chrome)
+        files.removeFirst();
+    if (files.isEmpty()) {
+        fprintf(stderr, "Usage: %s DUMP...\n"
+                "       %s --chrome TRACE.json...\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    if (chrome)
+        return mergeChromeTraces(files);
+
+    QList<DecodedEvent> events;
+    foreach (const QString &fileName, files) {
+        if (!readDump(fileName, events))
+            return 1;
+    }
+
+    qSort(events.begin(), events.end(), eventLessThan);
+
+    foreach (const DecodedEvent &decoded, events) {
+        const TraceEvent &event = decoded.event;
+        printf("%llu.%09llu %u #%u %s request=%08x %llu %llu\n",
+               event.timestamp / 1000000000,
+               event.timestamp % 1000000000,
+               decoded.pid,
+               event.sequence,
+               TraceBuffer::eventName(event.eventId),
+               event.requestId,
+               event.args[0],
+               event.args[1]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,23 @@
+include( ../../common-project-config.pri )
+include( ../../common-vars.pri )
+TEMPLATE = app
+TARGET = signon-trace-decode
+QT += core
+QT -= gui
+
+SOURCES += \
+    main.cpp
+
+INCLUDEPATH += . \
+               $$TOP_SRC_DIR/lib/plugins/signon-plugins-common
+
+QMAKE_LIBDIR += \
+    $${TOP_BUILD_DIR}/lib/plugins/signon-plugins-common
+
+LIBS += \
+    -lsignon-plugins-common
+
+QMAKE_CXXFLAGS += -fno-exceptions \
+                  -fno-rtti
+
+include( ../../common-installs-config.pri )
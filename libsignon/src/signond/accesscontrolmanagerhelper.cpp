@@ -28,6 +28,7 @@
 #include <QBuffer>
 #include <QDBusConnection>
 #include <QDBusConnectionInterface>
+#include <QDBusPendingReply>
 #ifdef ENABLE_P2P
 #include <dbus/dbus.h>
 #endif
@@ -39,6 +40,36 @@
 
 using namespace SignonDaemonNS;
 
+namespace SignonDaemonNS {
+
+/* Drops the cached peer information when a P2P connection goes away */
+class PeerConnectionWatcher: public QObject
+{
+    Q_OBJECT
+
+public:
+    PeerConnectionWatcher(const QString &connectionName,
+                          AccessControlManagerHelper *parent):
+        QObject(parent),
+        m_connectionName(connectionName)
+    {
+    }
+
+public Q_SLOTS:
+    void onDisconnected()
+    {
+        TRACE() << "P2P connection closed:" << m_connectionName;
+        static_cast<AccessControlManagerHelper *>(parent())->
+            forgetPeer(m_connectionName);
+        deleteLater();
+    }
+
+private:
+    QString m_connectionName;
+};
+
+} // namespace SignonDaemonNS
+
 AccessControlManagerHelper *AccessControlManagerHelper::m_pInstance = NULL;
 
 AccessControlManagerHelper *AccessControlManagerHelper::instance()
@@ -47,7 +78,9 @@ AccessControlManagerHelper *AccessControlManagerHelper::instance()
 }
 
 AccessControlManagerHelper::AccessControlManagerHelper(
-                                SignOn::AbstractAccessControlManager *acManager)
+                                SignOn::AbstractAccessControlManager *acManager):
+    m_decisionCacheHits(0),
+    m_decisionCacheMisses(0)
 {
     if (!m_pInstance) {
         m_pInstance = this;
@@ -76,6 +109,15 @@ bool AccessControlManagerHelper::isPeerAllowedToUseIdentity(
         TRACE() << "NULL db pointer, secure storage might be unavailable,";
         return false;
     }
+
+    QString key = peerKey(peerConnection, peerMessage);
+    int decision;
+    if (lookupDecision(key, identityId, UseIdentityOperation, decision)) {
+        m_decisionCacheHits++;
+        return decision;
+    }
+    m_decisionCacheMisses++;
+
     QStringList acl = db->accessControlList(identityId);
 
     TRACE() << QString(QLatin1String("Access control list of identity: "
@@ -87,18 +129,20 @@ bool AccessControlManagerHelper::isPeerAllowedToUseIdentity(
     if (db->errorOccurred())
         return false;
 
+    bool allowed;
     IdentityOwnership ownership =
-        isPeerOwnerOfIdentity(peerConnection, peerMessage, identityId);
+        ownershipOfIdentity(key, peerConnection, peerMessage, identityId);
     if (ownership == ApplicationIsOwner || ownership == IdentityDoesNotHaveOwner)
-        return true;
-
-    if (acl.isEmpty())
-        return false;
-
-    if (acl.contains(QLatin1String("*")))
-        return true;
+        allowed = true;
+    else if (acl.isEmpty())
+        allowed = false;
+    else if (acl.contains(QLatin1String("*")))
+        allowed = true;
+    else
+        allowed = peerHasOneOfAccesses(peerConnection, peerMessage, acl);
 
-    return peerHasOneOfAccesses(peerConnection, peerMessage, acl);
+    storeDecision(key, identityId, UseIdentityOperation, allowed);
+    return allowed;
 }
 
 AccessControlManagerHelper::IdentityOwnership
@@ -112,16 +156,86 @@ AccessControlManagerHelper::isPeerOwnerOfIdentity(
         TRACE() << "NULL db pointer, secure storage might be unavailable,";
         return ApplicationIsNotOwner;
     }
+
+    QString key = peerKey(peerConnection, peerMessage);
+    int decision;
+    if (lookupDecision(key, identityId, OwnIdentityOperation, decision)) {
+        m_decisionCacheHits++;
+        return IdentityOwnership(decision);
+    }
+    m_decisionCacheMisses++;
+
+    return ownershipOfIdentity(key, peerConnection, peerMessage, identityId);
+}
+
+bool AccessControlManagerHelper::isPeerKnownToUseIdentity(
+                                       const QDBusConnection &peerConnection,
+                                       const QDBusMessage &peerMessage,
+                                       const quint32 identityId)
+{
+    if (CredentialsAccessManager::instance()->credentialsDB() == 0)
+        return false;
+
+    /* Misses are not counted: the caller will go through the full check */
+    int decision;
+    if (!lookupDecision(peerKey(peerConnection, peerMessage), identityId,
+                        UseIdentityOperation, decision) || !decision)
+        return false;
+
+    m_decisionCacheHits++;
+    return true;
+}
+
+bool AccessControlManagerHelper::isPeerKnownToOwnIdentity(
+                                       const QDBusConnection &peerConnection,
+                                       const QDBusMessage &peerMessage,
+                                       const quint32 identityId)
+{
+    if (CredentialsAccessManager::instance()->credentialsDB() == 0)
+        return false;
+
+    int decision;
+    if (!lookupDecision(peerKey(peerConnection, peerMessage), identityId,
+                        OwnIdentityOperation, decision) ||
+        decision == ApplicationIsNotOwner)
+        return false;
+
+    m_decisionCacheHits++;
+    return true;
+}
+
+/* Like isPeerOwnerOfIdentity(), but not counted in the cache statistics, as
+ * it's part of a check which has already been counted */
+AccessControlManagerHelper::IdentityOwnership
+AccessControlManagerHelper::ownershipOfIdentity(
+                                       const QString &key,
+                                       const QDBusConnection &peerConnection,
+                                       const QDBusMessage &peerMessage,
+                                       quint32 identityId)
+{
+    int decision;
+    if (lookupDecision(key, identityId, OwnIdentityOperation, decision))
+        return IdentityOwnership(decision);
+
+    CredentialsDB *db = CredentialsAccessManager::instance()->credentialsDB();
+    if (db == 0)
+        return ApplicationIsNotOwner;
+
     QStringList ownerSecContexts = db->ownerList(identityId);
 
     if (db->errorOccurred())
         return ApplicationIsNotOwner;
 
+    IdentityOwnership ownership;
     if (ownerSecContexts.isEmpty())
-        return IdentityDoesNotHaveOwner;
+        ownership = IdentityDoesNotHaveOwner;
+    else
+        ownership = peerHasOneOfAccesses(peerConnection, peerMessage,
+                                         ownerSecContexts) ?
+            ApplicationIsOwner : ApplicationIsNotOwner;
 
-    return peerHasOneOfAccesses(peerConnection, peerMessage, ownerSecContexts) ?
-        ApplicationIsOwner : ApplicationIsNotOwner;
+    storeDecision(key, identityId, OwnIdentityOperation, ownership);
+    return ownership;
 }
 
 bool
@@ -138,8 +252,20 @@ QString AccessControlManagerHelper::appIdOfPeer(
                                        const QDBusConnection &peerConnection,
                                        const QDBusMessage &peerMessage)
 {
-    TRACE() << m_acManager->appIdOfPeer(peerConnection, peerMessage);
-    return m_acManager->appIdOfPeer(peerConnection, peerMessage);
+    QString key = peerKey(peerConnection, peerMessage);
+    if (!key.isEmpty()) {
+        PeerInfo &info = peerInfo(key);
+        if (!info.hasAppId) {
+            info.appId = m_acManager->appIdOfPeer(peerConnection, peerMessage);
+            info.hasAppId = true;
+        }
+        TRACE() << info.appId;
+        return info.appId;
+    }
+
+    QString appId = m_acManager->appIdOfPeer(peerConnection, peerMessage);
+    TRACE() << appId;
+    return appId;
 }
 
 bool
@@ -178,6 +304,27 @@ pid_t AccessControlManagerHelper::pidOfPeer(const QDBusContext &peerContext)
 pid_t AccessControlManagerHelper::pidOfPeer(
                                        const QDBusConnection &peerConnection,
                                        const QDBusMessage &peerMessage)
+{
+    AccessControlManagerHelper *helper = instance();
+    QString key = helper != 0 ?
+        helper->peerKey(peerConnection, peerMessage) : QString();
+    if (key.isEmpty())
+        return resolvePidOfPeer(peerConnection, peerMessage);
+
+    QHash<QString, PeerInfo>::iterator i = helper->m_peers.find(key);
+    if (i != helper->m_peers.end() && i->pid != 0)
+        return i->pid;
+
+    pid_t pid = resolvePidOfPeer(peerConnection, peerMessage);
+    /* Don't cache failures: the peer has probably gone already */
+    if (pid != 0)
+        helper->peerInfo(key).pid = pid;
+    return pid;
+}
+
+pid_t AccessControlManagerHelper::resolvePidOfPeer(
+                                       const QDBusConnection &peerConnection,
+                                       const QDBusMessage &peerMessage)
 {
     QString service = peerMessage.service();
     if (service.isEmpty()) {
@@ -201,6 +348,195 @@ pid_t AccessControlManagerHelper::pidOfPeer(
     }
 }
 
+QString AccessControlManagerHelper::peerKey(
+                                       const QDBusConnection &peerConnection,
+                                       const QDBusMessage &peerMessage) const
+{
+    QString service = peerMessage.service();
+    if (!service.isEmpty()) {
+        /* Only unique names identify a single client connection */
+        return service.startsWith(QLatin1Char(':')) ? service : QString();
+    }
+
+    /* The P2P connection is only cached while it is being watched for
+     * disconnection, see watchPeerConnection() */
+    QString name = peerConnection.name();
+    return m_peers.contains(name) ? name : QString();
+}
+
+void AccessControlManagerHelper::prefetchPeer(
+                                       const QDBusConnection &peerConnection,
+                                       const QDBusMessage &peerMessage)
+{
+    QString service = peerMessage.service();
+    if (service.isEmpty()) {
+        /* P2P peers are resolved locally, no round trip involved */
+        return;
+    }
+
+    QString key = peerKey(peerConnection, peerMessage);
+    if (key.isEmpty() || m_peers.contains(key))
+        return;
+
+    /* Insert an empty entry, so that the request is issued only once */
+    peerInfo(key);
+
+    QDBusPendingCall call =
+        peerConnection.interface()->asyncCall(
+            QLatin1String("GetConnectionUnixProcessID"), service);
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, this);
+    watcher->setProperty("peerKey", key);
+    QObject::connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
+                     this, SLOT(onPidReplyFinished(QDBusPendingCallWatcher*)));
+}
+
+void AccessControlManagerHelper::onPidReplyFinished(
+                                       QDBusPendingCallWatcher *watcher)
+{
+    watcher->deleteLater();
+
+    QDBusPendingReply<uint> reply = *watcher;
+    QString key = watcher->property("peerKey").toString();
+    if (reply.isError()) {
+        TRACE() << "Couldn't get PID of" << key << reply.error().message();
+        /* If the peer left before we started watching it, we would never
+         * hear about it */
+        if (reply.error().type() == QDBusError::NameHasNoOwner)
+            forgetPeer(key);
+        return;
+    }
+
+    /* The peer might have gone away in the meantime */
+    QHash<QString, PeerInfo>::iterator i = m_peers.find(key);
+    if (i != m_peers.end() && i->pid == 0)
+        i->pid = reply.value();
+}
+
+void AccessControlManagerHelper::watchPeerConnection(
+                                       const QDBusConnection &connection)
+{
+    PeerConnectionWatcher *watcher =
+        new PeerConnectionWatcher(connection.name(), this);
+    m_peers.insert(connection.name(), PeerInfo());
+
+    QDBusConnection conn(connection);
+    conn.connect(QString(),
+                 QLatin1String("/org/freedesktop/DBus/Local"),
+                 QLatin1String("org.freedesktop.DBus.Local"),
+                 QLatin1String("Disconnected"),
+                 watcher, SLOT(onDisconnected()));
+}
+
+void AccessControlManagerHelper::forgetPeer(const QString &peerKey)
+{
+    if (m_peers.remove(peerKey) > 0 && peerKey.startsWith(QLatin1Char(':')))
+        watchBusPeer(peerKey, false);
+}
+
+AccessControlManagerHelper::PeerInfo &
+AccessControlManagerHelper::peerInfo(const QString &peerKey)
+{
+    QHash<QString, PeerInfo>::iterator i = m_peers.find(peerKey);
+    if (i != m_peers.end())
+        return i.value();
+
+    if (peerKey.startsWith(QLatin1Char(':')))
+        watchBusPeer(peerKey, true);
+    return m_peers[peerKey];
+}
+
+void AccessControlManagerHelper::watchBusPeer(const QString &name, bool watch)
+{
+    /* Bus peers are identified by their unique name, which is never reused:
+     * drop the cached information as soon as the peer leaves the bus. The
+     * match is restricted to the name, so that we are not woken up by every
+     * other name change on the bus. */
+    QDBusConnection connection = SIGNOND_BUS;
+    QStringList argumentMatch(name);
+    if (watch) {
+        connection.connect(QLatin1String("org.freedesktop.DBus"),
+                           QLatin1String("/org/freedesktop/DBus"),
+                           QLatin1String("org.freedesktop.DBus"),
+                           QLatin1String("NameOwnerChanged"),
+                           argumentMatch, QString(),
+                           this,
+                           SLOT(onNameOwnerChanged(QString,QString,QString)));
+    } else {
+        connection.disconnect(QLatin1String("org.freedesktop.DBus"),
+                              QLatin1String("/org/freedesktop/DBus"),
+                              QLatin1String("org.freedesktop.DBus"),
+                              QLatin1String("NameOwnerChanged"),
+                              argumentMatch, QString(),
+                              this,
+                              SLOT(onNameOwnerChanged(QString,QString,QString)));
+    }
+}
+
+bool AccessControlManagerHelper::lookupDecision(const QString &peerKey,
+                                                quint32 identityId,
+                                                AccessOperation operation,
+                                                int &decision) const
+{
+    if (peerKey.isEmpty())
+        return false;
+
+    QHash<QString, PeerInfo>::const_iterator i = m_peers.constFind(peerKey);
+    if (i == m_peers.constEnd())
+        return false;
+
+    QHash<DecisionKey, int>::const_iterator d =
+        i->decisions.constFind(DecisionKey(identityId, operation));
+    if (d == i->decisions.constEnd())
+        return false;
+
+    decision = d.value();
+    return true;
+}
+
+void AccessControlManagerHelper::storeDecision(const QString &peerKey,
+                                               quint32 identityId,
+                                               AccessOperation operation,
+                                               int decision)
+{
+    if (peerKey.isEmpty())
+        return;
+
+    peerInfo(peerKey).decisions.insert(DecisionKey(identityId, operation),
+                                       decision);
+}
+
+void AccessControlManagerHelper::clearDecisions(quint32 identityId)
+{
+    QHash<QString, PeerInfo>::iterator i;
+    for (i = m_peers.begin(); i != m_peers.end(); ++i) {
+        i->decisions.remove(DecisionKey(identityId, UseIdentityOperation));
+        i->decisions.remove(DecisionKey(identityId, OwnIdentityOperation));
+    }
+}
+
+void AccessControlManagerHelper::clearDecisions()
+{
+    QHash<QString, PeerInfo>::iterator i;
+    for (i = m_peers.begin(); i != m_peers.end(); ++i)
+        i->decisions.clear();
+}
+
+void AccessControlManagerHelper::onCredentialsUpdated(quint32 identityId)
+{
+    TRACE() << "ACL might have changed for identity" << identityId;
+    clearDecisions(identityId);
+}
+
+void AccessControlManagerHelper::onNameOwnerChanged(const QString &name,
+                                                    const QString &oldOwner,
+                                                    const QString &newOwner)
+{
+    Q_UNUSED(oldOwner);
+
+    if (newOwner.isEmpty() && name.startsWith(QLatin1Char(':')))
+        forgetPeer(name);
+}
+
 SignOn::AccessReply *
 AccessControlManagerHelper::requestAccessToIdentity(
                                        const QDBusConnection &peerConnection,
@@ -210,5 +546,23 @@ AccessControlManagerHelper::requestAccessToIdentity(
     SignOn::AccessRequest request;
     request.setPeer(peerConnection, peerMessage);
     request.setIdentity(id);
-    return m_acManager->handleRequest(request);
+    SignOn::AccessReply *reply = m_acManager->handleRequest(request);
+    /* Connected before the caller gets the reply, so that the decisions
+     * are invalidated before it checks the access again. */
+    QObject::connect(reply, SIGNAL(finished()),
+                     this, SLOT(onAccessReplyFinished()));
+    return reply;
+}
+
+void AccessControlManagerHelper::onAccessReplyFinished()
+{
+    SignOn::AccessReply *reply = qobject_cast<SignOn::AccessReply*>(sender());
+    Q_ASSERT(reply != 0);
+
+    /* The access control manager might have granted access by some other
+     * means than by updating the ACL */
+    if (reply->isAccepted())
+        clearDecisions(reply->request().identity());
 }
+
+#include "accesscontrolmanagerhelper.moc"
@@ -37,6 +37,10 @@
 #include <QDBusConnection>
 #include <QDBusContext>
 #include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
+#include <QHash>
+#include <QObject>
+#include <QPair>
 
 #include "signonauthsession.h"
 #include "SignOn/abstract-access-control-manager.h"
@@ -48,8 +52,10 @@ namespace SignonDaemonNS {
  * Contains helper functions related to Access Control
  * @ingroup Accounts_and_SSO_Framework
  */
-class AccessControlManagerHelper
+class AccessControlManagerHelper: public QObject
 {
+    Q_OBJECT
+
 public:
     /*!
      * @enum IdentityOwnership
@@ -102,6 +108,31 @@ public:
                                             const QDBusMessage &peerMessage,
                                             const quint32 identityId);
 
+    /*!
+     * Like isPeerAllowedToUseIdentity(), but only answers from the decision
+     * cache: the access control manager is never called.
+     * @param peerConnection the connection over which the message was sent.
+     * @param peerMessage, the request message sent over DBUS by the process.
+     * @param identityId, the SignonIdentity to be used.
+     * @returns true, if the peer is known to be allowed; false if it is not
+     * allowed, or if the decision is not cached.
+     */
+    bool isPeerKnownToUseIdentity(const QDBusConnection &peerConnection,
+                                  const QDBusMessage &peerMessage,
+                                  const quint32 identityId);
+
+    /*!
+     * Like isPeerOwnerOfIdentity(), but only answers from the decision cache.
+     * @param peerConnection the connection over which the message was sent.
+     * @param peerMessage, the request message sent over DBUS by the process.
+     * @param identityId, the SignonIdentity in context.
+     * @returns true, if the peer is known to be the owner of the identity or
+     * the identity is known not to have an owner; false otherwise.
+     */
+    bool isPeerKnownToOwnIdentity(const QDBusConnection &peerConnection,
+                                  const QDBusMessage &peerMessage,
+                                  const quint32 identityId);
+
     /*!
      * Checks if a specific process is allowed to use the SignonAuthSession
      * functionality.
@@ -187,8 +218,108 @@ public:
                                 const QDBusMessage &peerMessage,
                                 quint32 id);
 
+    /*!
+     * Starts resolving the credentials of the peer in the background, so
+     * that later access checks can be answered from the peer cache without
+     * blocking on the bus daemon.
+     * @param peerConnection the connection over which the message was sent.
+     * @param peerMessage, the request message sent over DBUS by the process.
+     */
+    void prefetchPeer(const QDBusConnection &peerConnection,
+                      const QDBusMessage &peerMessage);
+
+    /*!
+     * Starts tracking a peer to peer connection, so that the cached
+     * information about its peer is dropped when it disconnects.
+     * @param connection the P2P connection.
+     */
+    void watchPeerConnection(const QDBusConnection &connection);
+
+    /*!
+     * Drops the cached information about a peer.
+     * @param peerKey the unique bus name of the peer, or the name of the
+     * P2P connection.
+     */
+    void forgetPeer(const QString &peerKey);
+
+    /*!
+     * Drops the cached access control decisions about an identity. This
+     * must be called whenever the ACL or the owner of the identity change,
+     * or the identity is removed.
+     * @param identityId the identity.
+     */
+    void clearDecisions(quint32 identityId);
+
+    /*!
+     * Drops all the cached access control decisions.
+     */
+    void clearDecisions();
+
+    /*!
+     * @returns the number of access control checks which have been answered
+     * from the decision cache.
+     */
+    quint64 decisionCacheHits() const { return m_decisionCacheHits; }
+
+    /*!
+     * @returns the number of access control checks which could not be
+     * answered from the decision cache.
+     */
+    quint64 decisionCacheMisses() const { return m_decisionCacheMisses; }
+
+    /*!
+     * @returns the number of client connections whose PID and application
+     * ID are currently cached.
+     */
+    int trackedPeers() const { return m_peers.count(); }
+
+public Q_SLOTS:
+    void onCredentialsUpdated(quint32 identityId);
+
+private Q_SLOTS:
+    void onNameOwnerChanged(const QString &name,
+                            const QString &oldOwner,
+                            const QString &newOwner);
+    void onPidReplyFinished(QDBusPendingCallWatcher *watcher);
+    void onAccessReplyFinished();
+
 private:
+    enum AccessOperation {
+        UseIdentityOperation = 0,
+        OwnIdentityOperation
+    };
+    typedef QPair<quint32, int> DecisionKey;
+
+    struct PeerInfo {
+        PeerInfo(): pid(0), hasAppId(false) {}
+        pid_t pid;
+        bool hasAppId;
+        QString appId;
+        /* Cached results of the access checks made by this peer */
+        QHash<DecisionKey, int> decisions;
+    };
+
+    bool lookupDecision(const QString &peerKey, quint32 identityId,
+                        AccessOperation operation, int &decision) const;
+    void storeDecision(const QString &peerKey, quint32 identityId,
+                       AccessOperation operation, int decision);
+    IdentityOwnership ownershipOfIdentity(const QString &peerKey,
+                                          const QDBusConnection &peerConnection,
+                                          const QDBusMessage &peerMessage,
+                                          quint32 identityId);
+
+    PeerInfo &peerInfo(const QString &peerKey);
+    void watchBusPeer(const QString &name, bool watch);
+
+    QString peerKey(const QDBusConnection &peerConnection,
+                    const QDBusMessage &peerMessage) const;
+    static pid_t resolvePidOfPeer(const QDBusConnection &peerConnection,
+                                  const QDBusMessage &peerMessage);
+
     SignOn::AbstractAccessControlManager *m_acManager;
+    QHash<QString, PeerInfo> m_peers;
+    quint64 m_decisionCacheHits;
+    quint64 m_decisionCacheMisses;
     static AccessControlManagerHelper* m_pInstance;
 };
 
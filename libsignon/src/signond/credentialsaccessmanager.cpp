@@ -31,6 +31,7 @@
 #include "default-key-authorizer.h"
 #include "default-secrets-storage.h"
 #include "signond-common.h"
+#include "startupprofile.h"
 
 #include "SignOn/ExtensionInterface"
 #include "SignOn/misc.h"
@@ -130,6 +131,7 @@ CredentialsAccessManager::CredentialsAccessManager(
     m_error(NoError),
     keyManagers(),
     m_pCredentialsDB(NULL),
+    m_pCredentialsDBReader(NULL),
     m_cryptoManager(NULL),
     m_keyHandler(NULL),
     m_keyAuthorizer(NULL),
@@ -176,6 +178,8 @@ void CredentialsAccessManager::finalize()
 
 bool CredentialsAccessManager::init()
 {
+    StartupProfile::Phase phase("CredentialsAccessManager::init");
+
     if (m_isInitialized) {
         TRACE() << "CAM already initialized.";
         m_error = AlreadyInitialized;
@@ -451,11 +455,32 @@ bool CredentialsAccessManager::openMetaDataDB()
         return false;
     }
 
+    QObject::connect(m_pCredentialsDB, SIGNAL(credentialsUpdated(quint32)),
+                     this, SIGNAL(credentialsUpdated(quint32)));
+
+    /* Cached access control decisions are valid only as long as the ACLs
+     * they have been computed from */
+    if (m_acManagerHelper != 0) {
+        m_acManagerHelper->clearDecisions();
+        QObject::connect(m_pCredentialsDB, SIGNAL(credentialsUpdated(quint32)),
+                         m_acManagerHelper, SLOT(onCredentialsUpdated(quint32)));
+    }
+
+    /* Long read-only queries are served by a separate connection, in its
+     * own thread */
+    m_pCredentialsDBReader = new CredentialsDBReader(dbPath);
+    m_pCredentialsDBReader->start();
+
     return true;
 }
 
 void CredentialsAccessManager::closeMetaDataDB()
 {
+    if (m_pCredentialsDBReader) {
+        delete m_pCredentialsDBReader;
+        m_pCredentialsDBReader = NULL;
+    }
+
     if (m_pCredentialsDB) {
         delete m_pCredentialsDB;
         m_pCredentialsDB = NULL;
@@ -465,6 +490,8 @@ void CredentialsAccessManager::closeMetaDataDB()
 bool CredentialsAccessManager::openCredentialsSystem()
 {
     RETURN_IF_NOT_INITIALIZED(false);
+    StartupProfile::Phase phase(
+        "CredentialsAccessManager::openCredentialsSystem");
 
     if (!openMetaDataDB()) {
         BLAME() << "Couldn't open metadata DB!";
@@ -527,6 +554,13 @@ CredentialsDB *CredentialsAccessManager::credentialsDB() const
     return m_pCredentialsDB;
 }
 
+CredentialsDBReader *CredentialsAccessManager::credentialsDBReader() const
+{
+    RETURN_IF_NOT_INITIALIZED(NULL);
+
+    return m_pCredentialsDBReader;
+}
+
 bool CredentialsAccessManager::isCredentialsSystemReady() const
 {
     return (m_keyHandler != 0) ? m_keyHandler->isReady() : true;
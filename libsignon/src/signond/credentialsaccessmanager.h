@@ -33,6 +33,7 @@
 
 #include "accesscontrolmanagerhelper.h"
 #include "credentialsdb.h"
+#include "credentialsdbreader.h"
 #include "signonui_interface.h"
 
 #include <QObject>
@@ -340,6 +341,12 @@ public:
      */
     CredentialsDB *credentialsDB() const;
 
+    /*!
+     * @returns the object serving read-only queries on the credentials
+     * database from a separate thread, or NULL if not available.
+     */
+    CredentialsDBReader *credentialsDBReader() const;
+
     /*!
      * @returns the CAM in use configuration.
      */
@@ -363,6 +370,13 @@ Q_SIGNALS:
      */
     void credentialsSystemReady();
 
+    /*!
+     * Is emitted when the stored data of the identity @a id has changed.
+     * Unlike CredentialsDB::credentialsUpdated(), it keeps being emitted
+     * after the database has been reopened.
+     */
+    void credentialsUpdated(quint32 id);
+
 private Q_SLOTS:
     void onKeyInserted(const SignOn::Key key);
     void onLastAuthorizedKeyRemoved(const SignOn::Key key);
@@ -396,6 +410,7 @@ private:
     QList<SignOn::AbstractKeyManager *> keyManagers;
 
     CredentialsDB *m_pCredentialsDB;
+    CredentialsDBReader *m_pCredentialsDBReader;
     SignOn::AbstractCryptoManager *m_cryptoManager;
     SignOn::KeyHandler *m_keyHandler;
     SignOn::AbstractKeyAuthorizer *m_keyAuthorizer;
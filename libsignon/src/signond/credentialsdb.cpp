@@ -28,6 +28,8 @@
 #include "signond-common.h"
 #include "signonidentityinfo.h"
 #include "signonsessioncoretools.h"
+#include "signonmetrics.h"
+#include "startupprofile.h"
 
 #define INIT_ERROR() ErrorMonitor errorMonitor(this)
 #define RETURN_IF_NO_SECRETS_DB(retval) \
@@ -144,11 +146,15 @@ SqlDatabase::~SqlDatabase()
 
 bool SqlDatabase::init()
 {
-    if (!connect())
+    int phase = StartupProfile::begin("SQLite connection");
+    bool connected = connect();
+    StartupProfile::end(phase);
+    if (!connected)
         return false;
 
     TRACE() <<  "Database connection succeeded.";
 
+    StartupProfile::Phase schemaPhase("SQLite schema setup");
     if (!hasTables()) {
         TRACE() << "Creating SQL table structure...";
         if (!createTables())
@@ -198,7 +204,11 @@ bool SqlDatabase::startTransaction()
 
 bool SqlDatabase::commit()
 {
-    return m_database.commit();
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = m_database.commit();
+    SignonMetrics::record(SignonMetrics::DBCommitTime, timer);
+    return ok;
 }
 
 void SqlDatabase::rollback()
@@ -211,10 +221,14 @@ QSqlQuery SqlDatabase::exec(const QString &queryStr)
 {
     QSqlQuery query(QString(), m_database);
 
+    QElapsedTimer timer;
+    timer.start();
     if (!query.prepare(queryStr))
         TRACE() << "Query prepare warning: " << query.lastQuery();
 
-    if (!query.exec()) {
+    bool ok = query.exec();
+    SignonMetrics::record(SignonMetrics::DBQueryTime, timer);
+    if (!ok) {
         TRACE() << "Query exec error: " << query.lastQuery();
         setLastError(query.lastError());
         TRACE() << errorInfo(query.lastError());
@@ -226,8 +240,11 @@ QSqlQuery SqlDatabase::exec(const QString &queryStr)
 
 QSqlQuery SqlDatabase::exec(QSqlQuery &query)
 {
-
-    if (!query.exec()) {
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = query.exec();
+    SignonMetrics::record(SignonMetrics::DBQueryTime, timer);
+    if (!ok) {
         TRACE() << "Query exec error: " << query.lastQuery();
         setLastError(query.lastError());
         TRACE() << errorInfo(query.lastError());
@@ -1313,7 +1330,20 @@ CredentialsDB::~CredentialsDB()
 
 bool CredentialsDB::init()
 {
-    return metaDataDB->init();
+    if (!metaDataDB->init())
+        return false;
+
+    /* With write-ahead logging, the CredentialsDBReader connection reads
+     * from a snapshot without blocking the writes done on this connection,
+     * and the other way around. The mode is persistent: it is recorded in
+     * the DB file, and SQLite keeps the "-wal" and "-shm" files next to it
+     * while the DB is open (see SignonDaemon::backupStarts()). */
+    QSqlQuery q = metaDataDB->exec(S("PRAGMA journal_mode = WAL"));
+    if (!q.first() ||
+        q.value(0).toString().compare(S("wal"), Qt::CaseInsensitive) != 0)
+        TRACE() << "Write-ahead logging not enabled on the metadata DB";
+
+    return true;
 }
 
 bool CredentialsDB::openSecretsDB(const QString &secretsDbName)
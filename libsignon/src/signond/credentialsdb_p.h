@@ -151,6 +151,14 @@ public:
         m_database.setPassword(password);
     }
 
+    /*!
+     * Makes the connection read-only; this must be called before
+     * connect().
+     */
+    void setReadOnly() {
+        m_database.setConnectOptions(QLatin1String("QSQLITE_OPEN_READONLY"));
+    }
+
     /*!
      * @returns the database name.
      */
@@ -247,9 +255,9 @@ class MetaDataDB: public SqlDatabase
 {
     friend class ::TestDatabase;
 public:
-    MetaDataDB(const QString &name):
-        SqlDatabase(name, QLatin1String("SSO-metadata"),
-                    SSO_METADATADB_VERSION) {}
+    MetaDataDB(const QString &name,
+               const QString &connectionName = QLatin1String("SSO-metadata")):
+        SqlDatabase(name, connectionName, SSO_METADATADB_VERSION) {}
 
     bool createTables();
     bool updateDB(int version);
@@ -0,0 +1,134 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "credentialsdbreader.h"
+#include "credentialsdb_p.h"
+#include "signond-common.h"
+
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include <QSqlDatabase>
+
+using namespace SignonDaemonNS;
+
+QEvent::Type IdentitiesQueryEvent::eventType()
+{
+    static int type = QEvent::registerEventType();
+    return QEvent::Type(type);
+}
+
+CredentialsDBReader::CredentialsDBReader(const QString &metaDataDbName,
+                                         QObject *parent):
+    QThread(parent),
+    m_metaDataDbName(metaDataDbName),
+    m_lastRequestId(0),
+    m_stopping(false)
+{
+}
+
+CredentialsDBReader::~CredentialsDBReader()
+{
+    stop();
+}
+
+quint64 CredentialsDBReader::queryIdentities(
+                                    const QMap<QString, QString> &filter,
+                                    QObject *receiver)
+{
+    QMutexLocker locker(&m_mutex);
+
+    Request request;
+    request.id = ++m_lastRequestId;
+    request.filter = filter;
+    request.receiver = receiver;
+
+    if (m_stopping) {
+        QCoreApplication::postEvent(receiver,
+                                    new IdentitiesQueryEvent(request.id));
+    } else {
+        m_requests.enqueue(request);
+        m_condition.wakeOne();
+    }
+
+    return request.id;
+}
+
+void CredentialsDBReader::stop()
+{
+    m_mutex.lock();
+    m_stopping = true;
+    m_condition.wakeOne();
+    m_mutex.unlock();
+
+    wait();
+
+    /* The thread might have never been started, or might have exited
+     * before serving all the requests */
+    while (!m_requests.isEmpty()) {
+        Request request = m_requests.dequeue();
+        QCoreApplication::postEvent(request.receiver,
+                                    new IdentitiesQueryEvent(request.id));
+    }
+}
+
+void CredentialsDBReader::run()
+{
+    const QString connectionName = QString::fromLatin1("SSO-metadata-reader");
+
+    /* The database connection can only be used from the thread which
+     * created it */
+    MetaDataDB *db = new MetaDataDB(m_metaDataDbName, connectionName);
+    db->setReadOnly();
+    if (!db->connect())
+        BLAME() << "Couldn't open reader connection:" << m_metaDataDbName;
+
+    forever {
+        m_mutex.lock();
+        while (m_requests.isEmpty() && !m_stopping)
+            m_condition.wait(&m_mutex);
+        if (m_stopping) {
+            m_mutex.unlock();
+            break;
+        }
+        Request request = m_requests.dequeue();
+        m_mutex.unlock();
+
+        IdentitiesQueryEvent *event = new IdentitiesQueryEvent(request.id);
+        if (db->connected()) {
+            /* Read all the identities from a consistent snapshot */
+            db->startTransaction();
+            QList<SignonIdentityInfo> identities =
+                db->identities(request.filter);
+            event->ok = !db->errorOccurred();
+            db->commit();
+
+            foreach (const SignonIdentityInfo &info, identities)
+                event->identities.append(info.toMap());
+        }
+
+        QCoreApplication::postEvent(request.receiver, event);
+    }
+
+    delete db;
+    QSqlDatabase::removeDatabase(connectionName);
+}
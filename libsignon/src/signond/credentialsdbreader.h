@@ -0,0 +1,108 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef SIGNON_CREDENTIALS_DB_READER_H
+#define SIGNON_CREDENTIALS_DB_READER_H
+
+#include <QEvent>
+#include <QMap>
+#include <QMutex>
+#include <QQueue>
+#include <QString>
+#include <QThread>
+#include <QVariantMap>
+#include <QWaitCondition>
+
+namespace SignonDaemonNS {
+
+/*!
+ * @class IdentitiesQueryEvent
+ * Carries the result of a CredentialsDBReader::queryIdentities() request
+ * back to the thread of the object which issued it.
+ */
+class IdentitiesQueryEvent: public QEvent
+{
+public:
+    static QEvent::Type eventType();
+
+    IdentitiesQueryEvent(quint64 requestId):
+        QEvent(eventType()),
+        requestId(requestId),
+        ok(false)
+    {}
+
+    quint64 requestId;
+    bool ok;
+    QList<QVariantMap> identities;
+};
+
+/*!
+ * @class CredentialsDBReader
+ * Serves read-only queries on the metadata database from a dedicated
+ * thread, which owns its own database connection. This keeps long listings
+ * from stalling the main thread, which does the D-Bus dispatch and owns all
+ * the other daemon objects.
+ */
+class CredentialsDBReader: public QThread
+{
+    Q_OBJECT
+
+public:
+    CredentialsDBReader(const QString &metaDataDbName, QObject *parent = 0);
+    ~CredentialsDBReader();
+
+    /*!
+     * Queues a query for the identities matching @filter. When done, an
+     * IdentitiesQueryEvent is posted to @receiver, which must not be
+     * destroyed before the reader is stopped.
+     * @returns the request ID, which will be set in the event.
+     */
+    quint64 queryIdentities(const QMap<QString, QString> &filter,
+                            QObject *receiver);
+
+    /*!
+     * Stops the thread; pending requests are answered with a failure.
+     */
+    void stop();
+
+protected:
+    void run();
+
+private:
+    struct Request {
+        quint64 id;
+        QMap<QString, QString> filter;
+        QObject *receiver;
+    };
+
+    QString m_metaDataDbName;
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    QQueue<Request> m_requests;
+    quint64 m_lastRequestId;
+    bool m_stopping;
+};
+
+} // namespace
+
+#endif // SIGNON_CREDENTIALS_DB_READER_H
@@ -21,6 +21,9 @@
  */
 
 #include "signondaemon.h"
+#include "startupprofile.h"
+
+#include "SignOn/tracebuffer.h"
 
 #include <QtCore>
 
@@ -36,12 +39,18 @@ void installSigHandlers()
     sigaction(SIGHUP, &act, 0);
     sigaction(SIGTERM, &act, 0);
     sigaction(SIGINT, &act, 0);
+    sigaction(SIGUSR1, &act, 0);
 }
 
 Q_DECL_EXPORT int main(int argc, char *argv[])
 {
     QCoreApplication app(argc, argv);
     installSigHandlers();
+    SignOn::TraceBuffer::initialize(QLatin1String("signond"));
+
+    if (app.arguments().contains(QLatin1String("--profile-startup")) ||
+        !qgetenv("SSO_PROFILE_STARTUP").isEmpty())
+        StartupProfile::enable();
 
     QMetaObject::invokeMethod(SignonDaemon::instance(),
                               "init",
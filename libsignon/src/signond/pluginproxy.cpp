@@ -22,7 +22,11 @@
 
 #include "pluginproxy.h"
 
+#include <errno.h>
+#include <string.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <fcntl.h>
 #include <pwd.h>
 #include <unistd.h>
 
@@ -32,6 +36,7 @@
 #include <QDataStream>
 
 #include "signond-common.h"
+#include "signonmetrics.h"
 #include "SignOn/uisessiondata_priv.h"
 #include "SignOn/signonplugincommon.h"
 
@@ -45,12 +50,15 @@
 // signon-plugins-common
 #include "SignOn/blobiohandler.h"
 #include "SignOn/ipc.h"
+#include "SignOn/tracebuffer.h"
+#include "signond/chrometrace.h"
 
 using namespace SignOn;
 
 #define REMOTEPLUGIN_BIN_PATH QLatin1String("signonpluginprocess")
 #define PLUGINPROCESS_START_TIMEOUT 5000
 #define PLUGINPROCESS_STOP_TIMEOUT 1000
+#define PLUGINPROCESS_SOCKET_BUFFER_SIZE (256 * 1024)
 
 using namespace SignOn;
 
@@ -67,6 +75,14 @@ PluginProcess::~PluginProcess()
 {
 }
 
+void PluginProcess::setupChildProcess()
+{
+    /* Runs in the child, between fork() and exec(): let the plugin process
+     * inherit its ends of the IPC and shared memory sockets. */
+    foreach (int fd, m_childChannels)
+        fcntl(fd, F_SETFD, 0);
+}
+
 /* ---------------------- PluginProxy ---------------------- */
 
 PluginProxy::PluginProxy(QString type, QObject *parent):
@@ -78,7 +94,15 @@ PluginProxy::PluginProxy(QString type, QObject *parent):
     m_isProcessing = false;
     m_isResultObtained = false;
     m_currentResultOperation = -1;
+    m_traceStart = 0;
+    m_traceRequestId = 0;
+    m_blobIOHandler = NULL;
+    m_sharedMemoryChannel = -1;
+    m_cancelChannel = -1;
+    m_processCounted = false;
     m_process = new PluginProcess(this);
+    m_socket = NULL;
+    m_channel = m_process;
 
 #ifdef SIGNOND_TRACE
     if (criticalsEnabled()) {
@@ -115,7 +139,10 @@ PluginProxy::~PluginProxy()
         /* Closing the write channel ensures that the plugin process
          * will not get stuck on the next read.
          */
-        m_process->closeWriteChannel();
+        if (m_socket != NULL)
+            ::shutdown((int)m_socket->socketDescriptor(), SHUT_WR);
+        else
+            m_process->closeWriteChannel();
 
         if (!m_process->waitForFinished(PLUGINPROCESS_STOP_TIMEOUT)) {
             qCritical() << "The signon plugin does not react on demand to "
@@ -133,14 +160,20 @@ PluginProxy::~PluginProxy()
             }
         }
     }
+
+    closeChannels();
+
+    /* The process might have been killed without us seeing it finish */
+    countProcess(false);
 }
 
 PluginProxy* PluginProxy::createNewPluginProxy(const QString &type)
 {
     PluginProxy *pp = new PluginProxy(type);
 
-    QStringList args = QStringList() << pp->m_type;
-    pp->m_process->start(REMOTEPLUGIN_BIN_PATH, args);
+    QElapsedTimer spawnTimer;
+    spawnTimer.start();
+    pp->startProcess();
 
     QByteArray tmp;
 
@@ -166,16 +199,19 @@ PluginProxy* PluginProxy::createNewPluginProxy(const QString &type)
     }
     pp->m_mechanisms = pp->queryMechanisms();
 
-    connect(pp->m_process, SIGNAL(readyRead()),
+    connect(pp->m_channel, SIGNAL(readyRead()),
             pp, SLOT(onReadStandardOutput()));
 
-    TRACE() << "The process is started";
+    SignonMetrics::record(SignonMetrics::PluginSpawnTime, spawnTimer);
+    TraceBuffer::record(TracePluginSpawned, 0,
+                        spawnTimer.nsecsElapsed() / 1000);
     return pp;
 }
 
 bool PluginProxy::process(const QVariantMap &inData,
                           const QString &mechanism)
 {
+    m_traceRequestId = inData.value(SIGNOND_SESSION_REQUEST_ID).toUInt();
     if (!restartIfRequired())
         return false;
 
@@ -183,10 +219,15 @@ bool PluginProxy::process(const QVariantMap &inData,
     QVariant value = inData.value(SSOUI_KEY_UIPOLICY);
     m_uiPolicy = value.toInt();
 
-    QDataStream in(m_process);
+    QDataStream in(m_channel);
     in << (quint32)PLUGIN_OP_PROCESS;
     in << mechanism;
 
+    m_processTimer.start();
+    TraceBuffer::record(TracePluginSent, m_traceRequestId,
+                        PLUGIN_OP_PROCESS);
+    m_traceId = inData.value(SIGNOND_SESSION_TRACE_ID).toString();
+    m_traceStart = ChromeTrace::now();
     m_blobIOHandler->sendData(inData);
 
     m_isProcessing = true;
@@ -195,16 +236,22 @@ bool PluginProxy::process(const QVariantMap &inData,
 
 bool PluginProxy::processUi(const QVariantMap &inData)
 {
-    TRACE();
-
     if (!restartIfRequired())
         return false;
 
-    QDataStream in(m_process);
+    QDataStream in(m_channel);
 
     in << (quint32)PLUGIN_OP_PROCESS_UI;
 
-    m_blobIOHandler->sendData(inData);
+    m_processTimer.start();
+    TraceBuffer::record(TracePluginSent, m_traceRequestId,
+                        PLUGIN_OP_PROCESS_UI);
+    m_traceStart = ChromeTrace::now();
+    QVariantMap data = inData;
+    if (!m_traceId.isEmpty())
+        data.insert(SIGNOND_SESSION_TRACE_ID, m_traceId);
+    data.insert(SIGNOND_SESSION_REQUEST_ID, m_traceRequestId);
+    m_blobIOHandler->sendData(data);
 
     m_isProcessing = true;
 
@@ -213,16 +260,22 @@ bool PluginProxy::processUi(const QVariantMap &inData)
 
 bool PluginProxy::processRefresh(const QVariantMap &inData)
 {
-    TRACE();
-
     if (!restartIfRequired())
         return false;
 
-    QDataStream in(m_process);
+    QDataStream in(m_channel);
 
     in << (quint32)PLUGIN_OP_REFRESH;
 
-    m_blobIOHandler->sendData(inData);
+    m_processTimer.start();
+    TraceBuffer::record(TracePluginSent, m_traceRequestId,
+                        PLUGIN_OP_REFRESH);
+    m_traceStart = ChromeTrace::now();
+    QVariantMap data = inData;
+    if (!m_traceId.isEmpty())
+        data.insert(SIGNOND_SESSION_TRACE_ID, m_traceId);
+    data.insert(SIGNOND_SESSION_REQUEST_ID, m_traceRequestId);
+    m_blobIOHandler->sendData(data);
 
     m_isProcessing = true;
 
@@ -232,27 +285,46 @@ bool PluginProxy::processRefresh(const QVariantMap &inData)
 void PluginProxy::cancel()
 {
     TRACE();
-    QDataStream in(m_process);
+    if (m_cancelChannel >= 0) {
+        QByteArray opcode;
+        QDataStream out(&opcode, QIODevice::WriteOnly);
+        out << (quint32)PLUGIN_OP_CANCEL;
+
+        ssize_t written;
+        do {
+            written = ::write(m_cancelChannel,
+                              opcode.constData(), opcode.size());
+        } while (written < 0 && errno == EINTR);
+        if (written == opcode.size())
+            return;
+        BLAME() << "Cannot write to the cancel channel:" << strerror(errno);
+    }
+
+    QDataStream in(m_channel);
     in << (quint32)PLUGIN_OP_CANCEL;
+    if (m_socket != NULL)
+        m_socket->flush();
 }
 
 void PluginProxy::stop()
 {
     TRACE();
-    QDataStream in(m_process);
+    QDataStream in(m_channel);
     in << (quint32)PLUGIN_OP_STOP;
+    if (m_socket != NULL)
+        m_socket->flush();
 }
 
 bool PluginProxy::readOnReady(QByteArray &buffer, int timeout)
 {
-    bool ready = m_process->waitForReadyRead(timeout);
+    bool ready = m_channel->waitForReadyRead(timeout);
 
     if (ready) {
-        if (!m_process->bytesAvailable())
+        if (!m_channel->bytesAvailable())
             return false;
 
-        while (m_process->bytesAvailable())
-            buffer += m_process->readAllStandardOutput();
+        while (m_channel->bytesAvailable())
+            buffer += m_channel->readAll();
     }
 
     return ready;
@@ -269,7 +341,7 @@ void PluginProxy::blobIOError()
     disconnect(m_blobIOHandler, SIGNAL(error()), this, SLOT(blobIOError()));
     stop();
 
-    connect(m_process, SIGNAL(readyRead()), this, SLOT(onReadStandardOutput()));
+    connect(m_channel, SIGNAL(readyRead()), this, SLOT(onReadStandardOutput()));
     emit processError(
         (int)Error::InternalServer,
         QLatin1String("Failed to I/O session data to/from the authentication "
@@ -290,17 +362,17 @@ bool PluginProxy::isResultOperationCodeValid(const int opCode) const
 
 void PluginProxy::onReadStandardOutput()
 {
-    disconnect(m_process, SIGNAL(readyRead()),
+    disconnect(m_channel, SIGNAL(readyRead()),
                this, SLOT(onReadStandardOutput()));
 
-    if (!m_process->bytesAvailable()) {
+    if (!m_channel->bytesAvailable()) {
         qCritical() << "No information available on process";
         m_isProcessing = false;
         emit processError(Error::InternalServer, QString());
         return;
     }
 
-    QDataStream reader(m_process);
+    QDataStream reader(m_channel);
     reader >> m_currentResultOperation;
 
     TRACE() << "PROXY RESULT OPERATION:" << m_currentResultOperation;
@@ -309,9 +381,9 @@ void PluginProxy::onReadStandardOutput()
         TRACE() << "Unknown operation code - skipping.";
 
         //flushing the stdin channel
-        Q_UNUSED(m_process->readAllStandardOutput());
+        Q_UNUSED(m_channel->readAll());
 
-        connect(m_process, SIGNAL(readyRead()),
+        connect(m_channel, SIGNAL(readyRead()),
                 this, SLOT(onReadStandardOutput()));
         return;
     }
@@ -340,11 +412,18 @@ void PluginProxy::sessionDataReceived(const QVariantMap &map)
 void PluginProxy::handlePluginResponse(const quint32 resultOperation,
                                        const QVariantMap &sessionDataMap)
 {
-    TRACE() << resultOperation;
+    TraceBuffer::record(TracePluginReceived, m_traceRequestId,
+                        resultOperation,
+                        m_isProcessing ?
+                        m_processTimer.nsecsElapsed() / 1000 : 0);
+    if (resultOperation != PLUGIN_RESPONSE_SIGNAL &&
+        resultOperation != PLUGIN_RESPONSE_STORE)
+        ChromeTrace::span(m_traceId, "PluginProxy::roundTrip", m_traceStart);
 
     if (resultOperation == PLUGIN_RESPONSE_RESULT) {
-        TRACE() << "PLUGIN_RESPONSE_RESULT";
-
+        if (m_isProcessing)
+            SignonMetrics::record(SignonMetrics::PluginRoundTripTime,
+                                  m_processTimer);
         m_isProcessing = false;
 
         if (!m_isResultObtained)
@@ -409,9 +488,12 @@ void PluginProxy::handlePluginResponse(const quint32 resultOperation,
         quint32 err;
         QString errorMessage;
 
-        QDataStream stream(m_process);
+        QDataStream stream(m_channel);
         stream >> err;
         stream >> errorMessage;
+        if (m_isProcessing)
+            SignonMetrics::record(SignonMetrics::PluginRoundTripTime,
+                                  m_processTimer);
         m_isProcessing = false;
 
         if (!m_isResultObtained)
@@ -425,7 +507,7 @@ void PluginProxy::handlePluginResponse(const quint32 resultOperation,
         quint32 state;
         QString message;
 
-        QDataStream stream(m_process);
+        QDataStream stream(m_channel);
         stream >> state;
         stream >> message;
 
@@ -435,8 +517,8 @@ void PluginProxy::handlePluginResponse(const quint32 resultOperation,
             BLAME() << "Unexpected plugin signal: " << state << message;
     }
 
-    connect(m_process, SIGNAL(readyRead()), this, SLOT(onReadStandardOutput()));
-    if (m_process->bytesAvailable()) {
+    connect(m_channel, SIGNAL(readyRead()), this, SLOT(onReadStandardOutput()));
+    if (m_channel->bytesAvailable()) {
         TRACE() << "plugin has more to read after handling a response";
         onReadStandardOutput();
     }
@@ -452,6 +534,8 @@ void PluginProxy::onExit(int exitCode, QProcess::ExitStatus exitStatus)
     TRACE() << "Plugin process exit with code " << exitCode <<
         " : " << exitStatus;
 
+    countProcess(false);
+
     if (m_isProcessing || exitStatus == QProcess::CrashExit) {
         qCritical() << "Challenge produces CRASH!";
         emit processError(Error::InternalServer,
@@ -476,7 +560,7 @@ QString PluginProxy::queryType()
     if (!restartIfRequired())
         return QString();
 
-    QDataStream ds(m_process);
+    QDataStream ds(m_channel);
     ds << (quint32)PLUGIN_OP_TYPE;
 
     QByteArray buffer;
@@ -498,7 +582,7 @@ QStringList PluginProxy::queryMechanisms()
     if (!restartIfRequired())
         return QStringList();
 
-    QDataStream in(m_process);
+    QDataStream in(m_channel);
     in << (quint32)PLUGIN_OP_MECHANISMS;
 
     QByteArray buffer;
@@ -523,27 +607,136 @@ QStringList PluginProxy::queryMechanisms()
     return strList;
 }
 
+void PluginProxy::startProcess()
+{
+    setupChannels();
+    m_process->start(REMOTEPLUGIN_BIN_PATH, QStringList(m_type));
+
+    /* The child has been forked and holds its own copies of its ends */
+    closeChildChannels();
+}
+
+void PluginProxy::setupChannels()
+{
+    closeChannels();
+
+    QProcessEnvironment env = m_process->processEnvironment();
+    if (env.isEmpty())
+        env = QProcessEnvironment::systemEnvironment();
+    env.remove(QLatin1String(PLUGIN_IPC_FD_ENV));
+    env.remove(QLatin1String(PLUGIN_SHARED_MEMORY_FD_ENV));
+    env.remove(QLatin1String(PLUGIN_CANCEL_FD_ENV));
+
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0) {
+        int bufferSize = PLUGINPROCESS_SOCKET_BUFFER_SIZE;
+        for (int i = 0; i < 2; i++) {
+            setsockopt(fds[i], SOL_SOCKET, SO_SNDBUF,
+                       &bufferSize, sizeof(bufferSize));
+            setsockopt(fds[i], SOL_SOCKET, SO_RCVBUF,
+                       &bufferSize, sizeof(bufferSize));
+        }
+
+        m_socket = new QLocalSocket(this);
+        m_socket->setSocketDescriptor(fds[0]);
+        m_channel = m_socket;
+        m_process->m_childChannels.append(fds[1]);
+        env.insert(QLatin1String(PLUGIN_IPC_FD_ENV), QString::number(fds[1]));
+
+        /* Nothing is expected on the standard output anymore */
+        m_process->setStandardOutputFile(QLatin1String("/dev/null"));
+    } else {
+        BLAME() << "Couldn't create IPC socket; using the standard I/O";
+        m_process->setStandardOutputFile(QString());
+    }
+
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0) {
+        m_sharedMemoryChannel = fds[0];
+        m_process->m_childChannels.append(fds[1]);
+        env.insert(QLatin1String(PLUGIN_SHARED_MEMORY_FD_ENV),
+                   QString::number(fds[1]));
+    } else {
+        BLAME() << "Couldn't create shared memory channel; BLOBs will be "
+            "paged through the IPC channel";
+    }
+
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0) {
+        m_cancelChannel = fds[0];
+        m_process->m_childChannels.append(fds[1]);
+        env.insert(QLatin1String(PLUGIN_CANCEL_FD_ENV),
+                   QString::number(fds[1]));
+    } else {
+        BLAME() << "Couldn't create cancel channel; cancel requests will "
+            "wait for the plugin to read the IPC channel";
+    }
+
+    m_process->setProcessEnvironment(env);
+}
+
+void PluginProxy::closeChannels()
+{
+    if (m_socket != NULL) {
+        delete m_socket;
+        m_socket = NULL;
+    }
+    m_channel = m_process;
+
+    if (m_sharedMemoryChannel >= 0) {
+        ::close(m_sharedMemoryChannel);
+        m_sharedMemoryChannel = -1;
+    }
+
+    if (m_cancelChannel >= 0) {
+        ::close(m_cancelChannel);
+        m_cancelChannel = -1;
+    }
+
+    closeChildChannels();
+}
+
+void PluginProxy::closeChildChannels()
+{
+    foreach (int fd, m_process->m_childChannels)
+        ::close(fd);
+    m_process->m_childChannels.clear();
+}
+
 bool PluginProxy::waitForStarted(int timeout)
 {
     if (!m_process->waitForStarted(timeout))
         return false;
 
-    m_blobIOHandler = new BlobIOHandler(m_process, m_process, this);
+    countProcess(true);
+
+    delete m_blobIOHandler;
+    m_blobIOHandler = new BlobIOHandler(m_channel, m_channel, this);
+    m_blobIOHandler->setSharedMemoryChannel(m_sharedMemoryChannel);
 
     connect(m_blobIOHandler,
             SIGNAL(dataReceived(const QVariantMap &)),
             this,
             SLOT(sessionDataReceived(const QVariantMap &)));
 
-    QSocketNotifier *readNotifier =
-        new QSocketNotifier(STDIN_FILENO, QSocketNotifier::Read, this);
+    /* The socket notifies about incoming BLOB pages via readyRead() */
+    if (m_socket == NULL) {
+        QSocketNotifier *readNotifier =
+            new QSocketNotifier(STDIN_FILENO, QSocketNotifier::Read, this);
 
-    readNotifier->setEnabled(false);
-    m_blobIOHandler->setReadChannelSocketNotifier(readNotifier);
+        readNotifier->setEnabled(false);
+        m_blobIOHandler->setReadChannelSocketNotifier(readNotifier);
+    }
 
     return true;
 }
 
+void PluginProxy::countProcess(bool running)
+{
+    if (running == m_processCounted) return;
+
+    m_processCounted = running;
+    SignonMetrics::add(SignonMetrics::LivePluginProcesses, running ? 1 : -1);
+}
+
 bool PluginProxy::waitForFinished(int timeout)
 {
     return m_process->waitForFinished(timeout);
@@ -553,12 +746,21 @@ bool PluginProxy::restartIfRequired()
 {
     if (m_process->state() == QProcess::NotRunning) {
         TRACE() << "RESTART REQUIRED";
-        m_process->start(REMOTEPLUGIN_BIN_PATH, QStringList(m_type));
+        QElapsedTimer spawnTimer;
+        spawnTimer.start();
+        startProcess();
 
         QByteArray tmp;
         if (!waitForStarted(PLUGINPROCESS_START_TIMEOUT) ||
             !readOnReady(tmp, PLUGINPROCESS_START_TIMEOUT))
             return false;
+        SignonMetrics::record(SignonMetrics::PluginSpawnTime, spawnTimer);
+        TraceBuffer::record(TracePluginSpawned, m_traceRequestId,
+                            spawnTimer.nsecsElapsed() / 1000);
+
+        /* The IPC socket is recreated on every start */
+        connect(m_channel, SIGNAL(readyRead()),
+                this, SLOT(onReadStandardOutput()), Qt::UniqueConnection);
     }
     return true;
 }
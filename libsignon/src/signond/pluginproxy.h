@@ -25,8 +25,12 @@
 
 #include <QDBusConnection>
 #include <QDBusMessage>
+#include <QLocalSocket>
 #include <QtCore>
 
+class TestPluginProxy;
+class TestPluginProxyBench;
+
 namespace SignOn {
     class BlobIOHandler;
     class EncryptedDevice;
@@ -46,6 +50,13 @@ class PluginProcess: public QProcess
 
     PluginProcess(QObject* parent = NULL);
     ~PluginProcess();
+
+protected:
+    void setupChildProcess();
+
+private:
+    /* Descriptors which the plugin process must inherit across exec() */
+    QVector<int> m_childChannels;
 };
 
 /*!
@@ -59,6 +70,8 @@ class PluginProxy: public QObject
 
     friend class SignonIdentity;
     friend class TestAuthSession;
+    friend class ::TestPluginProxy;
+    friend class ::TestPluginProxyBench;
 
 public:
     static PluginProxy *createNewPluginProxy(const QString &type);
@@ -91,6 +104,10 @@ private:
     QString queryType();
     QStringList queryMechanisms();
 
+    void startProcess();
+    void setupChannels();
+    void closeChannels();
+    void closeChildChannels();
     bool waitForStarted(int timeout);
     bool waitForFinished(int timeout);
 
@@ -100,6 +117,8 @@ private:
                               const QVariantMap &sessionDataMap = QVariantMap());
 
     bool isResultOperationCodeValid(const int opCode) const;
+    /* Keeps the LivePluginProcesses metric in sync with the process state */
+    void countProcess(bool running);
 
 private Q_SLOTS:
     void onReadStandardOutput();
@@ -114,13 +133,33 @@ private:
 
     bool m_isProcessing;
     bool m_isResultObtained;
+    /* measures the round-trip time of the current operation */
+    QElapsedTimer m_processTimer;
+    /* correlation id of the traced request being processed */
+    QString m_traceId;
+    qint64 m_traceStart;
+    /* TraceBuffer request ID of the request being processed */
+    quint32 m_traceRequestId;
     QString m_type;
     QStringList m_mechanisms;
     int m_uiPolicy;
     int m_currentResultOperation;
 
     PluginProcess *m_process;
+    /* Our end of the IPC socket, or NULL when the plugin process is talked to
+     * through its standard input and output. */
+    QLocalSocket *m_socket;
+    /* Either m_socket or m_process */
+    QIODevice *m_channel;
     SignOn::BlobIOHandler *m_blobIOHandler;
+    /* Our end of the socket used to exchange sealed memory files with the
+     * plugin process, or -1 if not available. */
+    int m_sharedMemoryChannel;
+    /* Our end of the socket carrying cancel requests, or -1 if not
+     * available. */
+    int m_cancelChannel;
+    /* Whether the running process is counted in LivePluginProcesses */
+    bool m_processCounted;
 };
 
 } //namespace SignonDaemonNS
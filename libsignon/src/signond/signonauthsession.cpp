@@ -24,6 +24,8 @@
 #include "signond-common.h"
 #include "signonauthsession.h"
 #include "signonauthsessionadaptor.h"
+#include "credentialsaccessmanager.h"
+#include "credentialsdb.h"
 
 using namespace SignonDaemonNS;
 
@@ -39,8 +41,8 @@ SignonAuthSession::SignonAuthSession(quint32 id,
     (void)new SignonAuthSessionAdaptor(this);
 
     static quint32 incr = 0;
-    QString objectName = SIGNOND_DAEMON_OBJECTPATH +
-        QLatin1String("/AuthSession_") + QString::number(incr++, 16);
+    QString objectName = SIGNOND_AUTH_SESSION_OBJECTPATH_PREFIX +
+        QString::number(incr++, 16);
     TRACE() << objectName;
 
     setObjectName(objectName);
@@ -96,6 +98,46 @@ pid_t SignonAuthSession::ownerPid() const
     return m_ownerPid;
 }
 
+bool SignonAuthSession::checkMechanism(const QString &mechanism,
+                                       QString &allowedMechanism,
+                                       QString &errorMessage) const
+{
+    allowedMechanism = mechanism;
+    if (m_id == SIGNOND_NEW_IDENTITY) return true;
+
+    CredentialsDB *db = CredentialsAccessManager::instance()->credentialsDB();
+    if (!db) {
+        BLAME() << "Null database handler object.";
+        return true;
+    }
+
+    SignonIdentityInfo identityInfo = db->credentials(m_id, false);
+    if (identityInfo.checkMethodAndMechanism(m_method, mechanism,
+                                             allowedMechanism))
+        return true;
+
+    QTextStream(&errorMessage) << SIGNOND_METHOD_OR_MECHANISM_NOT_ALLOWED_ERR_STR
+                               << " Method:"
+                               << m_method
+                               << ", mechanism:"
+                               << mechanism
+                               << ", allowed:"
+                               << allowedMechanism;
+    return false;
+}
+
+void SignonAuthSession::processRequest(const QDBusConnection &connection,
+                                       const QDBusMessage &message,
+                                       const QVariantMap &sessionDataVa,
+                                       const QString &mechanism)
+{
+    parent()->process(connection,
+                      message,
+                      sessionDataVa,
+                      mechanism,
+                      objectName());
+}
+
 QStringList
 SignonAuthSession::queryAvailableMechanisms(const QStringList &wantedMechanisms)
 {
@@ -106,11 +148,7 @@ QVariantMap SignonAuthSession::process(const QVariantMap &sessionDataVa,
                                        const QString &mechanism)
 {
     setDelayedReply(true);
-    parent()->process(connection(),
-                      message(),
-                      sessionDataVa,
-                      mechanism,
-                      objectName());
+    processRequest(connection(), message(), sessionDataVa, mechanism);
     return QVariantMap();
 }
 
@@ -63,6 +63,24 @@ public:
     QString method() const;
     pid_t ownerPid() const;
 
+    /*!
+     * Checks that the identity of the session allows @a mechanism to be used
+     * with the session's method; @a allowedMechanism is set to the mechanism
+     * to use, or @a errorMessage describes why none is allowed.
+     */
+    bool checkMechanism(const QString &mechanism,
+                        QString &allowedMechanism,
+                        QString &errorMessage) const;
+
+    /*!
+     * Starts processing @a sessionDataVa with @a mechanism; the result is
+     * sent as the reply to @a message.
+     */
+    void processRequest(const QDBusConnection &connection,
+                        const QDBusMessage &message,
+                        const QVariantMap &sessionDataVa,
+                        const QString &mechanism);
+
 public Q_SLOTS:
     QStringList queryAvailableMechanisms(const QStringList &wantedMechanisms);
     QVariantMap process(const QVariantMap &sessionDataVa,
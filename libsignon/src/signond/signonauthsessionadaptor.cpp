@@ -25,19 +25,21 @@
 
 #include "signonauthsessionadaptor.h"
 #include "accesscontrolmanagerhelper.h"
-#include "credentialsaccessmanager.h"
-#include "credentialsdb.h"
+#include "signonmetrics.h"
 
 namespace SignonDaemonNS {
 
 SignonAuthSessionAdaptor::SignonAuthSessionAdaptor(SignonAuthSession *parent):
-    QDBusAbstractAdaptor(parent)
+    QDBusAbstractAdaptor(parent),
+    m_hasPendingSetId(false),
+    m_setIdReply(0)
 {
     setAutoRelaySignals(true);
 }
 
 SignonAuthSessionAdaptor::~SignonAuthSessionAdaptor()
 {
+    cancelPendingSetId();
 }
 
 void SignonAuthSessionAdaptor::errorReply(const QString &name,
@@ -52,6 +54,7 @@ QStringList
 SignonAuthSessionAdaptor::queryAvailableMechanisms(
                                            const QStringList &wantedMechanisms)
 {
+    SignonMetrics::countRequest("AuthSession.queryAvailableMechanisms");
     TRACE();
 
     QDBusContext &dbusContext = *static_cast<QDBusContext *>(parent());
@@ -73,34 +76,14 @@ SignonAuthSessionAdaptor::queryAvailableMechanisms(
 QVariantMap SignonAuthSessionAdaptor::process(const QVariantMap &sessionDataVa,
                                               const QString &mechanism)
 {
+    SignonMetrics::countRequest("AuthSession.process");
     TRACE() << mechanism;
 
-    QString allowedMechanism(mechanism);
-
-    if (parent()->id() != SIGNOND_NEW_IDENTITY) {
-        CredentialsDB *db =
-            CredentialsAccessManager::instance()->credentialsDB();
-        if (db) {
-            SignonIdentityInfo identityInfo = db->credentials(parent()->id(),
-                                                              false);
-            if (!identityInfo.checkMethodAndMechanism(parent()->method(),
-                                                      mechanism,
-                                                      allowedMechanism)) {
-                QString errMsg;
-                QTextStream(&errMsg) << SIGNOND_METHOD_OR_MECHANISM_NOT_ALLOWED_ERR_STR
-                                     << " Method:"
-                                     << parent()->method()
-                                     << ", mechanism:"
-                                     << mechanism
-                                     << ", allowed:"
-                                     << allowedMechanism;
-                errorReply(SIGNOND_METHOD_OR_MECHANISM_NOT_ALLOWED_ERR_NAME,
-                           errMsg);
-                return QVariantMap();
-            }
-        } else {
-            BLAME() << "Null database handler object.";
-        }
+    QString allowedMechanism;
+    QString errMsg;
+    if (!parent()->checkMechanism(mechanism, allowedMechanism, errMsg)) {
+        errorReply(SIGNOND_METHOD_OR_MECHANISM_NOT_ALLOWED_ERR_NAME, errMsg);
+        return QVariantMap();
     }
 
     QDBusContext &dbusContext = *static_cast<QDBusContext *>(parent());
@@ -121,6 +104,7 @@ QVariantMap SignonAuthSessionAdaptor::process(const QVariantMap &sessionDataVa,
 
 void SignonAuthSessionAdaptor::cancel()
 {
+    SignonMetrics::countRequest("AuthSession.cancel");
     TRACE();
 
     QDBusContext &dbusContext = *static_cast<QDBusContext *>(parent());
@@ -135,6 +119,7 @@ void SignonAuthSessionAdaptor::cancel()
 
 void SignonAuthSessionAdaptor::setId(quint32 id)
 {
+    SignonMetrics::countRequest("AuthSession.setId");
     TRACE();
 
     QDBusContext &dbusContext = *static_cast<QDBusContext *>(parent());
@@ -144,10 +129,66 @@ void SignonAuthSessionAdaptor::setId(quint32 id)
             "object";
         return;
     }
-    if (!AccessControlManagerHelper::instance()->isPeerAllowedToUseIdentity(
-                                    dbusContext.connection(),
-                                    dbusContext.message(),
-                                    id)) {
+    /* The last call wins */
+    cancelPendingSetId();
+
+    AccessControlManagerHelper *acm = AccessControlManagerHelper::instance();
+    if (acm->isPeerKnownToUseIdentity(dbusContext.connection(),
+                                      dbusContext.message(),
+                                      id)) {
+        parent()->setId(id);
+        return;
+    }
+
+    /* The full check might call the access control manager, which can be
+     * slow: run it from the main loop */
+    m_pendingSetId.setPeer(dbusContext.connection(), dbusContext.message());
+    m_pendingSetId.setIdentity(id);
+    m_hasPendingSetId = true;
+    QMetaObject::invokeMethod(this, "checkPendingSetId", Qt::QueuedConnection);
+}
+
+void SignonAuthSessionAdaptor::checkPendingSetId()
+{
+    if (!m_hasPendingSetId || m_setIdReply != 0) return;
+
+    quint32 id = m_pendingSetId.identity();
+    AccessControlManagerHelper *acm = AccessControlManagerHelper::instance();
+    if (acm->isPeerAllowedToUseIdentity(m_pendingSetId.peerConnection(),
+                                        m_pendingSetId.peerMessage(),
+                                        id)) {
+        m_hasPendingSetId = false;
+        parent()->setId(id);
+        return;
+    }
+
+    TRACE() << "setId called with an identifier the peer is not allowed "
+        "to use; asking the access control manager";
+    m_setIdReply =
+        acm->requestAccessToIdentity(m_pendingSetId.peerConnection(),
+                                     m_pendingSetId.peerMessage(),
+                                     id);
+    QObject::connect(m_setIdReply, SIGNAL(finished()),
+                     this, SLOT(onSetIdAccessReplyFinished()));
+}
+
+void SignonAuthSessionAdaptor::onSetIdAccessReplyFinished()
+{
+    SignOn::AccessReply *reply = qobject_cast<SignOn::AccessReply*>(sender());
+    Q_ASSERT(reply != 0);
+
+    reply->deleteLater();
+    if (reply != m_setIdReply) return;
+    m_setIdReply = 0;
+    m_hasPendingSetId = false;
+
+    quint32 id = reply->request().identity();
+    AccessControlManagerHelper *acm = AccessControlManagerHelper::instance();
+
+    if (!reply->isAccepted() ||
+        !acm->isPeerAllowedToUseIdentity(reply->request().peerConnection(),
+                                         reply->request().peerMessage(),
+                                         id)) {
         TRACE() << "setId called with an identifier the peer is not allowed "
             "to use";
         return;
@@ -156,8 +197,17 @@ void SignonAuthSessionAdaptor::setId(quint32 id)
     parent()->setId(id);
 }
 
+void SignonAuthSessionAdaptor::cancelPendingSetId()
+{
+    /* Nobody else is interested in the outcome of the request */
+    delete m_setIdReply;
+    m_setIdReply = 0;
+    m_hasPendingSetId = false;
+}
+
 void SignonAuthSessionAdaptor::objectUnref()
 {
+    SignonMetrics::countRequest("AuthSession.objectUnref");
     TRACE();
 
     QDBusContext &dbusContext = *static_cast<QDBusContext *>(parent());
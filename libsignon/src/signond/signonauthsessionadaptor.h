@@ -28,6 +28,7 @@
 
 #include "signond-common.h"
 #include "signonauthsession.h"
+#include "SignOn/abstract-access-control-manager.h"
 
 namespace SignonDaemonNS {
 
@@ -57,6 +58,18 @@ public Q_SLOTS:
     Q_NOREPLY void setId(quint32 id);
     Q_NOREPLY void objectUnref();
 
+private Q_SLOTS:
+    void checkPendingSetId();
+    void onSetIdAccessReplyFinished();
+
+private:
+    void cancelPendingSetId();
+
+    /* The last setId() call, while its access check is pending */
+    SignOn::AccessRequest m_pendingSetId;
+    bool m_hasPendingSetId;
+    SignOn::AccessReply *m_setIdReply;
+
 Q_SIGNALS:
     void stateChanged(int state, const QString &message);
     void unregistered();
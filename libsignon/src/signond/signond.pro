@@ -24,6 +24,7 @@ HEADERS += \
     credentialsaccessmanager.h \
     credentialsdb.h \
     credentialsdb_p.h \
+    credentialsdbreader.h \
     default-crypto-manager.h \
     default-key-authorizer.h \
     default-secrets-storage.h \
@@ -35,17 +36,21 @@ HEADERS += \
     signondaemonadaptor.h \
     signondaemon.h \
     signondisposable.h \
+    signonmetrics.h \
+    signonmetricsadaptor.h \
     signontrace.h \
     pluginproxy.h \
     signonidentityinfo.h \
     signonui_interface.h \
     signonidentityadaptor.h \
     backupifadaptor.h \
-    signonsessioncoretools.h
+    signonsessioncoretools.h \
+    startupprofile.h
 SOURCES += \
     accesscontrolmanagerhelper.cpp \
     credentialsaccessmanager.cpp \
     credentialsdb.cpp \
+    credentialsdbreader.cpp \
     default-crypto-manager.cpp \
     default-key-authorizer.cpp \
     default-secrets-storage.cpp \
@@ -55,6 +60,8 @@ SOURCES += \
     signonidentity.cpp \
     signondaemonadaptor.cpp \
     signondisposable.cpp \
+    signonmetrics.cpp \
+    signonmetricsadaptor.cpp \
     signonui_interface.cpp \
     pluginproxy.cpp \
     main.cpp \
@@ -62,7 +69,8 @@ SOURCES += \
     signonidentityinfo.cpp \
     signonidentityadaptor.cpp \
     backupifadaptor.cpp \
-    signonsessioncoretools.cpp
+    signonsessioncoretools.cpp \
+    startupprofile.cpp
 INCLUDEPATH += . \
     $${TOP_SRC_DIR}/lib/plugins \
     $${TOP_SRC_DIR}/lib/plugins/signon-plugins-common \
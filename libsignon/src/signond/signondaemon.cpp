@@ -48,10 +48,14 @@ extern "C" {
 #include "signond-common.h"
 #include "signontrace.h"
 #include "signondaemonadaptor.h"
+#include "signonmetricsadaptor.h"
 #include "signonidentity.h"
 #include "signonauthsession.h"
 #include "accesscontrolmanagerhelper.h"
 #include "backupifadaptor.h"
+#include "startupprofile.h"
+
+#include "SignOn/tracebuffer.h"
 
 #define SIGNON_RETURN_IF_CAM_UNAVAILABLE(_ret_arg_) do {                   \
         if (m_pCAMManager && !m_pCAMManager->credentialsSystemOpened()) {  \
@@ -78,7 +82,10 @@ SignonDaemonConfiguration::SignonDaemonConfiguration():
     m_camConfiguration(),
     m_daemonTimeout(0), // 0 = no timeout
     m_identityTimeout(300),//secs
-    m_authSessionTimeout(300)//secs
+    m_authSessionTimeout(300),//secs
+    m_maxConcurrentRequests(1),
+    m_coalesceRequests(false),
+    m_cacheResults(false)
 {}
 
 SignonDaemonConfiguration::~SignonDaemonConfiguration()
@@ -120,6 +127,11 @@ void SignonDaemonConfiguration::load()
         settings.value(QLatin1String("LoggingLevel"), 1).toInt();
     setLoggingLevel(loggingLevel);
 
+    m_coalesceRequests =
+        settings.value(QLatin1String("CoalesceRequests"), false).toBool();
+    m_cacheResults =
+        settings.value(QLatin1String("CacheResults"), false).toBool();
+
     QString cfgStoragePath =
         settings.value(QLatin1String("StoragePath")).toString();
     if (!cfgStoragePath.isEmpty()) {
@@ -171,6 +183,22 @@ void SignonDaemonConfiguration::load()
 
     settings.endGroup();
 
+    //Concurrency
+    settings.beginGroup(QLatin1String("PluginConcurrency"));
+
+    foreach (const QString &key, settings.childKeys()) {
+        aux = settings.value(key).toUInt(&isOk);
+        if (!isOk || aux == 0)
+            continue;
+
+        if (key == QLatin1String("Default"))
+            m_maxConcurrentRequests = aux;
+        else
+            m_methodConcurrentRequests.insert(key, aux);
+    }
+
+    settings.endGroup();
+
     //Environment variables
 
     int value = 0;
@@ -192,6 +220,24 @@ void SignonDaemonConfiguration::load()
         if (value > 0 && isOk) m_authSessionTimeout = value;
     }
 
+    if (environment.contains(QLatin1String("SSO_PLUGIN_CONCURRENCY"))) {
+        value = environment.value(
+            QLatin1String("SSO_PLUGIN_CONCURRENCY")).toInt(&isOk);
+        if (value > 0 && isOk) m_maxConcurrentRequests = value;
+    }
+
+    if (environment.contains(QLatin1String("SSO_COALESCE_REQUESTS"))) {
+        value = environment.value(
+            QLatin1String("SSO_COALESCE_REQUESTS")).toInt(&isOk);
+        if (isOk) m_coalesceRequests = (value != 0);
+    }
+
+    if (environment.contains(QLatin1String("SSO_CACHE_RESULTS"))) {
+        value = environment.value(
+            QLatin1String("SSO_CACHE_RESULTS")).toInt(&isOk);
+        if (isOk) m_cacheResults = (value != 0);
+    }
+
     if (environment.contains(QLatin1String("SSO_LOGGING_LEVEL"))) {
         value = environment.value(
             QLatin1String("SSO_LOGGING_LEVEL")).toInt(&isOk);
@@ -239,6 +285,12 @@ void SignonDaemonConfiguration::load()
     }
 }
 
+uint SignonDaemonConfiguration::maxConcurrentRequests(const QString &method)
+    const
+{
+    return m_methodConcurrentRequests.value(method, m_maxConcurrentRequests);
+}
+
 /* ---------------------- SignonDaemon ---------------------- */
 
 const QString internalServerErrName = SIGNOND_INTERNAL_SERVER_ERR_NAME;
@@ -252,6 +304,9 @@ SignonDaemon::SignonDaemon(QObject *parent):
     QObject(parent),
     m_configuration(0),
     m_pCAMManager(0),
+    m_backup(false),
+    m_extensionsLoaded(false),
+    m_initCompleted(false),
     m_dbusServer(0)
 {
     // Files created by signond must be unreadable by "other"
@@ -346,6 +401,13 @@ void SignonDaemon::handleUnixSignal()
                                       Qt::QueuedConnection);
             break;
         }
+        case SIGUSR1: {
+            if (TraceBuffer::dump())
+                TRACE() << "Trace buffer dumped to" << TraceBuffer::dumpFile();
+            else
+                BLAME() << "Couldn't dump the trace buffer";
+            break;
+        }
         case SIGINT:  {
             TRACE() << "\n\n SIGINT \n\n";
             //gently stop daemon
@@ -379,10 +441,12 @@ SignonDaemon *SignonDaemon::instance()
 
 void SignonDaemon::init()
 {
+    int phase = StartupProfile::begin("configuration");
     if (!(m_configuration = new SignonDaemonConfiguration))
         qWarning("SignonDaemon could not create the configuration object.");
 
     m_configuration->load();
+    StartupProfile::end(phase);
 
     if (getuid() != 0) {
         BLAME() << "Failed to SUID root. Secure storage will not be available.";
@@ -399,6 +463,7 @@ void SignonDaemon::init()
         new CredentialsAccessManager(m_configuration->camConfiguration());
 
     /* backup dbus interface */
+    phase = StartupProfile::begin("backup service registration");
     QDBusConnection sessionConnection = QDBusConnection::sessionBus();
 
     if (!sessionConnection.isConnected()) {
@@ -431,6 +496,7 @@ void SignonDaemon::init()
 
         qFatal("SignonDaemon requires to register backup service");
     }
+    StartupProfile::end(phase);
 
     if (m_backup) {
         TRACE() << "Signond initialized in backup mode.";
@@ -439,6 +505,7 @@ void SignonDaemon::init()
     }
 
     /* DBus Service init */
+    phase = StartupProfile::begin("service registration");
     QDBusConnection connection = SIGNOND_BUS;
 
     if (!connection.isConnected()) {
@@ -454,6 +521,7 @@ void SignonDaemon::init()
         QDBusConnection::ExportAllContents;
 
     (void)new SignonDaemonAdaptor(this);
+    (void)new SignonMetricsAdaptor(this);
     registerOptions = QDBusConnection::ExportAdaptors;
 
     // p2p connection
@@ -486,18 +554,65 @@ void SignonDaemon::init()
                        QLatin1String("org.freedesktop.DBus.Local"),
                        QLatin1String("Disconnected"),
                        this, SLOT(onDisconnected()));
-
-    initExtensions();
-
-    if (!initStorage())
-        BLAME() << "Signond: Cannot initialize credentials storage.";
+    StartupProfile::end(phase);
 
     if (m_configuration->daemonTimeout() > 0) {
         SignonDisposable::invokeOnIdle(m_configuration->daemonTimeout(),
                                        this, SLOT(deleteLater()));
     }
 
+    /* Loading the extensions and opening the storage can take a while
+     * (especially if an encrypted file system must be mounted): do it in
+     * stages, one per main loop iteration, so that the requests queued on
+     * the bus are dispatched in between. Those which need the storage are
+     * resumed by the adaptor once initCompleted() is emitted. */
+    QTimer::singleShot(0, this, SLOT(onDeferredInit()));
+}
+
+/* Runs the next initialization stage; returns false when there are no more
+ * stages to run */
+bool SignonDaemon::runInitStage()
+{
+    if (m_initCompleted || m_backup) return false;
+
+    if (!m_extensionsLoaded) {
+        int phase = StartupProfile::begin("extensions");
+        initExtensions();
+        StartupProfile::end(phase);
+        m_extensionsLoaded = true;
+        return true;
+    }
+
+    int phase = StartupProfile::begin("storage");
+    if (!initStorage())
+        BLAME() << "Signond: Cannot initialize credentials storage.";
+    StartupProfile::end(phase);
+    m_initCompleted = true;
+
     TRACE() << "Signond SUCCESSFULLY initialized.";
+    StartupProfile::setReady();
+
+    /* The access control manager is created with the storage */
+    AccessControlManagerHelper *acm = AccessControlManagerHelper::instance();
+    foreach (const QDBusConnection &connection, m_unwatchedConnections) {
+        if (acm != 0 && connection.isConnected())
+            acm->watchPeerConnection(connection);
+    }
+    m_unwatchedConnections.clear();
+
+    Q_EMIT initCompleted();
+    return false;
+}
+
+void SignonDaemon::completeInit()
+{
+    while (runInitStage()) {}
+}
+
+void SignonDaemon::onDeferredInit()
+{
+    if (runInitStage())
+        QTimer::singleShot(0, this, SLOT(onDeferredInit()));
 }
 
 void SignonDaemon::onNewConnection(const QDBusConnection &connection)
@@ -508,6 +623,16 @@ void SignonDaemon::onNewConnection(const QDBusConnection &connection)
                              this, QDBusConnection::ExportAdaptors)) {
         qFatal("Failed to register SignonDaemon object");
     }
+
+    /* The access control manager is created with the storage */
+    if (!m_initCompleted) {
+        m_unwatchedConnections.append(conn);
+        return;
+    }
+
+    AccessControlManagerHelper *acm = AccessControlManagerHelper::instance();
+    if (acm != 0)
+        acm->watchPeerConnection(conn);
 }
 
 void SignonDaemon::initExtensions()
@@ -614,6 +739,24 @@ int SignonDaemon::authSessionTimeout() const
                                      m_configuration->authSessionTimeout());
 }
 
+bool SignonDaemon::coalesceRequests() const
+{
+    return (m_configuration == NULL ?
+            false : m_configuration->coalesceRequests());
+}
+
+bool SignonDaemon::cacheResults() const
+{
+    return (m_configuration == NULL ?
+            false : m_configuration->cacheResults());
+}
+
+int SignonDaemon::maxConcurrentRequests(const QString &method) const
+{
+    return (m_configuration == NULL ?
+            1 : m_configuration->maxConcurrentRequests(method));
+}
+
 QObject *SignonDaemon::getIdentity(const quint32 id,
                                    QVariantMap &identityData)
 {
@@ -702,6 +845,17 @@ QStringList SignonDaemon::queryMechanisms(const QString &method)
     return mechs;
 }
 
+static QMap<QString, QString> stringFilter(const QVariantMap &filter)
+{
+    QMap<QString, QString> filterLocal;
+    QMapIterator<QString, QVariant> it(filter);
+    while (it.hasNext()) {
+        it.next();
+        filterLocal.insert(it.key(), it.value().toString());
+    }
+    return filterLocal;
+}
+
 QList<QVariantMap> SignonDaemon::queryIdentities(const QVariantMap &filter)
 {
     clearLastError();
@@ -716,14 +870,8 @@ QList<QVariantMap> SignonDaemon::queryIdentities(const QVariantMap &filter)
         return QList<QVariantMap>();
     }
 
-    QMap<QString, QString> filterLocal;
-    QMapIterator<QString, QVariant> it(filter);
-    while (it.hasNext()) {
-        it.next();
-        filterLocal.insert(it.key(), it.value().toString());
-    }
-
-    QList<SignonIdentityInfo> credentials = db->credentials(filterLocal);
+    QList<SignonIdentityInfo> credentials =
+        db->credentials(stringFilter(filter));
 
     if (db->errorOccurred()) {
         setLastError(internalServerErrName,
@@ -739,6 +887,51 @@ QList<QVariantMap> SignonDaemon::queryIdentities(const QVariantMap &filter)
     return mapList;
 }
 
+bool SignonDaemon::queryIdentities(const QVariantMap &filter,
+                                   const QDBusConnection &connection,
+                                   const QDBusMessage &message)
+{
+    if (!m_pCAMManager->credentialsSystemOpened())
+        return false;
+
+    CredentialsDBReader *reader = m_pCAMManager->credentialsDBReader();
+    if (reader == 0)
+        return false;
+
+    TRACE() << "Querying identities in the reader thread";
+    quint64 requestId = reader->queryIdentities(stringFilter(filter), this);
+    m_pendingQueries.insert(requestId, PendingQuery(connection, message));
+    return true;
+}
+
+void SignonDaemon::customEvent(QEvent *event)
+{
+    if (event->type() != IdentitiesQueryEvent::eventType()) {
+        QObject::customEvent(event);
+        return;
+    }
+
+    IdentitiesQueryEvent *queryEvent =
+        static_cast<IdentitiesQueryEvent *>(event);
+    if (!m_pendingQueries.contains(queryEvent->requestId)) {
+        BLAME() << "Unexpected identities query result";
+        return;
+    }
+    PendingQuery query = m_pendingQueries.take(queryEvent->requestId);
+
+    QDBusMessage reply;
+    if (queryEvent->ok) {
+        reply = query.message.createReply(
+            QVariant::fromValue(MapList(queryEvent->identities)));
+    } else {
+        reply = query.message.createErrorReply(
+            internalServerErrName,
+            internalServerErrStr +
+            QLatin1String("Querying database error occurred."));
+    }
+    query.connection.send(reply);
+}
+
 bool SignonDaemon::clear()
 {
     clearLastError();
@@ -752,6 +945,8 @@ bool SignonDaemon::clear()
         return false;
     }
 
+    AccessControlManagerHelper::instance()->clearDecisions();
+
     if (!db->clear()) {
         setLastError(SIGNOND_INTERNAL_SERVER_ERR_NAME,
                      SIGNOND_INTERNAL_SERVER_ERR_STR +
@@ -897,6 +1092,19 @@ bool SignonDaemon::copyFromBackupDir(const QStringList &fileNames) const
     return ok;
 }
 
+/* The metadata DB uses write-ahead logging (see CredentialsDB::init()):
+ * committed transactions might still be in the "-wal" file, which must be
+ * saved and restored together with the DB. The "-shm" index is rebuilt from
+ * it, and is only listed so that a stale one is not left over on restore. */
+static QStringList walFilesOf(const QString &dbName, bool withIndex)
+{
+    QStringList files;
+    files << dbName + QLatin1String("-wal");
+    if (withIndex)
+        files << dbName + QLatin1String("-shm");
+    return files;
+}
+
 bool SignonDaemon::createStorageFileTree(const QStringList &backupFiles) const
 {
     QString storageDirPath = m_configuration->camConfiguration().m_storagePath;
@@ -928,6 +1136,8 @@ bool SignonDaemon::createStorageFileTree(const QStringList &backupFiles) const
 uchar SignonDaemon::backupStarts()
 {
     TRACE() << "backup";
+    completeInit();
+
     if (!m_backup && m_pCAMManager->credentialsSystemOpened())
     {
         m_pCAMManager->closeCredentialsSystem();
@@ -953,6 +1163,9 @@ uchar SignonDaemon::backupStarts()
         return 2;
     }
 
+    /* These are not created if missing: an empty log would be useless */
+    backupFiles << walFilesOf(config.m_dbName, false);
+
     /* perform the copy */
     eraseBackupDir();
     if (!copyToBackupDir(backupFiles)) {
@@ -1000,6 +1213,8 @@ uchar SignonDaemon::restoreStarts()
 uchar SignonDaemon::restoreFinished()
 {
     TRACE() << "restore";
+    completeInit();
+
     //restore requested
     if (m_pCAMManager->credentialsSystemOpened())
     {
@@ -1015,6 +1230,7 @@ uchar SignonDaemon::restoreFinished()
 
     QStringList backupFiles;
     backupFiles << config.m_dbName;
+    backupFiles << walFilesOf(config.m_dbName, true);
     backupFiles << m_pCAMManager->backupFiles();
 
     /* perform the copy */
@@ -80,6 +80,9 @@ public:
     uint daemonTimeout() const { return m_daemonTimeout; }
     uint identityTimeout() const { return m_identityTimeout; }
     uint authSessionTimeout() const { return m_authSessionTimeout; }
+    uint maxConcurrentRequests(const QString &method) const;
+    bool coalesceRequests() const { return m_coalesceRequests; }
+    bool cacheResults() const { return m_cacheResults; }
 
 private:
     QString m_pluginsDir;
@@ -93,6 +96,12 @@ private:
     uint m_daemonTimeout;
     uint m_identityTimeout;
     uint m_authSessionTimeout;
+
+    //plugin processes serving an authentication session at the same time
+    uint m_maxConcurrentRequests;
+    QHash<QString, uint> m_methodConcurrentRequests;
+    bool m_coalesceRequests;
+    bool m_cacheResults;
 };
 
 class SignonIdentity;
@@ -108,6 +117,7 @@ class SignonDaemon: public QObject, protected QDBusContext
 
     friend class SignonSessionCore;
     friend class SignonDaemonAdaptor;
+    friend class SignonMetricsAdaptor;
 
 public:
     static SignonDaemon *instance();
@@ -115,6 +125,22 @@ public:
 
     Q_INVOKABLE void init();
 
+    /*!
+     * Loads the extensions and opens the credentials storage, unless this
+     * has already been done. init() only claims the D-Bus names, and
+     * schedules these stages to run one per main loop iteration; this
+     * method runs the remaining ones at once, for the operations which
+     * cannot wait, such as backup and restore.
+     */
+    void completeInit();
+
+    /*!
+     * Returns whether the extensions have been loaded and the credentials
+     * storage has been opened.
+     * @see initCompleted()
+     */
+    bool isInitCompleted() const { return m_initCompleted; }
+
     /*!
      * Returns the number of seconds of inactivity after which identity
      * objects might be automatically deleted.
@@ -122,6 +148,25 @@ public:
     int identityTimeout() const;
     int authSessionTimeout() const;
 
+    /*!
+     * Returns how many requests of one authentication session using the
+     * given method can be processed in parallel, each by its own plugin
+     * process.
+     */
+    int maxConcurrentRequests(const QString &method) const;
+
+    /*!
+     * Returns whether identical non-interactive authentication requests
+     * should share the reply of the one already being processed.
+     */
+    bool coalesceRequests() const;
+
+    /*!
+     * Returns whether plugin results which declare a validity period can be
+     * given again to identical non-interactive requests.
+     */
+    bool cacheResults() const;
+
 public:
     QObject *registerNewIdentity();
     QObject *getIdentity(const quint32 id, QVariantMap &identityData);
@@ -131,13 +176,24 @@ public:
     QStringList queryMethods();
     QStringList queryMechanisms(const QString &method);
     QList<QVariantMap> queryIdentities(const QVariantMap &filter);
+    bool queryIdentities(const QVariantMap &filter,
+                         const QDBusConnection &connection,
+                         const QDBusMessage &message);
     bool clear();
 
     QString lastErrorName() const { return m_lastErrorName; }
     QString lastErrorMessage() const { return m_lastErrorMessage; }
     bool lastErrorIsValid() const { return !m_lastErrorName.isEmpty(); }
 
+Q_SIGNALS:
+    /*!
+     * Emitted once the extensions have been loaded and the credentials
+     * storage has been opened.
+     */
+    void initCompleted();
+
 private Q_SLOTS:
+    void onDeferredInit();
     void onDisconnected();
     void onNewConnection(const QDBusConnection &connection);
     void onIdentityStored(SignonIdentity *identity);
@@ -154,6 +210,7 @@ private:
     void initExtensions();
     void initExtension(const QString &filePath);
     bool initStorage();
+    bool runInitStage();
 
     void watchIdentity(SignonIdentity *identity);
     void setupSignalHandlers();
@@ -166,6 +223,9 @@ private:
     void setLastError(const QString &name, const QString &msg);
     void clearLastError();
 
+protected:
+    void customEvent(QEvent *event);
+
 private:
     /*
      * The list of created SignonIdentities
@@ -180,6 +240,9 @@ private:
     CredentialsAccessManager *m_pCAMManager;
 
     bool m_backup;
+    bool m_extensionsLoaded;
+    bool m_initCompleted;
+    QList<QDBusConnection> m_unwatchedConnections;
 
     int m_identityTimeout;
     int m_authSessionTimeout;
@@ -189,6 +252,19 @@ private:
     QString m_lastErrorName;
     QString m_lastErrorMessage;
 
+    /*
+     * Identity queries being served by the CredentialsDBReader
+     * */
+    struct PendingQuery {
+        PendingQuery(): connection(QString()) {}
+        PendingQuery(const QDBusConnection &connection,
+                     const QDBusMessage &message):
+            connection(connection), message(message) {}
+        QDBusConnection connection;
+        QDBusMessage message;
+    };
+    QHash<quint64, PendingQuery> m_pendingQueries;
+
     /*
      * UNIX signals handling related
      * */
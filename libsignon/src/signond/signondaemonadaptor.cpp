@@ -26,33 +26,131 @@
 
 #include "signondaemonadaptor.h"
 #include "signondisposable.h"
+#include "signonauthsession.h"
 #include "accesscontrolmanagerhelper.h"
+#include "signonmetrics.h"
+#include "startupprofile.h"
 
 namespace SignonDaemonNS {
 
 SignonDaemonAdaptor::SignonDaemonAdaptor(SignonDaemon *parent):
     QDBusAbstractAdaptor(parent),
-    m_parent(parent)
+    m_parent(parent),
+    m_resumedRequest(0)
 {
     setAutoRelaySignals(false);
+    QObject::connect(parent, SIGNAL(initCompleted()),
+                     this, SLOT(onInitCompleted()));
 }
 
 SignonDaemonAdaptor::~SignonDaemonAdaptor()
 {
 }
 
+QDBusConnection SignonDaemonAdaptor::connection() const
+{
+    return m_resumedRequest != 0 ?
+        m_resumedRequest->connection : parentDBusContext().connection();
+}
+
+const QDBusMessage &SignonDaemonAdaptor::message() const
+{
+    return m_resumedRequest != 0 ?
+        m_resumedRequest->message : parentDBusContext().message();
+}
+
+void SignonDaemonAdaptor::countRequest(const char *methodName)
+{
+    /* Resumed requests have already been counted */
+    if (m_resumedRequest == 0)
+        SignonMetrics::countRequest(methodName);
+}
+
+bool SignonDaemonAdaptor::deferUntilInitialized(Operation operation)
+{
+    if (m_parent->isInitCompleted()) return false;
+
+    TRACE() << "Deferring" << message().member() << "until initialized";
+    message().setDelayedReply(true);
+    m_pendingRequests.append(PendingRequest(operation, connection(),
+                                            message()));
+    return true;
+}
+
+void SignonDaemonAdaptor::onInitCompleted()
+{
+    QList<PendingRequest> requests = m_pendingRequests;
+    m_pendingRequests.clear();
+
+    foreach (const PendingRequest &request, requests)
+        resumeRequest(request);
+}
+
+void SignonDaemonAdaptor::resumeRequest(const PendingRequest &request)
+{
+    const QVariantList args = request.message.arguments();
+    QVariantList replyArgs;
+
+    /* The methods mark the message again if they take care of the reply */
+    request.message.setDelayedReply(false);
+    m_resumedRequest = &request;
+
+    switch (request.operation) {
+    case RegisterNewIdentity:
+        {
+            QDBusObjectPath objectPath;
+            registerNewIdentity(objectPath);
+            replyArgs << QVariant::fromValue(objectPath);
+        }
+        break;
+    case GetIdentity:
+        {
+            QDBusObjectPath objectPath;
+            QVariantMap identityData;
+            getIdentity(args.value(0).toUInt(), objectPath, identityData);
+            replyArgs << QVariant::fromValue(objectPath) << identityData;
+        }
+        break;
+    case GetAuthSessionObjectPath:
+        replyArgs << getAuthSessionObjectPath(args.value(0).toUInt(),
+                                              args.value(1).toString());
+        break;
+    case ProcessWithIdentity:
+        processWithIdentity(args.value(0).toUInt(),
+                            args.value(1).toString(),
+                            qdbus_cast<QDBusObjectPath>(args.value(2)),
+                            qdbus_cast<QVariantMap>(args.value(3)),
+                            args.value(4).toString());
+        break;
+    case QueryIdentities:
+        queryIdentities(qdbus_cast<QVariantMap>(args.value(0)));
+        break;
+    case Clear:
+        replyArgs << clear();
+        break;
+    }
+
+    m_resumedRequest = 0;
+    if (!request.message.isDelayedReply())
+        request.connection.send(request.message.createReply(replyArgs));
+}
+
 void SignonDaemonAdaptor::registerNewIdentity(QDBusObjectPath &objectPath)
 {
+    countRequest("AuthService.registerNewIdentity");
+    if (deferUntilInitialized(RegisterNewIdentity)) return;
+    AccessControlManagerHelper::instance()->prefetchPeer(connection(),
+                                                         message());
+
     QObject *identity = m_parent->registerNewIdentity();
-    objectPath = registerObject(parentDBusContext().connection(), identity);
+    objectPath = registerObject(connection(), identity);
 
     SignonDisposable::destroyUnused();
 }
 
 void SignonDaemonAdaptor::securityErrorReply()
 {
-    securityErrorReply(parentDBusContext().connection(),
-                       parentDBusContext().message());
+    securityErrorReply(connection(), message());
 }
 
 void SignonDaemonAdaptor::securityErrorReply(const QDBusConnection &conn,
@@ -86,9 +184,10 @@ bool SignonDaemonAdaptor::handleLastError(const QDBusConnection &conn,
 
 QDBusObjectPath
 SignonDaemonAdaptor::registerObject(const QDBusConnection &connection,
-                                    QObject *object)
+                                    QObject *object, bool *ok)
 {
     QString path = object->objectName();
+    bool registered = true;
 
     if (connection.objectRegisteredAt(path) != object) {
         QDBusConnection conn(connection);
@@ -96,8 +195,10 @@ SignonDaemonAdaptor::registerObject(const QDBusConnection &connection,
                                  QDBusConnection::ExportAdaptors)) {
             BLAME() << "Object registration failed:" << object <<
                 conn.lastError();
+            registered = false;
         }
     }
+    if (ok != 0) *ok = registered;
     return QDBusObjectPath(path);
 }
 
@@ -105,9 +206,13 @@ void SignonDaemonAdaptor::getIdentity(const quint32 id,
                                       QDBusObjectPath &objectPath,
                                       QVariantMap &identityData)
 {
+    countRequest("AuthService.getIdentity");
+    if (deferUntilInitialized(GetIdentity)) return;
+
     AccessControlManagerHelper *acm = AccessControlManagerHelper::instance();
-    QDBusMessage msg = parentDBusContext().message();
-    QDBusConnection conn = parentDBusContext().connection();
+    QDBusMessage msg = message();
+    QDBusConnection conn = connection();
+    acm->prefetchPeer(conn, msg);
     if (!acm->isPeerAllowedToUseIdentity(conn, msg, id)) {
         SignOn::AccessReply *reply =
             acm->requestAccessToIdentity(conn, msg, id);
@@ -158,17 +263,20 @@ void SignonDaemonAdaptor::onIdentityAccessReplyFinished()
 
 QStringList SignonDaemonAdaptor::queryMethods()
 {
+    SignonMetrics::countRequest("AuthService.queryMethods");
     return m_parent->queryMethods();
 }
 
 QString SignonDaemonAdaptor::getAuthSessionObjectPath(const quint32 id,
                                                       const QString &type)
 {
+    countRequest("AuthService.getAuthSessionObjectPath");
+    if (deferUntilInitialized(GetAuthSessionObjectPath)) return QString();
     SignonDisposable::destroyUnused();
 
     AccessControlManagerHelper *acm = AccessControlManagerHelper::instance();
-    QDBusMessage msg = parentDBusContext().message();
-    QDBusConnection conn = parentDBusContext().connection();
+    QDBusMessage msg = message();
+    QDBusConnection conn = connection();
 
     /* Access Control */
     if (id != SIGNOND_NEW_IDENTITY) {
@@ -225,11 +333,211 @@ void SignonDaemonAdaptor::onAuthSessionAccessReplyFinished()
     SignonDisposable::destroyUnused();
 }
 
+/* The client chooses the path of the session created by
+ * processWithIdentity(), so that it can listen to its signals before the
+ * processing starts. Such paths have their own prefix, so that they cannot
+ * collide with the ones we choose, and end with a UUID, so that they cannot
+ * be guessed by other clients. */
+static bool isValidAuthSessionPath(const QDBusConnection &connection,
+                                   const QString &path)
+{
+    QString prefix = SIGNOND_CLIENT_AUTH_SESSION_OBJECTPATH_PREFIX;
+    if (!path.startsWith(prefix) || path.length() != prefix.length() + 32)
+        return false;
+
+    for (int i = prefix.length(); i < path.length(); i++) {
+        char c = path.at(i).toLatin1();
+        if (!(c >= '0' && c <= '9') && !(c >= 'a' && c <= 'f'))
+            return false;
+    }
+    return connection.objectRegisteredAt(path) == 0;
+}
+
+/*
+ * Stands at the object path chosen for a session by processWithIdentity()
+ * while the access control manager decides whether the session can be
+ * created: the client might already be calling cancel() on it, or drop it.
+ * Like SignonAuthSessionAdaptor, it only obeys the process which requested
+ * the session.
+ */
+class PendingAuthSession: public QObject, protected QDBusContext
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface",
+                "com.google.code.AccountsSSO.SingleSignOn.AuthSession")
+
+public:
+    PendingAuthSession(pid_t ownerPid, QObject *parent):
+        QObject(parent),
+        m_ownerPid(ownerPid),
+        m_canceled(false)
+    {
+    }
+
+    bool isCanceled() const { return m_canceled; }
+
+public Q_SLOTS:
+    Q_NOREPLY void cancel() { cancelIfOwner("cancel"); }
+    Q_NOREPLY void objectUnref() { cancelIfOwner("objectUnref"); }
+
+private:
+    void cancelIfOwner(const char *methodName)
+    {
+        if (AccessControlManagerHelper::pidOfPeer(*this) != m_ownerPid) {
+            TRACE() << methodName << "called from peer that doesn't own "
+                "the AuthSession object";
+            return;
+        }
+        m_canceled = true;
+    }
+
+    pid_t m_ownerPid;
+    bool m_canceled;
+};
+
+QVariantMap SignonDaemonAdaptor::processWithIdentity(
+                                            const quint32 id,
+                                            const QString &type,
+                                            const QDBusObjectPath &objectPath,
+                                            const QVariantMap &sessionData,
+                                            const QString &mechanism)
+{
+    countRequest("AuthService.processWithIdentity");
+    if (deferUntilInitialized(ProcessWithIdentity)) return QVariantMap();
+    SignonDisposable::destroyUnused();
+
+    AccessControlManagerHelper *acm = AccessControlManagerHelper::instance();
+    QDBusMessage msg = message();
+    QDBusConnection conn = connection();
+    msg.setDelayedReply(true);
+
+    if (!isValidAuthSessionPath(conn, objectPath.path())) {
+        conn.send(msg.createErrorReply(SIGNOND_INVALID_QUERY_ERR_NAME,
+                                       SIGNOND_INVALID_QUERY_ERR_STR));
+        return QVariantMap();
+    }
+
+    /* Access Control */
+    if (id != SIGNOND_NEW_IDENTITY) {
+        if (!acm->isPeerAllowedToUseAuthSession(conn, msg, id)) {
+            SignOn::AccessReply *reply =
+                acm->requestAccessToIdentity(conn, msg, id);
+            /* If the request is accepted, we'll need all the parameters in
+             * order to create the authsession and start the processing. */
+            reply->setProperty("type", type);
+            reply->setProperty("path", objectPath.path());
+            reply->setProperty("sessionData", sessionData);
+            reply->setProperty("mechanism", mechanism);
+            QObject::connect(reply, SIGNAL(finished()),
+                             this, SLOT(onProcessAccessReplyFinished()));
+
+            /* Hold the path, so that the calls made to the session before
+             * the decision don't get lost */
+            PendingAuthSession *pending =
+                new PendingAuthSession(acm->pidOfPeer(conn, msg), reply);
+            if (!conn.registerObject(objectPath.path(), pending,
+                                     QDBusConnection::ExportAllSlots)) {
+                BLAME() << "Couldn't hold the session path:" <<
+                    conn.lastError();
+                delete pending;
+            }
+            return QVariantMap();
+        }
+    }
+
+    processWithIdentity(conn, msg, id, type, objectPath.path(),
+                        sessionData, mechanism);
+    return QVariantMap();
+}
+
+void SignonDaemonAdaptor::onProcessAccessReplyFinished()
+{
+    SignOn::AccessReply *reply = qobject_cast<SignOn::AccessReply*>(sender());
+    Q_ASSERT(reply != 0);
+
+    reply->deleteLater();
+    QDBusConnection connection = reply->request().peerConnection();
+    QDBusMessage message = reply->request().peerMessage();
+    quint32 id = reply->request().identity();
+    AccessControlManagerHelper *acm = AccessControlManagerHelper::instance();
+
+    QString path = reply->property("path").toString();
+    PendingAuthSession *pending = reply->findChild<PendingAuthSession *>();
+    if (pending != 0 && connection.objectRegisteredAt(path) == pending)
+        connection.unregisterObject(path);
+
+    if (!reply->isAccepted() ||
+        !acm->isPeerAllowedToUseIdentity(connection, message, id)) {
+        securityErrorReply(connection, message);
+        TRACE() << "still not allowed";
+        return;
+    }
+
+    if (pending != 0 && pending->isCanceled()) {
+        TRACE() << "Session canceled while waiting for access";
+        connection.send(message.createErrorReply(
+                SIGNOND_SESSION_CANCELED_ERR_NAME,
+                SIGNOND_SESSION_CANCELED_ERR_STR));
+        return;
+    }
+
+    if (!isValidAuthSessionPath(connection, path)) {
+        connection.send(message.createErrorReply(SIGNOND_INVALID_QUERY_ERR_NAME,
+                                                 SIGNOND_INVALID_QUERY_ERR_STR));
+        return;
+    }
+
+    processWithIdentity(connection, message, id,
+                        reply->property("type").toString(), path,
+                        reply->property("sessionData").toMap(),
+                        reply->property("mechanism").toString());
+}
+
+void SignonDaemonAdaptor::processWithIdentity(const QDBusConnection &connection,
+                                              const QDBusMessage &message,
+                                              quint32 id, const QString &type,
+                                              const QString &path,
+                                              const QVariantMap &sessionData,
+                                              const QString &mechanism)
+{
+    TRACE() << "ACM passed, creating AuthSession object at" << path;
+    pid_t ownerPid =
+        AccessControlManagerHelper::instance()->pidOfPeer(connection, message);
+    QObject *object = m_parent->getAuthSession(id, type, ownerPid);
+    if (handleLastError(connection, message)) return;
+
+    SignonAuthSession *authSession = qobject_cast<SignonAuthSession*>(object);
+    Q_ASSERT(authSession != 0);
+
+    QString allowedMechanism;
+    QString errMsg;
+    if (!authSession->checkMechanism(mechanism, allowedMechanism, errMsg)) {
+        connection.send(message.createErrorReply(
+                SIGNOND_METHOD_OR_MECHANISM_NOT_ALLOWED_ERR_NAME, errMsg));
+        delete authSession;
+        return;
+    }
+
+    authSession->setObjectName(path);
+    bool registered;
+    registerObject(connection, authSession, &registered);
+    if (!registered) {
+        connection.send(message.createErrorReply(
+                SIGNOND_INTERNAL_SERVER_ERR_NAME,
+                SIGNOND_INTERNAL_SERVER_ERR_STR));
+        delete authSession;
+        return;
+    }
+
+    authSession->processRequest(connection, message,
+                                sessionData, allowedMechanism);
+}
+
 QStringList SignonDaemonAdaptor::queryMechanisms(const QString &method)
 {
+    SignonMetrics::countRequest("AuthService.queryMechanisms");
     QStringList mechanisms = m_parent->queryMechanisms(method);
-    if (handleLastError(parentDBusContext().connection(),
-                        parentDBusContext().message())) {
+    if (handleLastError(connection(), message())) {
         return QStringList();
     }
 
@@ -238,9 +546,12 @@ QStringList SignonDaemonAdaptor::queryMechanisms(const QString &method)
 
 void SignonDaemonAdaptor::queryIdentities(const QVariantMap &filter)
 {
+    countRequest("AuthService.queryIdentities");
+    if (deferUntilInitialized(QueryIdentities)) return;
+
     /* Access Control */
-    QDBusMessage msg = parentDBusContext().message();
-    QDBusConnection conn = parentDBusContext().connection();
+    QDBusMessage msg = message();
+    QDBusConnection conn = connection();
     if (!AccessControlManagerHelper::instance()->isPeerKeychainWidget(conn,
                                                                       msg)) {
         securityErrorReply();
@@ -248,6 +559,11 @@ void SignonDaemonAdaptor::queryIdentities(const QVariantMap &filter)
     }
 
     msg.setDelayedReply(true);
+
+    /* Prefer serving the query from the reader thread, so that other clients
+     * don't have to wait for it */
+    if (m_parent->queryIdentities(filter, conn, msg)) return;
+
     MapList identities = m_parent->queryIdentities(filter);
     if (handleLastError(conn, msg)) return;
 
@@ -257,9 +573,12 @@ void SignonDaemonAdaptor::queryIdentities(const QVariantMap &filter)
 
 bool SignonDaemonAdaptor::clear()
 {
+    countRequest("AuthService.clear");
+    if (deferUntilInitialized(Clear)) return false;
+
     /* Access Control */
-    QDBusMessage msg = parentDBusContext().message();
-    QDBusConnection conn = parentDBusContext().connection();
+    QDBusMessage msg = message();
+    QDBusConnection conn = connection();
     if (!AccessControlManagerHelper::instance()->isPeerKeychainWidget(conn,
                                                                       msg)) {
         securityErrorReply();
@@ -272,4 +591,12 @@ bool SignonDaemonAdaptor::clear()
     return ok;
 }
 
+QString SignonDaemonAdaptor::startupProfile()
+{
+    SignonMetrics::countRequest("AuthService.startupProfile");
+    return StartupProfile::toJson();
+}
+
 } //namespace SignonDaemonNS
+
+#include "signondaemonadaptor.moc"
@@ -54,27 +54,74 @@ public Q_SLOTS:
     void getIdentity(const quint32 id, QDBusObjectPath &objectPath,
                      QVariantMap &identityData);
     QString getAuthSessionObjectPath(const quint32 id, const QString &type);
+    QVariantMap processWithIdentity(const quint32 id, const QString &type,
+                                    const QDBusObjectPath &objectPath,
+                                    const QVariantMap &sessionData,
+                                    const QString &mechanism);
 
     QStringList queryMethods();
     QStringList queryMechanisms(const QString &method);
     void queryIdentities(const QVariantMap &filter);
     bool clear();
+    QString startupProfile();
 
 private:
+    /* The methods which need the credentials storage */
+    enum Operation {
+        RegisterNewIdentity = 0,
+        GetIdentity,
+        GetAuthSessionObjectPath,
+        ProcessWithIdentity,
+        QueryIdentities,
+        Clear
+    };
+
+    struct PendingRequest {
+        PendingRequest(Operation operation,
+                       const QDBusConnection &connection,
+                       const QDBusMessage &message):
+            operation(operation),
+            connection(connection),
+            message(message)
+        {}
+        Operation operation;
+        QDBusConnection connection;
+        QDBusMessage message;
+    };
+
+    /* These return the context of the request being resumed, if any, or
+     * of the current D-Bus call */
+    QDBusConnection connection() const;
+    const QDBusMessage &message() const;
+
+    void countRequest(const char *methodName);
+    bool deferUntilInitialized(Operation operation);
+    void resumeRequest(const PendingRequest &request);
     void securityErrorReply();
     void securityErrorReply(const QDBusConnection &connection,
                             const QDBusMessage &message);
     bool handleLastError(const QDBusConnection &connection,
                          const QDBusMessage &message);
     QDBusObjectPath registerObject(const QDBusConnection &connection,
-                                   QObject *object);
+                                   QObject *object, bool *ok = 0);
+    void processWithIdentity(const QDBusConnection &connection,
+                             const QDBusMessage &message,
+                             quint32 id, const QString &type,
+                             const QString &path,
+                             const QVariantMap &sessionData,
+                             const QString &mechanism);
 
 private Q_SLOTS:
+    void onInitCompleted();
     void onIdentityAccessReplyFinished();
     void onAuthSessionAccessReplyFinished();
+    void onProcessAccessReplyFinished();
 
 private:
     SignonDaemon *m_parent;
+    /* Requests waiting for SignonDaemon::initCompleted() */
+    QList<PendingRequest> m_pendingRequests;
+    const PendingRequest *m_resumedRequest;
 }; //class SignonDaemonAdaptor
 
 } //namespace SignonDaemonNS
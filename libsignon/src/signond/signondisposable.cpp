@@ -22,28 +22,85 @@
 
 #include "signondisposable.h"
 
+#include <QBasicTimer>
 #include <QTimer>
+#include <QTimerEvent>
+#include <climits>
+#include <time.h>
 
 namespace SignonDaemonNS {
 
-static QList<SignonDisposable *> disposableObjects;
+/* Disposable objects whose autodestruction is enabled, ordered by the
+ * (monotonic, in milliseconds) time at which they expire. */
+typedef QMultiMap<qint64, SignonDisposable *> DeadlineQueue;
+
+static DeadlineQueue expirationQueue;
+static int disposableCount = 0;
 static QPointer<QTimer> notifyTimer = 0;
-static QPointer<QTimer> disposeTimer = 0;
+
+class DisposeTimer: public QObject
+{
+public:
+    DisposeTimer(QObject *parent):
+        QObject(parent),
+        m_deadline(0)
+    {
+    }
+
+    /* Make sure that the timer fires not later than @deadline */
+    void schedule(qint64 deadline, qint64 now);
+
+protected:
+    void timerEvent(QTimerEvent *event);
+
+private:
+    QBasicTimer m_timer;
+    qint64 m_deadline;
+};
+
+static QPointer<DisposeTimer> disposeTimer = 0;
+
+static bool monotonicTime(qint64 &msecs)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+        qWarning("Couldn't get time from monotonic clock");
+        return false;
+    }
+    msecs = qint64(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+    return true;
+}
+
+void DisposeTimer::schedule(qint64 deadline, qint64 now)
+{
+    if (m_timer.isActive() && m_deadline <= deadline)
+        return;
+
+    m_deadline = deadline;
+    m_timer.start(int(qBound(qint64(0), deadline - now, qint64(INT_MAX))),
+                  this);
+}
+
+void DisposeTimer::timerEvent(QTimerEvent *event)
+{
+    if (event->timerId() != m_timer.timerId()) {
+        QObject::timerEvent(event);
+        return;
+    }
+
+    m_timer.stop();
+    /* This will reschedule the timer for the next deadline, if any */
+    SignonDisposable::destroyUnused();
+}
 
 SignonDisposable::SignonDisposable(int maxInactivity, QObject *parent):
     QObject(parent),
     maxInactivity(maxInactivity),
+    deadline(0),
     autoDestruct(true)
 {
-    disposableObjects.append(this);
-
-    if (disposeTimer != 0) {
-        int interval = (maxInactivity + 2) * 1000;
-        if (interval > disposeTimer->interval())
-            disposeTimer->setInterval(interval);
-        QObject::connect(disposeTimer, SIGNAL(timeout()),
-                         this, SLOT(destroyUnused()));
-    }
+    disposableCount++;
 
     // mark as used
     keepInUse();
@@ -51,25 +108,43 @@ SignonDisposable::SignonDisposable(int maxInactivity, QObject *parent):
 
 SignonDisposable::~SignonDisposable()
 {
-    disposableObjects.removeOne(this);
+    unschedule();
+
+    disposableCount--;
+    if (disposableCount == 0 && notifyTimer != 0) {
+        TRACE() << "No disposable objects, starting notification timer";
+        notifyTimer->start();
+    }
 }
 
-void SignonDisposable::keepInUse() const
+void SignonDisposable::unschedule() const
 {
-    struct timespec ts;
+    if (deadline != 0) {
+        expirationQueue.remove(deadline,
+                               const_cast<SignonDisposable *>(this));
+        deadline = 0;
+    }
+}
 
-    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
-        qWarning("Couldn't get time from monotonic clock");
-        return;
+void SignonDisposable::keepInUse() const
+{
+    qint64 now;
+    if (!monotonicTime(now)) return;
+
+    unschedule();
+    if (autoDestruct) {
+        /* The object expires once it has been inactive for more than
+         * maxInactivity seconds. */
+        deadline = now + maxInactivity * 1000 + 1;
+        expirationQueue.insert(deadline,
+                               const_cast<SignonDisposable *>(this));
+        if (disposeTimer != 0)
+            disposeTimer->schedule(deadline, now);
     }
-    lastActivity = ts.tv_sec;
 
     if (notifyTimer != 0) {
         notifyTimer->stop();
     }
-    if (disposeTimer != 0) {
-        disposeTimer->start();
-    }
 }
 
 void SignonDisposable::setAutoDestruct(bool value) const
@@ -88,43 +163,41 @@ void SignonDisposable::invokeOnIdle(int maxInactivity,
                      object, member);
 
     /* In addition to the notifyTimer, we create another timer to let
-     * destroyUnused() to run when we expect that some SignonDisposable object
-     * might be inactive: that is, a couple of seconds later than the maximum
-     * inactivity interval. This timer is triggered by the keepInUse() method.
+     * destroyUnused() run when the first SignonDisposable object in the
+     * expiration queue becomes inactive.
      */
-    disposeTimer = new QTimer(object);
-    disposeTimer->setSingleShot(true);
-    int disposableMaxInactivity = 0;
-    foreach (SignonDisposable *disposable, disposableObjects) {
-        QObject::connect(disposeTimer, SIGNAL(timeout()),
-                         disposable, SLOT(destroyUnused()));
-        if (disposableMaxInactivity < disposable->maxInactivity)
-            disposableMaxInactivity = disposable->maxInactivity;
+    disposeTimer = new DisposeTimer(object);
+    if (!expirationQueue.isEmpty()) {
+        qint64 now;
+        if (monotonicTime(now))
+            disposeTimer->schedule(expirationQueue.constBegin().key(), now);
     }
-
-    // Add a couple of seconds, to run the check after the objects are inactive
-    disposeTimer->setInterval((disposableMaxInactivity + 2) * 1000);
 }
 
 void SignonDisposable::destroyUnused()
 {
-    struct timespec ts;
+    qint64 now;
+    if (!monotonicTime(now)) return;
+
+    while (!expirationQueue.isEmpty()) {
+        DeadlineQueue::iterator first = expirationQueue.begin();
+        if (first.key() > now) {
+            if (disposeTimer != 0)
+                disposeTimer->schedule(first.key(), now);
+            break;
+        }
 
-    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
-        qWarning("Couldn't get time from monotonic clock");
-        return;
-    }
+        SignonDisposable *object = first.value();
+        expirationQueue.erase(first);
+        object->deadline = 0;
 
-    foreach (SignonDisposable *object, disposableObjects) {
-        if (object->autoDestruct &&
-            (ts.tv_sec - object->lastActivity > object->maxInactivity)) {
-            TRACE() << "Object unused, deleting: " << object;
-            object->destroy();
-            disposableObjects.removeOne(object);
-        }
+        /* destroy() might decide to keep the object alive, in which case
+         * it will call keepInUse() and reschedule it. */
+        TRACE() << "Object unused, deleting: " << object;
+        object->destroy();
     }
 
-    if (disposableObjects.isEmpty() && notifyTimer != 0) {
+    if (disposableCount == 0 && notifyTimer != 0) {
         TRACE() << "No disposable objects, starting notification timer";
         notifyTimer->start();
     }
@@ -26,7 +26,6 @@
 #include "signond-common.h"
 
 #include <QtCore>
-#include <time.h>
 
 namespace SignonDaemonNS {
 
@@ -72,6 +71,11 @@ public:
      */
     void setAutoDestruct(bool value = true) const;
 
+    /*!
+     * @returns whether autodestruction is enabled.
+     */
+    bool isAutoDestruct() const { return autoDestruct; }
+
     /*!
      * Invoke the specified method on @object when there are no
      * disposable objects for more than @maxInactivity seconds.
@@ -87,12 +91,16 @@ public Q_SLOTS:
     /*!
      * Deletes all disposable object for which the inactivity time has
      * elapsed.
+     * Objects are kept ordered by their expiration deadline, so this only
+     * visits the objects which are actually expired.
      */
     static void destroyUnused();
 
 private:
+    void unschedule() const;
+
     int maxInactivity;
-    mutable time_t lastActivity;
+    mutable qint64 deadline;
     mutable bool autoDestruct;
 }; //class SignonDaemon
 
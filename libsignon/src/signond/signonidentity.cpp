@@ -36,6 +36,8 @@
 
 #include "accesscontrolmanagerhelper.h"
 #include "signonidentityadaptor.h"
+#include "signonsessioncore.h"
+#include "signonmetrics.h"
 
 #define SIGNON_RETURN_IF_CAM_UNAVAILABLE(_ret_arg_) do {                          \
         if (!(CredentialsAccessManager::instance()->credentialsSystemOpened())) { \
@@ -85,7 +87,8 @@ private:
 SignonIdentity::SignonIdentity(quint32 id, int timeout,
                                SignonDaemon *parent):
     SignonDisposable(timeout, parent),
-    m_pInfo(NULL)
+    m_pInfo(NULL),
+    m_resumedCall(0)
 {
     m_id = id;
 
@@ -109,6 +112,8 @@ SignonIdentity::SignonIdentity(quint32 id, int timeout,
     CredentialsDB *db = CredentialsAccessManager::instance()->credentialsDB();
     QObject::connect(db, SIGNAL(credentialsUpdated(quint32)),
                      this, SLOT(onCredentialsUpdated(quint32)));
+
+    SignonMetrics::add(SignonMetrics::LiveIdentities);
 }
 
 SignonIdentity::~SignonIdentity()
@@ -117,6 +122,8 @@ SignonIdentity::~SignonIdentity()
 
     delete m_signonui;
     delete m_pInfo;
+
+    SignonMetrics::add(SignonMetrics::LiveIdentities, -1);
 }
 
 SignonIdentity *SignonIdentity::createIdentity(quint32 id, SignonDaemon *parent)
@@ -132,6 +139,60 @@ void SignonIdentity::destroy()
     deleteLater();
 }
 
+QDBusConnection SignonIdentity::connection() const
+{
+    return m_resumedCall != 0 ?
+        m_resumedCall->connection : QDBusContext::connection();
+}
+
+const QDBusMessage &SignonIdentity::message() const
+{
+    return m_resumedCall != 0 ?
+        m_resumedCall->message : QDBusContext::message();
+}
+
+void SignonIdentity::sendErrorReply(const QString &name,
+                                    const QString &msg) const
+{
+    if (m_resumedCall == 0) {
+        QDBusContext::sendErrorReply(name, msg);
+        return;
+    }
+
+    m_resumedCall->connection.send(
+        m_resumedCall->message.createErrorReply(name, msg));
+    m_resumedCall->replied = true;
+}
+
+void SignonIdentity::setDelayedReply(bool enable) const
+{
+    if (m_resumedCall == 0) {
+        QDBusContext::setDelayedReply(enable);
+        return;
+    }
+
+    /* The reply to a resumed call is always delayed: here we only record
+     * that it will be sent by someone else than the adaptor */
+    if (enable)
+        m_resumedCall->replied = true;
+}
+
+void SignonIdentity::beginResumedCall(const QDBusConnection &connection,
+                                      const QDBusMessage &message)
+{
+    Q_ASSERT(m_resumedCall == 0);
+    m_resumedCall = new ResumedCall(connection, message);
+}
+
+bool SignonIdentity::endResumedCall()
+{
+    Q_ASSERT(m_resumedCall != 0);
+    bool replied = m_resumedCall->replied;
+    delete m_resumedCall;
+    m_resumedCall = 0;
+    return replied;
+}
+
 SignonIdentityInfo SignonIdentity::queryInfo(bool &ok, bool queryPassword)
 {
     ok = true;
@@ -180,11 +241,9 @@ bool SignonIdentity::addReference(const QString &reference)
         BLAME() << "NULL database handler object.";
         return false;
     }
-    const QDBusContext &context = static_cast<QDBusContext>(*this);
     QString appId =
-        AccessControlManagerHelper::instance()->appIdOfPeer(
-                                                   context.connection(),
-                                                   context.message());
+        AccessControlManagerHelper::instance()->appIdOfPeer(connection(),
+                                                            message());
     keepInUse();
     return db->addReference(m_id, appId, reference);
 }
@@ -200,11 +259,9 @@ bool SignonIdentity::removeReference(const QString &reference)
         BLAME() << "NULL database handler object.";
         return false;
     }
-    const QDBusContext &context = static_cast<QDBusContext>(*this);
     QString appId =
-        AccessControlManagerHelper::instance()->appIdOfPeer(
-                                                   context.connection(),
-                                                   context.message());
+        AccessControlManagerHelper::instance()->appIdOfPeer(connection(),
+                                                            message());
     keepInUse();
     return db->removeReference(m_id, appId, reference);
 }
@@ -352,6 +409,9 @@ void SignonIdentity::remove()
 {
     SIGNON_RETURN_IF_CAM_UNAVAILABLE();
 
+    SignonSessionCore::clearCachedResults(m_id);
+    AccessControlManagerHelper::instance()->clearDecisions(m_id);
+
     CredentialsDB *db = CredentialsAccessManager::instance()->credentialsDB();
     if ((db == 0) || !db->removeCredentials(m_id)) {
         TRACE() << "Error occurred while inserting/updating credentials.";
@@ -401,6 +461,8 @@ bool SignonIdentity::signOut()
      * one - should not inform server side to sign out.
      */
     if (id() != SIGNOND_NEW_IDENTITY) {
+        SignonSessionCore::clearCachedResults(m_id);
+
         //clear stored sessiondata
         CredentialsDB *db =
             CredentialsAccessManager::instance()->credentialsDB();
@@ -461,11 +523,9 @@ quint32 SignonIdentity::store(const QVariantMap &info)
     keepInUse();
     SIGNON_RETURN_IF_CAM_UNAVAILABLE(SIGNOND_NEW_IDENTITY);
 
-    const QDBusContext &context = static_cast<QDBusContext>(*this);
     QString appId =
-        AccessControlManagerHelper::instance()->appIdOfPeer(
-                                                   context.connection(),
-                                                   context.message());
+        AccessControlManagerHelper::instance()->appIdOfPeer(connection(),
+                                                            message());
 
     const QVariant container = info.value(SIGNOND_IDENTITY_INFO_AUTHMETHODS);
     MethodMap methods = container.isValid() ?
@@ -93,10 +93,39 @@ private:
                            const QDBusConnection &connection,
                            const QDBusMessage &message);
 
+    /* These hide the QDBusContext methods: the D-Bus call being served is
+     * either the current one, or a call whose processing has been resumed
+     * by the adaptor after an asynchronous access control check. */
+    QDBusConnection connection() const;
+    const QDBusMessage &message() const;
+    void sendErrorReply(const QString &name,
+                        const QString &msg = QString()) const;
+    void setDelayedReply(bool enable) const;
+
+    /* Used by the adaptor to resume the processing of a call; returns
+     * whether a reply has already been sent or will be sent later */
+    void beginResumedCall(const QDBusConnection &connection,
+                          const QDBusMessage &message);
+    bool endResumedCall();
+    bool isResumedCall() const { return m_resumedCall != 0; }
+
 private:
+    struct ResumedCall {
+        ResumedCall(const QDBusConnection &connection,
+                    const QDBusMessage &message):
+            connection(connection),
+            message(message),
+            replied(false)
+        {}
+        QDBusConnection connection;
+        QDBusMessage message;
+        bool replied;
+    };
+
     quint32 m_id;
     SignonUiAdaptor *m_signonui;
     SignonIdentityInfo *m_pInfo;
+    ResumedCall *m_resumedCall;
 }; //class SignonDaemon
 
 } //namespace SignonDaemonNS
@@ -28,18 +28,30 @@
 
 #include "signonidentity.h"
 #include "accesscontrolmanagerhelper.h"
+#include "signonmetrics.h"
 
 namespace SignonDaemonNS {
 
 SignonIdentityAdaptor::SignonIdentityAdaptor(SignonIdentity *parent):
     QDBusAbstractAdaptor(parent),
-    m_parent(parent)
+    m_parent(parent),
+    m_autoDestructBeforeAccessCheck(true)
 {
     setAutoRelaySignals(true);
 }
 
 SignonIdentityAdaptor::~SignonIdentityAdaptor()
 {
+    /* The identity is going away under the calls still waiting for their
+     * access check: fail them, and drop the access requests, as nobody else
+     * is interested in their outcome */
+    QList<PendingCall> calls = m_uncheckedCalls + m_accessRequests.values();
+    foreach (const PendingCall &call, calls) {
+        call.connection.send(call.message.createErrorReply(
+                SIGNOND_IDENTITY_NOT_FOUND_ERR_NAME,
+                SIGNOND_IDENTITY_NOT_FOUND_ERR_STR));
+    }
+    qDeleteAll(m_accessRequests.keys());
 }
 
 void SignonIdentityAdaptor::securityErrorReply(const char *failedMethodName)
@@ -53,53 +65,208 @@ void SignonIdentityAdaptor::securityErrorReply(const char *failedMethodName)
     TRACE() << "Method FAILED Access Control check:" << failedMethodName;
 }
 
+void SignonIdentityAdaptor::countRequest(const char *methodName)
+{
+    /* Resumed calls have already been counted */
+    if (!m_parent->isResumedCall())
+        SignonMetrics::countRequest(methodName);
+}
+
 void SignonIdentityAdaptor::errorReply(const QString &name,
                                        const QString &message)
 {
-    QDBusMessage msg = parentDBusContext().message();
-    msg.setDelayedReply(true);
-    QDBusMessage errReply = msg.createErrorReply(name, message);
-    parentDBusContext().connection().send(errReply);
+    m_parent->sendErrorReply(name, message);
+}
+
+bool SignonIdentityAdaptor::isPeerAllowed(AccessType type,
+                                          const QDBusConnection &connection,
+                                          const QDBusMessage &message)
+{
+    AccessControlManagerHelper *acm = AccessControlManagerHelper::instance();
+
+    if (type == UseAccess)
+        return acm->isPeerAllowedToUseIdentity(connection, message,
+                                               m_parent->id());
+
+    AccessControlManagerHelper::IdentityOwnership ownership =
+        acm->isPeerOwnerOfIdentity(connection, message, m_parent->id());
+    if (ownership != AccessControlManagerHelper::ApplicationIsNotOwner)
+        return true;
+
+    /* Identity has an owner, but the peer is not it */
+    return acm->isPeerKeychainWidget(connection, message);
+}
+
+bool SignonIdentityAdaptor::checkAccess(AccessType type, Operation operation)
+{
+    /* Resumed calls have already been checked */
+    if (m_parent->isResumedCall())
+        return true;
+
+    AccessControlManagerHelper *acm = AccessControlManagerHelper::instance();
+    QDBusConnection connection = m_parent->connection();
+    const QDBusMessage &message = m_parent->message();
+    bool allowed = type == UseAccess ?
+        acm->isPeerKnownToUseIdentity(connection, message, m_parent->id()) :
+        acm->isPeerKnownToOwnIdentity(connection, message, m_parent->id());
+    if (allowed)
+        return true;
+
+    /* The full check might call the access control manager, which can be
+     * slow: run it from the main loop, and resume the call afterwards. */
+    TRACE() << "Deferring the access check of" << message.member();
+    m_parent->setDelayedReply(true);
+
+    /* Don't let the identity go away while waiting */
+    if (!hasPendingCalls()) {
+        m_autoDestructBeforeAccessCheck = m_parent->isAutoDestruct();
+        m_parent->setAutoDestruct(false);
+    }
+
+    m_uncheckedCalls.append(PendingCall(operation, type, connection, message));
+    if (m_uncheckedCalls.count() == 1)
+        QMetaObject::invokeMethod(this, "checkPendingCall",
+                                  Qt::QueuedConnection);
+    return false;
+}
+
+void SignonIdentityAdaptor::checkPendingCall()
+{
+    if (m_uncheckedCalls.isEmpty()) return;
+
+    /* One check per main loop iteration, so that the other clients are
+     * served in between */
+    PendingCall call = m_uncheckedCalls.takeFirst();
+    if (!m_uncheckedCalls.isEmpty())
+        QMetaObject::invokeMethod(this, "checkPendingCall",
+                                  Qt::QueuedConnection);
+
+    if (isPeerAllowed(call.type, call.connection, call.message)) {
+        finishCall(call, true);
+        return;
+    }
+
+    /* The access control manager can only grant the use of an identity;
+     * ownership cannot be granted, so there is nothing to ask. */
+    if (call.type == OwnerAccess) {
+        finishCall(call, false);
+        return;
+    }
+
+    TRACE() << "Requesting access for method" << call.message.member();
+    SignOn::AccessReply *reply =
+        AccessControlManagerHelper::instance()->
+            requestAccessToIdentity(call.connection, call.message,
+                                    m_parent->id());
+    QObject::connect(reply, SIGNAL(finished()),
+                     this, SLOT(onAccessReplyFinished()));
+    m_accessRequests.insert(reply, call);
+}
+
+void SignonIdentityAdaptor::onAccessReplyFinished()
+{
+    SignOn::AccessReply *reply = qobject_cast<SignOn::AccessReply*>(sender());
+    Q_ASSERT(reply != 0);
+
+    reply->deleteLater();
+    if (!m_accessRequests.contains(reply)) return;
+    PendingCall call = m_accessRequests.take(reply);
+
+    /* The decision is final: check the updated ACL once more, but don't
+     * ask again */
+    finishCall(call, reply->isAccepted() &&
+               isPeerAllowed(call.type, call.connection, call.message));
+}
+
+void SignonIdentityAdaptor::finishCall(const PendingCall &call, bool allowed)
+{
+    if (!hasPendingCalls())
+        m_parent->setAutoDestruct(m_autoDestructBeforeAccessCheck);
+
+    m_parent->beginResumedCall(call.connection, call.message);
+    if (allowed) {
+        resumeCall(call);
+    } else {
+        securityErrorReply(call.message.member().toLatin1().constData());
+        m_parent->endResumedCall();
+    }
+}
+
+void SignonIdentityAdaptor::resumeCall(const PendingCall &call)
+{
+    /* Invoke again the method, which will now skip the access control check
+     * and proceed */
+    const QVariantList args = call.message.arguments();
+    QVariantList replyArgs;
+
+    switch (call.operation) {
+    case RequestCredentialsUpdate:
+        replyArgs << requestCredentialsUpdate(args.value(0).toString());
+        break;
+    case GetInfo:
+        replyArgs << getInfo();
+        break;
+    case AddReference:
+        addReference(args.value(0).toString());
+        break;
+    case RemoveReference:
+        removeReference(args.value(0).toString());
+        break;
+    case VerifyUser:
+        replyArgs << verifyUser(qdbus_cast<QVariantMap>(args.value(0)));
+        break;
+    case VerifySecret:
+        replyArgs << verifySecret(args.value(0).toString());
+        break;
+    case Remove:
+        remove();
+        break;
+    case SignOut:
+        replyArgs << signOut();
+        break;
+    case Store:
+        replyArgs << store(qdbus_cast<QVariantMap>(args.value(0)));
+        break;
+    }
+
+    if (!m_parent->endResumedCall())
+        call.connection.send(call.message.createReply(replyArgs));
+}
+
+bool SignonIdentityAdaptor::hasPendingCalls() const
+{
+    return !m_uncheckedCalls.isEmpty() || !m_accessRequests.isEmpty();
 }
 
 quint32 SignonIdentityAdaptor::requestCredentialsUpdate(const QString &msg)
 {
+    countRequest("Identity.requestCredentialsUpdate");
+
     /* Access Control */
-    if (!AccessControlManagerHelper::instance()->isPeerAllowedToUseIdentity(
-                                    parentDBusContext().connection(),
-                                    parentDBusContext().message(),
-                                    m_parent->id())) {
-        securityErrorReply(__func__);
+    if (!checkAccess(UseAccess, RequestCredentialsUpdate))
         return 0;
-    }
 
     return m_parent->requestCredentialsUpdate(msg);
 }
 
 QVariantMap SignonIdentityAdaptor::getInfo()
 {
+    countRequest("Identity.getInfo");
+
     /* Access Control */
-    if (!AccessControlManagerHelper::instance()->isPeerAllowedToUseIdentity(
-                                    parentDBusContext().connection(),
-                                    parentDBusContext().message(),
-                                    m_parent->id())) {
-        securityErrorReply(__func__);
+    if (!checkAccess(UseAccess, GetInfo))
         return QVariantMap();
-    }
 
     return m_parent->getInfo();
 }
 
 void SignonIdentityAdaptor::addReference(const QString &reference)
 {
+    countRequest("Identity.addReference");
+
     /* Access Control */
-    if (!AccessControlManagerHelper::instance()->isPeerAllowedToUseIdentity(
-                                    parentDBusContext().connection(),
-                                    parentDBusContext().message(),
-                                    m_parent->id())) {
-        securityErrorReply(__func__);
+    if (!checkAccess(UseAccess, AddReference))
         return;
-    }
 
     if (!m_parent->addReference(reference)) {
         /* TODO: add a lastError() method to SignonIdentity */
@@ -110,14 +277,11 @@ void SignonIdentityAdaptor::addReference(const QString &reference)
 
 void SignonIdentityAdaptor::removeReference(const QString &reference)
 {
+    countRequest("Identity.removeReference");
+
     /* Access Control */
-    if (!AccessControlManagerHelper::instance()->isPeerAllowedToUseIdentity(
-                                    parentDBusContext().connection(),
-                                    parentDBusContext().message(),
-                                    m_parent->id())) {
-        securityErrorReply(__func__);
+    if (!checkAccess(UseAccess, RemoveReference))
         return;
-    }
 
     if (!m_parent->removeReference(reference)) {
         /* TODO: add a lastError() method to SignonIdentity */
@@ -129,91 +293,56 @@ void SignonIdentityAdaptor::removeReference(const QString &reference)
 
 bool SignonIdentityAdaptor::verifyUser(const QVariantMap &params)
 {
+    countRequest("Identity.verifyUser");
+
     /* Access Control */
-    if (!AccessControlManagerHelper::instance()->isPeerAllowedToUseIdentity(
-                                    parentDBusContext().connection(),
-                                    parentDBusContext().message(),
-                                    m_parent->id())) {
-        securityErrorReply(__func__);
+    if (!checkAccess(UseAccess, VerifyUser))
         return false;
-    }
 
     return m_parent->verifyUser(params);
 }
 
 bool SignonIdentityAdaptor::verifySecret(const QString &secret)
 {
+    countRequest("Identity.verifySecret");
+
     /* Access Control */
-    if (!AccessControlManagerHelper::instance()->isPeerAllowedToUseIdentity(
-                                    parentDBusContext().connection(),
-                                    parentDBusContext().message(),
-                                    m_parent->id())) {
-        securityErrorReply(__func__);
+    if (!checkAccess(UseAccess, VerifySecret))
         return false;
-    }
 
     return m_parent->verifySecret(secret);
 }
 
 void SignonIdentityAdaptor::remove()
 {
-    /* Access Control */
-    AccessControlManagerHelper::IdentityOwnership ownership =
-            AccessControlManagerHelper::instance()->isPeerOwnerOfIdentity(
-                                    parentDBusContext().connection(),
-                                    parentDBusContext().message(),
-                                    m_parent->id());
+    countRequest("Identity.remove");
 
-    if (ownership != AccessControlManagerHelper::IdentityDoesNotHaveOwner) {
-        //Identity has an owner
-        if (ownership == AccessControlManagerHelper::ApplicationIsNotOwner &&
-            !AccessControlManagerHelper::instance()->isPeerKeychainWidget(
-                                    parentDBusContext().connection(),
-                                    parentDBusContext().message())) {
-            securityErrorReply(__func__);
-            return;
-        }
-    }
+    /* Access Control */
+    if (!checkAccess(OwnerAccess, Remove))
+        return;
 
     m_parent->remove();
 }
 
 bool SignonIdentityAdaptor::signOut()
 {
+    countRequest("Identity.signOut");
+
     /* Access Control */
-    if (!AccessControlManagerHelper::instance()->isPeerAllowedToUseIdentity(
-                                    parentDBusContext().connection(),
-                                    parentDBusContext().message(),
-                                    m_parent->id())) {
-        securityErrorReply(__func__);
+    if (!checkAccess(UseAccess, SignOut))
         return false;
-    }
 
     return m_parent->signOut();
 }
 
 quint32 SignonIdentityAdaptor::store(const QVariantMap &info)
 {
+    countRequest("Identity.store");
     quint32 id = info.value(QLatin1String("Id"), SIGNOND_NEW_IDENTITY).toInt();
     /* Access Control */
     if (id != SIGNOND_NEW_IDENTITY) {
-    AccessControlManagerHelper::IdentityOwnership ownership =
-            AccessControlManagerHelper::instance()->isPeerOwnerOfIdentity(
-                                    parentDBusContext().connection(),
-                                    parentDBusContext().message(),
-                                    m_parent->id());
-
-        if (ownership != AccessControlManagerHelper::IdentityDoesNotHaveOwner) {
-            //Identity has an owner
-            if (ownership == AccessControlManagerHelper::ApplicationIsNotOwner &&
-                !AccessControlManagerHelper::instance()->isPeerKeychainWidget(
-                                    parentDBusContext().connection(),
-                                    parentDBusContext().message())) {
-
-                securityErrorReply(__func__);
-                return 0;
-            }
-        }
+        if (!checkAccess(OwnerAccess, Store))
+            return 0;
     }
     return m_parent->store(info);
 }
@@ -27,9 +27,12 @@
 
 #include <QDBusAbstractAdaptor>
 #include <QDBusContext>
+#include <QHash>
+#include <QList>
 
 #include "signond-common.h"
 #include "signonidentity.h"
+#include "SignOn/abstract-access-control-manager.h"
 
 namespace SignonDaemonNS {
 
@@ -62,12 +65,62 @@ Q_SIGNALS:
     void unregistered();
     void infoUpdated(int);
 
+private Q_SLOTS:
+    void checkPendingCall();
+    void onAccessReplyFinished();
+
 private:
+    enum AccessType {
+        UseAccess = 0,
+        OwnerAccess
+    };
+
+    /* The methods whose processing can wait for an access check */
+    enum Operation {
+        RequestCredentialsUpdate = 0,
+        GetInfo,
+        AddReference,
+        RemoveReference,
+        VerifyUser,
+        VerifySecret,
+        Remove,
+        SignOut,
+        Store
+    };
+
+    struct PendingCall {
+        PendingCall(Operation operation, AccessType type,
+                    const QDBusConnection &connection,
+                    const QDBusMessage &message):
+            operation(operation),
+            type(type),
+            connection(connection),
+            message(message)
+        {}
+        Operation operation;
+        AccessType type;
+        QDBusConnection connection;
+        QDBusMessage message;
+    };
+
+    bool isPeerAllowed(AccessType type,
+                       const QDBusConnection &connection,
+                       const QDBusMessage &message);
+    bool checkAccess(AccessType type, Operation operation);
+    void finishCall(const PendingCall &call, bool allowed);
+    void resumeCall(const PendingCall &call);
+    bool hasPendingCalls() const;
+    void countRequest(const char *methodName);
     void securityErrorReply(const char *failedMethodName);
     void errorReply(const QString &name, const QString &message);
 
 private:
     SignonIdentity *m_parent;
+    /* Calls waiting for their access check to run */
+    QList<PendingCall> m_uncheckedCalls;
+    /* Calls waiting for the access control manager to decide */
+    QHash<SignOn::AccessReply *, PendingCall> m_accessRequests;
+    bool m_autoDestructBeforeAccessCheck;
 };
 
 } //namespace SignonDaemonNS
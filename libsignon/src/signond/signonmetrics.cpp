@@ -0,0 +1,152 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+#include "signonmetrics.h"
+
+#include <QHash>
+#include <QVariantList>
+
+using namespace SignonDaemonNS;
+
+namespace {
+
+/* Upper bounds of the histogram buckets, in microseconds */
+const qint64 bucketBounds[MetricsHistogram::BucketCount - 1] = {
+    100, 250, 500,
+    1000, 2500, 5000,
+    10000, 25000, 50000,
+    100000, 250000, 500000,
+    1000000, 2500000, 5000000,
+    10000000
+};
+
+const char *counterNames[SignonMetrics::CounterCount] = {
+    "liveIdentities",
+    "livePluginProcesses",
+    "resultCacheHits",
+    "resultCacheMisses",
+    "coalescedRequests",
+    "expiredRequests",
+};
+
+const char *histogramNames[SignonMetrics::HistogramCount] = {
+    "pluginSpawnTime",
+    "pluginRoundTripTime",
+    "dbQueryTime",
+    "dbCommitTime",
+};
+
+MetricsCounter counters[SignonMetrics::CounterCount];
+MetricsHistogram histograms[SignonMetrics::HistogramCount];
+
+/* Keyed by the address of the string literal naming the method: main
+ * thread only */
+QHash<const char *, quint64> requestCounters;
+
+inline qint64 loadCounter(const MetricsCounter &counter)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    return counter.load();
+#else
+    return int(counter);
+#endif
+}
+
+} // namespace
+
+void MetricsHistogram::record(qint64 usecs)
+{
+    int bucket = 0;
+    while (bucket < BucketCount - 1 && usecs > bucketBounds[bucket])
+        bucket++;
+
+    m_buckets[bucket].fetchAndAddRelaxed(1);
+    m_count.fetchAndAddRelaxed(1);
+    m_sum.fetchAndAddRelaxed(usecs);
+}
+
+QVariantMap MetricsHistogram::toMap() const
+{
+    QVariantList bounds;
+    QVariantList buckets;
+    for (int i = 0; i < BucketCount; i++) {
+        if (i < BucketCount - 1)
+            bounds.append(bucketBounds[i]);
+        buckets.append(loadCounter(m_buckets[i]));
+    }
+
+    QVariantMap map;
+    map.insert(QLatin1String("count"), loadCounter(m_count));
+    map.insert(QLatin1String("sum"), loadCounter(m_sum));
+    map.insert(QLatin1String("bounds"), bounds);
+    map.insert(QLatin1String("buckets"), buckets);
+    return map;
+}
+
+void SignonMetrics::countRequest(const char *method)
+{
+    requestCounters[method]++;
+}
+
+void SignonMetrics::add(Counter counter, int value)
+{
+    counters[counter].fetchAndAddRelaxed(value);
+}
+
+void SignonMetrics::record(Histogram histogram, qint64 usecs)
+{
+    histograms[histogram].record(usecs);
+}
+
+QVariantMap SignonMetrics::snapshot()
+{
+    QVariantMap requests;
+    QHash<const char *, quint64>::const_iterator i;
+    for (i = requestCounters.constBegin();
+         i != requestCounters.constEnd();
+         i++) {
+        /* The same name might be used by more than one literal */
+        QString method = QLatin1String(i.key());
+        requests.insert(method, requests.value(method).toULongLong() +
+                        i.value());
+    }
+
+    QVariantMap counterValues;
+    for (int counter = 0; counter < CounterCount; counter++) {
+        counterValues.insert(QLatin1String(counterNames[counter]),
+                             loadCounter(counters[counter]));
+    }
+
+    QVariantMap histogramValues;
+    for (int histogram = 0; histogram < HistogramCount; histogram++) {
+        histogramValues.insert(QLatin1String(histogramNames[histogram]),
+                               histograms[histogram].toMap());
+    }
+
+    QVariantMap metrics;
+    metrics.insert(QLatin1String("requests"), requests);
+    metrics.insert(QLatin1String("counters"), counterValues);
+    metrics.insert(QLatin1String("histograms"), histogramValues);
+    return metrics;
+}
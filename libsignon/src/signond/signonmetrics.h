@@ -0,0 +1,110 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+#ifndef SIGNON_METRICS_H
+#define SIGNON_METRICS_H
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QVariantMap>
+
+namespace SignonDaemonNS {
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 3, 0)
+typedef QAtomicInteger<qint64> MetricsCounter;
+#else
+typedef QAtomicInt MetricsCounter;
+#endif
+
+/*!
+ * @class MetricsHistogram
+ * Distribution of durations over a fixed set of buckets, whose upper
+ * bounds grow exponentially from 100 microseconds to 10 seconds; the last
+ * bucket collects everything above. Recording is lock-free.
+ */
+class MetricsHistogram
+{
+public:
+    enum { BucketCount = 17 };
+
+    void record(qint64 usecs);
+    QVariantMap toMap() const;
+
+private:
+    MetricsCounter m_buckets[BucketCount];
+    MetricsCounter m_count;
+    MetricsCounter m_sum;
+};
+
+/*!
+ * @class SignonMetrics
+ * Runtime statistics of signond, exposed over D-Bus by
+ * SignonMetricsAdaptor.
+ *
+ * Counters and histograms are atomic and can be updated from any thread;
+ * the per-method request counters are only updated from the main thread,
+ * where all the D-Bus adaptors live.
+ */
+class SignonMetrics
+{
+public:
+    enum Counter {
+        LiveIdentities = 0,
+        LivePluginProcesses,
+        ResultCacheHits,
+        ResultCacheMisses,
+        CoalescedRequests,
+        ExpiredRequests,
+        CounterCount
+    };
+
+    enum Histogram {
+        PluginSpawnTime = 0,
+        PluginRoundTripTime,
+        DBQueryTime,
+        DBCommitTime,
+        HistogramCount
+    };
+
+    /*!
+     * Counts a D-Bus request to @a method, which must be a string literal.
+     */
+    static void countRequest(const char *method);
+
+    static void add(Counter counter, int value = 1);
+    static void record(Histogram histogram, qint64 usecs);
+    static void record(Histogram histogram, const QElapsedTimer &timer)
+        { record(histogram, timer.nsecsElapsed() / 1000); }
+
+    /*!
+     * Returns a snapshot of the counters and histograms: the "requests",
+     * "counters" and "histograms" entries each hold a map keyed by the
+     * metric name.
+     */
+    static QVariantMap snapshot();
+};
+
+} //namespace SignonDaemonNS
+
+#endif // SIGNON_METRICS_H
@@ -0,0 +1,87 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+#include "signonmetricsadaptor.h"
+#include "accesscontrolmanagerhelper.h"
+#include "signondaemon.h"
+#include "signonmetrics.h"
+#include "signonsessioncore.h"
+
+#include "SignOn/tracebuffer.h"
+
+using namespace SignonDaemonNS;
+
+SignonMetricsAdaptor::SignonMetricsAdaptor(SignonDaemon *parent):
+    QDBusAbstractAdaptor(parent),
+    m_parent(parent)
+{
+    setAutoRelaySignals(false);
+}
+
+SignonMetricsAdaptor::~SignonMetricsAdaptor()
+{
+}
+
+QVariantMap SignonMetricsAdaptor::metrics()
+{
+    QVariantMap metrics = SignonMetrics::snapshot();
+
+    /* Add the metrics which are computed on demand */
+    QVariantMap counters =
+        metrics.value(QLatin1String("counters")).toMap();
+    counters.insert(QLatin1String("liveSessionCores"),
+                    SignonSessionCore::sessionCoreCount());
+
+    AccessControlManagerHelper *acm = AccessControlManagerHelper::instance();
+    if (acm != 0) {
+        counters.insert(QLatin1String("decisionCacheHits"),
+                        acm->decisionCacheHits());
+        counters.insert(QLatin1String("decisionCacheMisses"),
+                        acm->decisionCacheMisses());
+        counters.insert(QLatin1String("trackedPeers"), acm->trackedPeers());
+    }
+    metrics.insert(QLatin1String("counters"), counters);
+
+    metrics.insert(QLatin1String("queueDepths"),
+                   SignonSessionCore::queueDepths());
+    return metrics;
+}
+
+QByteArray SignonMetricsAdaptor::traceBuffer()
+{
+    /* Access Control: the trace tells which identities are being used, so
+     * it's restricted like the other administrative calls */
+    QDBusMessage msg = parentDBusContext().message();
+    QDBusConnection conn = parentDBusContext().connection();
+    if (!AccessControlManagerHelper::instance()->isPeerKeychainWidget(conn,
+                                                                      msg)) {
+        msg.setDelayedReply(true);
+        conn.send(msg.createErrorReply(SIGNOND_PERMISSION_DENIED_ERR_NAME,
+                                       SIGNOND_PERMISSION_DENIED_ERR_STR));
+        TRACE() << "Method FAILED Access Control check:" << msg.member();
+        return QByteArray();
+    }
+
+    return SignOn::TraceBuffer::toByteArray();
+}
@@ -0,0 +1,63 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+#ifndef SIGNON_METRICS_ADAPTOR_H
+#define SIGNON_METRICS_ADAPTOR_H
+
+#include <QtCore>
+#include <QtDBus>
+
+namespace SignonDaemonNS {
+
+class SignonDaemon;
+
+/*!
+ * @class SignonMetricsAdaptor
+ * Read-only D-Bus interface of the daemon object, exposing the runtime
+ * statistics collected by SignonMetrics.
+ */
+class SignonMetricsAdaptor: public QDBusAbstractAdaptor
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface",
+                "com.google.code.AccountsSSO.SingleSignOn.Metrics")
+
+public:
+    SignonMetricsAdaptor(SignonDaemon *parent);
+    virtual ~SignonMetricsAdaptor();
+
+public Q_SLOTS:
+    QVariantMap metrics();
+    QByteArray traceBuffer();
+
+private:
+    inline const QDBusContext &parentDBusContext() const
+        { return *static_cast<QDBusContext *>(m_parent); }
+
+    SignonDaemon *m_parent;
+}; //class SignonMetricsAdaptor
+
+} //namespace SignonDaemonNS
+
+#endif // SIGNON_METRICS_ADAPTOR_H
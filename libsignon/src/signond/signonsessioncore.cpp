@@ -28,10 +28,15 @@
 #include "signonidentity.h"
 #include "signonui_interface.h"
 #include "accesscontrolmanagerhelper.h"
+#include "signonmetrics.h"
 
 #include "SignOn/uisessiondata_priv.h"
 #include "SignOn/authpluginif.h"
 #include "SignOn/signonerror.h"
+#include "SignOn/tracebuffer.h"
+#include "signond/chrometrace.h"
+
+#include <QCryptographicHash>
 
 #define MAX_IDLE_TIME SIGNOND_MAX_IDLE_TIME
 /*
@@ -54,6 +59,19 @@ QMap<QString, SignonSessionCore *> sessionsOfStoredCredentials;
  * */
 QList<SignonSessionCore *> sessionsOfNonStoredCredentials;
 
+static inline void traceRequest(SignOn::TraceEventId id,
+                                const QString &cancelKey,
+                                quint64 arg0, quint64 arg1 = 0)
+{
+    SignOn::TraceBuffer::record(id, SignOn::TraceBuffer::requestId(cancelKey),
+                                arg0, arg1);
+}
+
+static inline void traceSpan(const RequestData &request, const char *name)
+{
+    SignOn::ChromeTrace::span(request.m_traceId, name, request.m_traceStart);
+}
+
 static QVariantMap filterVariantMap(const QVariantMap &other)
 {
     QVariantMap result;
@@ -71,38 +89,76 @@ static QString sessionName(const quint32 id, const QString &method)
    return QString::number(id) + QLatin1String("+") + method;
 }
 
+/* ---------------------- PluginWorker ---------------------- */
+
+SignonSessionCore::PluginWorker::PluginWorker(PluginProxy *plugin):
+    m_plugin(plugin),
+    m_request(0),
+    m_canceled(false),
+    m_queryCredsUiDisplayed(false)
+{
+}
+
+SignonSessionCore::PluginWorker::~PluginWorker()
+{
+    delete m_request;
+}
+
+/* ---------------------- SignonSessionCore ---------------------- */
+
 SignonSessionCore::SignonSessionCore(quint32 id,
                                      const QString &method,
                                      int timeout,
+                                     int maxConcurrentRequests,
+                                     bool coalesceRequests,
+                                     bool cacheResults,
                                      QObject *parent):
     SignonDisposable(timeout, parent),
+    m_plugin(0),
+    m_maxConcurrentRequests(qMax(maxConcurrentRequests, 1)),
+    m_coalesceRequests(coalesceRequests),
+    m_cacheResults(cacheResults),
     m_signonui(0),
     m_watcher(0),
-    m_requestIsActive(false),
-    m_canceled(false),
+    m_uiWorker(0),
     m_id(id),
-    m_method(method),
-    m_queryCredsUiDisplayed(false)
+    m_method(method)
 {
     m_signonui = new SignonUiAdaptor(SIGNON_UI_SERVICE,
                                      SIGNON_UI_DAEMON_OBJECTPATH,
                                      QDBusConnection::sessionBus());
 
+    m_deadlineTimer.setSingleShot(true);
+    connect(&m_deadlineTimer, SIGNAL(timeout()), SLOT(expireRequests()));
 
     connect(CredentialsAccessManager::instance(),
             SIGNAL(credentialsSystemReady()),
             SLOT(credentialsSystemReady()));
+
+    if (m_cacheResults) {
+        m_cacheClock.start();
+
+        connect(CredentialsAccessManager::instance(),
+                SIGNAL(credentialsUpdated(quint32)),
+                SLOT(onCredentialsUpdated(quint32)));
+    }
 }
 
 SignonSessionCore::~SignonSessionCore()
 {
-    delete m_plugin;
+    foreach (PluginWorker *worker, m_workers) {
+        delete worker->m_plugin;
+        delete worker;
+    }
+    m_workers.clear();
+
     delete m_watcher;
     delete m_signonui;
 
     m_plugin = NULL;
     m_signonui = NULL;
     m_watcher = NULL;
+    m_uiWorker = NULL;
 }
 
 SignonSessionCore *SignonSessionCore::sessionCore(const quint32 id,
@@ -117,9 +173,13 @@ SignonSessionCore *SignonSessionCore::sessionCore(const quint32 id,
         }
     }
 
-    SignonSessionCore *ssc = new SignonSessionCore(id, method,
-                                                   parent->authSessionTimeout(),
-                                                   parent);
+    SignonSessionCore *ssc =
+        new SignonSessionCore(id, method,
+                              parent->authSessionTimeout(),
+                              parent->maxConcurrentRequests(method),
+                              parent->coalesceRequests(),
+                              parent->cacheResults(),
+                              parent);
 
     if (ssc->setupPlugin() == false) {
         TRACE() << "The resulted object is corrupted and has to be deleted";
@@ -152,50 +212,161 @@ QString SignonSessionCore::method() const
 
 bool SignonSessionCore::setupPlugin()
 {
-    m_plugin = PluginProxy::createNewPluginProxy(m_method);
+    PluginWorker *worker = addWorker();
 
-    if (!m_plugin) {
+    if (!worker) {
         TRACE() << "Plugin of type " << m_method << " cannot be found";
         return false;
     }
 
-    connect(m_plugin,
+    m_plugin = worker->m_plugin;
+    return true;
+}
+
+SignonSessionCore::PluginWorker *SignonSessionCore::addWorker()
+{
+    PluginProxy *plugin = PluginProxy::createNewPluginProxy(m_method);
+    if (!plugin)
+        return NULL;
+
+    connect(plugin,
             SIGNAL(processResultReply(const QVariantMap&)),
             this,
             SLOT(processResultReply(const QVariantMap&)),
             Qt::DirectConnection);
 
-    connect(m_plugin,
+    connect(plugin,
             SIGNAL(processStore(const QVariantMap&)),
             this,
             SLOT(processStore(const QVariantMap&)),
             Qt::DirectConnection);
 
-    connect(m_plugin,
+    connect(plugin,
             SIGNAL(processUiRequest(const QVariantMap&)),
             this,
             SLOT(processUiRequest(const QVariantMap&)),
             Qt::DirectConnection);
 
-    connect(m_plugin,
+    connect(plugin,
             SIGNAL(processRefreshRequest(const QVariantMap&)),
             this,
             SLOT(processRefreshRequest(const QVariantMap&)),
             Qt::DirectConnection);
 
-    connect(m_plugin,
+    connect(plugin,
             SIGNAL(processError(int, const QString&)),
             this,
             SLOT(processError(int, const QString&)),
             Qt::DirectConnection);
 
-    connect(m_plugin,
+    connect(plugin,
             SIGNAL(stateChanged(int, const QString&)),
             this,
             SLOT(stateChangedSlot(int, const QString&)),
             Qt::DirectConnection);
 
-    return true;
+    PluginWorker *worker = new PluginWorker(plugin);
+    m_workers.append(worker);
+    return worker;
+}
+
+SignonSessionCore::PluginWorker *SignonSessionCore::idleWorker()
+{
+    foreach (PluginWorker *worker, m_workers) {
+        if (worker->m_request == NULL)
+            return worker;
+    }
+
+    if (m_workers.count() >= m_maxConcurrentRequests)
+        return NULL;
+
+    TRACE() << "Starting plugin process" << m_workers.count() + 1
+        << "for" << m_method;
+    return addWorker();
+}
+
+SignonSessionCore::PluginWorker *
+SignonSessionCore::workerForPlugin(QObject *plugin) const
+{
+    foreach (PluginWorker *worker, m_workers) {
+        if (worker->m_plugin == plugin)
+            return worker;
+    }
+
+    return NULL;
+}
+
+bool SignonSessionCore::hasActiveRequests() const
+{
+    foreach (PluginWorker *worker, m_workers) {
+        if (worker->m_request != NULL)
+            return true;
+    }
+
+    return false;
+}
+
+SignonSessionCore::PluginWorker *
+SignonSessionCore::workerForKey(const QByteArray &key) const
+{
+    foreach (PluginWorker *worker, m_workers) {
+        if (worker->m_request != NULL && !worker->m_canceled &&
+            worker->m_requestKey == key)
+            return worker;
+    }
+
+    return NULL;
+}
+
+static bool isNonInteractive(const RequestData &request)
+{
+    return request.m_params.value(SSOUI_KEY_UIPOLICY).toInt() ==
+        NoUserInteractionPolicy;
+}
+
+QByteArray SignonSessionCore::requestKey(const RequestData &request) const
+{
+    /* Requests which might interact with the user are never shared */
+    if (!isNonInteractive(request))
+        return QByteArray();
+
+    /* QDBusArgument values cannot be serialized, so they cannot be
+     * compared either */
+    QVariantMap params = filterVariantMap(request.m_params);
+    foreach (const QVariant &value, params) {
+        if (qstrcmp(value.typeName(), "QDBusArgument") == 0)
+            return QByteArray();
+    }
+
+    /* The plugin's reply might depend on which of the identity's ACL tokens
+     * the peer holds: only share it with the same peer. Computing the tokens
+     * would take a database read and an access control check per request;
+     * the cached results are dropped when the identity (and its ACL)
+     * changes. */
+    QString peer = request.m_conn.name() + QLatin1Char(' ') +
+        request.m_msg.service();
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << request.m_mechanism << params << peer;
+
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+}
+
+QStringList
+SignonSessionCore::accessControlTokens(const RequestData &request,
+                                       const SignonIdentityInfo &info) const
+{
+    QStringList paramsTokenList;
+    QStringList identityAclList = info.accessControlList();
+
+    foreach(QString acl, identityAclList) {
+        if (AccessControlManagerHelper::instance()->
+            isPeerAllowedToAccess(request.m_conn, request.m_msg, acl))
+            paramsTokenList.append(acl);
+    }
+
+    return paramsTokenList;
 }
 
 void SignonSessionCore::stopAllAuthSessions()
@@ -207,6 +378,48 @@ void SignonSessionCore::stopAllAuthSessions()
     sessionsOfNonStoredCredentials.clear();
 }
 
+void SignonSessionCore::clearCachedResults(quint32 id)
+{
+    foreach (SignonSessionCore *corePtr, sessionsOfStoredCredentials) {
+        if (corePtr->m_id == id)
+            corePtr->m_resultCache.clear();
+    }
+}
+
+int SignonSessionCore::sessionCoreCount()
+{
+    return sessionsOfStoredCredentials.count() +
+        sessionsOfNonStoredCredentials.count();
+}
+
+QVariantMap SignonSessionCore::queueDepths()
+{
+    QList<SignonSessionCore *> cores = sessionsOfStoredCredentials.values();
+    cores += sessionsOfNonStoredCredentials;
+
+    /* Only totals are reported: the metrics can be read by any client,
+     * which must not learn which identities are being used */
+    int queued = 0;
+    int maxQueued = 0;
+    int active = 0;
+    foreach (SignonSessionCore *corePtr, cores) {
+        foreach (PluginWorker *worker, corePtr->m_workers) {
+            if (worker->m_request != NULL)
+                active++;
+        }
+
+        int count = corePtr->m_listOfRequests.count();
+        queued += count;
+        maxQueued = qMax(maxQueued, count);
+    }
+
+    QVariantMap depths;
+    depths.insert(QLatin1String("queued"), queued);
+    depths.insert(QLatin1String("maxQueued"), maxQueued);
+    depths.insert(QLatin1String("active"), active);
+    return depths;
+}
+
 QStringList SignonSessionCore::loadedPluginMethods(const QString &method)
 {
     foreach (SignonSessionCore *corePtr, sessionsOfStoredCredentials) {
@@ -241,11 +454,48 @@ void SignonSessionCore::process(const QDBusConnection &connection,
                                 const QString &cancelKey)
 {
     keepInUse();
-    m_listOfRequests.enqueue(RequestData(connection,
-                                         message,
-                                         sessionDataVa,
-                                         mechanism,
-                                         cancelKey));
+    RequestData request(connection, message, sessionDataVa, mechanism,
+                        cancelKey);
+
+    QByteArray key;
+    if ((m_cacheResults && !m_resultCache.isEmpty()) ||
+        (m_coalesceRequests && hasActiveRequests()))
+        key = requestKey(request);
+
+    if (!key.isEmpty() && m_resultCache.contains(key)) {
+        CachedResult cached = m_resultCache.value(key);
+        if (cached.m_expiresAt > m_cacheClock.elapsed()) {
+            traceRequest(SignOn::TraceSessionCacheHit, cancelKey, m_id);
+            SignonMetrics::add(SignonMetrics::ResultCacheHits);
+            connection.send(message.createReply(cached.m_reply));
+            traceSpan(request, "SignonSessionCore::cachedResult");
+            return;
+        }
+        m_resultCache.remove(key);
+    }
+
+    if (m_cacheResults && isNonInteractive(request))
+        SignonMetrics::add(SignonMetrics::ResultCacheMisses);
+
+    if (m_coalesceRequests && !key.isEmpty()) {
+        PluginWorker *worker = workerForKey(key);
+        if (worker != NULL) {
+            traceRequest(SignOn::TraceSessionCoalesced, cancelKey, m_id);
+            worker->m_followers.append(request);
+            SignonMetrics::add(SignonMetrics::CoalescedRequests);
+            if (request.m_deadline != 0)
+                scheduleDeadlineCheck();
+            emit stateChanged(cancelKey, SignOn::SessionStarted,
+                        QLatin1String("The request is started successfully"));
+            return;
+        }
+    }
+
+    m_listOfRequests.enqueue(request);
+    traceRequest(SignOn::TraceSessionQueued, cancelKey,
+                 m_id, m_listOfRequests.count());
+    if (request.m_deadline != 0)
+        scheduleDeadlineCheck();
 
     if (CredentialsAccessManager::instance()->isCredentialsSystemReady())
         QMetaObject::invokeMethod(this, "startNewRequest", Qt::QueuedConnection);
@@ -254,6 +504,61 @@ void SignonSessionCore::process(const QDBusConnection &connection,
 void SignonSessionCore::cancel(const QString &cancelKey)
 {
     TRACE();
+    dropRequest(cancelKey, SIGNOND_SESSION_CANCELED_ERR_NAME,
+                SIGNOND_SESSION_CANCELED_ERR_STR);
+}
+
+void SignonSessionCore::dropRequest(const QString &cancelKey,
+                                    const QString &errorName,
+                                    const QString &errorMessage)
+{
+    /* If the request being cancelled is active, we need to keep its worker
+     * busy until the plugin has replied, in order to delay the next request
+     * execution until the actual cancelation will happen. We will know about
+     * that precisely: plugin must reply via resultSlot or via errorSlot. */
+    foreach (PluginWorker *worker, m_workers) {
+        RequestData *rd = worker->m_request;
+        if (rd == NULL || worker->m_canceled)
+            continue;
+
+        for (int i = 0; i < worker->m_followers.count(); i++) {
+            if (worker->m_followers.at(i).m_cancelKey == cancelKey) {
+                TRACE() << "The request is waiting for a coalesced reply";
+                RequestData follower(worker->m_followers.takeAt(i));
+                QDBusMessage errReply =
+                    follower.m_msg.createErrorReply(errorName,
+                                                    errorMessage);
+                follower.m_conn.send(errReply);
+                return;
+            }
+        }
+
+        if (rd->m_cancelKey != cancelKey)
+            continue;
+
+        /* Other callers are still waiting for the plugin's reply: hand the
+         * request over to the first of them */
+        if (!worker->m_followers.isEmpty()) {
+            TRACE() << "The request is being processed for others too";
+            worker->m_request =
+                new RequestData(worker->m_followers.takeFirst());
+            QDBusMessage errReply =
+                rd->m_msg.createErrorReply(errorName, errorMessage);
+            rd->m_conn.send(errReply);
+            delete rd;
+            return;
+        }
+
+        TRACE() << "The request is being processed";
+        worker->m_canceled = true;
+        worker->m_plugin->cancel();
+        cancelUi(worker);
+
+        QDBusMessage errReply =
+            rd->m_msg.createErrorReply(errorName, errorMessage);
+        rd->m_conn.send(errReply);
+        return;
+    }
 
     int requestIndex;
     for (requestIndex = 0;
@@ -266,38 +571,71 @@ void SignonSessionCore::cancel(const QString &cancelKey)
     TRACE() << "The request is found with index " << requestIndex;
 
     if (requestIndex < m_listOfRequests.size()) {
-        /* If the request being cancelled is active, we need to keep
-         * in the queue until the plugin has replied. */
-        bool isActive = (requestIndex == 0) && m_requestIsActive;
-        if (isActive) {
-            m_canceled = true;
-            m_plugin->cancel();
-
-            if (m_watcher && !m_watcher->isFinished()) {
-                m_signonui->cancelUiRequest(cancelKey);
-                delete m_watcher;
-                m_watcher = 0;
-            }
-        }
-
-        /*
-         * We must let to the m_listOfRequests to have the canceled request data
-         * in order to delay the next request execution until the actual cancelation
-         * will happen. We will know about that precisely: plugin must reply via
-         * resultSlot or via errorSlot.
-         * */
-        RequestData rd(isActive ?
-                       m_listOfRequests.head() :
-                       m_listOfRequests.takeAt(requestIndex));
+        RequestData rd(m_listOfRequests.takeAt(requestIndex));
 
         QDBusMessage errReply =
-            rd.m_msg.createErrorReply(SIGNOND_SESSION_CANCELED_ERR_NAME,
-                                      SIGNOND_SESSION_CANCELED_ERR_STR);
+            rd.m_msg.createErrorReply(errorName, errorMessage);
         rd.m_conn.send(errReply);
         TRACE() << "Size of the queue is" << m_listOfRequests.size();
     }
 }
 
+void SignonSessionCore::scheduleDeadlineCheck()
+{
+    qint64 earliest = 0;
+    foreach (PluginWorker *worker, m_workers) {
+        if (worker->m_request != NULL && !worker->m_canceled &&
+            worker->m_request->m_deadline != 0 &&
+            (earliest == 0 || worker->m_request->m_deadline < earliest))
+            earliest = worker->m_request->m_deadline;
+        foreach (const RequestData &follower, worker->m_followers) {
+            if (follower.m_deadline != 0 &&
+                (earliest == 0 || follower.m_deadline < earliest))
+                earliest = follower.m_deadline;
+        }
+    }
+    foreach (const RequestData &request, m_listOfRequests) {
+        if (request.m_deadline != 0 &&
+            (earliest == 0 || request.m_deadline < earliest))
+            earliest = request.m_deadline;
+    }
+
+    if (earliest == 0) {
+        m_deadlineTimer.stop();
+        return;
+    }
+    m_deadlineTimer.start(int(qMax(earliest - RequestData::now(), qint64(0))));
+}
+
+void SignonSessionCore::expireRequests()
+{
+    /* The clients have given up on these requests: don't let them wait for
+     * a worker, and stop the plugins processing them */
+    QStringList expiredKeys;
+    foreach (PluginWorker *worker, m_workers) {
+        if (worker->m_request != NULL && !worker->m_canceled &&
+            worker->m_request->hasExpired())
+            expiredKeys.append(worker->m_request->m_cancelKey);
+        foreach (const RequestData &follower, worker->m_followers) {
+            if (follower.hasExpired())
+                expiredKeys.append(follower.m_cancelKey);
+        }
+    }
+    foreach (const RequestData &request, m_listOfRequests) {
+        if (request.hasExpired())
+            expiredKeys.append(request.m_cancelKey);
+    }
+
+    foreach (const QString &cancelKey, expiredKeys) {
+        TRACE() << "Request expired:" << cancelKey;
+        SignonMetrics::add(SignonMetrics::ExpiredRequests);
+        dropRequest(cancelKey, SIGNOND_TIMED_OUT_ERR_NAME,
+                    SIGNOND_TIMED_OUT_ERR_STR);
+    }
+
+    scheduleDeadlineCheck();
+}
+
 void SignonSessionCore::setId(quint32 id)
 {
     keepInUse();
@@ -324,18 +662,26 @@ void SignonSessionCore::setId(quint32 id)
     m_id = id;
 }
 
-void SignonSessionCore::startProcess()
+void SignonSessionCore::startProcess(PluginWorker *worker)
 {
+    worker->m_request = new RequestData(m_listOfRequests.dequeue());
+    worker->m_canceled = false;
+    if (m_coalesceRequests || m_cacheResults)
+        worker->m_requestKey = requestKey(*worker->m_request);
+
+    traceRequest(SignOn::TraceSessionStarted, worker->m_request->m_cancelKey,
+                 m_id, m_listOfRequests.count());
+    if (!worker->m_request->m_traceId.isEmpty()) {
+        traceSpan(*worker->m_request, "SignonSessionCore::queued");
+        worker->m_request->m_traceStart = SignOn::ChromeTrace::now();
+    }
 
-    TRACE() << "the number of requests is" << m_listOfRequests.length();
-
-    m_requestIsActive = true;
-    RequestData data = m_listOfRequests.head();
+    RequestData data = *worker->m_request;
     QVariantMap parameters = data.m_params;
 
     /* save the client data; this should not be modified during the processing
      * of this request */
-    m_clientData = parameters;
+    worker->m_clientData = parameters;
 
     if (m_id) {
         CredentialsDB *db =
@@ -353,15 +699,7 @@ void SignonSessionCore::startProcess()
                 parameters[SSO_KEY_USERNAME] = info.userName();
             }
 
-            QStringList paramsTokenList;
-            QStringList identityAclList = info.accessControlList();
-
-            foreach(QString acl, identityAclList) {
-                if (AccessControlManagerHelper::instance()->
-                    isPeerAllowedToAccess(data.m_conn, data.m_msg, acl))
-                    paramsTokenList.append(acl);
-            }
-
+            QStringList paramsTokenList = accessControlTokens(data, info);
             if (!paramsTokenList.isEmpty()) {
                 parameters[SSO_ACCESS_CONTROL_TOKENS] = paramsTokenList;
             }
@@ -383,18 +721,24 @@ void SignonSessionCore::startProcess()
 
     /* Temporary caching, if credentials are valid
      * this data will be effectively cached */
-    m_tmpUsername = parameters[SSO_KEY_USERNAME].toString();
-    m_tmpPassword = parameters[SSO_KEY_PASSWORD].toString();
+    worker->m_tmpUsername = parameters[SSO_KEY_USERNAME].toString();
+    worker->m_tmpPassword = parameters[SSO_KEY_PASSWORD].toString();
 
-    if (!m_plugin->process(parameters, data.m_mechanism)) {
+    /* Let the plugin process record its spans too */
+    if (!data.m_traceId.isEmpty())
+        parameters.insert(SIGNOND_SESSION_TRACE_ID, data.m_traceId);
+    parameters.insert(SIGNOND_SESSION_REQUEST_ID,
+                      SignOn::TraceBuffer::requestId(data.m_cancelKey));
+
+    if (!worker->m_plugin->process(parameters, data.m_mechanism)) {
         QDBusMessage errReply =
             data.m_msg.createErrorReply(SIGNOND_RUNTIME_ERR_NAME,
                                         SIGNOND_RUNTIME_ERR_STR);
         data.m_conn.send(errReply);
-        requestDone();
+        requestDone(worker);
     } else
-        stateChangedSlot(SignOn::SessionStarted,
-                         QLatin1String("The request is started successfully"));
+        setStateChanged(worker, SignOn::SessionStarted,
+                        QLatin1String("The request is started successfully"));
 }
 
 void SignonSessionCore::replyError(const QDBusConnection &conn,
@@ -532,25 +876,28 @@ void SignonSessionCore::processStoreOperation(const StoreOperation &operation)
     }
 }
 
-void SignonSessionCore::requestDone()
+void SignonSessionCore::requestDone(PluginWorker *worker)
 {
-    m_listOfRequests.removeFirst();
-    m_requestIsActive = false;
+    delete worker->m_request;
+    worker->m_request = NULL;
+    worker->m_canceled = false;
+    worker->m_requestKey.clear();
+    worker->m_followers.clear();
     QMetaObject::invokeMethod(this, "startNewRequest", Qt::QueuedConnection);
 }
 
 void SignonSessionCore::processResultReply(const QVariantMap &data)
 {
-    TRACE();
-
     keepInUse();
 
-    if (m_listOfRequests.isEmpty())
+    PluginWorker *worker = workerForPlugin(sender());
+    if (worker == NULL || worker->m_request == NULL)
         return;
 
-    RequestData rd = m_listOfRequests.head();
+    RequestData rd = *worker->m_request;
+    traceRequest(SignOn::TraceSessionResult, rd.m_cancelKey, m_id);
 
-    if (!m_canceled) {
+    if (!worker->m_canceled) {
         QVariantList arguments;
         QVariantMap filteredData = filterVariantMap(data);
 
@@ -563,31 +910,40 @@ void SignonSessionCore::processResultReply(const QVariantMap &data)
         if (m_id != SIGNOND_NEW_IDENTITY) {
             SignonIdentityInfo info = db->credentials(m_id);
             bool identityWasValidated = info.validated();
+            bool changed = !identityWasValidated;
 
             /* update username and password from ui interaction; do not allow
-             * updating the username if the identity is validated */
-            if (!info.validated() && !m_tmpUsername.isEmpty()) {
-                info.setUserName(m_tmpUsername);
+             * updating the username if the identity is validated. The
+             * password usually is the stored one, or the one the client
+             * already stored: it's only a change if it differs. */
+            if (!info.validated() && !worker->m_tmpUsername.isEmpty()) {
+                info.setUserName(worker->m_tmpUsername);
             }
-            if (!m_tmpPassword.isEmpty()) {
-                info.setPassword(m_tmpPassword);
+            if (!worker->m_tmpPassword.isEmpty() &&
+                worker->m_tmpPassword != info.password()) {
+                info.setPassword(worker->m_tmpPassword);
+                changed = true;
             }
             info.setValidated(true);
 
-            StoreOperation storeOp(StoreOperation::Credentials);
-            storeOp.m_info = info;
-            processStoreOperation(storeOp);
+            /* Most replies don't change anything: don't rewrite the identity
+             * then, as every update is notified to its observers */
+            if (changed) {
+                StoreOperation storeOp(StoreOperation::Credentials);
+                storeOp.m_info = info;
+                processStoreOperation(storeOp);
+            }
 
             /* If the credentials are validated, the secrets db is not
              * available and not authorized keys are available, then
              * the store operation has been performed on the memory
              * cache only; inform the CAM about the situation. */
-            if (identityWasValidated && !db->isSecretsDBOpen()) {
+            if (changed && identityWasValidated && !db->isSecretsDBOpen()) {
                 /* Send the storage not available event only if the curent
                  * result processing is following a previous signon UI query.
                  * This is to avoid unexpected UI pop-ups. */
 
-                if (m_queryCredsUiDisplayed) {
+                if (worker->m_queryCredsUiDisplayed) {
                     SecureStorageEvent *event =
                         new SecureStorageEvent(
                             (QEvent::Type)SIGNON_SECURE_STORAGE_NOT_AVAILABLE);
@@ -602,26 +958,39 @@ void SignonSessionCore::processResultReply(const QVariantMap &data)
             }
         }
 
-        m_tmpUsername.clear();
-        m_tmpPassword.clear();
+        worker->m_tmpUsername.clear();
+        worker->m_tmpPassword.clear();
 
         //remove secret field from output
         if (m_method != QLatin1String("password")
             && filteredData.contains(SSO_KEY_PASSWORD))
             filteredData.remove(SSO_KEY_PASSWORD);
 
+        /* The plugin can allow its result to be reused for a while */
+        int cacheTtl = filteredData.take(SSO_RESULT_CACHE_TTL).toInt();
+
         arguments << filteredData;
         rd.m_conn.send(rd.m_msg.createReply(arguments));
+        traceSpan(rd, "SignonSessionCore::process");
+        foreach (const RequestData &follower, worker->m_followers) {
+            follower.m_conn.send(follower.m_msg.createReply(arguments));
+            traceSpan(follower, "SignonSessionCore::coalesced");
+        }
 
-        if (m_watcher && !m_watcher->isFinished()) {
-            m_signonui->cancelUiRequest(rd.m_cancelKey);
-            delete m_watcher;
-            m_watcher = 0;
+        if (m_cacheResults && cacheTtl > 0 &&
+            !worker->m_requestKey.isEmpty() &&
+            !worker->m_queryCredsUiDisplayed) {
+            CachedResult cached;
+            cached.m_reply = arguments;
+            cached.m_expiresAt = m_cacheClock.elapsed() + cacheTtl * 1000LL;
+            m_resultCache.insert(worker->m_requestKey, cached);
         }
-        m_queryCredsUiDisplayed = false;
+
+        cancelUi(worker);
+        worker->m_queryCredsUiDisplayed = false;
     }
 
-    requestDone();
+    requestDone(worker);
 }
 
 void SignonSessionCore::processStore(const QVariantMap &data)
@@ -629,6 +998,11 @@ void SignonSessionCore::processStore(const QVariantMap &data)
     TRACE();
 
     keepInUse();
+
+    PluginWorker *worker = workerForPlugin(sender());
+    if (worker == NULL)
+        return;
+
     if (m_id == SIGNOND_NEW_IDENTITY) {
         BLAME() << "Cannot store without identity";
         return;
@@ -648,6 +1022,9 @@ void SignonSessionCore::processStore(const QVariantMap &data)
     storeOp.m_authMethod = m_method;
     processStoreOperation(storeOp);
 
+    /* The stored data is part of the plugin's input */
+    m_resultCache.clear();
+
     /* If the credentials are validated, the secrets db is not available and
      * not authorized keys are available inform the CAM about the situation. */
     SignonIdentityInfo info = db->credentials(m_id);
@@ -656,7 +1033,7 @@ void SignonSessionCore::processStore(const QVariantMap &data)
          * processing is following a previous signon UI query. This is to avoid
          * unexpected UI pop-ups.
          */
-        if (m_queryCredsUiDisplayed) {
+        if (worker->m_queryCredsUiDisplayed) {
             TRACE() << "Secure storage not available.";
 
             SecureStorageEvent *event =
@@ -671,7 +1048,7 @@ void SignonSessionCore::processStore(const QVariantMap &data)
         }
     }
 
-    m_queryCredsUiDisplayed = false;
+    worker->m_queryCredsUiDisplayed = false;
 
     return;
 }
@@ -682,18 +1059,58 @@ void SignonSessionCore::processUiRequest(const QVariantMap &data)
 
     keepInUse();
 
-    if (!m_canceled && !m_listOfRequests.isEmpty()) {
-        RequestData &request = m_listOfRequests.head();
-        QString uiRequestId = request.m_cancelKey;
+    PluginWorker *worker = workerForPlugin(sender());
+    if (worker != NULL)
+        queryUi(worker, data, false);
+}
+
+void SignonSessionCore::processRefreshRequest(const QVariantMap &data)
+{
+    TRACE();
+
+    keepInUse();
+
+    PluginWorker *worker = workerForPlugin(sender());
+    if (worker != NULL)
+        queryUi(worker, data, true);
+}
 
-        if (m_watcher) {
-            if (!m_watcher->isFinished())
-                m_signonui->cancelUiRequest(uiRequestId);
+void SignonSessionCore::queryUi(PluginWorker *worker,
+                                const QVariantMap &data,
+                                bool isRefresh)
+{
+    if (worker->m_canceled || worker->m_request == NULL)
+        return;
 
-            delete m_watcher;
-            m_watcher = 0;
+    RequestData &request = *worker->m_request;
+    QString uiRequestId = request.m_cancelKey;
+
+    if (m_watcher) {
+        /* The signon UI is busy with another request of this session:
+         * dialogs are shown one at a time, in the order they were asked. */
+        if (m_uiWorker != worker) {
+            TRACE() << "Queueing UI request" << uiRequestId;
+            PendingUiRequest pending;
+            pending.m_worker = worker;
+            pending.m_data = data;
+            pending.m_isRefresh = isRefresh;
+            m_pendingUiRequests.enqueue(pending);
+            return;
         }
 
+        if (!m_watcher->isFinished())
+            m_signonui->cancelUiRequest(uiRequestId);
+
+        delete m_watcher;
+        m_watcher = 0;
+    }
+
+    if (isRefresh) {
+        request.m_params = filterVariantMap(data);
+        m_watcher = new QDBusPendingCallWatcher(
+                     m_signonui->refreshDialog(request.m_params),
+                     this);
+    } else {
         request.m_params = filterVariantMap(data);
         request.m_params[SSOUI_KEY_REQUESTID] = uiRequestId;
 
@@ -702,7 +1119,7 @@ void SignonSessionCore::processUiRequest(const QVariantMap &data)
         else
             request.m_params[SSOUI_KEY_STORED_IDENTITY] = true;
         request.m_params[SSOUI_KEY_IDENTITY] = m_id;
-        request.m_params[SSOUI_KEY_CLIENT_DATA] = m_clientData;
+        request.m_params[SSOUI_KEY_CLIENT_DATA] = worker->m_clientData;
         request.m_params[SSOUI_KEY_METHOD] = m_method;
         request.m_params[SSOUI_KEY_MECHANISM] = request.m_mechanism;
 
@@ -738,72 +1155,98 @@ void SignonSessionCore::processUiRequest(const QVariantMap &data)
         m_watcher = new QDBusPendingCallWatcher(
                      m_signonui->queryDialog(request.m_params),
                      this);
-        connect(m_watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
-                this, SLOT(queryUiSlot(QDBusPendingCallWatcher*)));
     }
+
+    m_uiWorker = worker;
+    connect(m_watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
+            this, SLOT(queryUiSlot(QDBusPendingCallWatcher*)));
 }
 
-void SignonSessionCore::processRefreshRequest(const QVariantMap &data)
+void SignonSessionCore::startPendingUiRequests()
 {
-    TRACE();
+    while (m_watcher == NULL && !m_pendingUiRequests.isEmpty()) {
+        PendingUiRequest pending = m_pendingUiRequests.dequeue();
+        queryUi(pending.m_worker, pending.m_data, pending.m_isRefresh);
+    }
+}
 
-    keepInUse();
+void SignonSessionCore::cancelUi(PluginWorker *worker)
+{
+    for (int i = m_pendingUiRequests.count() - 1; i >= 0; i--) {
+        if (m_pendingUiRequests.at(i).m_worker == worker)
+            m_pendingUiRequests.removeAt(i);
+    }
 
-    if (!m_canceled && !m_listOfRequests.isEmpty()) {
-        QString uiRequestId = m_listOfRequests.head().m_cancelKey;
+    if (m_watcher == NULL || m_uiWorker != worker)
+        return;
 
-        if (m_watcher) {
-            if (!m_watcher->isFinished())
-                m_signonui->cancelUiRequest(uiRequestId);
+    if (!m_watcher->isFinished())
+        m_signonui->cancelUiRequest(worker->m_request->m_cancelKey);
 
-            delete m_watcher;
-            m_watcher = 0;
-        }
+    delete m_watcher;
+    m_watcher = NULL;
+    m_uiWorker = NULL;
 
-        m_listOfRequests.head().m_params = filterVariantMap(data);
-        m_watcher = new QDBusPendingCallWatcher(
-                     m_signonui->refreshDialog(m_listOfRequests.head().m_params),
-                     this);
-        connect(m_watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
-                this, SLOT(queryUiSlot(QDBusPendingCallWatcher*)));
-    }
+    startPendingUiRequests();
 }
 
 void SignonSessionCore::processError(int err, const QString &message)
 {
-    TRACE();
     keepInUse();
-    m_tmpUsername.clear();
-    m_tmpPassword.clear();
 
-    if (m_listOfRequests.isEmpty())
+    PluginWorker *worker = workerForPlugin(sender());
+    if (worker == NULL)
         return;
 
-    RequestData rd = m_listOfRequests.head();
+    worker->m_tmpUsername.clear();
+    worker->m_tmpPassword.clear();
 
-    if (!m_canceled) {
-        replyError(rd.m_conn, rd.m_msg, err, message);
+    if (worker->m_request == NULL)
+        return;
+
+    RequestData rd = *worker->m_request;
+    traceRequest(SignOn::TraceSessionError, rd.m_cancelKey, m_id, err);
 
-        if (m_watcher && !m_watcher->isFinished()) {
-            m_signonui->cancelUiRequest(rd.m_cancelKey);
-            delete m_watcher;
-            m_watcher = 0;
+    if (!worker->m_canceled) {
+        replyError(rd.m_conn, rd.m_msg, err, message);
+        traceSpan(rd, "SignonSessionCore::process");
+        foreach (const RequestData &follower, worker->m_followers) {
+            replyError(follower.m_conn, follower.m_msg, err, message);
+            traceSpan(follower, "SignonSessionCore::coalesced");
         }
+        cancelUi(worker);
     }
 
-    requestDone();
+    requestDone(worker);
 }
 
 void SignonSessionCore::stateChangedSlot(int state, const QString &message)
 {
-    if (!m_canceled && !m_listOfRequests.isEmpty()) {
-        RequestData rd = m_listOfRequests.head();
-        emit stateChanged(rd.m_cancelKey, (int)state, message);
-    }
+    PluginWorker *worker = workerForPlugin(sender());
+    if (worker != NULL)
+        setStateChanged(worker, state, message);
 
     keepInUse();
 }
 
+void SignonSessionCore::onCredentialsUpdated(quint32 id)
+{
+    if (id == m_id)
+        m_resultCache.clear();
+}
+
+void SignonSessionCore::setStateChanged(PluginWorker *worker,
+                                        int state,
+                                        const QString &message)
+{
+    if (worker->m_canceled || worker->m_request == NULL)
+        return;
+
+    emit stateChanged(worker->m_request->m_cancelKey, state, message);
+    foreach (const RequestData &follower, worker->m_followers)
+        emit stateChanged(follower.m_cancelKey, state, message);
+}
+
 void SignonSessionCore::childEvent(QChildEvent *ce)
 {
     if (ce->added())
@@ -836,10 +1279,11 @@ void SignonSessionCore::queryUiSlot(QDBusPendingCallWatcher *call)
 
     QDBusPendingReply<QVariantMap> reply = *call;
     bool isRequestToRefresh = false;
-    Q_ASSERT_X(m_listOfRequests.size() != 0, __func__,
-               "queue of requests is empty");
+    PluginWorker *worker = m_uiWorker;
+    Q_ASSERT_X(worker != NULL && worker->m_request != NULL, __func__,
+               "no request is waiting for the UI");
 
-    RequestData &rd = m_listOfRequests.head();
+    RequestData &rd = *worker->m_request;
     if (!reply.isError() && reply.count()) {
         QVariantMap resultParameters = reply.argumentAt<0>();
         if (resultParameters.contains(SSOUI_KEY_REFRESH)) {
@@ -854,52 +1298,50 @@ void SignonSessionCore::queryUiSlot(QDBusPendingCallWatcher *call)
         if (resultParameters.contains(SSOUI_KEY_ERROR)
             && (resultParameters[SSOUI_KEY_ERROR] == QUERY_ERROR_CANCELED)) {
 
-            m_queryCredsUiDisplayed = false;
+            worker->m_queryCredsUiDisplayed = false;
         } else {
-            m_queryCredsUiDisplayed = true;
+            worker->m_queryCredsUiDisplayed = true;
         }
     } else {
         rd.m_params.insert(SSOUI_KEY_ERROR,
                            (int)SignOn::QUERY_ERROR_NO_SIGNONUI);
     }
 
-    if (!m_canceled) {
+    if (!worker->m_canceled) {
         /* Temporary caching, if credentials are valid
          * this data will be effectively cached */
-        m_tmpUsername = rd.m_params.value(SSO_KEY_USERNAME,
-                                          QVariant()).toString();
-        m_tmpPassword = rd.m_params.value(SSO_KEY_PASSWORD,
-                                          QVariant()).toString();
+        worker->m_tmpUsername = rd.m_params.value(SSO_KEY_USERNAME,
+                                                  QVariant()).toString();
+        worker->m_tmpPassword = rd.m_params.value(SSO_KEY_PASSWORD,
+                                                  QVariant()).toString();
 
         if (isRequestToRefresh) {
             TRACE() << "REFRESH IS REQUIRED";
 
             rd.m_params.remove(SSOUI_KEY_REFRESH);
-            m_plugin->processRefresh(rd.m_params);
+            worker->m_plugin->processRefresh(rd.m_params);
         } else {
-            m_plugin->processUi(rd.m_params);
+            worker->m_plugin->processUi(rd.m_params);
         }
     }
 
     delete m_watcher;
     m_watcher = NULL;
+    m_uiWorker = NULL;
+
+    /* Let the other requests of this session talk to the user */
+    startPendingUiRequests();
+    QMetaObject::invokeMethod(this, "startNewRequest", Qt::QueuedConnection);
 }
 
 void SignonSessionCore::startNewRequest()
 {
     keepInUse();
 
-    m_canceled = false;
-
     if (m_listOfRequests.isEmpty()) {
         TRACE() << "No more requests to process";
-        setAutoDestruct(true);
-        return;
-    }
-
-    // there is an active request already
-    if (m_requestIsActive) {
-        TRACE() << "One request is already active";
+        if (!hasActiveRequests())
+            setAutoDestruct(true);
         return;
     }
 
@@ -909,14 +1351,25 @@ void SignonSessionCore::startNewRequest()
         return;
     }
 
-    TRACE() << "Starting the authentication process";
-    setAutoDestruct(false);
-    startProcess();
+    PluginWorker *worker;
+    while (!m_listOfRequests.isEmpty() &&
+           (worker = idleWorker()) != NULL) {
+        if (m_listOfRequests.head().hasExpired()) {
+            expireRequests();
+            continue;
+        }
+        TRACE() << "Starting the authentication process";
+        setAutoDestruct(false);
+        startProcess(worker);
+    }
+
+    if (!m_listOfRequests.isEmpty())
+        TRACE() << "All the plugin processes are busy";
 }
 
 void SignonSessionCore::destroy()
 {
-    if (m_requestIsActive ||
+    if (hasActiveRequests() ||
         m_watcher != NULL) {
         keepInUse();
         return;
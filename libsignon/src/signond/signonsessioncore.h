@@ -64,6 +64,9 @@ public:
      * */
     static void stopAllAuthSessions();
     static QStringList loadedPluginMethods(const QString &method);
+    static void clearCachedResults(quint32 id);
+    static int sessionCoreCount();
+    static QVariantMap queueDepths();
 
     void destroy();
 
@@ -94,6 +97,7 @@ Q_SIGNALS:
 
 private Q_SLOTS:
     void startNewRequest();
+    void expireRequests();
 
     void processResultReply(const QVariantMap &data);
     void processStore(const QVariantMap &data);
@@ -102,6 +106,7 @@ private Q_SLOTS:
     void processError(int err, const QString &message);
     void stateChangedSlot(int state,
                           const QString &message);
+    void onCredentialsUpdated(quint32 id);
 
     void queryUiSlot(QDBusPendingCallWatcher *call);
 
@@ -109,45 +114,120 @@ protected:
     SignonSessionCore(quint32 id,
                       const QString &method,
                       int timeout,
+                      int maxConcurrentRequests,
+                      bool coalesceRequests,
+                      bool cacheResults,
                       QObject *parent);
 
     void childEvent(QChildEvent *ce);
     void customEvent(QEvent *event);
 
 private:
-    void startProcess();
+    /*
+     * A plugin process, together with the state of the request which it
+     * is currently processing (if any).
+     */
+    struct PluginWorker {
+        PluginWorker(PluginProxy *plugin);
+        ~PluginWorker();
+
+        PluginProxy *m_plugin;
+        /* the request being processed, or NULL if the worker is idle */
+        RequestData *m_request;
+        bool m_canceled;
+        /* the original request parameters; this should not be modified
+         * during the processing of the request */
+        QVariantMap m_clientData;
+
+        //Temporary caching
+        QString m_tmpUsername;
+        QString m_tmpPassword;
+
+        /* Flag used for handling post ui querying results' processing.
+         * Secure storage not available events won't be posted if the current
+         * session processing was not preceded by a signon UI query
+         * credentials interaction, when this flag is set to true. */
+        bool m_queryCredsUiDisplayed;
+
+        /* identical requests sharing the reply of m_request, and the key
+         * which identifies them (empty if the request cannot be shared or
+         * cached) */
+        QByteArray m_requestKey;
+        QList<RequestData> m_followers;
+    };
+
+    /*
+     * A UI interaction requested by a worker while the signon UI was busy
+     * with another one.
+     */
+    struct PendingUiRequest {
+        PluginWorker *m_worker;
+        QVariantMap m_data;
+        bool m_isRefresh;
+    };
+
+    PluginWorker *addWorker();
+    PluginWorker *idleWorker();
+    PluginWorker *workerForPlugin(QObject *plugin) const;
+    bool hasActiveRequests() const;
+    PluginWorker *workerForKey(const QByteArray &key) const;
+    QByteArray requestKey(const RequestData &request) const;
+    QStringList accessControlTokens(const RequestData &request,
+                                    const SignonIdentityInfo &info) const;
+
+    void startProcess(PluginWorker *worker);
+    void dropRequest(const QString &cancelKey,
+                     const QString &errorName,
+                     const QString &errorMessage);
+    void scheduleDeadlineCheck();
     void replyError(const QDBusConnection &conn,
                     const QDBusMessage &msg,
                     int err,
                     const QString &message);
     void processStoreOperation(const StoreOperation &operation);
-    void requestDone();
+    void requestDone(PluginWorker *worker);
+    void setStateChanged(PluginWorker *worker,
+                         int state,
+                         const QString &message);
+    void queryUi(PluginWorker *worker,
+                 const QVariantMap &data,
+                 bool isRefresh);
+    void startPendingUiRequests();
+    void cancelUi(PluginWorker *worker);
 
 private:
     PluginProxy *m_plugin;
+    /* the first worker always wraps m_plugin; more are added on demand, up to
+     * m_maxConcurrentRequests. The workers report their results, and store
+     * their data, in the order they complete: with more than one worker,
+     * that is not necessarily the order of the requests. */
+    QList<PluginWorker *> m_workers;
+    int m_maxConcurrentRequests;
+    bool m_coalesceRequests;
+
+    /* Plugin results which can be given again to identical requests, until
+     * they expire */
+    struct CachedResult {
+        QVariantList m_reply;
+        qint64 m_expiresAt;
+    };
+    bool m_cacheResults;
+    QHash<QByteArray, CachedResult> m_resultCache;
+    QElapsedTimer m_cacheClock;
+    /* requests waiting for a worker */
     QQueue<RequestData> m_listOfRequests;
+    /* fires at the earliest deadline of the pending requests */
+    QTimer m_deadlineTimer;
     SignonUiAdaptor *m_signonui;
 
+    /* Only one UI interaction at a time: m_watcher tracks the one owned by
+     * m_uiWorker, the others wait in m_pendingUiRequests. */
     QDBusPendingCallWatcher *m_watcher;
-
-    bool m_requestIsActive;
-    bool m_canceled;
+    PluginWorker *m_uiWorker;
+    QQueue<PendingUiRequest> m_pendingUiRequests;
 
     uint m_id;
     QString m_method;
-    /* the original request parameters, for the request currently being
-     * processed */
-    QVariantMap m_clientData;
-
-    //Temporary caching
-    QString m_tmpUsername;
-    QString m_tmpPassword;
-
-    /* Flag used for handling post ui querying results' processing.
-     * Secure storage not available events won't be posted if the current
-     * session processing was not preceded by a signon UI query credentials
-     * interaction, when this flag is set to true. */
-    bool m_queryCredsUiDisplayed;
 
     Q_DISABLE_COPY(SignonSessionCore)
 }; //class SignonDaemon
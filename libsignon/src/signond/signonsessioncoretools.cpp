@@ -24,7 +24,9 @@
 #include "signonsessioncoretools.h"
 
 #include <QDebug>
+#include <QElapsedTimer>
 #include "signond-common.h"
+#include "signond/chrometrace.h"
 
 using namespace SignonDaemonNS;
 
@@ -75,8 +77,23 @@ RequestData::RequestData(const QDBusConnection &conn,
     m_msg(msg),
     m_params(params),
     m_mechanism(mechanism),
-    m_cancelKey(cancelKey)
+    m_cancelKey(cancelKey),
+    m_traceStart(0),
+    m_deadline(0)
 {
+    /* The correlation id must not take part in the comparison of requests
+     * done when coalescing them or caching their results */
+    if (m_params.contains(SIGNOND_SESSION_TRACE_ID)) {
+        m_traceId = m_params.take(SIGNOND_SESSION_TRACE_ID).toString();
+        m_traceStart = SignOn::ChromeTrace::now();
+    }
+
+    /* Likewise for the deadline */
+    if (m_params.contains(SIGNOND_SESSION_TIMEOUT)) {
+        qint64 timeout = m_params.take(SIGNOND_SESSION_TIMEOUT).toLongLong();
+        if (timeout > 0)
+            m_deadline = now() + timeout;
+    }
 }
 
 RequestData::RequestData(const RequestData &other):
@@ -84,10 +101,21 @@ RequestData::RequestData(const RequestData &other):
     m_msg(other.m_msg),
     m_params(other.m_params),
     m_mechanism(other.m_mechanism),
-    m_cancelKey(other.m_cancelKey)
+    m_cancelKey(other.m_cancelKey),
+    m_traceId(other.m_traceId),
+    m_traceStart(other.m_traceStart),
+    m_deadline(other.m_deadline)
 {
 }
 
 RequestData::~RequestData()
 {
 }
+
+qint64 RequestData::now()
+{
+    static QElapsedTimer clock;
+    if (!clock.isValid())
+        clock.start();
+    return clock.elapsed();
+}
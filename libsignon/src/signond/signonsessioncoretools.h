@@ -79,12 +79,22 @@ struct RequestData
     RequestData(const RequestData &other);
     ~RequestData();
 
+    /* Milliseconds elapsed on the monotonic clock of the deadlines */
+    static qint64 now();
+    bool hasExpired() const { return m_deadline != 0 && m_deadline <= now(); }
+
 public:
     QDBusConnection m_conn;
     QDBusMessage m_msg;
     QVariantMap m_params;
     QString m_mechanism;
     QString m_cancelKey;
+    /* Correlation id of a traced request, taken out of m_params, and the
+     * start time of its current span */
+    QString m_traceId;
+    qint64 m_traceStart;
+    /* The time by which the client wants the reply, or 0 */
+    qint64 m_deadline;
 };
 
 } //SignonDaemonNS
@@ -0,0 +1,145 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+#include "startupprofile.h"
+
+#include <QList>
+#include <QThread>
+
+#include <stdio.h>
+#include <time.h>
+
+using namespace SignonDaemonNS;
+
+namespace {
+
+struct PhaseRecord {
+    const char *name;
+    qint64 start;
+    qint64 end;
+};
+
+bool profileEnabled = false;
+bool profileReady = false;
+qint64 profileOrigin = 0;
+qint64 profileReadyTime = 0;
+QThread *profileThread = 0;
+QList<PhaseRecord> profilePhases;
+
+qint64 monotonicTime()
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
+    return qint64(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool isRecording()
+{
+    return profileEnabled && !profileReady &&
+        QThread::currentThread() == profileThread;
+}
+
+} // namespace
+
+void StartupProfile::enable()
+{
+    if (profileEnabled) return;
+
+    profileOrigin = monotonicTime();
+    profileThread = QThread::currentThread();
+    profileEnabled = true;
+}
+
+bool StartupProfile::isEnabled()
+{
+    return profileEnabled;
+}
+
+int StartupProfile::begin(const char *name)
+{
+    if (!isRecording()) return -1;
+
+    PhaseRecord record;
+    record.name = name;
+    record.start = monotonicTime() - profileOrigin;
+    record.end = -1;
+    profilePhases.append(record);
+    return profilePhases.count() - 1;
+}
+
+void StartupProfile::end(int index)
+{
+    if (index < 0 || !isRecording()) return;
+
+    profilePhases[index].end = monotonicTime() - profileOrigin;
+}
+
+void StartupProfile::setReady()
+{
+    if (!isRecording()) return;
+
+    profileReadyTime = monotonicTime() - profileOrigin;
+    profileReady = true;
+
+    QByteArray json = toJson().toUtf8();
+    fprintf(stderr, "%s\n", json.constData());
+    fflush(stderr);
+}
+
+bool StartupProfile::isReady()
+{
+    return profileReady;
+}
+
+QString StartupProfile::toJson()
+{
+    QString json = QString::fromLatin1("{\"enabled\":%1")
+        .arg(QLatin1String(profileEnabled ? "true" : "false"));
+    if (!profileEnabled)
+        return json + QLatin1Char('}');
+
+    json += QString::fromLatin1(",\"clock\":\"monotonic\",\"unit\":\"us\","
+                                "\"origin\":%1,\"ready\":")
+        .arg(profileOrigin);
+    json += profileReady ?
+        QString::number(profileReadyTime) : QLatin1String("null");
+    json += QLatin1String(",\"phases\":[");
+
+    for (int i = 0; i < profilePhases.count(); i++) {
+        const PhaseRecord &record = profilePhases.at(i);
+        if (i > 0) json += QLatin1Char(',');
+        /* Phase names are string literals which don't need escaping */
+        json += QString::fromLatin1("{\"name\":\"%1\",\"start\":%2,\"end\":")
+            .arg(QLatin1String(record.name))
+            .arg(record.start);
+        json += record.end >= 0 ?
+            QString::number(record.end) : QLatin1String("null");
+        json += QLatin1Char('}');
+    }
+
+    json += QLatin1String("]}");
+    return json;
+}
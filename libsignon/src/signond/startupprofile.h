@@ -0,0 +1,85 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+#ifndef SIGNON_STARTUP_PROFILE_H
+#define SIGNON_STARTUP_PROFILE_H
+
+#include <QString>
+
+namespace SignonDaemonNS {
+
+/*!
+ * @class StartupProfile
+ * Records when each phase of the daemon startup begins and ends.
+ *
+ * Profiling is off unless enable() is called, which main() does when
+ * signond is started with --profile-startup or with the SSO_PROFILE_STARTUP
+ * environment variable set. Timestamps come from the monotonic clock and
+ * are only recorded from the thread which enabled the profile, and only
+ * until setReady() is called: at that point the profile is printed to
+ * stderr as JSON and stays available through toJson().
+ */
+class StartupProfile
+{
+public:
+    /*!
+     * @class Phase
+     * Records a phase lasting as long as the object is in scope.
+     */
+    class Phase
+    {
+    public:
+        Phase(const char *name): m_index(StartupProfile::begin(name)) {}
+        ~Phase() { StartupProfile::end(m_index); }
+    private:
+        int m_index;
+    };
+
+    static void enable();
+    static bool isEnabled();
+
+    /*!
+     * Starts recording a phase named @a name, which must be a string
+     * literal. Returns an index to be passed to end(), or -1 if the phase
+     * is not being recorded.
+     */
+    static int begin(const char *name);
+    static void end(int index);
+
+    /*!
+     * Marks the daemon as ready to serve any request, and stops recording.
+     */
+    static void setReady();
+    static bool isReady();
+
+    /*!
+     * Returns the recorded phases as a JSON object; times are in
+     * microseconds since the profile was enabled.
+     */
+    static QString toJson();
+};
+
+} //namespace SignonDaemonNS
+
+#endif // SIGNON_STARTUP_PROFILE_H
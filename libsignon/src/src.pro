@@ -3,5 +3,6 @@ SUBDIRS = \
     signond \
     plugins \
     remotepluginprocess \
+    signon-trace-decode \
     extensions
 
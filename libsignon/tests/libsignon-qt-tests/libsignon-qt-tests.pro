@@ -42,4 +42,4 @@ QMAKE_CXXFLAGS += -fno-exceptions \
     -fno-rtti
 
 check.depends = $$TARGET
-check.commands = "SSO_PLUGINS_DIR=$${TOP_BUILD_DIR}/src/plugins/test SSO_EXTENSIONS_DIR=$${TOP_BUILD_DIR}/non-existing-dir $$RUN_WITH_SIGNOND ./libsignon-qt-tests"
+check.commands = "SSO_CACHE_RESULTS=1 SSO_COALESCE_REQUESTS=1 SSO_PLUGIN_CONCURRENCY=4 SSO_PLUGINS_DIR=$${TOP_BUILD_DIR}/src/plugins/test SSO_EXTENSIONS_DIR=$${TOP_BUILD_DIR}/non-existing-dir $$RUN_WITH_SIGNOND ./libsignon-qt-tests"
@@ -23,6 +23,7 @@
 #include "SignOn/uisessiondata.h"
 #include "SignOn/uisessiondata_priv.h"
 #include "signon-ui.h"
+#include "signond-metrics.h"
 #include "ssotestclient.h"
 
 #include <QEventLoop>
@@ -1689,6 +1690,196 @@ void SsoTestClient::emptyPasswordRegression()
     TEST_DONE
 }
 
+void SsoTestClient::sharedIdentity()
+{
+    TEST_START
+
+    QMap<MethodName, MechanismsList> methods;
+    methods.insert("method1", QStringList() << "mech1" << "mech2");
+    IdentityInfo info("SHARED_CAPTION_1", "SHARED_USERNAME", methods);
+    info.setAccessControlList(QStringList() << "*");
+
+    Identity *creator = Identity::newIdentity(info);
+
+    QEventLoop loop;
+    const char *errorSignature = SIGNAL(error(const SignOn::Error &));
+    const char *credentialsStoredSignature =
+        SIGNAL(credentialsStored(const quint32));
+    const char *infoSignature = SIGNAL(info(const SignOn::IdentityInfo &));
+
+    QSignalSpy storedSignal(creator, credentialsStoredSignature);
+    connect(creator, credentialsStoredSignature, &loop, SLOT(quit()));
+    connect(creator, errorSignature, &loop, SLOT(quit()));
+
+    creator->storeCredentials();
+
+    QTimer::singleShot(test_timeout, &loop, SLOT(quit()));
+    loop.exec();
+
+    QCOMPARE(storedSignal.count(), 1);
+    quint32 id = creator->id();
+    QVERIFY(id != 0);
+
+    /* Both instances share the remote object of the stored identity */
+    Identity *first = Identity::existingIdentity(id);
+    Identity *second = Identity::existingIdentity(id);
+    QVERIFY(first != 0);
+    QVERIFY(second != 0);
+
+    QSignalSpy firstStored(first, credentialsStoredSignature);
+    QSignalSpy firstError(first, errorSignature);
+    connect(first, credentialsStoredSignature, &loop, SLOT(quit()));
+    connect(first, errorSignature, &loop, SLOT(quit()));
+
+    qint64 getInfoRequests = signondRequests("Identity.getInfo");
+    QVERIFY(getInfoRequests >= 0);
+
+    info.setCaption("SHARED_CAPTION_2");
+    first->storeCredentials(info);
+
+    QTimer::singleShot(test_timeout, &loop, SLOT(quit()));
+    loop.exec();
+
+    QCOMPARE(firstError.count(), 0);
+    QCOMPARE(firstStored.count(), 1);
+
+    /* Nobody is waiting for the info, so the update notification, which
+     * signond sends before the reply to the store, must not fetch it: such
+     * a fetch would reach signond before this call. */
+    const char *secretVerifiedSignature = SIGNAL(secretVerified(const bool));
+    connect(second, secretVerifiedSignature, &loop, SLOT(quit()));
+    connect(second, errorSignature, &loop, SLOT(quit()));
+    second->verifySecret(QString());
+
+    QTimer::singleShot(test_timeout, &loop, SLOT(quit()));
+    loop.exec();
+
+    QCOMPARE(signondRequests("Identity.getInfo"), getInfoRequests);
+
+    /* The change must be visible through the other instance; the info is
+     * delivered only to the instance which asked for it */
+    QSignalSpy firstInfo(first, infoSignature);
+    QSignalSpy secondInfo(second, infoSignature);
+    QSignalSpy secondError(second, errorSignature);
+    connect(second, infoSignature, &loop, SLOT(quit()));
+    connect(second, errorSignature, &loop, SLOT(quit()));
+
+    second->queryInfo();
+    if (secondInfo.isEmpty()) {
+        QTimer::singleShot(test_timeout, &loop, SLOT(quit()));
+        loop.exec();
+    }
+
+    QCOMPARE(secondError.count(), 0);
+    QCOMPARE(secondInfo.count(), 1);
+    QCOMPARE(firstInfo.count(), 0);
+    QCOMPARE(signondRequests("Identity.getInfo"), getInfoRequests + 1);
+    IdentityInfo secondData =
+        secondInfo.at(0).at(0).value<SignOn::IdentityInfo>();
+    QCOMPARE(secondData.caption(), QString("SHARED_CAPTION_2"));
+
+    /* The other instance gets the shared data when it asks for it */
+    first->queryInfo();
+    if (firstInfo.isEmpty()) {
+        connect(first, infoSignature, &loop, SLOT(quit()));
+        QTimer::singleShot(test_timeout, &loop, SLOT(quit()));
+        loop.exec();
+    }
+
+    QCOMPARE(firstInfo.count(), 1);
+    QCOMPARE(secondInfo.count(), 1);
+    QCOMPARE(firstError.count(), 0);
+    /* Served from the shared data */
+    QCOMPARE(signondRequests("Identity.getInfo"), getInfoRequests + 1);
+
+    /* Deleting one instance must not affect the other one */
+    delete first;
+    QSignalSpy removedSignal(second, SIGNAL(removed()));
+    connect(second, SIGNAL(removed()), &loop, SLOT(quit()));
+
+    second->remove();
+
+    QTimer::singleShot(test_timeout, &loop, SLOT(quit()));
+    loop.exec();
+
+    QCOMPARE(removedSignal.count(), 1);
+
+    delete second;
+    delete creator;
+
+    TEST_DONE
+}
+
+void SsoTestClient::identityTimeout()
+{
+    TEST_START
+
+    QMap<MethodName, MechanismsList> methods;
+    methods.insert("method1", QStringList() << "mech1");
+    IdentityInfo info("TIMEOUT_CAPTION", "TIMEOUT_USERNAME", methods);
+
+    Identity *creator = Identity::newIdentity(info);
+
+    QEventLoop loop;
+    const char *errorSignature = SIGNAL(error(const SignOn::Error &));
+    const char *credentialsStoredSignature =
+        SIGNAL(credentialsStored(const quint32));
+    const char *infoSignature = SIGNAL(info(const SignOn::IdentityInfo &));
+
+    QSignalSpy storedSignal(creator, credentialsStoredSignature);
+    connect(creator, credentialsStoredSignature, &loop, SLOT(quit()));
+    connect(creator, errorSignature, &loop, SLOT(quit()));
+
+    creator->storeCredentials();
+
+    QTimer::singleShot(test_timeout, &loop, SLOT(quit()));
+    loop.exec();
+
+    QCOMPARE(storedSignal.count(), 1);
+    quint32 id = creator->id();
+    /* The new instance must not find a cached copy of the info */
+    delete creator;
+
+    Identity *identity = Identity::existingIdentity(id);
+    QVERIFY(identity != 0);
+
+    QSignalSpy infoSignal(identity, infoSignature);
+    QSignalSpy errorSignal(identity, errorSignature);
+    connect(identity, infoSignature, &loop, SLOT(quit()));
+    connect(identity, errorSignature, &loop, SLOT(quit()));
+
+    /* The query can't complete before the event loop runs again: keep it
+     * blocked past the deadline */
+    identity->setTimeout(1);
+    identity->queryInfo();
+    QTest::qSleep(50);
+
+    QTimer::singleShot(test_timeout, &loop, SLOT(quit()));
+    loop.exec();
+
+    QCOMPARE(infoSignal.count(), 0);
+    QCOMPARE(errorSignal.count(), 1);
+    SignOn::Error error = errorSignal.at(0).at(0).value<SignOn::Error>();
+    QCOMPARE(error.type(), int(SignOn::Error::TimedOut));
+
+    /* The identity is still usable once the deadline is removed */
+    identity->setTimeout(0);
+    identity->queryInfo();
+    if (infoSignal.isEmpty()) {
+        QTimer::singleShot(test_timeout, &loop, SLOT(quit()));
+        loop.exec();
+    }
+
+    QCOMPARE(infoSignal.count(), 1);
+    QCOMPARE(errorSignal.count(), 1);
+    IdentityInfo data = infoSignal.at(0).at(0).value<SignOn::IdentityInfo>();
+    QCOMPARE(data.caption(), QString("TIMEOUT_CAPTION"));
+
+    delete identity;
+
+    TEST_DONE
+}
+
 int main(int argc, char *argv[])
 {
     QCoreApplication app(argc, argv);
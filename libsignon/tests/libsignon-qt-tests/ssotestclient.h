@@ -71,6 +71,8 @@ private Q_SLOTS:
     void removeStoreRemove();
     void queryAuthPluginACL();
     void emptyPasswordRegression();
+    void sharedIdentity();
+    void identityTimeout();
 
 private:
     void clearDB();
@@ -22,10 +22,13 @@
  */
 
 #include "signon-ui.h"
+#include "signond-metrics.h"
 #include "testauthsession.h"
 #include "testthread.h"
 #include "SignOn/identity.h"
+#include <QDBusArgument>
 #include <QDBusInterface>
+#include <QElapsedTimer>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -41,6 +44,93 @@ static QStringList g_processReplyRealmsList;
 static int g_bigStringSize = 50000;
 static int g_bigStringReplySize = 0;
 
+/* Waits until signond has no request in progress */
+static bool waitForIdleSignond()
+{
+    QElapsedTimer clock;
+    clock.start();
+    while (clock.elapsed() < 10 * 1000) {
+        QVariantMap metrics = signondMetrics();
+        if (metrics.isEmpty()) return false;
+
+        QVariantMap depths =
+            qdbus_cast<QVariantMap>(metrics.value("queueDepths"));
+        if (depths.value(QLatin1String("active")).toInt() == 0 &&
+            depths.value(QLatin1String("queued")).toInt() == 0)
+            return true;
+        QTest::qWait(50);
+    }
+    return false;
+}
+
+/* Creates an identity allowed to use the ssotest method, and stores it */
+static Identity *newStoredIdentity(QObject *parent)
+{
+    QMap<MethodName,MechanismsList> methods;
+    methods.insert(QLatin1String("ssotest"), QStringList() << "mech1");
+    IdentityInfo info("test_caption", "test_user_name", methods);
+    info.setSecret("test_secret");
+    Identity *id = Identity::newIdentity(info, parent);
+
+    QEventLoop loop;
+    QObject::connect(id, SIGNAL(credentialsStored(const quint32)),
+                     &loop, SLOT(quit()));
+    QObject::connect(id, SIGNAL(error(const SignOn::Error &)),
+                     &loop, SLOT(quit()));
+    QTimer::singleShot(10*1000, &loop, SLOT(quit()));
+    id->storeCredentials();
+    loop.exec();
+
+    return id;
+}
+
+/* Waits until each spy has recorded @count signals, for at most 10
+ * seconds */
+static void waitForSignals(const QList<QSignalSpy *> &spies, int count = 1)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < 10*1000) {
+        bool done = true;
+        foreach (QSignalSpy *spy, spies) {
+            if (spy->count() < count) done = false;
+        }
+        if (done) break;
+        QTest::qWait(50);
+    }
+}
+
+/* Runs one process() call and waits for its reply; returns the number of
+ * status updates received from the plugin, or -1 on error */
+static int processAndWait(AuthSession *as, const SessionData &inData,
+                          SessionData *outData = 0)
+{
+    QSignalSpy spyResponse(as, SIGNAL(response(const SignOn::SessionData&)));
+    QSignalSpy spyState(as,
+        SIGNAL(stateChanged(AuthSession::AuthSessionState, const QString&)));
+    QEventLoop loop;
+
+    QObject::connect(as, SIGNAL(response(const SignOn::SessionData&)),
+                     &loop, SLOT(quit()));
+    QObject::connect(as, SIGNAL(error(const SignOn::Error &)),
+                     &loop, SLOT(quit()));
+    QTimer::singleShot(10*1000, &loop, SLOT(quit()));
+
+    as->process(inData, "mech1");
+    loop.exec();
+
+    if (spyResponse.count() != 1) return -1;
+    if (outData != 0)
+        *outData = spyResponse.at(0).at(0).value<SessionData>();
+
+    int pluginStates = 0;
+    for (int i = 0; i < spyState.count(); i++) {
+        if (spyState.at(i).at(1).toString() == "hello from the test plugin")
+            pluginStates++;
+    }
+    return pluginStates;
+}
+
 TestAuthSession::TestAuthSession(SignOnUI *signOnUI, QObject *parent):
     QObject(parent),
     m_signOnUI(signOnUI)
@@ -509,6 +599,70 @@ void TestAuthSession::process_from_other_process()
     QCOMPARE(exitCode, 0);
 }
 
+void TestAuthSession::process_with_identity_call()
+{
+    // The client API uses processWithIdentity only for the first process()
+    // call of a session; make direct D-Bus calls to check the validation
+    // of the object path and that the session remains usable
+    QDBusConnection dbuscon =
+        QDBusConnection::connectToBus(QDBusConnection::SessionBus,
+                                      "processwithidentity");
+    QDBusInterface iface(SIGNOND_SERVICE,
+                         SIGNOND_DAEMON_OBJECTPATH,
+                         SIGNOND_DAEMON_INTERFACE,
+                         dbuscon);
+
+    SessionData inData;
+    inData.setSecret("testSecret");
+    inData.setUserName("testUsername");
+    QVariantMap inDataVarMap;
+    foreach(QString key, inData.propertyNames()) {
+        if (!inData.getProperty(key).isNull() && inData.getProperty(key).isValid())
+            inDataVarMap[key] = inData.getProperty(key);
+    }
+
+    QString path = QString(SIGNOND_AUTH_SESSION_OBJECTPATH_PREFIX) +
+        QLatin1String("processwithidentity");
+    QVariantList arguments;
+    arguments += (quint32)SIGNOND_NEW_IDENTITY;
+    arguments += QString::fromLatin1("ssotest");
+    arguments += QVariant::fromValue(QDBusObjectPath("/invalid/path"));
+    arguments += inDataVarMap;
+    arguments += QString::fromLatin1("mech1");
+
+    QDBusMessage reply =
+        iface.callWithArgumentList(QDBus::Block,
+                                   QLatin1String("processWithIdentity"),
+                                   arguments);
+    QCOMPARE(reply.type(), QDBusMessage::ErrorMessage);
+    QCOMPARE(reply.errorName(), QString(SIGNOND_INVALID_QUERY_ERR_NAME));
+
+    arguments[2] = QVariant::fromValue(QDBusObjectPath(path));
+    reply = iface.callWithArgumentList(QDBus::Block,
+                                       QLatin1String("processWithIdentity"),
+                                       arguments);
+    QCOMPARE(reply.type(), QDBusMessage::ReplyMessage);
+    QVariantMap outData = qdbus_cast<QVariantMap>(reply.arguments().at(0));
+    QCOMPARE(outData.value("Realm").toString(),
+             QString("testRealm_after_test"));
+
+    // The session object is registered at the chosen path...
+    QDBusInterface session(SIGNOND_SERVICE,
+                           path,
+                           SIGNOND_AUTH_SESSION_INTERFACE,
+                           dbuscon);
+    reply = session.call(QLatin1String("queryAvailableMechanisms"),
+                         QStringList());
+    QCOMPARE(reply.type(), QDBusMessage::ReplyMessage);
+
+    // ...which cannot be used for another one
+    reply = iface.callWithArgumentList(QDBus::Block,
+                                       QLatin1String("processWithIdentity"),
+                                       arguments);
+    QCOMPARE(reply.type(), QDBusMessage::ErrorMessage);
+    QCOMPARE(reply.errorName(), QString(SIGNOND_INVALID_QUERY_ERR_NAME));
+}
+
 void TestAuthSession::process_many_times_after_auth()
 {
     AuthSession *as;
@@ -669,6 +823,195 @@ void TestAuthSession::process_after_timeout()
     QCOMPARE(spyError.count(), 0);
 }
 
+void TestAuthSession::process_with_result_cache()
+{
+    /* "make check" runs signond with SSO_CACHE_RESULTS=1 */
+    Identity *id = newStoredIdentity(this);
+    QVERIFY(id->id() != 0);
+    AuthSession *as = id->createSession(QLatin1String("ssotest"));
+
+    /* The test plugin echoes its input, so it will allow its result to be
+     * cached */
+    SessionData noTtlData;
+    noTtlData.setSecret("testSecret");
+    noTtlData.setUserName("testUsername");
+    noTtlData.setUiPolicy(NoUserInteractionPolicy);
+    QVariantMap map = noTtlData.toMap();
+    map.insert(SSO_RESULT_CACHE_TTL, 60);
+    SessionData inData(map);
+
+    qint64 hits = signondCounter("resultCacheHits");
+    qint64 misses = signondCounter("resultCacheMisses");
+    QVERIFY(hits >= 0);
+    QVERIFY(misses >= 0);
+
+    SessionData outData;
+    QCOMPARE(processAndWait(as, inData, &outData), 10);
+    QVERIFY(!outData.toMap().contains(SSO_RESULT_CACHE_TTL));
+    qint64 newMisses = signondCounter("resultCacheMisses");
+    if (newMisses == misses)
+        QSKIP("signond is not caching results", SkipSingle);
+    QCOMPARE(newMisses, misses + 1);
+
+    /* An identical request is replied without involving the plugin */
+    QCOMPARE(processAndWait(as, inData, &outData), 0);
+    QCOMPARE(outData.Realm(), QString("testRealm_after_test"));
+    QCOMPARE(signondCounter("resultCacheHits"), hits + 1);
+
+    /* Serving other requests doesn't invalidate the cached result */
+    SessionData otherData(inData);
+    otherData.setUserName("otherUsername");
+    QCOMPARE(processAndWait(as, otherData), 10);
+    QCOMPARE(processAndWait(as, inData), 0);
+    QCOMPARE(signondCounter("resultCacheHits"), hits + 2);
+
+    /* Requests which cannot be cached are not counted as misses */
+    misses = signondCounter("resultCacheMisses");
+    SessionData interactiveData(inData);
+    interactiveData.setUiPolicy(DefaultPolicy);
+    QCOMPARE(processAndWait(as, interactiveData), 10);
+    QCOMPARE(signondCounter("resultCacheMisses"), misses);
+
+    /* Updating the identity drops its cached results */
+    QEventLoop loop;
+    QObject::connect(id, SIGNAL(credentialsStored(const quint32)),
+                     &loop, SLOT(quit()));
+    QTimer::singleShot(10*1000, &loop, SLOT(quit()));
+    QMap<MethodName,MechanismsList> methods;
+    methods.insert(QLatin1String("ssotest"), QStringList() << "mech1");
+    IdentityInfo info("new_caption", "test_user_name", methods);
+    info.setSecret("new_secret");
+    id->storeCredentials(info);
+    loop.exec();
+
+    QCOMPARE(processAndWait(as, inData), 10);
+    QCOMPARE(signondCounter("resultCacheHits"), hits + 2);
+}
+
+void TestAuthSession::process_concurrently()
+{
+    /* "make check" runs signond with SSO_PLUGIN_CONCURRENCY=4 */
+    if (qgetenv("SSO_PLUGIN_CONCURRENCY").toInt() < 4)
+        QSKIP("signond doesn't process requests concurrently", SkipSingle);
+
+    Identity *id = newStoredIdentity(this);
+    QVERIFY(id->id() != 0);
+
+    /* The sessions of an identity share the same session core in signond */
+    const int sessionCount = 4;
+    QList<AuthSession *> sessions;
+    QList<QSignalSpy *> responses;
+    QList<QSignalSpy *> errors;
+    for (int i = 0; i < sessionCount; i++) {
+        Identity *identity = Identity::existingIdentity(id->id(), this);
+        AuthSession *as = identity->createSession(QLatin1String("ssotest"));
+        sessions.append(as);
+        responses.append(new QSignalSpy(as,
+            SIGNAL(response(const SignOn::SessionData&))));
+        errors.append(new QSignalSpy(as,
+            SIGNAL(error(const SignOn::Error &))));
+    }
+
+    SessionData inData;
+    inData.setSecret("testSecret");
+    inData.setUserName("testUsername");
+
+    foreach (AuthSession *as, sessions)
+        as->process(inData, "mech1");
+    waitForSignals(responses);
+
+    /* The test plugin tells when it started and finished each request */
+    QList<QPair<qint64, qint64> > spans;
+    for (int i = 0; i < sessionCount; i++) {
+        QCOMPARE(responses.at(i)->count(), 1);
+        QCOMPARE(errors.at(i)->count(), 0);
+        SessionData data =
+            responses.at(i)->at(0).at(0).value<SignOn::SessionData>();
+        qint64 started = data.getProperty("ProcessStarted").toLongLong();
+        qint64 finished = data.getProperty("ProcessFinished").toLongLong();
+        QVERIFY(started > 0);
+        QVERIFY(finished >= started);
+        spans.append(qMakePair(started, finished));
+    }
+
+    /* One at a time, each request would start after the previous one
+     * finished: some of them must have been running at the same time */
+    bool overlapped = false;
+    for (int i = 0; i < spans.count(); i++) {
+        for (int j = i + 1; j < spans.count(); j++) {
+            if (spans.at(i).first < spans.at(j).second &&
+                spans.at(j).first < spans.at(i).second)
+                overlapped = true;
+        }
+    }
+    QVERIFY(overlapped);
+
+    qDeleteAll(responses);
+    qDeleteAll(errors);
+}
+
+void TestAuthSession::process_coalesced()
+{
+    /* "make check" runs signond with SSO_COALESCE_REQUESTS=1 */
+    if (qgetenv("SSO_COALESCE_REQUESTS").toInt() == 0)
+        QSKIP("signond doesn't coalesce requests", SkipSingle);
+
+    Identity *id = newStoredIdentity(this);
+    QVERIFY(id->id() != 0);
+    Identity *other = Identity::existingIdentity(id->id(), this);
+    AuthSession *first = id->createSession(QLatin1String("ssotest"));
+    AuthSession *second = other->createSession(QLatin1String("ssotest"));
+
+    QSignalSpy firstResponse(first,
+                             SIGNAL(response(const SignOn::SessionData&)));
+    QSignalSpy secondResponse(second,
+                              SIGNAL(response(const SignOn::SessionData&)));
+    QList<QSignalSpy *> responses;
+    responses << &firstResponse << &secondResponse;
+    /* signond reports the state once the plugin got the request */
+    QSignalSpy firstState(first,
+        SIGNAL(stateChanged(AuthSession::AuthSessionState, const QString&)));
+    QList<QSignalSpy *> firstStarted;
+    firstStarted << &firstState;
+
+    SessionData inData;
+    inData.setSecret("testSecret");
+    inData.setUserName("testUsername");
+    inData.setUiPolicy(NoUserInteractionPolicy);
+
+    qint64 coalesced = signondCounter("coalescedRequests");
+    QVERIFY(coalesced >= 0);
+
+    /* The second request arrives while the plugin is processing the first
+     * one, and gets the same reply */
+    first->process(inData, "mech1");
+    waitForSignals(firstStarted);
+    QVERIFY(firstState.count() > 0);
+    QCOMPARE(firstResponse.count(), 0);
+    second->process(inData, "mech1");
+    waitForSignals(responses);
+
+    QCOMPARE(firstResponse.count(), 1);
+    QCOMPARE(secondResponse.count(), 1);
+    SessionData secondData =
+        secondResponse.at(0).at(0).value<SignOn::SessionData>();
+    QCOMPARE(secondData.Realm(), QString("testRealm_after_test"));
+    QCOMPARE(signondCounter("coalescedRequests"), coalesced + 1);
+
+    /* Requests which might interact with the user are not shared */
+    inData.setUiPolicy(DefaultPolicy);
+    firstState.clear();
+    first->process(inData, "mech1");
+    waitForSignals(firstStarted);
+    QVERIFY(firstState.count() > 0);
+    second->process(inData, "mech1");
+    waitForSignals(responses, 2);
+
+    QCOMPARE(firstResponse.count(), 2);
+    QCOMPARE(secondResponse.count(), 2);
+    QCOMPARE(signondCounter("coalescedRequests"), coalesced + 1);
+}
+
 void TestAuthSession::cancel_immediately()
 {
     AuthSession *as;
@@ -811,6 +1154,49 @@ void TestAuthSession::cancel_without_process()
     QCOMPARE(spyError.count(), 1);
 }
 
+void TestAuthSession::process_with_timeout()
+{
+    AuthSession *as;
+    SSO_TEST_CREATE_AUTH_SESSION(as, "ssotest");
+
+    QSignalSpy spyResponse(as, SIGNAL(response(const SignOn::SessionData&)));
+    QSignalSpy spyError(as, SIGNAL(error(const SignOn::Error &)));
+    QEventLoop loop;
+
+    QObject::connect(as, SIGNAL(response(const SignOn::SessionData&)),
+                     &loop, SLOT(quit()));
+    QObject::connect(as, SIGNAL(error(const SignOn::Error &)),
+                     &loop, SLOT(quit()));
+    QTimer::singleShot(10*1000, &loop, SLOT(quit()));
+
+    SessionData inData;
+    inData.setSecret("testSecret");
+    inData.setUserName("testUsername");
+
+    /* the test plugin takes one second to process the request */
+    as->setTimeout(300);
+    as->process(inData, "mech1");
+    loop.exec();
+
+    QCOMPARE(spyResponse.count(), 0);
+    QCOMPARE(spyError.count(), 1);
+    SignOn::Error error = spyError.at(0).at(0).value<SignOn::Error>();
+    QCOMPARE(error.type(), int(SignOn::Error::TimedOut));
+
+    /* ssotest keeps the cancellation in a static flag until the canceled
+     * request is over: the next request must not start before that */
+    QVERIFY(waitForIdleSignond());
+
+    /* the session is still usable once the deadline is removed */
+    as->setTimeout(0);
+    QTimer::singleShot(10*1000, &loop, SLOT(quit()));
+    as->process(inData, "mech1");
+    loop.exec();
+
+    QCOMPARE(spyResponse.count(), 1);
+    QCOMPARE(spyError.count(), 1);
+}
+
 void TestAuthSession::handle_destroyed_signal()
 {
     QSKIP("testing in sb", SkipSingle);
@@ -859,6 +1245,52 @@ void TestAuthSession::multi_thread_test()
     process_with_new_identity();
 }
 
+void TestAuthSession::multi_thread_process_test()
+{
+    /* Authenticate from many threads in parallel, each of them having its
+     * own connection to signond */
+    const int threadCount = 24;
+    QList<ProcessThread *> threads;
+    for (int i = 0; i < threadCount; i++)
+        threads.append(new ProcessThread);
+
+    foreach (ProcessThread *thread, threads)
+        thread->start();
+
+    foreach (ProcessThread *thread, threads)
+        QVERIFY(thread->wait(g_testThreadTimeout + 1000));
+
+    foreach (ProcessThread *thread, threads) {
+        QCOMPARE(thread->m_errorCount, 0);
+        QCOMPARE(thread->m_responseCount, 1);
+        QCOMPARE(thread->m_realm, QString("testRealm_after_test"));
+    }
+
+    qDeleteAll(threads);
+}
+
+void TestAuthSession::connect_without_blocking()
+{
+#if QT_VERSION < QT_VERSION_CHECK(5, 6, 0)
+    QSKIP("the connection is set up synchronously", SkipSingle);
+#endif
+    QByteArray usePeerBus = qgetenv("SSO_USE_PEER_BUS");
+    if (!usePeerBus.isEmpty() && usePeerBus != "1")
+        QSKIP("the bus connection is shared and already open", SkipSingle);
+
+    /* A new thread opens its own connection to signond: the first call
+     * must return while the connection is being set up, and be sent once
+     * it's ready. */
+    ConnectThread thread;
+    thread.start();
+    QVERIFY(thread.wait(g_testThreadTimeout + 1000));
+
+    QVERIFY(thread.m_requestsBefore >= 0);
+    QVERIFY(thread.m_replied);
+    QCOMPARE(thread.m_requestsAtReturn, thread.m_requestsBefore);
+    QCOMPARE(thread.m_requestsAtReply, thread.m_requestsBefore + 1);
+}
+
 void TestAuthSession::cancel()
 {
     g_currentSession->cancel();
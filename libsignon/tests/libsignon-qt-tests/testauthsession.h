@@ -87,18 +87,25 @@ private Q_SLOTS:
     void process_with_nonexisting_method();
     void process_with_unauthorized_method();
     void process_from_other_process();
+    void process_with_identity_call();
     void process_many_times_after_auth();
     void process_many_times_before_auth();
     void process_with_big_session_data();
     void process_after_timeout();
+    void process_with_result_cache();
+    void process_concurrently();
+    void process_coalesced();
 
     void cancel_immediately();
     void cancel_with_delay();
     void cancel_without_process();
+    void process_with_timeout();
 
     void handle_destroyed_signal();
 
     void multi_thread_test();
+    void multi_thread_process_test();
+    void connect_without_blocking();
 
     void processUi_with_existing_identity();
     void processUi_and_cancel();
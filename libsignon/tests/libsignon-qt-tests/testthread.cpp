@@ -25,9 +25,12 @@
 #include "testthread.h"
 
 #include "SignOn/authservice.h"
+#include "SignOn/identity.h"
+#include "signond-metrics.h"
 
 #include <QTimer>
 #include <QEventLoop>
+#include <QSignalSpy>
 
 using namespace SignOn;
 
@@ -54,3 +57,64 @@ void TestThread::run()
     QTimer::singleShot(g_testThreadTimeout, &loop, SLOT(quit()));
     loop.exec();
 }
+
+void ProcessThread::run()
+{
+    /* All the objects are created in this thread, so that they use its
+     * connection to signond */
+    Identity *identity = Identity::newIdentity(IdentityInfo());
+    AuthSession *session = identity->createSession(QLatin1String("ssotest"));
+    QEventLoop loop;
+
+    QSignalSpy responseSpy(session,
+                           SIGNAL(response(const SignOn::SessionData &)));
+    QSignalSpy errorSpy(session, SIGNAL(error(const SignOn::Error &)));
+    connect(session, SIGNAL(response(const SignOn::SessionData &)),
+            &loop, SLOT(quit()));
+    connect(session, SIGNAL(error(const SignOn::Error &)),
+            &loop, SLOT(quit()));
+
+    SessionData inData;
+    inData.setSecret("testSecret");
+    inData.setUserName("testUsername");
+    session->process(inData, "mech1");
+
+    QTimer::singleShot(g_testThreadTimeout, &loop, SLOT(quit()));
+    loop.exec();
+
+    m_responseCount = responseSpy.count();
+    m_errorCount = errorSpy.count();
+    if (m_responseCount > 0)
+        m_realm = responseSpy.at(0).at(0).value<SessionData>().Realm();
+
+    identity->destroySession(session);
+    delete identity;
+}
+
+void ConnectThread::run()
+{
+    QEventLoop loop;
+    AuthService service;
+    connect(&service, SIGNAL(methodsAvailable(const QStringList &)),
+            this, SLOT(onReply()), Qt::DirectConnection);
+    connect(&service, SIGNAL(methodsAvailable(const QStringList &)),
+            &loop, SLOT(quit()));
+    connect(&service, SIGNAL(error(const SignOn::Error &)),
+            &loop, SLOT(quit()));
+
+    m_requestsBefore = signondRequests("AuthService.queryMethods");
+    service.queryMethods();
+    /* This is a blocking call, which doesn't run the event loop of this
+     * thread: if the connection is being opened in the background, the
+     * queued call cannot have been sent yet. */
+    m_requestsAtReturn = signondRequests("AuthService.queryMethods");
+
+    QTimer::singleShot(g_testThreadTimeout, &loop, SLOT(quit()));
+    loop.exec();
+}
+
+void ConnectThread::onReply()
+{
+    m_replied = true;
+    m_requestsAtReply = signondRequests("AuthService.queryMethods");
+}
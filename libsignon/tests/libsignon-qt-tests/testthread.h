@@ -23,6 +23,7 @@
  */
 
 
+#include <QString>
 #include <QThread>
 
 const int g_testThreadTimeout = 10000;
@@ -37,3 +38,42 @@ public:
 Q_SIGNALS:
     void testCompleted();
 };
+
+/* Runs one authentication with the ssotest plugin */
+class ProcessThread: public QThread
+{
+    Q_OBJECT
+
+public:
+    ProcessThread(): m_responseCount(0), m_errorCount(0) {}
+    void run();
+
+    int m_responseCount;
+    int m_errorCount;
+    QString m_realm;
+};
+
+/* Makes the first SignOn call of a new thread, which has to connect to
+ * signond, and records how many such calls signond had received before the
+ * call, once the call returned, and once the reply arrived */
+class ConnectThread: public QThread
+{
+    Q_OBJECT
+
+public:
+    ConnectThread():
+        m_requestsBefore(-1),
+        m_requestsAtReturn(-1),
+        m_requestsAtReply(-1),
+        m_replied(false)
+    {}
+    void run();
+
+    qint64 m_requestsBefore;
+    qint64 m_requestsAtReturn;
+    qint64 m_requestsAtReply;
+    bool m_replied;
+
+private Q_SLOTS:
+    void onReply();
+};
@@ -0,0 +1,200 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+#include "loadclient.h"
+
+#include "SignOn/authsession.h"
+#include "SignOn/identityinfo.h"
+#include "SignOn/sessiondata.h"
+#include "SignOn/signonerror.h"
+
+#include <QMetaObject>
+
+#include <stdio.h>
+
+using namespace SignOn;
+
+static const char *operationNames[LoadClient::OperationCount] = {
+    "getIdentity",
+    "queryInfo",
+    "storeCredentials",
+    "process",
+};
+
+LoadClient::LoadClient(const QList<Operation> &schedule, int requests,
+                       const QString &method, const QString &mechanism,
+                       QObject *parent):
+    QObject(parent),
+    m_schedule(schedule),
+    m_requests(requests),
+    m_done(0),
+    m_method(method),
+    m_mechanism(mechanism),
+    m_identity(0),
+    m_freshIdentity(0),
+    m_settingUp(true),
+    m_failed(false),
+    m_current(OperationCount)
+{
+}
+
+LoadClient::~LoadClient()
+{
+}
+
+const char *LoadClient::operationName(Operation operation)
+{
+    return operation < OperationCount ? operationNames[operation] : "";
+}
+
+int LoadClient::operationFromName(const QString &name)
+{
+    for (int i = 0; i < OperationCount; i++) {
+        if (name == QLatin1String(operationNames[i]))
+            return i;
+    }
+    return -1;
+}
+
+IdentityInfo LoadClient::identityInfo(int revision) const
+{
+    IdentityInfo info;
+    info.setCaption(QString::fromLatin1("signon-load %1").arg(revision));
+    info.setUserName(QLatin1String("load-user"));
+    info.setSecret(QLatin1String("load-secret"));
+    info.setMethod(m_method, QStringList() << m_mechanism);
+    info.setAccessControlList(QStringList() << QLatin1String("*"));
+    return info;
+}
+
+/* The identity used by all the operations is created first, and its
+ * creation is not measured */
+void LoadClient::start()
+{
+    m_identity = Identity::newIdentity(identityInfo(0), this);
+    connect(m_identity, SIGNAL(credentialsStored(const quint32)),
+            this, SLOT(onCredentialsStored(const quint32)));
+    connect(m_identity, SIGNAL(info(const SignOn::IdentityInfo&)),
+            this, SLOT(onInfo(const SignOn::IdentityInfo&)));
+    connect(m_identity, SIGNAL(error(const SignOn::Error&)),
+            this, SLOT(onError(const SignOn::Error&)));
+    m_identity->storeCredentials();
+}
+
+void LoadClient::next()
+{
+    if (m_done == m_requests) {
+        printf("elapsed %lld\n", m_runTimer.nsecsElapsed() / 1000);
+        fflush(stdout);
+        Q_EMIT finished();
+        return;
+    }
+
+    m_current = m_schedule.at(m_done % m_schedule.count());
+    m_timer.start();
+
+    switch (m_current) {
+    case GetIdentity:
+        /* A new Identity object must register itself with signond before
+         * any other call can reach it */
+        if (m_freshIdentity != 0)
+            m_freshIdentity->deleteLater();
+        m_freshIdentity = Identity::existingIdentity(m_identity->id(), this);
+        connect(m_freshIdentity, SIGNAL(info(const SignOn::IdentityInfo&)),
+                this, SLOT(onInfo(const SignOn::IdentityInfo&)));
+        connect(m_freshIdentity, SIGNAL(error(const SignOn::Error&)),
+                this, SLOT(onError(const SignOn::Error&)));
+        m_freshIdentity->queryInfo();
+        break;
+    case QueryInfo:
+        m_identity->queryInfo();
+        break;
+    case StoreCredentials:
+        m_identity->storeCredentials(identityInfo(m_done));
+        break;
+    case Process:
+        m_session->process(SessionData(), m_mechanism);
+        break;
+    default:
+        Q_ASSERT(false);
+    }
+}
+
+void LoadClient::operationDone(bool ok)
+{
+    if (ok) {
+        printf("%s %lld\n", operationName(m_current),
+               m_timer.nsecsElapsed() / 1000);
+    } else {
+        printf("%s error\n", operationName(m_current));
+    }
+
+    m_done++;
+    /* Don't nest the next operation into the signal emission */
+    QMetaObject::invokeMethod(this, "next", Qt::QueuedConnection);
+}
+
+void LoadClient::onCredentialsStored(const quint32 id)
+{
+    Q_UNUSED(id);
+
+    if (m_settingUp) {
+        m_settingUp = false;
+        m_session = m_identity->createSession(m_method);
+        connect(m_session, SIGNAL(response(const SignOn::SessionData&)),
+                this, SLOT(onResponse(const SignOn::SessionData&)));
+        connect(m_session, SIGNAL(error(const SignOn::Error&)),
+                this, SLOT(onError(const SignOn::Error&)));
+        m_runTimer.start();
+        next();
+        return;
+    }
+
+    operationDone(true);
+}
+
+void LoadClient::onInfo(const SignOn::IdentityInfo &info)
+{
+    Q_UNUSED(info);
+    operationDone(true);
+}
+
+void LoadClient::onResponse(const SignOn::SessionData &data)
+{
+    Q_UNUSED(data);
+    operationDone(true);
+}
+
+void LoadClient::onError(const SignOn::Error &err)
+{
+    if (m_settingUp) {
+        fprintf(stderr, "Cannot create the identity: %s\n",
+                qPrintable(err.message()));
+        m_failed = true;
+        Q_EMIT finished();
+        return;
+    }
+
+    operationDone(false);
+}
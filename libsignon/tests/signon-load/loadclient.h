@@ -0,0 +1,94 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+#ifndef SIGNON_LOADCLIENT_H
+#define SIGNON_LOADCLIENT_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+#include <QString>
+
+#include "SignOn/identity.h"
+
+/*
+ * A client of the load generator: it runs a fixed number of operations, one
+ * after the other, and prints the latency of each of them on stdout as
+ * "<operation> <microseconds>" (or "<operation> error").
+ */
+class LoadClient: public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Operation {
+        GetIdentity = 0,
+        QueryInfo,
+        StoreCredentials,
+        Process,
+        OperationCount
+    };
+
+    LoadClient(const QList<Operation> &schedule, int requests,
+               const QString &method, const QString &mechanism,
+               QObject *parent = 0);
+    ~LoadClient();
+
+    static const char *operationName(Operation operation);
+    static int operationFromName(const QString &name);
+
+    void start();
+    bool failed() const { return m_failed; }
+
+Q_SIGNALS:
+    void finished();
+
+private Q_SLOTS:
+    void next();
+    void onCredentialsStored(const quint32 id);
+    void onInfo(const SignOn::IdentityInfo &info);
+    void onResponse(const SignOn::SessionData &data);
+    void onError(const SignOn::Error &err);
+
+private:
+    SignOn::IdentityInfo identityInfo(int revision) const;
+    void operationDone(bool ok);
+
+private:
+    QList<Operation> m_schedule;
+    int m_requests;
+    int m_done;
+    QString m_method;
+    QString m_mechanism;
+    SignOn::Identity *m_identity;
+    SignOn::Identity *m_freshIdentity;
+    SignOn::AuthSessionP m_session;
+    bool m_settingUp;
+    bool m_failed;
+    Operation m_current;
+    QElapsedTimer m_timer;
+    QElapsedTimer m_runTimer;
+};
+
+#endif // SIGNON_LOADCLIENT_H
@@ -0,0 +1,304 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+/*
+ * Load generator for signond: it starts a number of client processes, each
+ * of them running a mix of libsignon-qt operations against signond, and
+ * reports the throughput and the latency percentiles of each operation.
+ * The load is run once using the P2P socket and once using the session bus,
+ * unless --bus is given.
+ *
+ * Run it against a private signond with "make load".
+ */
+
+#include "loadclient.h"
+
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QMap>
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QStringList>
+#include <QVector>
+#include <QtAlgorithms>
+
+#include <math.h>
+#include <stdio.h>
+
+struct Options {
+    Options():
+        clients(4),
+        requests(200),
+        mix(QLatin1String("getIdentity=2,queryInfo=4,"
+                          "storeCredentials=1,process=1")),
+        method(QLatin1String("ssotest")),
+        mechanism(QLatin1String("mech1")),
+        buses(QStringList() << QLatin1String("p2p") <<
+              QLatin1String("session")),
+        worker(false)
+    {}
+
+    int clients;
+    int requests;
+    QString mix;
+    QString method;
+    QString mechanism;
+    QStringList buses;
+    bool worker;
+};
+
+struct OperationStats {
+    OperationStats(): errors(0) {}
+
+    QVector<qint64> latencies;
+    int errors;
+};
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [OPTION]...\n"
+            "  --clients N        number of client processes (default 4)\n"
+            "  --requests N       operations run by each client (default 200)\n"
+            "  --mix LIST         weights of the operations, as in\n"
+            "                     \"getIdentity=2,queryInfo=4,"
+            "storeCredentials=1,process=1\"\n"
+            "  --method NAME      authentication method (default ssotest)\n"
+            "  --mechanism NAME   authentication mechanism (default mech1)\n"
+            "  --bus p2p|session  only use the given connection\n",
+            name);
+}
+
+static bool parseOptions(const QStringList &args, Options &options)
+{
+    for (int i = 1; i < args.count(); i++) {
+        const QString &arg = args.at(i);
+        if (arg == QLatin1String("--worker")) {
+            options.worker = true;
+            continue;
+        }
+
+        if (i + 1 == args.count()) return false;
+        const QString &value = args.at(++i);
+        bool ok = true;
+        if (arg == QLatin1String("--clients")) {
+            options.clients = value.toInt(&ok);
+        } else if (arg == QLatin1String("--requests")) {
+            options.requests = value.toInt(&ok);
+        } else if (arg == QLatin1String("--mix")) {
+            options.mix = value;
+        } else if (arg == QLatin1String("--method")) {
+            options.method = value;
+        } else if (arg == QLatin1String("--mechanism")) {
+            options.mechanism = value;
+        } else if (arg == QLatin1String("--bus") &&
+                   (value == QLatin1String("p2p") ||
+                    value == QLatin1String("session"))) {
+            options.buses = QStringList(value);
+        } else {
+            return false;
+        }
+        if (!ok) return false;
+    }
+
+    return options.clients > 0 && options.requests > 0;
+}
+
+/* Turns the weights into a sequence where the operations are interleaved
+ * as evenly as possible (smooth weighted round-robin) */
+static bool parseMix(const QString &mix, QList<LoadClient::Operation> &schedule)
+{
+    QVector<int> weights(LoadClient::OperationCount, 0);
+    int total = 0;
+    foreach (const QString &item, mix.split(QLatin1Char(','))) {
+        int op = LoadClient::operationFromName(item.section(QLatin1Char('='),
+                                                            0, 0));
+        bool ok = false;
+        int weight = item.section(QLatin1Char('='), 1, 1).toInt(&ok);
+        if (op < 0 || !ok || weight < 0) return false;
+        weights[op] = weight;
+        total += weight;
+    }
+    if (total == 0) return false;
+
+    QVector<int> current(LoadClient::OperationCount, 0);
+    for (int n = 0; n < total; n++) {
+        int best = 0;
+        for (int op = 0; op < LoadClient::OperationCount; op++) {
+            current[op] += weights[op];
+            if (current[op] > current[best]) best = op;
+        }
+        current[best] -= total;
+        schedule.append(LoadClient::Operation(best));
+    }
+    return true;
+}
+
+static int runWorker(QCoreApplication &app, const Options &options,
+                     const QList<LoadClient::Operation> &schedule)
+{
+    LoadClient client(schedule, options.requests,
+                      options.method, options.mechanism);
+    QObject::connect(&client, SIGNAL(finished()), &app, SLOT(quit()));
+    client.start();
+    int ret = app.exec();
+    return client.failed() ? 1 : ret;
+}
+
+static qint64 percentile(const QVector<qint64> &sorted, double fraction)
+{
+    if (sorted.isEmpty()) return 0;
+    int rank = int(ceil(fraction * sorted.count()));
+    return sorted.at(qBound(0, rank - 1, sorted.count() - 1));
+}
+
+static int runningWorkers(const QList<QProcess*> &workers)
+{
+    int running = 0;
+    foreach (QProcess *worker, workers) {
+        if (worker->state() != QProcess::NotRunning)
+            running++;
+    }
+    return running;
+}
+
+static bool runLoad(const Options &options, const QString &bus)
+{
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+    environment.insert(QLatin1String("SSO_USE_PEER_BUS"),
+                       bus == QLatin1String("p2p") ?
+                       QLatin1String("1") : QLatin1String("0"));
+
+    QStringList args = QStringList() << QLatin1String("--worker") <<
+        QLatin1String("--requests") << QString::number(options.requests) <<
+        QLatin1String("--mix") << options.mix <<
+        QLatin1String("--method") << options.method <<
+        QLatin1String("--mechanism") << options.mechanism;
+
+    /* The output of the workers is read by QProcess while the event loop
+     * runs, for all of them at once: waiting for one worker at a time would
+     * let the others block on a full pipe */
+    QEventLoop loop;
+    QList<QProcess*> workers;
+    for (int i = 0; i < options.clients; i++) {
+        QProcess *worker = new QProcess;
+        worker->setProcessEnvironment(environment);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 2, 0)
+        worker->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+#endif
+        QObject::connect(worker, SIGNAL(finished(int, QProcess::ExitStatus)),
+                         &loop, SLOT(quit()));
+        QObject::connect(worker, SIGNAL(error(QProcess::ProcessError)),
+                         &loop, SLOT(quit()));
+        worker->start(QCoreApplication::applicationFilePath(), args);
+        workers.append(worker);
+    }
+
+    while (runningWorkers(workers) > 0)
+        loop.exec();
+
+    /* The clients run concurrently: the throughput is measured over the
+     * time taken by the slowest of them */
+    QMap<QString, OperationStats> stats;
+    qint64 elapsed = 0;
+    bool ok = true;
+    foreach (QProcess *worker, workers) {
+        if (worker->error() == QProcess::FailedToStart ||
+            worker->exitStatus() != QProcess::NormalExit ||
+            worker->exitCode() != 0)
+            ok = false;
+
+        QList<QByteArray> lines = worker->readAllStandardOutput().split('\n');
+        foreach (const QByteArray &line, lines) {
+            QList<QByteArray> fields = line.split(' ');
+            if (fields.count() != 2) continue;
+            QString name = QString::fromLatin1(fields.at(0));
+            if (name == QLatin1String("elapsed")) {
+                elapsed = qMax(elapsed, fields.at(1).toLongLong());
+            } else if (fields.at(1) == "error") {
+                stats[name].errors++;
+            } else {
+                stats[name].latencies.append(fields.at(1).toLongLong());
+            }
+        }
+        delete worker;
+    }
+
+    if (!ok) {
+        fprintf(stderr, "Some clients failed\n");
+        return false;
+    }
+
+    double seconds = elapsed / 1000000.0;
+    printf("bus: %s, clients: %d, requests per client: %d, time: %.3f s\n",
+           qPrintable(bus), options.clients, options.requests, seconds);
+    printf("%-18s %8s %7s %10s %9s %9s %9s\n", "operation", "count",
+           "errors", "ops/s", "p50 ms", "p95 ms", "p99 ms");
+
+    QVector<qint64> all;
+    int errors = 0;
+    QMap<QString, OperationStats>::iterator it;
+    for (it = stats.begin(); it != stats.end(); it++) {
+        QVector<qint64> &latencies = it.value().latencies;
+        qSort(latencies);
+        all += latencies;
+        errors += it.value().errors;
+        printf("%-18s %8d %7d %10.1f %9.3f %9.3f %9.3f\n",
+               qPrintable(it.key()), latencies.count(), it.value().errors,
+               seconds > 0 ? latencies.count() / seconds : 0.0,
+               percentile(latencies, 0.50) / 1000.0,
+               percentile(latencies, 0.95) / 1000.0,
+               percentile(latencies, 0.99) / 1000.0);
+    }
+
+    qSort(all);
+    printf("%-18s %8d %7d %10.1f %9.3f %9.3f %9.3f\n\n", "total",
+           all.count(), errors, seconds > 0 ? all.count() / seconds : 0.0,
+           percentile(all, 0.50) / 1000.0,
+           percentile(all, 0.95) / 1000.0,
+           percentile(all, 0.99) / 1000.0);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    Options options;
+    QList<LoadClient::Operation> schedule;
+    if (!parseOptions(app.arguments(), options) ||
+        !parseMix(options.mix, schedule)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (options.worker)
+        return runWorker(app, options, schedule);
+
+    bool ok = true;
+    foreach (const QString &bus, options.buses)
+        ok = runLoad(options, bus) && ok;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,33 @@
+include( ../tests.pri )
+
+TARGET = signon-load
+
+CONFIG += \
+    build_all \
+    link_pkgconfig
+QT += \
+    core \
+    dbus
+QT -= gui
+
+greaterThan(QT_MAJOR_VERSION, 4) {
+    LIBS *= -lsignon-qt5
+} else {
+    LIBS *= -lsignon-qt
+}
+QMAKE_RPATHDIR = $${QMAKE_LIBDIR}
+
+SOURCES += \
+    loadclient.cpp \
+    main.cpp
+HEADERS += \
+    loadclient.h
+
+QMAKE_CXXFLAGS += -fno-exceptions \
+    -fno-rtti
+
+# "make load" runs the default load against a private signond, using the
+# test plugins; pass other options with LOAD_OPTIONS="..."
+load.depends = $$TARGET
+load.commands = "SSO_PLUGINS_DIR=$${TOP_BUILD_DIR}/src/plugins/test SSO_EXTENSIONS_DIR=$${TOP_BUILD_DIR}/non-existing-dir $$RUN_WITH_SIGNOND ./signon-load \$(LOAD_OPTIONS)"
+QMAKE_EXTRA_TARGETS += load
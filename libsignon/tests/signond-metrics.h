@@ -0,0 +1,75 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef SIGNON_TESTS_SIGNOND_METRICS_H
+#define SIGNON_TESTS_SIGNOND_METRICS_H
+
+#include <QDBusArgument>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDebug>
+#include <QVariantMap>
+
+#include "signond/signoncommon.h"
+
+/* Reads the data exposed by the signond metrics interface */
+static inline QVariantMap signondMetrics()
+{
+    QDBusMessage msg =
+        QDBusMessage::createMethodCall(SIGNOND_SERVICE,
+                                       SIGNOND_DAEMON_OBJECTPATH,
+                                       SIGNOND_SERVICE_PREFIX ".Metrics",
+                                       "metrics");
+    QDBusMessage reply = QDBusConnection::sessionBus().call(msg);
+    if (reply.type() != QDBusMessage::ReplyMessage) {
+        qWarning() << "Cannot read the metrics:" << reply.errorMessage();
+        return QVariantMap();
+    }
+
+    return qdbus_cast<QVariantMap>(reply.arguments().value(0));
+}
+
+/* Reads one of the counters exposed by the signond metrics interface, or
+ * returns -1 */
+static inline qint64 signondCounter(const char *name)
+{
+    QVariantMap metrics = signondMetrics();
+    QVariantMap counters =
+        qdbus_cast<QVariantMap>(metrics.value(QLatin1String("counters")));
+    return counters.value(QLatin1String(name), -1).toLongLong();
+}
+
+/* Reads how many times signond has been asked to run a D-Bus method, such
+ * as "Identity.getInfo", or returns -1 if the metrics cannot be read */
+static inline qint64 signondRequests(const char *method)
+{
+    QVariantMap metrics = signondMetrics();
+    if (metrics.isEmpty()) return -1;
+
+    /* Methods which have never been called are not listed */
+    QVariantMap requests =
+        qdbus_cast<QVariantMap>(metrics.value(QLatin1String("requests")));
+    return requests.value(QLatin1String(method), 0).toLongLong();
+}
+
+#endif // SIGNON_TESTS_SIGNOND_METRICS_H
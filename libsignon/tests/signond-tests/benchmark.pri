@@ -0,0 +1,8 @@
+# Benchmarks take a while and are not run by "make check": run them with
+# "make benchmark", which stores the results in XML, so that they can be
+# compared across commits. Set BENCHMARK_ENV before including this file to
+# run the benchmark in a specific environment.
+check.commands =
+benchmark.depends = $$TARGET
+benchmark.commands = "$$BENCHMARK_ENV ./$$TARGET -xml -o $${TARGET}.xml"
+QMAKE_EXTRA_TARGETS += benchmark
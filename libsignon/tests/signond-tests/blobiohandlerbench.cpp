@@ -0,0 +1,402 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "blobiohandlerbench.h"
+
+#include <QLocalSocket>
+#include <QMutex>
+#include <QSemaphore>
+#include <QThread>
+
+#include "SignOn/blobiohandler.h"
+#include "SignOn/ipc.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace SignOn;
+
+/* Writes the BLOBs from a separate thread, as the other end of the socket
+ * would otherwise block as soon as its buffer is full */
+class SenderThread: public QThread
+{
+public:
+    SenderThread(int rawFd, int blobFd, int sharedMemoryFd):
+        m_rawFd(rawFd),
+        m_blobFd(blobFd),
+        m_sharedMemoryFd(sharedMemoryFd),
+        m_useSharedMemory(false),
+        m_stop(false)
+    {
+    }
+
+    void sendRaw(const QByteArray &data)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_raw = data;
+        m_map.clear();
+        m_pending.release();
+    }
+
+    void sendMap(const QVariantMap &map, bool useSharedMemory)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_raw.clear();
+        m_map = map;
+        m_useSharedMemory = useSharedMemory;
+        m_pending.release();
+    }
+
+    void stop()
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stop = true;
+        m_pending.release();
+    }
+
+protected:
+    void run()
+    {
+        QFile blobFile;
+        blobFile.open(m_blobFd, QIODevice::WriteOnly | QIODevice::Unbuffered);
+        BlobIOHandler handler(0, &blobFile);
+
+        forever {
+            m_pending.acquire();
+            QMutexLocker locker(&m_mutex);
+            if (m_stop) break;
+
+            if (!m_raw.isEmpty()) {
+                writeAll(m_raw);
+            } else {
+                handler.setSharedMemoryChannel(m_useSharedMemory ?
+                                               m_sharedMemoryFd : -1);
+                handler.sendData(m_map);
+            }
+        }
+    }
+
+private:
+    void writeAll(const QByteArray &data)
+    {
+        const char *p = data.constData();
+        qint64 left = data.size();
+        while (left > 0) {
+            ssize_t written = ::write(m_rawFd, p, left);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            p += written;
+            left -= written;
+        }
+    }
+
+    int m_rawFd;
+    int m_blobFd;
+    int m_sharedMemoryFd;
+    QMutex m_mutex;
+    QSemaphore m_pending;
+    QByteArray m_raw;
+    QVariantMap m_map;
+    bool m_useSharedMemory;
+    bool m_stop;
+};
+
+static const int payloadSizes[] = {
+    100, 1024, 16 * 1024, 64 * 1024, 1024 * 1024, 8 * 1024 * 1024
+};
+
+static QString sizeName(int size)
+{
+    if (size >= 1024 * 1024)
+        return QString::fromLatin1("%1MB").arg(size / (1024 * 1024));
+    if (size >= 1024)
+        return QString::fromLatin1("%1kB").arg(size / 1024);
+    return QString::fromLatin1("%1B").arg(size);
+}
+
+/* About 100 bytes once serialized */
+static void insertString(QVariantMap &map, int i)
+{
+    map.insert(QString::fromLatin1("key%1").arg(i),
+               QString(32, QLatin1Char('a' + i % 26)));
+}
+
+static QVariantMap flatPayload(int size)
+{
+    QVariantMap map;
+    for (int i = 0; i < qMax(1, size / 100); i++)
+        insertString(map, i);
+    return map;
+}
+
+/* Three levels of maps, holding ten strings each at the bottom */
+static QVariantMap nestedPayload(int size)
+{
+    QVariantMap map;
+    int strings = qMax(1, size / 100);
+    for (int i = 0; i < strings; i += 100) {
+        QVariantMap middle;
+        for (int j = i; j < qMin(strings, i + 100); j += 10) {
+            QVariantMap leaf;
+            for (int k = j; k < qMin(strings, j + 10); k++)
+                insertString(leaf, k);
+            middle.insert(QString::fromLatin1("leaf%1").arg(j), leaf);
+        }
+        map.insert(QString::fromLatin1("middle%1").arg(i), middle);
+    }
+    return map;
+}
+
+/* Binary data, in chunks of up to 64kB, as captcha images or certificates */
+static QVariantMap bytesPayload(int size)
+{
+    QVariantMap map;
+    const int chunkSize = 64 * 1024;
+    for (int offset = 0, i = 0; offset < size; offset += chunkSize, i++) {
+        map.insert(QString::fromLatin1("blob%1").arg(i),
+                   QByteArray(qMin(chunkSize, size - offset), char(i)));
+    }
+    return map;
+}
+
+void TestBlobIOHandlerBench::initTestCase()
+{
+    int rawFds[2], blobFds[2], sharedMemoryFds[2];
+    QVERIFY(socketpair(AF_UNIX, SOCK_STREAM, 0, rawFds) == 0);
+    QVERIFY(socketpair(AF_UNIX, SOCK_STREAM, 0, blobFds) == 0);
+    QVERIFY(socketpair(AF_UNIX, SOCK_STREAM, 0, sharedMemoryFds) == 0);
+
+    m_handler = new BlobIOHandler(0, 0, this);
+
+    m_rawFd = rawFds[0];
+    m_socket = new QLocalSocket(this);
+    QVERIFY(m_socket->setSocketDescriptor(blobFds[0]));
+    m_receiver = new BlobIOHandler(m_socket, 0, this);
+    m_sharedMemoryFd = sharedMemoryFds[0];
+    m_receiver->setSharedMemoryChannel(m_sharedMemoryFd);
+    connect(m_receiver, SIGNAL(dataReceived(const QVariantMap&)),
+            this, SLOT(onDataReceived(const QVariantMap&)));
+    connect(m_receiver, SIGNAL(error()), this, SLOT(onError()));
+
+    m_sender = new SenderThread(rawFds[1], blobFds[1], sharedMemoryFds[1]);
+    m_sender->start();
+}
+
+void TestBlobIOHandlerBench::cleanupTestCase()
+{
+    m_sender->stop();
+    m_sender->wait();
+    delete m_sender;
+    m_sender = 0;
+}
+
+void TestBlobIOHandlerBench::onDataReceived(const QVariantMap &map)
+{
+    Q_UNUSED(map);
+    m_received = true;
+}
+
+void TestBlobIOHandlerBench::onError()
+{
+    m_received = true;
+    m_failed = true;
+}
+
+void TestBlobIOHandlerBench::addPayloads()
+{
+    QTest::addColumn<QVariantMap>("map");
+
+    for (uint i = 0; i < sizeof(payloadSizes) / sizeof(int); i++) {
+        int size = payloadSizes[i];
+        QString name = sizeName(size);
+        QTest::newRow(qPrintable(QLatin1String("flat-") + name)) <<
+            flatPayload(size);
+        QTest::newRow(qPrintable(QLatin1String("nested-") + name)) <<
+            nestedPayload(size);
+        QTest::newRow(qPrintable(QLatin1String("bytes-") + name)) <<
+            bytesPayload(size);
+    }
+}
+
+/* The data written on the channel by BlobIOHandler::sendData() */
+QByteArray TestBlobIOHandlerBench::framedPages(const QVariantMap &map)
+{
+    QByteArray blob = m_handler->variantMapToByteArray(map);
+    QByteArray framed;
+    QDataStream stream(&framed, QIODevice::WriteOnly);
+    stream << blob.size();
+    foreach (const QByteArray &page, m_handler->pageByteArray(blob))
+        stream << page;
+    return framed;
+}
+
+void TestBlobIOHandlerBench::serialize_data()
+{
+    addPayloads();
+}
+
+void TestBlobIOHandlerBench::serialize()
+{
+    QFETCH(QVariantMap, map);
+
+    QBENCHMARK {
+        m_handler->variantMapToByteArray(map);
+    }
+}
+
+void TestBlobIOHandlerBench::page_data()
+{
+    addPayloads();
+}
+
+void TestBlobIOHandlerBench::page()
+{
+    QFETCH(QVariantMap, map);
+
+    QByteArray blob = m_handler->variantMapToByteArray(map);
+    QBENCHMARK {
+        m_handler->pageByteArray(blob);
+    }
+}
+
+void TestBlobIOHandlerBench::transfer_data()
+{
+    addPayloads();
+}
+
+void TestBlobIOHandlerBench::transfer()
+{
+    QFETCH(QVariantMap, map);
+
+    QByteArray framed = framedPages(map);
+    QByteArray received(framed.size(), 0);
+    QBENCHMARK {
+        m_sender->sendRaw(framed);
+        char *p = received.data();
+        qint64 left = received.size();
+        while (left > 0) {
+            ssize_t n = ::read(m_rawFd, p, left);
+            if (n < 0 && errno == EINTR) continue;
+            QVERIFY(n > 0);
+            p += n;
+            left -= n;
+        }
+    }
+    QCOMPARE(received, framed);
+}
+
+void TestBlobIOHandlerBench::reassemble_data()
+{
+    addPayloads();
+}
+
+/* This is the loop of BlobIOHandler::readBlob(), without the
+ * deserialization */
+void TestBlobIOHandlerBench::reassemble()
+{
+    QFETCH(QVariantMap, map);
+
+    QByteArray framed = framedPages(map);
+    QBENCHMARK {
+        QDataStream in(framed);
+        int blobSize;
+        in >> blobSize;
+        QByteArray blob;
+        while (blob.size() < blobSize) {
+            QByteArray page;
+            in >> page;
+            if (page.isEmpty()) break;
+            blob.append(page);
+        }
+    }
+}
+
+void TestBlobIOHandlerBench::deserialize_data()
+{
+    addPayloads();
+}
+
+void TestBlobIOHandlerBench::deserialize()
+{
+    QFETCH(QVariantMap, map);
+
+    QByteArray blob = m_handler->variantMapToByteArray(map);
+    QVariantMap result;
+    QBENCHMARK {
+        result = m_handler->byteArrayToVariantMap(blob);
+    }
+    QCOMPARE(result, map);
+}
+
+void TestBlobIOHandlerBench::roundTrip_data()
+{
+    QTest::addColumn<QVariantMap>("map");
+    QTest::addColumn<bool>("sharedMemory");
+
+    for (uint i = 0; i < sizeof(payloadSizes) / sizeof(int); i++) {
+        int size = payloadSizes[i];
+        QString name = sizeName(size);
+        QTest::newRow(qPrintable(QLatin1String("flat-paged-") + name)) <<
+            flatPayload(size) << false;
+        QTest::newRow(qPrintable(QLatin1String("bytes-paged-") + name)) <<
+            bytesPayload(size) << false;
+        QTest::newRow(qPrintable(QLatin1String("bytes-memfd-") + name)) <<
+            bytesPayload(size) << true;
+    }
+}
+
+/* sendData() on one end of a socket, receiveData() on the other one; when
+ * memfd is not available, the "memfd" rows fall back to paging */
+void TestBlobIOHandlerBench::roundTrip()
+{
+    QFETCH(QVariantMap, map);
+    QFETCH(bool, sharedMemory);
+
+    m_failed = false;
+    QBENCHMARK {
+        m_received = false;
+        m_sender->sendMap(map, sharedMemory);
+
+        while (m_socket->bytesAvailable() < qint64(sizeof(int)))
+            QVERIFY(m_socket->waitForReadyRead(10000));
+        QDataStream in(m_socket);
+        int blobSize;
+        in >> blobSize;
+
+        /* A BLOB fitting in one page is read at once, as PluginProxy only
+         * gets notified once it's all there */
+        while (blobSize > 0 && blobSize <= 16384 &&
+               m_socket->bytesAvailable() < blobSize + qint64(sizeof(int)))
+            QVERIFY(m_socket->waitForReadyRead(10000));
+        m_receiver->receiveData(blobSize);
+
+        while (!m_received)
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    }
+    QVERIFY(!m_failed);
+}
+
+QTEST_MAIN(TestBlobIOHandlerBench)
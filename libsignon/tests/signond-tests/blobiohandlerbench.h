@@ -0,0 +1,84 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+#ifndef BLOBIOHANDLERBENCH_H_
+#define BLOBIOHANDLERBENCH_H_
+
+#include <QtTest/QtTest>
+#include <QtCore>
+
+class QLocalSocket;
+
+namespace SignOn {
+class BlobIOHandler;
+}
+
+class SenderThread;
+
+/*
+ * Benchmarks of the stages a BLOB goes through between signond and the
+ * plugin processes: serialization, paging, transfer over a socket,
+ * reassembly of the pages and deserialization; the roundTrip benchmark
+ * measures all of them together, as done by the real BlobIOHandler.
+ */
+class TestBlobIOHandlerBench: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void serialize_data();
+    void serialize();
+    void page_data();
+    void page();
+    void transfer_data();
+    void transfer();
+    void reassemble_data();
+    void reassemble();
+    void deserialize_data();
+    void deserialize();
+    void roundTrip_data();
+    void roundTrip();
+
+    void onDataReceived(const QVariantMap &map);
+    void onError();
+
+private:
+    void addPayloads();
+    QByteArray framedPages(const QVariantMap &map);
+
+private:
+    SignOn::BlobIOHandler *m_handler;
+    SenderThread *m_sender;
+    int m_rawFd;
+    QLocalSocket *m_socket;
+    SignOn::BlobIOHandler *m_receiver;
+    int m_sharedMemoryFd;
+    bool m_received;
+    bool m_failed;
+};
+
+#endif //BLOBIOHANDLERBENCH_H_
@@ -0,0 +1,339 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "databasebench.h"
+
+#include "signonidentityinfo.cpp"
+
+static const QString storeFile = QLatin1String("/tmp/signon_bench.db");
+static const QString secretsFile =
+    QLatin1String("/tmp/signon_bench_secrets.db");
+static const QString tokenMethod = QLatin1String("oauth2");
+
+static QString pristineFile(const QString &fileName, int identities)
+{
+    return fileName + QLatin1Char('.') + QString::number(identities);
+}
+
+static SignonIdentityInfo syntheticIdentity(int i)
+{
+    /* Applications are shared among identities, as it happens with real
+     * accounts */
+    QString app = QString::fromLatin1("com.example.app%1").arg(i % 50);
+
+    MethodMap methods;
+    methods.insert(tokenMethod, QStringList() <<
+                   QLatin1String("web_server") <<
+                   QLatin1String("user_agent"));
+    methods.insert(QLatin1String("password"),
+                   QStringList() << QLatin1String("password"));
+
+    SignonIdentityInfo info;
+    info.setCaption(QString::fromLatin1("Account %1").arg(i));
+    info.setUserName(QString::fromLatin1("user%1@example.com").arg(i));
+    info.setPassword(QString::fromLatin1("secret-%1").arg(i));
+    info.setStorePassword(true);
+    info.setMethods(methods);
+    info.setRealms(QStringList() <<
+                   QLatin1String("example.com") <<
+                   QLatin1String("api.example.com"));
+    info.setAccessControlList(QStringList() <<
+                              app + QLatin1String("::token") <<
+                              QLatin1String("com.example.sync") <<
+                              QLatin1String("com.example.settings"));
+    info.setOwnerList(QStringList() << app);
+    info.setType(1);
+    return info;
+}
+
+static QVariantMap syntheticTokens(int i)
+{
+    QVariantMap tokens;
+    tokens.insert(QLatin1String("AccessToken"),
+                  QString(512, QLatin1Char('a' + i % 26)));
+    tokens.insert(QLatin1String("RefreshToken"),
+                  QString(128, QLatin1Char('A' + i % 26)));
+    tokens.insert(QLatin1String("ExpiresIn"), 3600);
+    tokens.insert(QLatin1String("Scopes"), QStringList() <<
+                  QLatin1String("email") <<
+                  QLatin1String("profile") <<
+                  QLatin1String("calendar"));
+    return tokens;
+}
+
+void TestDatabaseBench::initTestCase()
+{
+    m_db = 0;
+    m_secretsStorage = new DefaultSecretsStorage();
+}
+
+void TestDatabaseBench::cleanupTestCase()
+{
+    closeStore();
+    delete m_secretsStorage;
+    m_secretsStorage = 0;
+
+    QFile::remove(storeFile);
+    QFile::remove(secretsFile);
+    foreach (int identities, m_storeIds.keys()) {
+        QFile::remove(pristineFile(storeFile, identities));
+        QFile::remove(pristineFile(secretsFile, identities));
+    }
+}
+
+void TestDatabaseBench::cleanup()
+{
+    closeStore();
+}
+
+void TestDatabaseBench::addStoreSizes()
+{
+    QTest::addColumn<int>("identities");
+
+    QTest::newRow("10") << 10;
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+}
+
+bool TestDatabaseBench::buildStore(int identities)
+{
+    QString dbFile = pristineFile(storeFile, identities);
+    QString secretsDbFile = pristineFile(secretsFile, identities);
+    QFile::remove(dbFile);
+    QFile::remove(secretsDbFile);
+
+    CredentialsDB db(dbFile, m_secretsStorage);
+    if (!db.init() || !db.openSecretsDB(secretsDbFile))
+        return false;
+
+    QList<quint32> ids;
+    for (int i = 0; i < identities; i++) {
+        quint32 id = db.insertCredentials(syntheticIdentity(i));
+        if (id == 0 || !db.storeData(id, tokenMethod, syntheticTokens(i)))
+            break;
+        ids.append(id);
+    }
+    db.closeSecretsDB();
+    if (ids.count() != identities)
+        return false;
+
+    m_storeIds.insert(identities, ids);
+    return true;
+}
+
+/* Every benchmark runs on a fresh copy of the store, so that the ones
+ * modifying it don't affect the others */
+bool TestDatabaseBench::openStore(int identities)
+{
+    closeStore();
+
+    if (!m_storeIds.contains(identities) && !buildStore(identities))
+        return false;
+
+    QFile::remove(storeFile);
+    QFile::remove(secretsFile);
+    if (!QFile::copy(pristineFile(storeFile, identities), storeFile) ||
+        !QFile::copy(pristineFile(secretsFile, identities), secretsFile))
+        return false;
+
+    m_db = new CredentialsDB(storeFile, m_secretsStorage);
+    m_ids = m_storeIds.value(identities);
+    return m_db->init() && m_db->openSecretsDB(secretsFile);
+}
+
+void TestDatabaseBench::closeStore()
+{
+    if (m_db == 0) return;
+
+    if (m_db->isSecretsDBOpen())
+        m_db->closeSecretsDB();
+    delete m_db;
+    m_db = 0;
+}
+
+quint32 TestDatabaseBench::someIdentity() const
+{
+    return m_ids.at(m_ids.count() / 2);
+}
+
+void TestDatabaseBench::insertCredentials_data()
+{
+    addStoreSizes();
+}
+
+void TestDatabaseBench::insertCredentials()
+{
+    QFETCH(int, identities);
+    QVERIFY(openStore(identities));
+
+    SignonIdentityInfo info = syntheticIdentity(identities);
+    QBENCHMARK {
+        m_db->insertCredentials(info);
+    }
+}
+
+void TestDatabaseBench::updateCredentials_data()
+{
+    addStoreSizes();
+}
+
+void TestDatabaseBench::updateCredentials()
+{
+    QFETCH(int, identities);
+    QVERIFY(openStore(identities));
+
+    quint32 id = someIdentity();
+    SignonIdentityInfo info = syntheticIdentity(id);
+    info.setId(id);
+    int i = 0;
+    QBENCHMARK {
+        info.setCaption(QString::fromLatin1("Renamed %1").arg(i++));
+        m_db->updateCredentials(info);
+    }
+}
+
+void TestDatabaseBench::identity_data()
+{
+    addStoreSizes();
+}
+
+void TestDatabaseBench::identity()
+{
+    QFETCH(int, identities);
+    QVERIFY(openStore(identities));
+
+    quint32 id = someIdentity();
+    QCOMPARE(m_db->credentials(id).id(), id);
+    QBENCHMARK {
+        m_db->credentials(id);
+    }
+}
+
+void TestDatabaseBench::identities_data()
+{
+    addStoreSizes();
+}
+
+void TestDatabaseBench::identities()
+{
+    QFETCH(int, identities);
+    QVERIFY(openStore(identities));
+
+    QMap<QString, QString> filter;
+    QCOMPARE(m_db->credentials(filter).count(), identities);
+    QBENCHMARK {
+        m_db->credentials(filter);
+    }
+}
+
+void TestDatabaseBench::methods_data()
+{
+    addStoreSizes();
+}
+
+void TestDatabaseBench::methods()
+{
+    QFETCH(int, identities);
+    QVERIFY(openStore(identities));
+
+    quint32 id = someIdentity();
+    QCOMPARE(m_db->methods(id).count(), 2);
+    QBENCHMARK {
+        m_db->methods(id);
+    }
+}
+
+void TestDatabaseBench::accessControlList_data()
+{
+    addStoreSizes();
+}
+
+void TestDatabaseBench::accessControlList()
+{
+    QFETCH(int, identities);
+    QVERIFY(openStore(identities));
+
+    quint32 id = someIdentity();
+    QCOMPARE(m_db->accessControlList(id).count(), 3);
+    QBENCHMARK {
+        m_db->accessControlList(id);
+    }
+}
+
+void TestDatabaseBench::loadData_data()
+{
+    addStoreSizes();
+}
+
+void TestDatabaseBench::loadData()
+{
+    QFETCH(int, identities);
+    QVERIFY(openStore(identities));
+
+    quint32 id = someIdentity();
+    QVERIFY(!m_db->loadData(id, tokenMethod).isEmpty());
+    QBENCHMARK {
+        m_db->loadData(id, tokenMethod);
+    }
+}
+
+void TestDatabaseBench::storeData_data()
+{
+    addStoreSizes();
+}
+
+void TestDatabaseBench::storeData()
+{
+    QFETCH(int, identities);
+    QVERIFY(openStore(identities));
+
+    quint32 id = someIdentity();
+    QVariantMap tokens = syntheticTokens(id);
+    int i = 0;
+    QBENCHMARK {
+        tokens.insert(QLatin1String("ExpiresIn"), i++);
+        m_db->storeData(id, tokenMethod, tokens);
+    }
+}
+
+void TestDatabaseBench::removeCredentials_data()
+{
+    addStoreSizes();
+}
+
+/* Removal can't be repeated on the same identity: this measures the removal
+ * of a batch of (up to) 100 identities, once */
+void TestDatabaseBench::removeCredentials()
+{
+    QFETCH(int, identities);
+    QVERIFY(openStore(identities));
+
+    QList<quint32> ids = m_ids.mid(0, 100);
+    QBENCHMARK_ONCE {
+        foreach (quint32 id, ids)
+            m_db->removeCredentials(id);
+    }
+    QVERIFY(m_db->credentials(ids.last()).isNew());
+}
+
+QTEST_MAIN(TestDatabaseBench)
@@ -0,0 +1,85 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+#ifndef DATABASEBENCH_H_
+#define DATABASEBENCH_H_
+
+#include <QtTest/QtTest>
+#include <QtCore>
+
+#include "signond/signoncommon.h"
+#include "credentialsdb.h"
+#include "default-secrets-storage.h"
+#include "signonidentityinfo.h"
+
+using namespace SignOn;
+using namespace SignonDaemonNS;
+
+/*
+ * Benchmarks of the CredentialsDB operations, run on synthetic stores of
+ * 10, 1000 and 10000 identities.
+ */
+class TestDatabaseBench: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void cleanup();
+
+    void insertCredentials_data();
+    void insertCredentials();
+    void updateCredentials_data();
+    void updateCredentials();
+    void identity_data();
+    void identity();
+    void identities_data();
+    void identities();
+    void methods_data();
+    void methods();
+    void accessControlList_data();
+    void accessControlList();
+    void loadData_data();
+    void loadData();
+    void storeData_data();
+    void storeData();
+    void removeCredentials_data();
+    void removeCredentials();
+
+private:
+    void addStoreSizes();
+    bool buildStore(int identities);
+    bool openStore(int identities);
+    void closeStore();
+    quint32 someIdentity() const;
+
+private:
+    CredentialsDB *m_db;
+    DefaultSecretsStorage *m_secretsStorage;
+    QList<quint32> m_ids;
+    QMap<int, QList<quint32> > m_storeIds;
+};
+
+#endif //DATABASEBENCH_H_
@@ -25,6 +25,7 @@
 #include <QSet>
 
 #include "credentialsdb.h"
+#include "signonmetrics.h"
 #include "signonidentityinfo.cpp"
 
 const QString dbFile = QLatin1String("/tmp/signon_test.db");
@@ -660,4 +661,118 @@ void TestDatabase::credentialsOwnerSecurityTokenTest()
 
 }
 
+class QueryReceiver: public QObject
+{
+public:
+    QueryReceiver():
+        received(0), failed(0), lastCount(-1), ordered(true) {}
+
+    int received;
+    int failed;
+    int lastCount;
+    bool ordered;
+
+protected:
+    void customEvent(QEvent *event)
+    {
+        if (event->type() != IdentitiesQueryEvent::eventType())
+            return;
+
+        IdentitiesQueryEvent *queryEvent =
+            static_cast<IdentitiesQueryEvent *>(event);
+        if (!queryEvent->ok)
+            failed++;
+        /* Queries are served in order, and identities are only added */
+        if (queryEvent->identities.count() < lastCount)
+            ordered = false;
+        lastCount = queryEvent->identities.count();
+        received++;
+    }
+};
+
+void TestDatabase::readerThreadTest()
+{
+    const int numQueries = 100;
+    const int insertInterval = 10;
+
+    /* The reader connection must not block the writes */
+    QSqlQuery q = m_meta->exec(QLatin1String("PRAGMA journal_mode"));
+    QVERIFY(q.first());
+    QCOMPARE(q.value(0).toString().toLower(), QLatin1String("wal"));
+
+    QueryReceiver receiver;
+    CredentialsDBReader reader(dbFile);
+    reader.start();
+
+    int initialCount = m_db->credentials(QMap<QString, QString>()).count();
+
+    SignonIdentityInfo info;
+    info.setUserName(QLatin1String("Reader"));
+    info.setMethods(testMethods);
+    info.setAccessControlList(testAcl);
+
+    /* Keep writing from this thread, while the reader thread serves the
+     * queries from its own connection */
+    for (int i = 0; i < numQueries; i++) {
+        if (i % insertInterval == 0)
+            QVERIFY(m_db->insertCredentials(info) != 0);
+        reader.queryIdentities(QMap<QString, QString>(), &receiver);
+    }
+
+    QTime timer;
+    timer.start();
+    while (receiver.received < numQueries && timer.elapsed() < 10000)
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+
+    QCOMPARE(receiver.received, numQueries);
+    QCOMPARE(receiver.failed, 0);
+    QVERIFY(receiver.ordered);
+    QCOMPARE(receiver.lastCount, initialCount + numQueries / insertInterval);
+
+    /* Requests made after stopping the reader are answered with a
+     * failure */
+    reader.stop();
+    reader.queryIdentities(QMap<QString, QString>(), &receiver);
+    QCoreApplication::processEvents();
+    QCOMPARE(receiver.received, numQueries + 1);
+    QCOMPARE(receiver.failed, 1);
+}
+
+static QVariantMap histogramSnapshot(const QString &name)
+{
+    QVariantMap histograms =
+        SignonMetrics::snapshot().value(QLatin1String("histograms")).toMap();
+    return histograms.value(name).toMap();
+}
+
+void TestDatabase::metricsTest()
+{
+    const QString queryTime = QLatin1String("dbQueryTime");
+    const QString commitTime = QLatin1String("dbCommitTime");
+    qint64 queries =
+        histogramSnapshot(queryTime).value(QLatin1String("count")).toLongLong();
+    qint64 commits =
+        histogramSnapshot(commitTime).value(QLatin1String("count")).toLongLong();
+
+    SignonIdentityInfo info;
+    info.setUserName(QLatin1String("Metrics"));
+    info.setMethods(testMethods);
+    QVERIFY(m_db->insertCredentials(info) != 0);
+
+    QVariantMap histogram = histogramSnapshot(queryTime);
+    QVERIFY(histogram.value(QLatin1String("count")).toLongLong() > queries);
+    QVERIFY(histogramSnapshot(commitTime).value(QLatin1String("count"))
+            .toLongLong() > commits);
+
+    /* Every recorded value falls in exactly one bucket */
+    QVariantList buckets = histogram.value(QLatin1String("buckets")).toList();
+    QCOMPARE(buckets.count(), int(MetricsHistogram::BucketCount));
+    QCOMPARE(histogram.value(QLatin1String("bounds")).toList().count(),
+             buckets.count() - 1);
+    qint64 total = 0;
+    foreach (const QVariant &bucket, buckets)
+        total += bucket.toLongLong();
+    QCOMPARE(total, histogram.value(QLatin1String("count")).toLongLong());
+}
+
 QTEST_MAIN(TestDatabase)
@@ -28,6 +28,7 @@
 
 #include "signond/signoncommon.h"
 #include "credentialsdb.h"
+#include "credentialsdbreader.h"
 #include "default-secrets-storage.h"
 #include "signonidentityinfo.h"
 
@@ -62,6 +63,8 @@ private Q_SLOTS:
 
     void accessControlListTest();
     void credentialsOwnerSecurityTokenTest();
+    void readerThreadTest();
+    void metricsTest();
 
 private:
     CredentialsDB *m_db;
@@ -27,6 +27,8 @@
 
 #include "pluginproxy.cpp"
 #include "blobiohandler.cpp"
+#include "tracebuffer.cpp"
+#include "signonmetrics.cpp"
 
 #endif //_EXTERNAL_INCLUDED_
 
@@ -0,0 +1,255 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+#include "pluginproxybench.h"
+
+#include "SignOn/sessiondata.h"
+
+#include <algorithm>
+#include <pwd.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+using namespace SignOn;
+
+/* Number of fresh plugin processes measured by the cold start tests */
+#define COLD_START_RUNS 10
+/* Number of requests served before the rss test measures again */
+#define WARM_REQUESTS 10
+#define PROCESS_TIMEOUT (10 * 1000)
+
+static void reportMedian(const char *what, QList<qreal> times)
+{
+    std::sort(times.begin(), times.end());
+    qDebug("%s: min %.2f ms, median %.2f ms, max %.2f ms", what,
+           times.first(), times.at(times.count() / 2), times.last());
+    QTest::setBenchmarkResult(times.at(times.count() / 2),
+                              QTest::WalltimeMilliseconds);
+}
+
+static qreal elapsedMsecs(const QElapsedTimer &timer)
+{
+    return timer.nsecsElapsed() / 1000000.0;
+}
+
+void TestPluginProxyBench::initTestCase()
+{
+#ifndef NO_SIGNON_USER
+    QVERIFY2(!::getuid(), "test must be run as root");
+
+    struct passwd *signonUser = getpwnam("signon");
+    QVERIFY2(signonUser,
+             "signon user do not exist, add with 'useradd --system signon'");
+#endif
+
+    qRegisterMetaType<QVariantMap>("QVariantMap");
+}
+
+void TestPluginProxyBench::addPlugins()
+{
+    QTest::addColumn<QString>("type");
+    QTest::addColumn<QString>("directory");
+    QTest::addColumn<QString>("mechanism");
+
+    QTest::newRow("password") << "password" << "password" << "password";
+    QTest::newRow("ssotest") << "ssotest" << "test" << "mech1";
+}
+
+/* The plugins are loaded from the build tree, each from its own directory */
+PluginProxy *TestPluginProxyBench::createProxy()
+{
+    QFETCH(QString, type);
+    QFETCH(QString, directory);
+
+    QByteArray pluginsDir = QByteArray(PLUGINS_BUILD_DIR "/") +
+        directory.toLatin1();
+    qputenv("SSO_PLUGINS_DIR", pluginsDir);
+
+    return PluginProxy::createNewPluginProxy(type);
+}
+
+bool TestPluginProxyBench::runProcess(PluginProxy *proxy)
+{
+    QFETCH(QString, mechanism);
+
+    SessionData inData;
+    inData.setUserName(QLatin1String("benchUser"));
+    inData.setSecret(QLatin1String("benchSecret"));
+    QVariantMap inDataV;
+    foreach (const QString &key, inData.propertyNames())
+        inDataV[key] = inData.getProperty(key);
+    /* Don't let the ssotest plugin sleep: the time must be spent in the IPC
+     * and in the plugin process, not in usleep() */
+    inDataV.insert(QLatin1String("NoDelay"), true);
+
+    QSignalSpy spyResult(proxy,
+                         SIGNAL(processResultReply(const QVariantMap&)));
+    QEventLoop loop;
+    QObject::connect(proxy, SIGNAL(processResultReply(const QVariantMap&)),
+                     &loop, SLOT(quit()));
+    QObject::connect(proxy, SIGNAL(processError(int, const QString&)),
+                     &loop, SLOT(quit()));
+    QTimer timer;
+    timer.setSingleShot(true);
+    QObject::connect(&timer, SIGNAL(timeout()), &loop, SLOT(quit()));
+    timer.start(PROCESS_TIMEOUT);
+
+    if (!proxy->process(inDataV, mechanism))
+        return false;
+
+    loop.exec();
+    return spyResult.count() == 1;
+}
+
+/* Returns the VmRSS of the plugin process, in kB */
+qint64 TestPluginProxyBench::residentSetSize(PluginProxy *proxy)
+{
+    QFile status(QString::fromLatin1("/proc/%1/status").
+                 arg(qint64(proxy->m_process->pid())));
+    if (!status.open(QIODevice::ReadOnly))
+        return -1;
+
+    while (!status.atEnd()) {
+        QByteArray line = status.readLine();
+        if (line.startsWith("VmRSS:"))
+            return line.mid(6).trimmed().split(' ').first().toLongLong();
+    }
+    return -1;
+}
+
+void TestPluginProxyBench::createNewPluginProxy_data()
+{
+    addPlugins();
+}
+
+void TestPluginProxyBench::createNewPluginProxy()
+{
+    QList<qreal> times;
+    for (int i = 0; i < COLD_START_RUNS; i++) {
+        QElapsedTimer timer;
+        timer.start();
+        PluginProxy *proxy = createProxy();
+        qreal msecs = elapsedMsecs(timer);
+        QVERIFY(proxy != NULL);
+        delete proxy;
+        times.append(msecs);
+    }
+    reportMedian("time to ready", times);
+}
+
+void TestPluginProxyBench::queryMechanisms_data()
+{
+    addPlugins();
+}
+
+void TestPluginProxyBench::queryMechanisms()
+{
+    PluginProxy *proxy = createProxy();
+    QVERIFY(proxy != NULL);
+
+    /* queryMechanisms() reads the reply synchronously, so the proxy must not
+     * consume it as the response of a request */
+    QObject::disconnect(proxy->m_channel, SIGNAL(readyRead()),
+                        proxy, SLOT(onReadStandardOutput()));
+
+    QStringList mechanisms;
+    QBENCHMARK {
+        mechanisms = proxy->queryMechanisms();
+    }
+    QCOMPARE(mechanisms, proxy->mechanisms());
+
+    QObject::connect(proxy->m_channel, SIGNAL(readyRead()),
+                     proxy, SLOT(onReadStandardOutput()));
+    delete proxy;
+}
+
+void TestPluginProxyBench::firstProcess_data()
+{
+    addPlugins();
+}
+
+void TestPluginProxyBench::firstProcess()
+{
+    QList<qreal> times;
+    for (int i = 0; i < COLD_START_RUNS; i++) {
+        PluginProxy *proxy = createProxy();
+        QVERIFY(proxy != NULL);
+
+        QElapsedTimer timer;
+        timer.start();
+        bool ok = runProcess(proxy);
+        qreal msecs = elapsedMsecs(timer);
+        delete proxy;
+        QVERIFY(ok);
+        times.append(msecs);
+    }
+    reportMedian("first process", times);
+}
+
+void TestPluginProxyBench::process_data()
+{
+    addPlugins();
+}
+
+void TestPluginProxyBench::process()
+{
+    PluginProxy *proxy = createProxy();
+    QVERIFY(proxy != NULL);
+    QVERIFY(runProcess(proxy));
+
+    bool ok = true;
+    QBENCHMARK {
+        ok = runProcess(proxy) && ok;
+    }
+    delete proxy;
+    QVERIFY(ok);
+}
+
+void TestPluginProxyBench::rss_data()
+{
+    addPlugins();
+}
+
+void TestPluginProxyBench::rss()
+{
+    PluginProxy *proxy = createProxy();
+    QVERIFY(proxy != NULL);
+
+    qint64 idle = residentSetSize(proxy);
+    QVERIFY(runProcess(proxy));
+    qint64 first = residentSetSize(proxy);
+    bool ok = true;
+    for (int i = 0; i < WARM_REQUESTS; i++)
+        ok = runProcess(proxy) && ok;
+    qint64 warm = residentSetSize(proxy);
+    delete proxy;
+
+    QVERIFY(ok);
+    QVERIFY(idle > 0 && first > 0 && warm > 0);
+    qDebug("plugin process RSS: %lld kB when ready, %lld kB after the first "
+           "request, %lld kB after %d more", idle, first, warm,
+           WARM_REQUESTS);
+}
+
+QTEST_MAIN(TestPluginProxyBench)
@@ -0,0 +1,71 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2013 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+#ifndef PLUGINPROXYBENCH_H_
+#define PLUGINPROXYBENCH_H_
+
+#include <QtTest/QtTest>
+#include <QtCore>
+
+#include "signond/signoncommon.h"
+#include "pluginproxy.h"
+
+using namespace SignonDaemonNS;
+
+/*
+ * Benchmarks of the plugin processes, as seen by signond: the time taken by
+ * PluginProxy::createNewPluginProxy() to get a plugin process ready, the
+ * queryMechanisms round trip, the first process() request served by a
+ * fresh plugin process and the steady-state process() request; the rss
+ * test reports the resident memory of the plugin processes.
+ *
+ * Note that the ssotest plugin sleeps for one second in each request, so
+ * its process() times are dominated by that.
+ */
+class TestPluginProxyBench: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+
+    void createNewPluginProxy_data();
+    void createNewPluginProxy();
+    void queryMechanisms_data();
+    void queryMechanisms();
+    void firstProcess_data();
+    void firstProcess();
+    void process_data();
+    void process();
+    void rss_data();
+    void rss();
+
+private:
+    void addPlugins();
+    PluginProxy *createProxy();
+    bool runProcess(PluginProxy *proxy);
+    qint64 residentSetSize(PluginProxy *proxy);
+};
+
+#endif //PLUGINPROXYBENCH_H_
@@ -3,7 +3,18 @@ SUBDIRS = \
     tst_timeouts.pro \
     tst_pluginproxy.pro \
     tst_database.pro \
+    tst_database_bench.pro \
+    tst_blobiohandler_bench.pro \
+    tst_pluginproxy_bench.pro \
     access-control.pro \
 
+# "make benchmark" runs the benchmarks only, see benchmark.pri
+benchmark.CONFIG = recursive
+benchmark.recurse = \
+    tst_database_bench.pro \
+    tst_blobiohandler_bench.pro \
+    tst_pluginproxy_bench.pro
+QMAKE_EXTRA_TARGETS += benchmark
+
 # Disabled until fixed
 #SUBDIRS += tst_backup.pro
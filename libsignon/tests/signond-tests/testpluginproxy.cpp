@@ -21,6 +21,7 @@
  */
 #include <QVariant>
 #include "testpluginproxy.h"
+#include "signonmetrics.h"
 
 #include <sys/types.h>
 #include <pwd.h>
@@ -136,6 +137,38 @@ void TestPluginProxy::process_for_dummy()
             outData["ProvidedTokens"] == providedTokens);
 }
 
+void TestPluginProxy::process_big_blob_for_dummy()
+{
+    /* Large enough to be exchanged as shared memory rather than paged */
+    QByteArray blob(1024 * 1024, 'x');
+    for (int i = 0; i < blob.size(); i += 4096)
+        blob[i] = char(i / 4096);
+
+    QVariantMap inDataV;
+    inDataV.insert("Blob", blob);
+
+    QSignalSpy spyResult(m_proxy,
+               SIGNAL(processResultReply(const QVariantMap&)));
+    QEventLoop loop;
+
+    QObject::connect(m_proxy,
+                 SIGNAL(processResultReply(const QVariantMap&)),
+                 &loop,
+                 SLOT(quit()));
+
+    QTimer::singleShot(10*1000, &loop, SLOT(quit()));
+
+    bool res = m_proxy->process(inDataV, "BLOB");
+    QVERIFY(res);
+
+    loop.exec();
+
+    QCOMPARE(spyResult.count(), 1);
+
+    QVariantMap outData = spyResult.at(0).at(0).toMap();
+    QCOMPARE(outData.value("Blob").toByteArray(), blob);
+}
+
 void TestPluginProxy::processUi_for_dummy()
 {
     SessionData inData;
@@ -249,6 +282,49 @@ void TestPluginProxy::process_and_cancel_for_dummy()
     QVERIFY(errMsg == QString("The operation is canceled"));
 }
 
+void TestPluginProxy::cancel_while_idle_for_dummy()
+{
+    /* The test plugin blocks its main thread while processing, so the
+     * cancel request in process_and_cancel_for_dummy() can only have come
+     * through the cancel channel; here we check that a request arriving
+     * when nothing is running doesn't cancel the next operation. */
+    m_proxy->cancel();
+    QTest::qWait(200);
+
+    SessionData inData;
+    inData.setSecret("testSecret");
+    inData.setUserName("testUsername");
+
+    QVariantMap inDataV;
+
+    foreach(QString key, inData.propertyNames())
+        inDataV[key] = inData.getProperty(key);
+
+    QSignalSpy spyResult(m_proxy, SIGNAL(processResultReply(const QVariantMap&)));
+    QSignalSpy spyError(m_proxy, SIGNAL(processError(int, const QString&)));
+
+    QEventLoop loop;
+
+    QObject::connect(m_proxy,
+                     SIGNAL(processResultReply(const QVariantMap&)),
+                     &loop,
+                     SLOT(quit()));
+
+    QObject::connect(m_proxy,
+                     SIGNAL(processError(int, const QString&)),
+                     &loop,
+                     SLOT(quit()));
+
+    QTimer::singleShot(10*1000, &loop, SLOT(quit()));
+
+    bool res = m_proxy->process(inDataV, "mech1");
+    QVERIFY(res);
+    loop.exec();
+
+    QCOMPARE(spyResult.count(), 1);
+    QCOMPARE(spyError.count(), 0);
+}
+
 void TestPluginProxy::process_wrong_mech_for_dummy()
 {
     SessionData inData;
@@ -305,6 +381,31 @@ void TestPluginProxy::wrong_user_for_dummy()
 #endif
 }
 
+static qint64 livePluginProcesses()
+{
+    QVariantMap counters =
+        SignonMetrics::snapshot().value(QLatin1String("counters")).toMap();
+    return counters.value(QLatin1String("livePluginProcesses")).toLongLong();
+}
+
+void TestPluginProxy::count_live_processes()
+{
+    qint64 before = livePluginProcesses();
+
+    PluginProxy *pp = PluginProxy::createNewPluginProxy("ssotest");
+    QVERIFY(pp != NULL);
+    QCOMPARE(livePluginProcesses(), before + 1);
+
+    /* A process which has died is not counted, even if its proxy is still
+     * alive */
+    pp->m_process->kill();
+    QVERIFY(pp->waitForFinished(5000));
+    QCOMPARE(livePluginProcesses(), before);
+
+    delete pp;
+    QCOMPARE(livePluginProcesses(), before);
+}
+
 #if !defined(SSO_CI_TESTMANAGEMENT)
 QTEST_MAIN(TestPluginProxy)
 #endif
@@ -47,10 +47,13 @@ private Q_SLOTS:
     void type_for_dummy();
     void mechanisms_for_dummy();
     void process_for_dummy();
+    void process_big_blob_for_dummy();
     void processUi_for_dummy();
     void process_wrong_mech_for_dummy();
     void process_and_cancel_for_dummy();
+    void cancel_while_idle_for_dummy();
     void wrong_user_for_dummy();
+    void count_live_processes();
 
 private:
     PluginProxy *m_proxy;
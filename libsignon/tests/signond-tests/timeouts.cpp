@@ -27,6 +27,7 @@
 #include <QDBusMessage>
 #include <QDBusObjectPath>
 #include <QDebug>
+#include <QElapsedTimer>
 
 #include "signond/signoncommon.h"
 
@@ -198,6 +199,46 @@ void TimeoutsTest::identityRegisterTwice()
     QVERIFY(identityAlive(path));
 }
 
+void TimeoutsTest::identityExpiresWhenIdle()
+{
+    QMap<MethodName,MechanismsList> methods;
+    methods.insert("dummy", QStringList() << "mech1" << "mech2");
+    IdentityInfo info = IdentityInfo(QLatin1String("timeout test"),
+                                     QLatin1String("timeout@test"),
+                                     methods);
+    Identity *identity = Identity::newIdentity(info);
+    QVERIFY(identity != NULL);
+
+    QString path = storedIdentityPath(identity);
+    QVERIFY(!path.isEmpty());
+
+    int timeout = qgetenv("SSO_IDENTITY_TIMEOUT").toInt() * 1000;
+    if (timeout <= 0)
+        QSKIP("SSO_IDENTITY_TIMEOUT is not set", SkipSingle);
+
+    /* Each call to the identity pushes its deadline forward: after more
+     * than SSO_IDENTITY_TIMEOUT seconds since its creation, the identity
+     * must still be alive because it has been used in between. */
+    QElapsedTimer clock;
+    clock.start();
+    while (clock.elapsed() <= timeout) {
+        QTest::qWait(timeout / 3);
+        QVERIFY(identityAlive(path));
+    }
+
+    /* Once it stays unused for SSO_IDENTITY_TIMEOUT seconds, the identity
+     * must be destroyed by its own expiration timer, without any other
+     * client activity triggering the cleanup. Introspection doesn't count
+     * as a use of the identity. */
+    clock.restart();
+    while (identityRegistered(path) && clock.elapsed() < 3 * timeout)
+        QTest::qWait(200);
+    QVERIFY(!identityRegistered(path));
+    QVERIFY(!identityAlive(path));
+
+    delete identity;
+}
+
 void TimeoutsTest::identityError(const SignOn::Error &error)
 {
     qDebug() << Q_FUNC_INFO << error.message();
@@ -232,6 +273,62 @@ bool TimeoutsTest::identityAlive(const QString &path)
     return (reply.type() == QDBusMessage::ReplyMessage);
 }
 
+bool TimeoutsTest::identityRegistered(const QString &path)
+{
+    QDBusConnection conn = SIGNOND_BUS;
+
+    QDBusMessage msg = QDBusMessage::createMethodCall(
+        SIGNOND_SERVICE, path,
+        QLatin1String("org.freedesktop.DBus.Introspectable"),
+        "Introspect");
+    QDBusMessage reply = conn.call(msg);
+    if (reply.type() != QDBusMessage::ReplyMessage)
+        return false;
+
+    QString xml = reply.arguments().value(0).toString();
+    return xml.contains(
+        QLatin1String("com.google.code.AccountsSSO.SingleSignOn.Identity"));
+}
+
+QString TimeoutsTest::storedIdentityPath(Identity *identity)
+{
+    QEventLoop loop;
+    QTimer::singleShot(test_timeout, &loop, SLOT(quit()));
+    QObject::connect(this, SIGNAL(finished()), &loop, SLOT(quit()));
+
+    QObject::connect(identity,
+                     SIGNAL(credentialsStored(const quint32)),
+                     this,
+                     SLOT(credentialsStored(const quint32)));
+    QObject::connect(identity,
+                     SIGNAL(error(const SignOn::Error &)),
+                     this,
+                     SLOT(identityError(const SignOn::Error &)));
+
+    identity->storeCredentials();
+    loop.exec();
+    if (identity->id() == SSO_NEW_IDENTITY)
+        return QString();
+
+    QDBusConnection conn = SIGNOND_BUS;
+
+    QDBusMessage msg = QDBusMessage::createMethodCall(SIGNOND_SERVICE,
+                                                      SIGNOND_DAEMON_OBJECTPATH,
+                                                      SIGNOND_DAEMON_INTERFACE,
+                                                      "getIdentity");
+    QList<QVariant> args;
+    args << identity->id();
+    msg.setArguments(args);
+
+    QDBusMessage reply = conn.call(msg);
+    if (reply.type() != QDBusMessage::ReplyMessage)
+        return QString();
+
+    QDBusObjectPath objectPath = reply.arguments()[0].value<QDBusObjectPath>();
+    qDebug() << "Got path" << objectPath.path();
+    return objectPath.path();
+}
+
 void TimeoutsTest::credentialsStored(const quint32 id)
 {
     QVERIFY(id != 0);
@@ -46,6 +46,7 @@ private Q_SLOTS:
 
     void identityTimeout();
     void identityRegisterTwice();
+    void identityExpiresWhenIdle();
 
 signals:
     void finished();
@@ -53,6 +54,8 @@ signals:
 private:
     bool triggerDisposableCleanup();
     bool identityAlive(const QString &path);
+    bool identityRegistered(const QString &path);
+    QString storedIdentityPath(Identity *identity);
 
     bool completed;
 };
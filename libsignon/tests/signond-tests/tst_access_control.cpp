@@ -21,15 +21,20 @@
  */
 
 #include <QByteArray>
+#include <QDBusArgument>
 #include <QDBusConnection>
 #include <QDBusMessage>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QEventLoop>
 #include <QProcess>
 #include <QSignalSpy>
 #include <QTest>
 #include <SignOn/Identity>
 
+#include "signond/signoncommon.h"
+#include "signond-metrics.h"
+
 #define IDENTITY_TOOL "./identity-tool"
 
 using namespace SignOn;
@@ -50,6 +55,10 @@ private Q_SLOTS:
     void testAccessAllowed();
     void testAccessRequestAllowed();
     void testAccessRequestAllowedSession();
+    void testRemoveDenied();
+    void testDecisionCache();
+    void testPeersForgotten();
+    void testTraceBufferDenied();
 
 private:
     IdentityInfo m_info;
@@ -257,5 +266,148 @@ void AccessControlTest::testAccessRequestAllowedSession()
     delete session;
 }
 
+void AccessControlTest::testRemoveDenied()
+{
+    /* Create an identity from another process, which will be its owner; we
+     * are in the ACL, but we must not be allowed to remove it. The access
+     * control manager is asked, and since the caption is not "allow" it will
+     * refuse.
+     */
+    QProcess identityTool;
+    identityTool.start(IDENTITY_TOOL,
+                       QStringList() << "--caption" << "with-acl" <<
+                       "--acl" << QCoreApplication::arguments().at(0));
+    QVERIFY(identityTool.waitForFinished());
+
+    uint id = identityTool.readAll().toUInt();
+    qDebug() << "Identity was created:" << id;
+    Identity *identity = Identity::existingIdentity(id);
+    QVERIFY(identity != NULL);
+
+    QEventLoop loop;
+    QSignalSpy removedSpy(identity, SIGNAL(removed()));
+    QSignalSpy errorSpy(identity, SIGNAL(error(const SignOn::Error&)));
+    QObject::connect(identity, SIGNAL(error(const SignOn::Error&)),
+                     &loop, SLOT(quit()));
+    QObject::connect(identity, SIGNAL(removed()),
+                     &loop, SLOT(quit()));
+    identity->remove();
+    loop.exec();
+
+    QCOMPARE(removedSpy.count(), 0);
+    QCOMPARE(errorSpy.count(), 1);
+    SignOn::Error error = errorSpy.at(0).at(0).value<SignOn::Error>();
+    QCOMPARE(error.type(), int(SignOn::Error::PermissionDenied));
+
+    delete identity;
+}
+
+/* Reads the identity info through a new Identity object, so that the info
+ * cached by libsignon-qt is not used */
+static bool queryInfo(quint32 id)
+{
+    Identity *identity = Identity::existingIdentity(id);
+    if (identity == NULL) return false;
+
+    QEventLoop loop;
+    QSignalSpy infoSpy(identity, SIGNAL(info(const SignOn::IdentityInfo&)));
+    QObject::connect(identity, SIGNAL(error(const SignOn::Error&)),
+                     &loop, SLOT(quit()));
+    QObject::connect(identity, SIGNAL(info(const SignOn::IdentityInfo&)),
+                     &loop, SLOT(quit()));
+    identity->queryInfo();
+    loop.exec();
+
+    delete identity;
+    return infoSpy.count() == 1;
+}
+
+void AccessControlTest::testDecisionCache()
+{
+    QMap<MethodName,MechanismsList> methods;
+    methods.insert("dummy", QStringList() << "mech1");
+    IdentityInfo info = IdentityInfo(QLatin1String("cached"),
+                                     QLatin1String("ac@test"),
+                                     methods);
+    info.setAccessControlList(QStringList() <<
+                              QCoreApplication::arguments().at(0));
+    Identity *identity = Identity::newIdentity(info, this);
+    QVERIFY(identity != NULL);
+
+    QEventLoop loop;
+    QObject::connect(identity, SIGNAL(error(const SignOn::Error&)),
+                     &loop, SLOT(quit()));
+    QObject::connect(identity, SIGNAL(credentialsStored(const quint32)),
+                     &loop, SLOT(quit()));
+    identity->storeCredentials();
+    loop.exec();
+    quint32 id = identity->id();
+    QVERIFY(id != 0);
+
+    qint64 hits = signondCounter("decisionCacheHits");
+    qint64 misses = signondCounter("decisionCacheMisses");
+    QVERIFY(hits >= 0);
+    QVERIFY(misses >= 0);
+
+    QVERIFY(queryInfo(id));
+    qint64 firstHits = signondCounter("decisionCacheHits") - hits;
+    qint64 firstMisses = signondCounter("decisionCacheMisses") - misses;
+    QVERIFY(firstMisses > 0);
+
+    /* The same checks are now all answered from the cache; each of them is
+     * counted exactly once */
+    hits += firstHits;
+    misses += firstMisses;
+    QVERIFY(queryInfo(id));
+    QCOMPARE(signondCounter("decisionCacheMisses"), misses);
+    QCOMPARE(signondCounter("decisionCacheHits") - hits,
+             firstHits + firstMisses);
+
+    /* Storing the identity might have changed its ACL */
+    identity->storeCredentials(info);
+    loop.exec();
+    misses = signondCounter("decisionCacheMisses");
+    QVERIFY(queryInfo(id));
+    QVERIFY(signondCounter("decisionCacheMisses") > misses);
+
+    delete identity;
+}
+
+void AccessControlTest::testPeersForgotten()
+{
+    qint64 peers = signondCounter("trackedPeers");
+    QVERIFY(peers >= 0);
+
+    /* Each run of the tool is a new client connection, which signond must
+     * forget once the tool has left the bus */
+    for (int i = 0; i < 3; i++) {
+        QProcess identityTool;
+        identityTool.start(IDENTITY_TOOL,
+                           QStringList() << "--caption" << "short-lived");
+        QVERIFY(identityTool.waitForFinished());
+        QVERIFY(identityTool.readAll().toUInt() != 0);
+    }
+
+    /* The NameOwnerChanged signals might still be on their way */
+    QElapsedTimer timer;
+    timer.start();
+    while (signondCounter("trackedPeers") > peers && timer.elapsed() < 5000)
+        QTest::qWait(100);
+    QCOMPARE(signondCounter("trackedPeers"), peers);
+}
+
+void AccessControlTest::testTraceBufferDenied()
+{
+    /* Only the keychain widget can read the trace buffer */
+    QDBusMessage msg =
+        QDBusMessage::createMethodCall(SIGNOND_SERVICE,
+                                       SIGNOND_DAEMON_OBJECTPATH,
+                                       SIGNOND_SERVICE_PREFIX ".Metrics",
+                                       "traceBuffer");
+    QDBusMessage reply = QDBusConnection::sessionBus().call(msg);
+    QCOMPARE(reply.type(), QDBusMessage::ErrorMessage);
+    QCOMPARE(reply.errorName(), SIGNOND_PERMISSION_DENIED_ERR_NAME);
+}
+
 QTEST_MAIN(AccessControlTest)
 #include "tst_access_control.moc"
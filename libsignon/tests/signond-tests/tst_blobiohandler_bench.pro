@@ -0,0 +1,13 @@
+TARGET = tst_blobiohandler_bench
+
+include(signond-tests.pri)
+
+HEADERS += \
+    blobiohandlerbench.h \
+    $${TOP_SRC_DIR}/lib/plugins/signon-plugins-common/SignOn/blobiohandler.h
+
+SOURCES = \
+    blobiohandlerbench.cpp \
+    $${TOP_SRC_DIR}/lib/plugins/signon-plugins-common/SignOn/blobiohandler.cpp
+
+include(benchmark.pri)
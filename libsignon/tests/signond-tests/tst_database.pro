@@ -5,9 +5,15 @@ include(signond-tests.pri)
 HEADERS += \
     databasetest.h \
     $$TOP_SRC_DIR/src/signond/credentialsdb.h \
-    $$TOP_SRC_DIR/src/signond/default-secrets-storage.h
+    $$TOP_SRC_DIR/src/signond/credentialsdbreader.h \
+    $$TOP_SRC_DIR/src/signond/default-secrets-storage.h \
+    $$TOP_SRC_DIR/src/signond/signonmetrics.h \
+    $$TOP_SRC_DIR/src/signond/startupprofile.h
 
 SOURCES = \
     databasetest.cpp \
     $$TOP_SRC_DIR/src/signond/credentialsdb.cpp \
-    $$TOP_SRC_DIR/src/signond/default-secrets-storage.cpp
+    $$TOP_SRC_DIR/src/signond/credentialsdbreader.cpp \
+    $$TOP_SRC_DIR/src/signond/default-secrets-storage.cpp \
+    $$TOP_SRC_DIR/src/signond/signonmetrics.cpp \
+    $$TOP_SRC_DIR/src/signond/startupprofile.cpp
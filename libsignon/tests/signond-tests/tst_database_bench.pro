@@ -0,0 +1,21 @@
+TARGET = tst_database_bench
+
+include(signond-tests.pri)
+
+HEADERS += \
+    databasebench.h \
+    $$TOP_SRC_DIR/src/signond/credentialsdb.h \
+    $$TOP_SRC_DIR/src/signond/credentialsdbreader.h \
+    $$TOP_SRC_DIR/src/signond/default-secrets-storage.h \
+    $$TOP_SRC_DIR/src/signond/signonmetrics.h \
+    $$TOP_SRC_DIR/src/signond/startupprofile.h
+
+SOURCES = \
+    databasebench.cpp \
+    $$TOP_SRC_DIR/src/signond/credentialsdb.cpp \
+    $$TOP_SRC_DIR/src/signond/credentialsdbreader.cpp \
+    $$TOP_SRC_DIR/src/signond/default-secrets-storage.cpp \
+    $$TOP_SRC_DIR/src/signond/signonmetrics.cpp \
+    $$TOP_SRC_DIR/src/signond/startupprofile.cpp
+
+include(benchmark.pri)
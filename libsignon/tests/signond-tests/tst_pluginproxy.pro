@@ -5,6 +5,7 @@ include(signond-tests.pri)
 HEADERS += \
     testpluginproxy.h \
     $$TOP_SRC_DIR/src/signond/pluginproxy.h \
+    $$TOP_SRC_DIR/src/signond/signonmetrics.h \
     $${TOP_SRC_DIR}/lib/plugins/signon-plugins-common/SignOn/blobiohandler.h
 
 SOURCES = \
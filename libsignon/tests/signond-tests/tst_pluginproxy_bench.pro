@@ -0,0 +1,19 @@
+TARGET = tst_pluginproxy_bench
+
+include(signond-tests.pri)
+
+HEADERS += \
+    pluginproxybench.h \
+    $$TOP_SRC_DIR/src/signond/pluginproxy.h \
+    $$TOP_SRC_DIR/src/signond/signonmetrics.h \
+    $${TOP_SRC_DIR}/lib/plugins/signon-plugins-common/SignOn/blobiohandler.h
+
+SOURCES = \
+    pluginproxybench.cpp \
+    include.cpp
+
+# Each plugin is loaded from its directory in the build tree
+DEFINES += "PLUGINS_BUILD_DIR=\\\"$${TOP_BUILD_DIR}/src/plugins\\\""
+
+BENCHMARK_ENV = "SSO_EXTENSIONS_DIR=$${TOP_BUILD_DIR}/non-existing-dir $$RUN_WITH_SIGNOND"
+include(benchmark.pri)
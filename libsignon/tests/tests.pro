@@ -11,6 +11,7 @@ SUBDIRS += \
     passwordplugintest \
     libsignon-qt-tests \
     signond-tests \
+    signon-load \
     extensions
 
 QMAKE_SUBSTITUTES += com.google.code.AccountsSSO.SingleSignOn.service.in